@@ -0,0 +1,326 @@
+/*
+ * LightningObjects C++ Object Storage based on Key/Value API
+ *
+ * Copyright (C) 2016 GS Vitec GmbH <christian@gsvitec.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, and provided
+ * in the LICENSE file in the root directory of this software.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FLEXIS_KVAGGREGATE_H
+#define FLEXIS_KVAGGREGATE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <type_traits>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace flexis {
+namespace persistence {
+namespace kv {
+
+/**
+ * aggregate values over a range of numeric data
+ */
+template <typename T>
+struct DataAggregate
+{
+  size_t count = 0;
+
+  //only meaningful if count > 0
+  T min = T(), max = T();
+
+  double sum = 0;
+
+  //sum of squared deviations from the mean
+  double m2 = 0;
+
+  double mean() const {return count ? sum / count : 0;}
+
+  /**
+   * @return the population variance
+   */
+  double variance() const {return count ? m2 / count : 0;}
+
+  /**
+   * combine with the aggregate over another range of data
+   */
+  void merge(const DataAggregate &other)
+  {
+    if(!other.count) return;
+    if(!count) {
+      *this = other;
+      return;
+    }
+    double delta = other.mean() - mean();
+    size_t total = count + other.count;
+    m2 += other.m2 + delta * delta * ((double)count * other.count / total);
+    sum += other.sum;
+    count = total;
+    if(other.min < min) min = other.min;
+    if(other.max > max) max = other.max;
+  }
+};
+
+namespace simd {
+
+/*
+ * generic kernels. Multiple accumulators give the compiler room to vectorize. Integers up to 32 bit are summed
+ * exactly in 64 bit
+ */
+template <typename T>
+using SumType = typename std::conditional<std::is_integral<T>::value && sizeof(T) <= 4,
+    typename std::conditional<std::is_signed<T>::value, int64_t, uint64_t>::type, double>::type;
+
+template <typename T>
+double sum(const T *data, size_t count)
+{
+  SumType<T> s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+  size_t i = 0;
+  for(; i + 4 <= count; i += 4) {
+    s0 += data[i]; s1 += data[i+1]; s2 += data[i+2]; s3 += data[i+3];
+  }
+  for(; i < count; i++) s0 += data[i];
+  return (double)(s0 + s1 + s2 + s3);
+}
+
+template <typename T>
+void minmax(const T *data, size_t count, T &min, T &max)
+{
+  min = max = data[0];
+  for(size_t i=1; i<count; i++) {
+    min = data[i] < min ? data[i] : min;
+    max = data[i] > max ? data[i] : max;
+  }
+}
+
+template <typename T>
+double sumSquaredDev(const T *data, size_t count, double mean)
+{
+  double s0 = 0, s1 = 0;
+  size_t i = 0;
+  for(; i + 2 <= count; i += 2) {
+    double d0 = data[i] - mean, d1 = data[i+1] - mean;
+    s0 += d0 * d0; s1 += d1 * d1;
+  }
+  for(; i < count; i++) {
+    double d = data[i] - mean;
+    s0 += d * d;
+  }
+  return s0 + s1;
+}
+
+#if defined(__SSE2__) || defined(_M_X64)
+
+#ifdef LO_ENABLE_AVX2
+/*
+ * AVX2 kernels, compiled separately in kvaggregate_avx2.cpp so that only that translation unit is built for AVX2.
+ * They are only called if the CPU supports AVX2
+ */
+namespace avx2 {
+bool available();
+double sum(const double *data, size_t count);
+double sum(const float *data, size_t count);
+void minmax(const double *data, size_t count, double &min, double &max);
+void minmax(const float *data, size_t count, float &min, float &max);
+double sumSquaredDev(const double *data, size_t count, double mean);
+double sumSquaredDev(const float *data, size_t count, double mean);
+}
+#define LO_AVX2_DISPATCH(call) if(avx2::available()) return avx2::call
+#else
+#define LO_AVX2_DISPATCH(call)
+#endif
+
+inline double hsum(__m128d v)
+{
+  return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+template <>
+inline double sum<double>(const double *data, size_t count)
+{
+  LO_AVX2_DISPATCH(sum(data, count));
+
+  __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+  size_t i = 0;
+  for(; i + 4 <= count; i += 4) {
+    s0 = _mm_add_pd(s0, _mm_loadu_pd(data + i));
+    s1 = _mm_add_pd(s1, _mm_loadu_pd(data + i + 2));
+  }
+  double s = hsum(_mm_add_pd(s0, s1));
+  for(; i < count; i++) s += data[i];
+  return s;
+}
+
+template <>
+inline double sum<float>(const float *data, size_t count)
+{
+  LO_AVX2_DISPATCH(sum(data, count));
+
+  //widen to double to avoid accumulating rounding errors
+  __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+  size_t i = 0;
+  for(; i + 4 <= count; i += 4) {
+    __m128 v = _mm_loadu_ps(data + i);
+    s0 = _mm_add_pd(s0, _mm_cvtps_pd(v));
+    s1 = _mm_add_pd(s1, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+  }
+  double s = hsum(_mm_add_pd(s0, s1));
+  for(; i < count; i++) s += data[i];
+  return s;
+}
+
+template <>
+inline void minmax<double>(const double *data, size_t count, double &min, double &max)
+{
+  LO_AVX2_DISPATCH(minmax(data, count, min, max));
+
+  size_t i = 0;
+  if(count >= 2) {
+    __m128d vmin = _mm_loadu_pd(data), vmax = vmin;
+    for(i = 2; i + 2 <= count; i += 2) {
+      __m128d v = _mm_loadu_pd(data + i);
+      vmin = _mm_min_pd(vmin, v);
+      vmax = _mm_max_pd(vmax, v);
+    }
+    min = std::min(_mm_cvtsd_f64(vmin), _mm_cvtsd_f64(_mm_unpackhi_pd(vmin, vmin)));
+    max = std::max(_mm_cvtsd_f64(vmax), _mm_cvtsd_f64(_mm_unpackhi_pd(vmax, vmax)));
+  }
+  else {
+    min = max = data[0];
+    i = 1;
+  }
+  for(; i < count; i++) {
+    min = data[i] < min ? data[i] : min;
+    max = data[i] > max ? data[i] : max;
+  }
+}
+
+template <>
+inline void minmax<float>(const float *data, size_t count, float &min, float &max)
+{
+  LO_AVX2_DISPATCH(minmax(data, count, min, max));
+
+  size_t i = 0;
+  if(count >= 4) {
+    __m128 vmin = _mm_loadu_ps(data), vmax = vmin;
+    for(i = 4; i + 4 <= count; i += 4) {
+      __m128 v = _mm_loadu_ps(data + i);
+      vmin = _mm_min_ps(vmin, v);
+      vmax = _mm_max_ps(vmax, v);
+    }
+    float mins[4], maxs[4];
+    _mm_storeu_ps(mins, vmin);
+    _mm_storeu_ps(maxs, vmax);
+    min = *std::min_element(mins, mins + 4);
+    max = *std::max_element(maxs, maxs + 4);
+  }
+  else {
+    min = max = data[0];
+    i = 1;
+  }
+  for(; i < count; i++) {
+    min = data[i] < min ? data[i] : min;
+    max = data[i] > max ? data[i] : max;
+  }
+}
+
+template <>
+inline double sumSquaredDev<double>(const double *data, size_t count, double mean)
+{
+  LO_AVX2_DISPATCH(sumSquaredDev(data, count, mean));
+
+  __m128d m = _mm_set1_pd(mean), s = _mm_setzero_pd();
+  size_t i = 0;
+  for(; i + 2 <= count; i += 2) {
+    __m128d d = _mm_sub_pd(_mm_loadu_pd(data + i), m);
+    s = _mm_add_pd(s, _mm_mul_pd(d, d));
+  }
+  double r = hsum(s);
+  for(; i < count; i++) r += (data[i] - mean) * (data[i] - mean);
+  return r;
+}
+
+template <>
+inline double sumSquaredDev<float>(const float *data, size_t count, double mean)
+{
+  LO_AVX2_DISPATCH(sumSquaredDev(data, count, mean));
+
+  __m128d m = _mm_set1_pd(mean), s = _mm_setzero_pd();
+  size_t i = 0;
+  for(; i + 4 <= count; i += 4) {
+    __m128 v = _mm_loadu_ps(data + i);
+    __m128d d0 = _mm_sub_pd(_mm_cvtps_pd(v), m), d1 = _mm_sub_pd(_mm_cvtps_pd(_mm_movehl_ps(v, v)), m);
+    s = _mm_add_pd(s, _mm_add_pd(_mm_mul_pd(d0, d0), _mm_mul_pd(d1, d1)));
+  }
+  double r = hsum(s);
+  for(; i < count; i++) r += (data[i] - mean) * (data[i] - mean);
+  return r;
+}
+
+#undef LO_AVX2_DISPATCH
+
+#endif
+
+} //simd
+
+/**
+ * aggregate a contiguous array of numeric data and merge the result into agg
+ */
+template <typename T>
+void aggregate(const T *data, size_t count, DataAggregate<T> &agg)
+{
+  if(!count) return;
+
+  DataAggregate<T> part;
+  part.count = count;
+  part.sum = simd::sum(data, count);
+  simd::minmax(data, count, part.min, part.max);
+
+  //second pass while the data is still in cache. More stable than a sum of squares
+  part.m2 = simd::sumSquaredDev(data, count, part.mean());
+
+  agg.merge(part);
+}
+
+/**
+ * count the values of a contiguous array of numeric data into equal-width bins over [lo, hi]. Values outside
+ * the range are not counted
+ *
+ * @param bins the bin counters. The size of the vector determines the number of bins
+ */
+template <typename T>
+void histogram(const T *data, size_t count, T lo, T hi, std::vector<size_t> &bins)
+{
+  if(bins.empty() || !(lo < hi)) return;
+
+  const size_t last = bins.size() - 1;
+  const double scale = bins.size() / ((double)hi - (double)lo);
+  for(size_t i=0; i<count; i++) {
+    T val = data[i];
+    if(!(val >= lo && val <= hi)) continue;
+    size_t bin = (size_t)(((double)val - (double)lo) * scale);
+    bins[bin > last ? last : bin]++;
+  }
+}
+
+} //kv
+} //persistence
+} //flexis
+
+#endif //FLEXIS_KVAGGREGATE_H
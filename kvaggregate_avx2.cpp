@@ -0,0 +1,166 @@
+/*
+ * LightningObjects C++ Object Storage based on Key/Value API
+ *
+ * Copyright (C) 2016 GS Vitec GmbH <christian@gsvitec.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, and provided
+ * in the LICENSE file in the root directory of this software.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * AVX2 aggregate kernels, declared in kvaggregate.h. This is the only translation unit built with AVX2 code
+ * generation (see LO_ENABLE_AVX2 in CMakeLists.txt). The kernels are selected at runtime by simd::avx2::available(),
+ * which lives in kvstore.cpp.
+ *
+ * No inline or template code is shared with other translation units here. The linker could otherwise pick the
+ * AVX2 build of a shared inline function for the whole program
+ */
+#if defined(LO_ENABLE_AVX2) && defined(__AVX2__)
+
+#include <cstddef>
+#include <immintrin.h>
+
+namespace flexis {
+namespace persistence {
+namespace kv {
+namespace simd {
+namespace avx2 {
+
+static inline double hsum(__m256d v)
+{
+  __m128d s = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+  return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+template <typename T>
+static void lanes(const T *mins, const T *maxs, size_t count, T &min, T &max)
+{
+  min = mins[0];
+  max = maxs[0];
+  for(size_t i=1; i<count; i++) {
+    min = mins[i] < min ? mins[i] : min;
+    max = maxs[i] > max ? maxs[i] : max;
+  }
+}
+
+double sum(const double *data, size_t count)
+{
+  __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+  size_t i = 0;
+  for(; i + 8 <= count; i += 8) {
+    s0 = _mm256_add_pd(s0, _mm256_loadu_pd(data + i));
+    s1 = _mm256_add_pd(s1, _mm256_loadu_pd(data + i + 4));
+  }
+  double s = hsum(_mm256_add_pd(s0, s1));
+  for(; i < count; i++) s += data[i];
+  return s;
+}
+
+double sum(const float *data, size_t count)
+{
+  //widen to double to avoid accumulating rounding errors
+  __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+  size_t i = 0;
+  for(; i + 8 <= count; i += 8) {
+    __m256 v = _mm256_loadu_ps(data + i);
+    s0 = _mm256_add_pd(s0, _mm256_cvtps_pd(_mm256_castps256_ps128(v)));
+    s1 = _mm256_add_pd(s1, _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)));
+  }
+  double s = hsum(_mm256_add_pd(s0, s1));
+  for(; i < count; i++) s += data[i];
+  return s;
+}
+
+void minmax(const double *data, size_t count, double &min, double &max)
+{
+  size_t i = 0;
+  if(count >= 4) {
+    __m256d vmin = _mm256_loadu_pd(data), vmax = vmin;
+    for(i = 4; i + 4 <= count; i += 4) {
+      __m256d v = _mm256_loadu_pd(data + i);
+      vmin = _mm256_min_pd(vmin, v);
+      vmax = _mm256_max_pd(vmax, v);
+    }
+    double mins[4], maxs[4];
+    _mm256_storeu_pd(mins, vmin);
+    _mm256_storeu_pd(maxs, vmax);
+    lanes(mins, maxs, 4, min, max);
+  }
+  else {
+    min = max = data[0];
+    i = 1;
+  }
+  for(; i < count; i++) {
+    min = data[i] < min ? data[i] : min;
+    max = data[i] > max ? data[i] : max;
+  }
+}
+
+void minmax(const float *data, size_t count, float &min, float &max)
+{
+  size_t i = 0;
+  if(count >= 8) {
+    __m256 vmin = _mm256_loadu_ps(data), vmax = vmin;
+    for(i = 8; i + 8 <= count; i += 8) {
+      __m256 v = _mm256_loadu_ps(data + i);
+      vmin = _mm256_min_ps(vmin, v);
+      vmax = _mm256_max_ps(vmax, v);
+    }
+    float mins[8], maxs[8];
+    _mm256_storeu_ps(mins, vmin);
+    _mm256_storeu_ps(maxs, vmax);
+    lanes(mins, maxs, 8, min, max);
+  }
+  else {
+    min = max = data[0];
+    i = 1;
+  }
+  for(; i < count; i++) {
+    min = data[i] < min ? data[i] : min;
+    max = data[i] > max ? data[i] : max;
+  }
+}
+
+double sumSquaredDev(const double *data, size_t count, double mean)
+{
+  __m256d m = _mm256_set1_pd(mean), s = _mm256_setzero_pd();
+  size_t i = 0;
+  for(; i + 4 <= count; i += 4) {
+    __m256d d = _mm256_sub_pd(_mm256_loadu_pd(data + i), m);
+    s = _mm256_add_pd(s, _mm256_mul_pd(d, d));
+  }
+  double r = hsum(s);
+  for(; i < count; i++) r += (data[i] - mean) * (data[i] - mean);
+  return r;
+}
+
+double sumSquaredDev(const float *data, size_t count, double mean)
+{
+  __m256d m = _mm256_set1_pd(mean), s = _mm256_setzero_pd();
+  size_t i = 0;
+  for(; i + 4 <= count; i += 4) {
+    __m256d d = _mm256_sub_pd(_mm256_cvtps_pd(_mm_loadu_ps(data + i)), m);
+    s = _mm256_add_pd(s, _mm256_mul_pd(d, d));
+  }
+  double r = hsum(s);
+  for(; i < count; i++) r += (data[i] - mean) * (data[i] - mean);
+  return r;
+}
+
+} //avx2
+} //simd
+} //kv
+} //persistence
+} //flexis
+
+#endif
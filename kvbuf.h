@@ -22,6 +22,9 @@
 
 #include <string.h>
 #include <memory>
+#include <new>
+#include <vector>
+#include <stdexcept>
 
 #include "kvkey.h"
 
@@ -35,17 +38,30 @@ using ObjectId = uint32_t;
 static const size_t ObjectId_sz = 4; //max 2^32 objects per class
 using PropertyId = uint16_t;
 static const size_t PropertyId_sz = 2; //max. 65535 properies per object
+using ChunkId = uint32_t;
+static const size_t ChunkId_sz = 4; //max 2^32 chunks per collection
 
 static const size_t ObjectKey_sz = ClassId_sz + ObjectId_sz;
 
 //header preceding each object in collections (classId, ObjectId, size, delete marker)
 static const size_t ObjectHeader_sz = ClassId_sz + ObjectId_sz + 4 + 1;
 
-//header preceding each collection chunk
-static const size_t ChunkHeader_sz = 4 * 3;
+//header preceding each collection chunk (dataSize, startIndex, elementCount)
+static const size_t ChunkHeader_sz = 4 + 8 + 4;
 
 using byte_t = unsigned char;
 
+/**
+ * instrumentation hook, called with the requested size whenever a write buffer, the write resource pool or a
+ * transaction arena allocates heap memory through malloc. Allocations through operator new (std containers, shared
+ * pointers) are not reported. Must not be changed while transactions are active
+ */
+extern void (*allocation_hook)(size_t size);
+
+inline void notify_allocation(size_t size) {
+  if(allocation_hook) allocation_hook(size);
+}
+
 /*
  * save an integral value to a fixed size of bytes (max. 8)
  */
@@ -184,7 +200,9 @@ public:
 };
 
 /**
- * a dynamically growing writable buffer
+ * a dynamically growing writable buffer. Buffers that own their memory grow geometrically as data is appended, so
+ * the final size need not be known in advance. Buffers over external memory (see start(byte_t *, size_t)) are
+ * bounds-checked
  */
 class WriteBuf
 {
@@ -211,8 +229,10 @@ public:
   }
 
   WriteBuf *push() {
-    if(!next)
+    if(!next) {
+      notify_allocation(sizeof(WriteBuf));
       next = new WriteBuf(this);
+    }
     return next;
   }
 
@@ -253,8 +273,11 @@ public:
     }
 
     if(newSize > m_allocsize) {
+      notify_allocation(newSize);
+      byte_t *data = (byte_t *)realloc(m_data, newSize);
+      if(!data) throw std::bad_alloc();
+      m_data = data;
       m_allocsize = newSize;
-      m_data = (byte_t *)realloc(m_data, m_allocsize);
     }
     m_growsize = grow;
     m_appendptr = m_data;
@@ -274,8 +297,35 @@ public:
     m_appendptr = m_data;
   }
 
+  /**
+   * make sure that size more bytes can be appended
+   *
+   * @throw std::overflow_error if the buffer is over external memory which is exhausted
+   * @throw std::bad_alloc if the buffer could not be grown. The buffer keeps its contents
+   */
+  inline void ensure(size_t size)
+  {
+    size_t used = m_appendptr - m_data;
+    if(used + size <= m_allocsize) return;
+
+    if(!m_growsize && m_data) throw std::overflow_error("write buffer overflow");
+
+    size_t newSize = m_allocsize * 2;
+    if(newSize < used + size) newSize = used + size;
+    if(newSize < min_size) newSize = min_size;
+
+    notify_allocation(newSize);
+    byte_t *data = (byte_t *)realloc(m_data, newSize);
+    if(!data) throw std::bad_alloc();
+    m_data = data;
+    m_allocsize = newSize;
+    if(!m_growsize) m_growsize = newSize;
+    m_appendptr = m_data + used;
+  }
+
   inline byte_t *allocate(size_t size)
   {
+    ensure(size);
     byte_t * ret = m_appendptr;
     m_appendptr += size;
     return ret;
@@ -290,8 +340,7 @@ public:
 
   template<typename T>
   void appendRaw(T num) {
-    *(T *)m_appendptr = num;
-    m_appendptr += sizeof(T);
+    *(T *)allocate(sizeof(T)) = num;
   }
 
   template<typename T>
@@ -300,6 +349,16 @@ public:
     write_integer(buf, num, bytes);
   }
 
+  /**
+   * overwrite an integer that was appended earlier, e.g. a size field that was reserved before the data
+   *
+   * @param offset the position of the integer, relative to the buffer start
+   */
+  template<typename T>
+  void writeInteger(size_t offset, T num, size_t bytes) {
+    write_integer(m_data + offset, num, bytes);
+  }
+
   void appendCString(const char *data) {
     size_t len = strlen(data) + 1;
     byte_t * buf = allocate(len);
@@ -342,6 +401,118 @@ public:
   }
 };
 
+/**
+ * bump allocator for short-lived bookkeeping data. Memory is handed out from blocks which are kept for reuse, and
+ * only reclaimed through release() or reset(). Allocations must therefore follow a stack discipline, see ArenaScope
+ */
+class Arena
+{
+  static const size_t block_size = 16 * 1024;
+
+  Arena(const Arena &other) = delete;
+
+  struct Block {
+    byte_t *data;
+    size_t size;
+  };
+  std::vector<Block> m_blocks;
+  size_t m_block = 0;
+  size_t m_offset = 0;
+
+public:
+  struct Mark {
+    size_t block, offset;
+  };
+
+  Arena() {}
+  ~Arena() {
+    for(auto &block : m_blocks) free(block.data);
+  }
+
+  void *allocate(size_t size, size_t align)
+  {
+    for(; m_block < m_blocks.size(); m_block++, m_offset = 0) {
+      size_t offset = (m_offset + align - 1) & ~(align - 1);
+      if(offset + size <= m_blocks[m_block].size) {
+        m_offset = offset + size;
+        return m_blocks[m_block].data + offset;
+      }
+    }
+    size_t sz = size > block_size ? size : block_size;
+    notify_allocation(sz);
+    m_blocks.reserve(m_blocks.size() + 1);
+    byte_t *data = (byte_t *)malloc(sz);
+    if(!data) throw std::bad_alloc();
+    m_blocks.push_back(Block {data, sz});
+    m_offset = size;
+    return m_blocks.back().data;
+  }
+
+  Mark mark() const {
+    return Mark {m_block, m_offset};
+  }
+
+  void release(const Mark &mark) {
+    m_block = mark.block;
+    m_offset = mark.offset;
+  }
+
+  void reset() {
+    m_block = 0;
+    m_offset = 0;
+  }
+};
+
+/**
+ * releases all arena memory allocated during its lifetime. Must be declared before the objects that use the arena
+ * within the same scope
+ */
+class ArenaScope
+{
+  Arena &m_arena;
+  const Arena::Mark m_mark;
+
+public:
+  ArenaScope(Arena &arena) : m_arena(arena), m_mark(arena.mark()) {}
+  ~ArenaScope() {m_arena.release(m_mark);}
+};
+
+/**
+ * standard library allocator over an Arena. Deallocation is a no-op
+ */
+template <typename T>
+struct ArenaAllocator
+{
+  using value_type = T;
+
+  Arena *arena;
+
+  ArenaAllocator(Arena &arena) : arena(&arena) {}
+  template <typename U> ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T *p, size_t n) {}
+
+  template <typename U> bool operator ==(const ArenaAllocator<U> &other) const {return arena == other.arena;}
+  template <typename U> bool operator !=(const ArenaAllocator<U> &other) const {return arena != other.arena;}
+};
+
+/**
+ * per-transaction write resources. They are pooled by the store and reused by subsequent transactions, so that
+ * grown buffers and arena blocks survive the transaction
+ */
+struct WriteResources
+{
+  WriteBuf writeBuf;
+  Arena arena;
+
+  ~WriteResources() {
+    writeBuf.deleteChain();
+  }
+};
+
 } //kv
 } //persistence
 } //flexis
@@ -17,10 +17,16 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <map>
+#include <algorithm>
 #include <set>
 #include <sstream>
+#include <cmath>
 #include "kvstore.h"
 
+#if defined(LO_ENABLE_AVX2) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 namespace flexis {
 namespace persistence {
 
@@ -302,8 +308,16 @@ bool KeyValueStoreBase::updateClassSchema(
   return true;
 }
 
+KeyValueStore::KeyValueStore(StoreId storeId) : KeyValueStoreBase(storeId)
+{
+  //shared, snapshot-consistent cache for parsed collection infos
+  objectCaches[COLLINFO_CLSID] = make_shared<TypedObjectCache<CollectionChunks>>(0);
+}
+
 namespace kv {
 
+void (*allocation_hook)(size_t size) = nullptr;
+
 static StoreId storeId = 0;
 StoreId nextStoreId() {
   if(storeId == MAX_DATABASES)
@@ -314,6 +328,39 @@ StoreId nextStoreId() {
   return ret;
 }
 
+#ifdef LO_ENABLE_AVX2
+namespace simd {
+namespace avx2 {
+
+static bool cpuSupported()
+{
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  if(info[0] < 7) return false;
+
+  //AVX2 also needs the OS to save the YMM registers
+  __cpuid(info, 1);
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  if(!osxsave || (_xgetbv(0) & 6) != 6) return false;
+
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+
+bool available()
+{
+  static const bool supported = cpuSupported();
+  return supported;
+}
+
+} //avx2
+} //simd
+#endif
+
 void readObjectHeader(ReadBuf &buf, ClassId *classId, ObjectId *objectId, size_t *size, bool *deleted)
 {
   ClassId cid = buf.readInteger<ClassId>(ClassId_sz);
@@ -326,11 +373,97 @@ void readObjectHeader(ReadBuf &buf, ClassId *classId, ObjectId *objectId, size_t
   if(deleted) *deleted = del;
 }
 
+struct WorkerPool::Batch
+{
+  size_t pending;
+};
+
+WorkerPool::WorkerPool(unsigned size)
+{
+  for(unsigned i=0; i<size; i++)
+    m_threads.push_back(std::thread(&WorkerPool::work, this));
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_available.notify_all();
+  for(auto &thread : m_threads) thread.join();
+}
+
+void WorkerPool::work()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  for(;;) {
+    m_available.wait(lock, [this] {return m_stop || !m_tasks.empty();});
+    if(m_tasks.empty()) return;
+
+    Task task = m_tasks.front();
+    m_tasks.pop_front();
+    lock.unlock();
+    (*task.fn)();
+    lock.lock();
+    if(--task.batch->pending == 0) m_done.notify_all();
+  }
+}
+
+void WorkerPool::run(std::vector<std::function<void()>> &tasks)
+{
+  if(tasks.empty()) return;
+
+  Batch batch {tasks.size() - 1};
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for(size_t i=1; i<tasks.size(); i++) m_tasks.push_back(Task {&tasks[i], &batch});
+  }
+  m_available.notify_all();
+  tasks[0]();
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while(batch.pending) {
+    //tasks no worker has picked up yet are run here rather than waiting behind other callers' tasks
+    auto it = std::find_if(m_tasks.begin(), m_tasks.end(), [&batch](const Task &t) {return t.batch == &batch;});
+    if(it != m_tasks.end()) {
+      Task task = *it;
+      m_tasks.erase(it);
+      lock.unlock();
+      (*task.fn)();
+      lock.lock();
+      batch.pending--;
+    }
+    else m_done.wait(lock);
+  }
+}
+
+void readChunkStats(ReadBuf &buf, ChunkStats &stats)
+{
+  //value statistics and time range are both optional. They are told apart by the size of what remains
+  static const size_t ValueStats_sz = 2 * sizeof(uint64_t) + sizeof(double);
+  static const size_t TimeStats_sz = 2 * sizeof(Timestamp);
+
+  size_t remaining = buf.size() - (buf.cur() - buf.data());
+  if(remaining == ValueStats_sz || remaining == ValueStats_sz + TimeStats_sz) {
+    stats.valid = true;
+    stats.min = buf.readRaw<uint64_t>();
+    stats.max = buf.readRaw<uint64_t>();
+    stats.sum = buf.readRaw<double>();
+    remaining -= ValueStats_sz;
+  }
+  if(remaining == TimeStats_sz) {
+    stats.timed = true;
+    stats.firstTime = buf.readRaw<Timestamp>();
+    stats.lastTime = buf.readRaw<Timestamp>();
+  }
+}
+
 void readChunkHeader(ReadBuf &buf, size_t *dataSize, size_t *startIndex, size_t *elementCount)
 {
   size_t val = buf.readInteger<size_t>(4);
   if(dataSize) *dataSize = val;
-  val = buf.readInteger<size_t>(4);
+  val = buf.readInteger<size_t>(8);
   if(startIndex) *startIndex = val;
   val = buf.readInteger<size_t>(4);
   if(elementCount) *elementCount = val;
@@ -341,8 +474,17 @@ void WriteTransaction::writeChunkHeader(size_t startIndex, size_t elementCount)
   //write to start of buffer. Space is preallocated in startChunk
   byte_t *data = writeBuf().data();
   write_integer(data, writeBuf().size(), 4);
-  write_integer(data+4, startIndex, 4);
-  write_integer(data+8, elementCount, 4);
+  write_integer(data+4, startIndex, 8);
+  write_integer(data+12, elementCount, 4);
+}
+
+void WriteTransaction::writeChunkIndex(ObjectId collectionId, ChunkId chunkId, const std::vector<size_t> &offsets)
+{
+  WriteBuf buf(offsets.size() * 4);
+  for(size_t offset : offsets) buf.appendInteger(offset, 4);
+
+  if(!putChunkData(COLLINDEX_CLSID, collectionId, chunkId, buf))
+    throw error("error saving chunk index");
 }
 
 void WriteTransaction::writeObjectHeader(ClassId classId, ObjectId objectId, size_t size)
@@ -356,35 +498,60 @@ void WriteTransaction::writeObjectHeader(ClassId classId, ObjectId objectId, siz
 
 WriteTransaction::~WriteTransaction()
 {
-  //assume all was popped
-  curBuf->deleteChain();
+  if(m_resources) store.releaseWriteResources(m_resources);
 }
 
 void WriteTransaction::abort()
 {
+  m_cacheTouched.clear();
+  m_writtenCollectionInfos.clear();
+  m_countDeltas.clear();
+  m_aggregateDeltas.clear();
+  if(m_resources) m_resources->arena.reset();
   _abort();
 }
 
 void WriteTransaction::writeCollections()
 {
   for(auto &it : m_collectionInfos) {
-    CollectionInfo *ci = it.second;
+    CollectionInfo *ci = it.second.get();
+    if(!ci) continue; //deleted
+
     for(auto app : ci->appenders) app->close(false);
     ci->appenders.clear();
 
-    size_t sz = ObjectId_sz + sizeof(size_t) + ci->chunkInfos.size() * (PropertyId_sz + 3 * sizeof(size_t));
-    writeBuf().start(sz);
+    writeBuf().start(ObjectId_sz + sizeof(size_t) + 1);
     writeBuf().appendRaw(ci->collectionId);
-    writeBuf().appendRaw(ci->chunkInfos.size());
-    for(auto &ch : ci->chunkInfos) {
-      writeBuf().appendRaw(ch.chunkId);
-      writeBuf().appendRaw(ch.startIndex);
-      writeBuf().appendRaw(ch.elementCount);
-      writeBuf().appendRaw(ch.dataSize);
-    }
+    writeBuf().appendRaw(ci->elementCount);
+    writeBuf().appendRaw((byte_t)ci->kind);
     putData(COLLINFO_CLSID, ci->collectionId, 0, writeBuf());
 
-    delete ci;
+    //chunk infos are saved under their own keys, so we only need to write what was touched
+    for(ChunkId chunkId : ci->modifiedChunks) {
+      auto ch = std::lower_bound(ci->chunkInfos.begin(), ci->chunkInfos.end(), chunkId,
+                                 [](const ChunkInfo &info, ChunkId id) {return info.chunkId < id;});
+      if(ch != ci->chunkInfos.end() && ch->chunkId == chunkId) {
+        writeBuf().start(4 * sizeof(size_t) + 2 * sizeof(uint64_t) + sizeof(double) + 2 * sizeof(Timestamp));
+        writeBuf().appendRaw(ch->startIndex);
+        writeBuf().appendRaw(ch->elementCount);
+        writeBuf().appendRaw(ch->dataSize);
+        writeBuf().appendRaw(ch->deletedCount);
+        if(ch->stats.valid) {
+          writeBuf().appendRaw(ch->stats.min);
+          writeBuf().appendRaw(ch->stats.max);
+          writeBuf().appendRaw(ch->stats.sum);
+        }
+        if(ch->stats.timed) {
+          writeBuf().appendRaw(ch->stats.firstTime);
+          writeBuf().appendRaw(ch->stats.lastTime);
+        }
+        putChunkData(CHUNKINFO_CLSID, ci->collectionId, chunkId, writeBuf());
+      }
+      else removeChunkData(CHUNKINFO_CLSID, ci->collectionId, chunkId);
+    }
+    ci->modifiedChunks.clear();
+
+    m_writtenCollectionInfos.push_back(it.second);
   }
   m_collectionInfos.clear();
 }
@@ -392,19 +559,38 @@ void WriteTransaction::writeCollections()
 void WriteTransaction::commit()
 {
   writeCollections();
+  writeStatistics();
+
+  //close cached object states before the new snapshot becomes visible to readers
+  TxnId commitId = txnId();
+  for(auto &touched : m_cacheTouched) {
+    auto &cache = store.objectCaches[touched.first];
+    for(ObjectId objectId : touched.second) cache->invalidate(objectId, commitId);
+  }
+  m_cacheTouched.clear();
+  store.m_lastCommitId = commitId;
+
   doCommit();
+
+  //the saved collection infos reflect the committed state, no need for readers to parse them again. Only the
+  //chunk layout is published, the transaction-private appender state stays behind
+  auto &cache = store.objectCaches[COLLINFO_CLSID];
+  for(auto &ci : m_writtenCollectionInfos)
+    cache->put<CollectionChunks>(ci->collectionId, commitId, std::make_shared<CollectionChunks>(*ci));
+  m_writtenCollectionInfos.clear();
+  if(m_resources) m_resources->arena.reset();
 }
 
 Transaction::~Transaction()
 {
-  for(auto &it : m_collectionInfos) delete it.second;
   m_collectionInfos.clear();
+  m_sharedCollections.clear();
 }
 
 void Transaction::_abort()
 {
-  for(auto &it : m_collectionInfos) delete it.second;
   m_collectionInfos.clear();
+  m_sharedCollections.clear();
   doAbort();
 }
 
@@ -424,28 +610,33 @@ void Transaction::renew()
   doRenew();
 }
 
-CollectionInfo *Transaction::readCollectionInfo(ReadBuf &readBuf)
+bool Transaction::readCollectionInfo(ObjectId collectionId, CollectionChunks &info)
 {
-  CollectionInfo *info = new CollectionInfo();
-  info->collectionId = readBuf.readRaw<ObjectId>();
-  size_t sz = readBuf.readRaw<size_t>();
-  for(size_t i=0; i<sz; i++) {
-    PropertyId chunkId = readBuf.readRaw<PropertyId>();
-    if(chunkId >= info->nextChunkId)
-      info->nextChunkId = chunkId + PropertyId(1);
+  ReadBuf readBuf;
+  getData(readBuf, COLLINFO_CLSID, collectionId, 0);
+  if(readBuf.null()) return false;
+
+  info.collectionId = readBuf.readRaw<ObjectId>();
+  info.elementCount = readBuf.readRaw<size_t>();
+  if(!readBuf.atEnd()) info.kind = (CollectionKind)readBuf.readRaw<byte_t>();
 
+  for(ChunkCursor::Ptr cc = _openChunkCursor(CHUNKINFO_CLSID, collectionId); !cc->atEnd(); cc->next()) {
+    ChunkId chunkId = cc->chunkId();
+    if(chunkId >= info.nextChunkId)
+      info.nextChunkId = chunkId + 1;
+
+    cc->get(readBuf);
     size_t startIndex = readBuf.readRaw<size_t>();
     size_t elementCount = readBuf.readRaw<size_t>();
-    if(startIndex + elementCount > info->nextStartIndex)
-      info->nextStartIndex = startIndex + elementCount;
+    if(startIndex + elementCount > info.nextStartIndex)
+      info.nextStartIndex = startIndex + elementCount;
 
     size_t dataSize = readBuf.readRaw<size_t>();
-    info->chunkInfos.push_back(ChunkInfo(chunkId, startIndex, elementCount, dataSize));
+    info.chunkInfos.push_back(ChunkInfo(chunkId, startIndex, elementCount, dataSize));
+    info.chunkInfos.back().deletedCount = readBuf.readRaw<size_t>();
+    readChunkStats(readBuf, info.chunkInfos.back().stats);
   }
-  //put into transaction cache
-  m_collectionInfos[info->collectionId] = info;
-
-  return info;
+  return true;
 }
 
 CollectionInfo *Transaction::getCollectionInfo(ObjectId &collectionId, bool create)
@@ -453,18 +644,532 @@ CollectionInfo *Transaction::getCollectionInfo(ObjectId &collectionId, bool crea
   if(collectionId == 0) {
     if(!create) return nullptr;
 
-    CollectionInfo *ci = new CollectionInfo(++store.m_maxCollectionId);
+    auto ci = std::make_shared<CollectionInfo>(++store.m_maxCollectionId);
     m_collectionInfos[ci->collectionId] = ci;
     collectionId = ci->collectionId;
-    return ci;
+    return ci.get();
   }
-  else if(m_collectionInfos.count(collectionId))
-    return m_collectionInfos[collectionId];
+  auto it = m_collectionInfos.find(collectionId);
+  if(it != m_collectionInfos.end()) return it->second.get();
+
+  //write transactions work on a private copy of the latest chunk layout
+  std::shared_ptr<CollectionInfo> info;
+  std::shared_ptr<CollectionChunks> cached = store.getCached<CollectionChunks>(
+      COLLINFO_CLSID, collectionId, ObjectCache::LATEST);
+  if(cached)
+    info = std::make_shared<CollectionInfo>(*cached);
   else {
+    info = std::make_shared<CollectionInfo>(collectionId);
+    if(!readCollectionInfo(collectionId, *info)) return nullptr;
+  }
+  m_collectionInfos[collectionId] = info;
+  return info.get();
+}
+
+const CollectionChunks *Transaction::getCollectionChunks(ObjectId collectionId)
+{
+  if(!readOnly()) return getCollectionInfo(collectionId, false);
+
+  auto it = m_sharedCollections.find(collectionId);
+  if(it != m_sharedCollections.end()) return it->second.get();
+
+  //parsed chunk layouts are shared by all read transactions on the same snapshot
+  std::shared_ptr<CollectionChunks> chunks = store.getCached<CollectionChunks>(COLLINFO_CLSID, collectionId, txnId());
+  if(!chunks) {
+    chunks = std::make_shared<CollectionChunks>(collectionId);
+    if(!readCollectionInfo(collectionId, *chunks)) return nullptr;
+
+    store.objectCaches[COLLINFO_CLSID]->put<CollectionChunks>(collectionId, txnId(), chunks);
+  }
+  m_sharedCollections[collectionId] = chunks;
+  return chunks.get();
+}
+
+size_t Transaction::_visitCollectionData(const CollectionChunks *info, size_t startIndex, size_t length, size_t elementSize,
+                                         std::function<bool(const byte_t *data, size_t count)> visitor)
+{
+  auto &chunkInfos = info->chunkInfos;
+  auto it = std::upper_bound(chunkInfos.begin(), chunkInfos.end(), startIndex,
+                             [](size_t pos, const ChunkInfo &ci) {return pos < ci.startIndex;});
+  if(it == chunkInfos.begin()) return 0;
+  it--;
+
+  size_t visited = 0;
+  for(; it != chunkInfos.end() && visited < length; it++) {
+    size_t position = startIndex + visited;
+    if(position < it->startIndex) break; //gap in data
+    if(position >= it->startIndex + it->elementCount) continue;
+
+    ReadBuf buf;
+    getChunkData(buf, COLLECTION_CLSID, info->collectionId, it->chunkId);
+    if(buf.null()) break;
+
+    size_t offset = position - it->startIndex;
+    size_t count = std::min(it->elementCount - offset, length - visited);
+    visited += count;
+
+    if(!visitor(buf.data() + ChunkHeader_sz + offset * elementSize, count)) break;
+  }
+  return visited;
+}
+
+bool Transaction::_seekTime(const CollectionChunks *info, Timestamp time, size_t sampleSize, size_t &chunkPos, size_t &offset)
+{
+  //only time series appenders write chunks with time ranges, and they can't be mixed with other appenders
+  if(info->kind != CollectionKind::timeSeries) throw error("not a time series collection");
+
+  auto &chunkInfos = info->chunkInfos;
+  auto it = std::lower_bound(chunkInfos.begin(), chunkInfos.end(), time,
+                             [](const ChunkInfo &ci, Timestamp t) {return ci.stats.lastTime < t;});
+  if(it == chunkInfos.end()) return false;
+
+  chunkPos = it - chunkInfos.begin();
+  offset = 0;
+  if(it->stats.firstTime >= time) return true;
+
+  ReadBuf buf;
+  getChunkData(buf, COLLECTION_CLSID, info->collectionId, it->chunkId);
+  if(buf.null()) throw error("time series chunk not found");
+
+  //the timestamp is the first member of each sample
+  const byte_t *data = buf.data() + ChunkHeader_sz;
+  size_t hi = it->elementCount;
+  while(offset < hi) {
+    size_t mid = (offset + hi) / 2;
+    Timestamp t;
+    memcpy(&t, data + mid * sampleSize, sizeof(Timestamp));
+    if(t < time) offset = mid + 1;
+    else hi = mid;
+  }
+  return true;
+}
+
+//spatial index node capacity. Nodes are split when they exceed SpatialNode_max entries
+static const size_t SpatialNode_max = 32;
+static const size_t SpatialNode_min = 12;
+
+static const size_t SpatialEntry_sz = BoundingBox_sz + 8;
+
+static inline uint64_t spatialRef(ClassId classId, ObjectId objectId) {
+  return (uint64_t(classId) << 32) | objectId;
+}
+
+bool Transaction::_loadSpatialRoot(ClassId classId, PropertyId propertyId, SpatialNodeId &rootId, SpatialNodeId &nextId)
+{
+  ReadBuf buf;
+  getSpatialNode(buf, classId, propertyId, 0);
+  if(buf.null()) {
+    rootId = 0;
+    nextId = 1;
+    return false;
+  }
+  rootId = buf.readRaw<SpatialNodeId>();
+  nextId = buf.readRaw<SpatialNodeId>();
+  return rootId != 0;
+}
+
+void Transaction::_loadSpatialNode(ClassId classId, PropertyId propertyId, SpatialNodeId nodeId, SpatialNode &node)
+{
+  ReadBuf buf;
+  getSpatialNode(buf, classId, propertyId, nodeId);
+  if(buf.null()) throw error("spatial index node not found");
+
+  node.id = nodeId;
+  node.level = buf.readRaw<uint16_t>();
+  node.entries.resize(buf.readRaw<uint16_t>());
+  for(auto &entry : node.entries) {
+    entry.box.minX = buf.readRaw<double>();
+    entry.box.minY = buf.readRaw<double>();
+    entry.box.maxX = buf.readRaw<double>();
+    entry.box.maxY = buf.readRaw<double>();
+    entry.ref = buf.readRaw<uint64_t>();
+  }
+}
+
+bool Transaction::_findSpatialEntry(ClassId classId, PropertyId propertyId, SpatialNodeId nodeId, const BoundingBox &box,
+                                    uint64_t ref, std::vector<SpatialNode> &path, std::vector<size_t> &pos)
+{
+  path.emplace_back();
+  _loadSpatialNode(classId, propertyId, nodeId, path.back());
+
+  size_t depth = path.size() - 1;
+  for(size_t i=0; i<path[depth].entries.size(); i++) {
+    const SpatialNode::Entry &entry = path[depth].entries[i];
+    if(path[depth].level == 0) {
+      if(entry.ref == ref) {
+        pos.push_back(i);
+        return true;
+      }
+    }
+    else if(entry.box.contains(box)) {
+      pos.push_back(i);
+      if(_findSpatialEntry(classId, propertyId, (SpatialNodeId)entry.ref, box, ref, path, pos)) return true;
+      pos.pop_back();
+    }
+  }
+  path.pop_back();
+  return false;
+}
+
+void Transaction::_searchSpatial(ClassId classId, PropertyId propertyId, const BoundingBox &box, std::vector<ObjectKey> &keys)
+{
+  SpatialNodeId rootId, nextId;
+  if(!_loadSpatialRoot(classId, propertyId, rootId, nextId)) return;
+
+  std::vector<SpatialNodeId> pending {rootId};
+  SpatialNode node;
+  while(!pending.empty()) {
+    _loadSpatialNode(classId, propertyId, pending.back(), node);
+    pending.pop_back();
+
+    for(auto &entry : node.entries) {
+      if(!entry.box.intersects(box)) continue;
+
+      if(node.level == 0) {
+        ObjectKey key;
+        key.classId = ClassId(entry.ref >> 32);
+        key.objectId = ObjectId(entry.ref);
+        keys.push_back(key);
+      }
+      else
+        pending.push_back((SpatialNodeId)entry.ref);
+    }
+  }
+}
+
+/**
+ * cursor backend over a precomputed list of object keys, used for spatial and referrer queries
+ */
+class KeyListCursorHelper : public CursorHelper
+{
+  Transaction * const m_tr;
+  std::vector<ObjectKey> m_keys;
+  size_t m_index = 0;
+
+  bool setCurrent() {
+    if(m_index >= m_keys.size()) return false;
+    m_currentClassId = m_keys[m_index].classId;
+    m_currentObjectId = m_keys[m_index].objectId;
+    return true;
+  }
+
+protected:
+  bool start() override {
+    m_index = 0;
+    return setCurrent();
+  }
+  bool next() override {
+    m_index++;
+    return setCurrent();
+  }
+  bool erasable() override {
+    return false;
+  }
+  bool erase() override {
+    throw error("objects cannot be erased through a key list cursor");
+  }
+  void close() override {
+    m_index = m_keys.size();
+  }
+  void get(ObjectKey &key, ReadBuf &rb) override {
+    key.classId = m_currentClassId;
+    key.objectId = m_currentObjectId;
+    m_tr->getData(rb, m_currentClassId, m_currentObjectId, 0);
+  }
+  void getObjectData(ObjectBuf &buf) override {
+    buf.key.classId = m_currentClassId;
+    buf.key.objectId = m_currentObjectId;
+    ReadBuf rb;
+    m_tr->getData(rb, m_currentClassId, m_currentObjectId, 0);
+    if(!rb.null()) buf.start(rb.data(), rb.size());
+  }
+
+public:
+  KeyListCursorHelper(Transaction *tr, std::vector<ObjectKey> &keys) : m_tr(tr) {
+    m_keys.swap(keys);
+  }
+};
+
+CursorHelper * Transaction::_openSpatialCursor(ClassId classId, PropertyId propertyId, const BoundingBox &box)
+{
+  std::vector<ObjectKey> keys;
+  _searchSpatial(classId, propertyId, box, keys);
+  return new KeyListCursorHelper(this, keys);
+}
+
+CursorHelper * Transaction::_openReferrersCursor(const ObjectKey &target)
+{
+  std::vector<Referrer> referrers;
+  loadReferrers(target, referrers);
+
+  //entries are ordered by referrer key, multiple properties of one referrer are adjacent
+  std::vector<ObjectKey> keys;
+  for(auto &referrer : referrers) {
+    if(keys.empty() || keys.back() < referrer.key) keys.push_back(referrer.key);
+  }
+  return new KeyListCursorHelper(this, keys);
+}
+
+ObjectFilter ObjectFilter::combine(const ObjectFilter &other, int op) const
+{
+  ObjectFilter result(*this);
+  result.m_plans.clear();
+
+  int shift = (int)m_terms.size();
+  result.m_terms.insert(result.m_terms.end(), other.m_terms.begin(), other.m_terms.end());
+  for(int instr : other.m_program) result.m_program.push_back(instr >= 0 ? instr + shift : instr);
+  result.m_program.push_back(op);
+
+  return result;
+}
+
+const std::vector<ObjectFilter::Location> &ObjectFilter::plan(StoreId storeId, ClassId classId, Properties *props)
+{
+  auto it = m_plans.find(classId);
+  if(it != m_plans.end()) return it->second;
+
+  std::vector<Location> &locations = m_plans[classId];
+  for(auto &term : m_terms) {
+    Location loc {true, 0, 0};
+    bool found = false;
+
+    for(unsigned px=0, sz=props->full_size(); px < sz && !found; px++) {
+      const PropertyAccessBase *pa = props->get(px);
+      if(!pa->enabled) continue;
+
+      if(pa == term->pa) {
+        loc.propertyIndex = px;
+        found = true;
+      }
+      else if(loc.fixed) {
+        switch(pa->storeinfo->layout) {
+          case StoreLayout::all_embedded:
+            if(pa->storeinfo->fixedSize) loc.offset += pa->storeinfo->fixedSize;
+            else loc.fixed = false;
+            break;
+          case StoreLayout::embedded_key:
+            loc.offset += ObjectKey_sz;
+            break;
+          case StoreLayout::property:
+          case StoreLayout::none:
+            //nothing in the object buffer
+            break;
+        }
+      }
+    }
+    if(!found) throw error("filter property does not belong to the filtered class");
+    locations.push_back(loc);
+  }
+  return locations;
+}
+
+bool ObjectFilter::matches(StoreId storeId, ClassId classId, Properties *props, ReadBuf &buf)
+{
+  const std::vector<Location> &locations = plan(storeId, classId, props);
+
+  std::vector<bool> &stack = m_stack;
+  stack.clear();
+  for(int instr : m_program) {
+    if(instr >= 0) {
+      const Location &loc = locations[instr];
+      if(loc.fixed) {
+        if(loc.offset >= buf.size()) {
+          stack.push_back(false);
+          continue;
+        }
+        ReadBuf valueBuf(buf.data() + loc.offset, buf.size() - loc.offset);
+        stack.push_back(m_terms[instr]->test(valueBuf));
+      }
+      else {
+        //walk the preceding properties
+        ObjectBuf obuf(buf.data(), buf.size());
+        for(unsigned px=0; px < loc.propertyIndex; px++) {
+          const PropertyAccessBase *pa = props->get(px);
+          if(!pa->enabled) continue;
+
+          obuf.mark();
+          size_t psz = pa->storeinfo->size(storeId, obuf);
+          obuf.unmark(psz);
+        }
+        stack.push_back(m_terms[instr]->test(obuf.getReadBuf()));
+      }
+    }
+    else {
+      bool right = stack.back();
+      stack.pop_back();
+      stack.back() = instr == AND ? stack.back() && right : stack.back() || right;
+    }
+  }
+  return stack.back();
+}
+
+/**
+ * saved form of a property aggregate. Other than DataAggregate, the sum of squares is kept, so that values can be
+ * removed again
+ */
+struct SavedAggregate
+{
+  uint64_t count = 0;
+  double sum = 0, sumsq = 0, min = 0, max = 0;
+
+  SavedAggregate() {}
+  SavedAggregate(const DataAggregate<double> &agg)
+      : count(agg.count), sum(agg.sum), sumsq(agg.count ? agg.m2 + agg.sum * agg.sum / agg.count : 0),
+        min(agg.min), max(agg.max) {}
+
+  void read(ReadBuf &buf) {
+    count = buf.readRaw<uint64_t>();
+    sum = buf.readRaw<double>();
+    sumsq = buf.readRaw<double>();
+    min = buf.readRaw<double>();
+    max = buf.readRaw<double>();
+  }
+  void write(WriteBuf &buf) {
+    buf.start(sizeof(uint64_t) + 4 * sizeof(double));
+    buf.appendRaw(count);
+    buf.appendRaw(sum);
+    buf.appendRaw(sumsq);
+    buf.appendRaw(min);
+    buf.appendRaw(max);
+  }
+  DataAggregate<double> aggregate() const {
+    DataAggregate<double> agg;
+    if(count) {
+      agg.count = count;
+      agg.sum = sum;
+      agg.min = min;
+      agg.max = max;
+      agg.m2 = std::max(0.0, sumsq - sum * sum / count);
+    }
+    return agg;
+  }
+};
+
+size_t Transaction::_scanCount(ClassId classId)
+{
+  size_t count = 0;
+
+  CursorHelper *helper = _openCursor(std::vector<ClassId>{classId});
+  for(bool hasData = helper->start(); hasData; hasData = helper->next()) count++;
+  helper->close();
+  delete helper;
+
+  return count;
+}
+
+DataAggregate<double> Transaction::_scanAggregate(ClassId classId, const PropertyAccessBase *pa)
+{
+  DataAggregate<double> agg;
+
+  Properties *props = store.objectProperties[classId];
+  if(!props) return agg;
+
+  CursorHelper *helper = _openCursor(std::vector<ClassId>{classId});
+  for(bool hasData = helper->start(); hasData; hasData = helper->next()) {
+    ObjectKey key;
     ReadBuf readBuf;
-    getData(readBuf, COLLINFO_CLSID, collectionId, 0);
-    return readBuf.null() ? nullptr : readCollectionInfo(readBuf);
+    helper->get(key, readBuf);
+    if(readBuf.null()) continue;
+
+    //skip to the aggregated property
+    ObjectBuf obuf(readBuf.data(), readBuf.size());
+    for(unsigned px=0, sz=props->full_size(); px < sz; px++) {
+      const PropertyAccessBase *p = props->get(px);
+      if(!p->enabled) continue;
+
+      if(p == pa) {
+        double value = pa->storeinfo->aggregateValue(obuf.getReadBuf());
+        DataAggregate<double> one;
+        one.count = 1;
+        one.sum = one.min = one.max = value;
+        agg.merge(one);
+        break;
+      }
+      obuf.mark();
+      size_t psz = p->storeinfo->size(store.id, obuf);
+      obuf.unmark(psz);
+    }
   }
+  helper->close();
+  delete helper;
+
+  return agg;
+}
+
+size_t Transaction::_classCount(ClassId classId)
+{
+  if(!classId) return 0;
+
+  ReadBuf buf;
+  getChunkData(buf, CLASSSTATS_CLSID, classId, 0);
+  return buf.null() ? _scanCount(classId) : (size_t)buf.readRaw<uint64_t>();
+}
+
+DataAggregate<double> Transaction::_classAggregate(ClassId classId, const PropertyAccessBase *pa)
+{
+  if(!classId) return DataAggregate<double>();
+
+  ReadBuf buf;
+  getChunkData(buf, CLASSSTATS_CLSID, classId, pa->id);
+  if(buf.null()) return _scanAggregate(classId, pa);
+
+  SavedAggregate saved;
+  saved.read(buf);
+  return saved.aggregate();
+}
+
+void WriteTransaction::writeStatistics()
+{
+  for(auto &cd : m_countDeltas) {
+    if(!cd.second) continue;
+
+    ReadBuf buf;
+    getChunkData(buf, CLASSSTATS_CLSID, cd.first, 0);
+
+    //without a saved count, we count the objects, which already reflects the changes made by this transaction
+    uint64_t count = buf.null() ? _scanCount(cd.first) : buf.readRaw<uint64_t>() + cd.second;
+
+    writeBuf().start(sizeof(uint64_t));
+    writeBuf().appendRaw(count);
+    putChunkData(CLASSSTATS_CLSID, cd.first, 0, writeBuf());
+  }
+  m_countDeltas.clear();
+
+  for(auto &ad : m_aggregateDeltas) {
+    ClassId classId = ad.first.first;
+    AggregateDelta &delta = ad.second;
+
+    ReadBuf buf;
+    getChunkData(buf, CLASSSTATS_CLSID, classId, delta.pa->id);
+
+    SavedAggregate saved;
+    if(buf.null()) {
+      saved = SavedAggregate(_scanAggregate(classId, delta.pa));
+    }
+    else {
+      saved.read(buf);
+      bool empty = saved.count == 0;
+
+      saved.count += delta.count;
+      if(saved.count == 0) {
+        saved = SavedAggregate();
+      }
+      else {
+        saved.sum += delta.sum;
+        saved.sumsq += delta.sumsq;
+        if(delta.added) {
+          if(empty || delta.addedMin < saved.min) saved.min = delta.addedMin;
+          if(empty || delta.addedMax > saved.max) saved.max = delta.addedMax;
+        }
+        //a removed value may have been the minimum or maximum. We can't know the successor without a scan
+        if(delta.removed && (delta.removedMin <= saved.min || delta.removedMax >= saved.max))
+          saved = SavedAggregate(_scanAggregate(classId, delta.pa));
+      }
+    }
+    saved.write(writeBuf());
+    putChunkData(CLASSSTATS_CLSID, classId, delta.pa->id, writeBuf());
+  }
+  m_aggregateDeltas.clear();
 }
 
 void ObjectBuf::checkData(Transaction *tr, ClassId cid, ObjectId oid) {
@@ -473,6 +1178,7 @@ void ObjectBuf::checkData(Transaction *tr, ClassId cid, ObjectId oid) {
     tr->getData(readBuf, cid, oid, 0);
     if(makeCopy) readBuf.copyData();
     if(markOffs) readBuf.unmark(markOffs);
+    if(markPending) readBuf.mark();
   }
 }
 
@@ -480,13 +1186,445 @@ void WriteTransaction::deleteCollection(ObjectId collectionId)
 {
   CollectionInfo *ci = getCollectionInfo(collectionId, false);
   if(ci) {
-    m_collectionInfos.erase(collectionId);
+    //keep a null entry, so the cached chunk layout of the last committed state is not picked up again
+    std::shared_ptr<CollectionInfo> deleted = m_collectionInfos[collectionId];
+    m_collectionInfos[collectionId] = nullptr;
     if(!remove(COLLINFO_CLSID, collectionId, 0))
       throw error("error deleting collection info");
-    for(auto chunk : ci->chunkInfos)
-      if(!remove(COLLECTION_CLSID, collectionId, chunk.chunkId))
+    for(auto chunk : ci->chunkInfos) {
+      if(!removeChunkData(COLLECTION_CLSID, collectionId, chunk.chunkId))
         throw error("error deleting collection chunk");
+      removeChunkData(COLLINDEX_CLSID, collectionId, chunk.chunkId);
+      removeChunkData(CHUNKINFO_CLSID, collectionId, chunk.chunkId);
+    }
+  }
+}
+
+bool WriteTransaction::deleteElement(ObjectId collectionId, size_t index)
+{
+  CollectionInfo *ci = getCollectionInfo(collectionId, false);
+  if(!ci) return false;
+  if(ci->kind != CollectionKind::unknown && ci->kind != CollectionKind::objects)
+    throw error("deleteElement: not an object collection");
+  if(!ci->appenders.empty()) throw error("deleteElement: collection has open appenders");
+
+  auto &chunkInfos = ci->chunkInfos;
+  auto it = std::upper_bound(chunkInfos.begin(), chunkInfos.end(), index,
+                             [](size_t pos, const ChunkInfo &info) {return pos < info.startIndex;});
+  if(it == chunkInfos.begin()) return false;
+
+  ChunkInfo &chunk = *(--it);
+  if(chunk.startIndex + chunk.elementCount <= index) return false;
+
+  ReadBuf readBuf;
+  getChunkData(readBuf, COLLECTION_CLSID, collectionId, chunk.chunkId);
+  if(readBuf.null()) throw error("deleteElement: chunk not found");
+
+  //locate the element, preferably through the offset index
+  size_t position = index - chunk.startIndex, offset;
+  ReadBuf indexBuf;
+  getChunkData(indexBuf, COLLINDEX_CLSID, collectionId, chunk.chunkId);
+  if(!indexBuf.null() && indexBuf.size() >= (position + 1) * 4) {
+    offset = read_integer<size_t>(indexBuf.data() + position * 4, 4);
+  }
+  else {
+    readChunkHeader(readBuf, 0, 0, 0);
+    for(size_t pos=0; pos < position; pos++) {
+      size_t sz;
+      readObjectHeader(readBuf, 0, 0, &sz);
+      readBuf.read(sz-ObjectHeader_sz);
+    }
+    offset = readBuf.cur() - readBuf.data();
   }
+  size_t flagOffset = offset + ObjectHeader_sz - 1;
+  if(read_integer<byte_t>(readBuf.data() + flagOffset, 1)) return false;
+
+  //values cannot be modified in place, rewrite the chunk
+  WriteBuf buf(readBuf.size());
+  buf.append(readBuf.data(), readBuf.size());
+  write_integer<byte_t>(buf.data() + flagOffset, 1, 1);
+  if(!putChunkData(COLLECTION_CLSID, collectionId, chunk.chunkId, buf))
+    throw error("deleteElement: error saving chunk");
+
+  chunk.deletedCount++;
+  ci->elementCount--;
+  ci->modifiedChunks.insert(chunk.chunkId);
+  return true;
+}
+
+size_t WriteTransaction::_updateCollectionData(ObjectId collectionId, size_t startIndex, size_t length,
+                                               size_t elementSize, const byte_t *data,
+                                               std::function<void(ChunkInfo &info, const byte_t *data)> updateStats)
+{
+  CollectionInfo *ci = getCollectionInfo(collectionId, false);
+  if(!ci) return 0;
+  if(!ci->appenders.empty()) throw error("updateDataCollection: collection has open appenders");
+
+  auto &chunkInfos = ci->chunkInfos;
+  auto it = std::upper_bound(chunkInfos.begin(), chunkInfos.end(), startIndex,
+                             [](size_t pos, const ChunkInfo &info) {return pos < info.startIndex;});
+  if(it == chunkInfos.begin()) return 0;
+  it--;
+
+  size_t updated = 0;
+  for(; it != chunkInfos.end() && updated < length; it++) {
+    size_t position = startIndex + updated;
+    if(position < it->startIndex) break; //gap in data
+    if(position >= it->startIndex + it->elementCount) continue;
+
+    size_t offset = position - it->startIndex;
+    size_t count = std::min(it->elementCount - offset, length - updated);
+
+    ReadBuf readBuf;
+    getChunkData(readBuf, COLLECTION_CLSID, collectionId, it->chunkId);
+    if(readBuf.null()) throw error("updateDataCollection: chunk not found");
+
+    //the reserved space may overlay the current value, so save what we keep. That's only the header if the
+    //whole chunk is replaced
+    size_t keep = count < it->elementCount ? it->dataSize : ChunkHeader_sz;
+    std::vector<byte_t> saved(readBuf.data(), readBuf.data() + keep);
+
+    byte_t *chunkData;
+    if(!allocChunkData(COLLECTION_CLSID, collectionId, it->chunkId, readBuf.size(), &chunkData))
+      throw error("updateDataCollection: error saving chunk");
+
+    memcpy(chunkData, saved.data(), keep);
+    memcpy(chunkData + ChunkHeader_sz + offset * elementSize, data + updated * elementSize, count * elementSize);
+
+    if(it->stats.valid) {
+      updateStats(*it, chunkData + ChunkHeader_sz);
+      ci->modifiedChunks.insert(it->chunkId);
+    }
+
+    updated += count;
+  }
+  return updated;
+}
+
+size_t WriteTransaction::compactCollection(ObjectId collectionId, double threshold, size_t maxChunks)
+{
+  CollectionInfo *ci = getCollectionInfo(collectionId, false);
+  if(!ci) return 0;
+  if(ci->kind != CollectionKind::unknown && ci->kind != CollectionKind::objects)
+    throw error("compactCollection: not an object collection");
+  if(!ci->appenders.empty()) throw error("compactCollection: collection has open appenders");
+
+  auto &chunkInfos = ci->chunkInfos;
+  size_t targetSize = store.getOptimalChunkSize();
+
+  //estimated size of the live elements in a chunk
+  auto liveSize = [](const ChunkInfo &info) -> size_t {
+    if(!info.elementCount) return 0;
+    return (info.dataSize - ChunkHeader_sz) * (info.elementCount - info.deletedCount) / info.elementCount;
+  };
+
+  size_t processed = 0;
+  for(size_t i=0; i < chunkInfos.size() && (!maxChunks || processed < maxChunks); ) {
+    //find a run of chunks starting at i that can be written into one chunk
+    size_t end = i, runSize = 0;
+    bool sparse = false;
+    while(end < chunkInfos.size() && (!maxChunks || processed + end - i < maxChunks)) {
+      ChunkInfo &info = chunkInfos[end];
+      bool chunkSparse = info.deletedCount && info.elementCount - info.deletedCount < info.elementCount * threshold;
+      bool chunkSmall = info.dataSize * 2 < targetSize;
+      if(!chunkSparse && !chunkSmall) break;
+      if(end > i && runSize + liveSize(info) + ChunkHeader_sz > targetSize) break;
+
+      sparse = sparse || chunkSparse;
+      runSize += liveSize(info);
+      end++;
+    }
+    if(!sparse && end - i < 2) {
+      i++;
+      continue;
+    }
+
+    //collect the live elements
+    std::vector<byte_t> data(ChunkHeader_sz);
+    std::vector<size_t> offsets;
+    for(size_t c=i; c < end; c++) {
+      ReadBuf readBuf;
+      getChunkData(readBuf, COLLECTION_CLSID, collectionId, chunkInfos[c].chunkId);
+      if(readBuf.null()) throw error("compactCollection: chunk not found");
+
+      size_t elementCount;
+      readChunkHeader(readBuf, 0, 0, &elementCount);
+      for(size_t e=0; e < elementCount; e++) {
+        const byte_t *element = readBuf.cur();
+        size_t sz;
+        bool deleted;
+        readObjectHeader(readBuf, 0, 0, &sz, &deleted);
+        readBuf.read(sz-ObjectHeader_sz);
+
+        if(!deleted) {
+          offsets.push_back(data.size());
+          data.insert(data.end(), element, element + sz);
+        }
+      }
+    }
+
+    //replace the run with one chunk that takes over the first chunk's id and start index
+    ChunkInfo first = chunkInfos[i];
+    for(size_t c=i; c < end; c++) {
+      if(!removeChunkData(COLLECTION_CLSID, collectionId, chunkInfos[c].chunkId))
+        throw error("compactCollection: error deleting chunk");
+      removeChunkData(COLLINDEX_CLSID, collectionId, chunkInfos[c].chunkId);
+      ci->modifiedChunks.insert(chunkInfos[c].chunkId);
+    }
+    chunkInfos.erase(chunkInfos.begin() + i, chunkInfos.begin() + end);
+    processed += end - i;
+
+    if(!offsets.empty()) {
+      byte_t *chunkData;
+      if(!allocChunkData(COLLECTION_CLSID, collectionId, first.chunkId, data.size(), &chunkData))
+        throw error("allocChunkData failed");
+
+      writeBuf().start(chunkData, data.size());
+      writeBuf().append(data.data(), data.size());
+      writeChunkHeader(first.startIndex, offsets.size());
+      writeChunkIndex(collectionId, first.chunkId, offsets);
+
+      chunkInfos.insert(chunkInfos.begin() + i, ChunkInfo(first.chunkId, first.startIndex, offsets.size(), data.size()));
+      i++;
+    }
+  }
+  return processed;
+}
+
+void WriteTransaction::_saveSpatialRoot(ClassId classId, PropertyId propertyId, SpatialNodeId rootId, SpatialNodeId nextId)
+{
+  WriteBuf buf(2 * sizeof(SpatialNodeId));
+  buf.appendRaw(rootId);
+  buf.appendRaw(nextId);
+  if(!putSpatialNode(classId, propertyId, 0, buf))
+    throw error("spatial index root was not saved");
+}
+
+void WriteTransaction::_saveSpatialNode(ClassId classId, PropertyId propertyId, const SpatialNode &node)
+{
+  WriteBuf buf(4 + node.entries.size() * SpatialEntry_sz);
+  buf.appendRaw((uint16_t)node.level);
+  buf.appendRaw((uint16_t)node.entries.size());
+  for(auto &entry : node.entries) {
+    buf.appendRaw(entry.box.minX);
+    buf.appendRaw(entry.box.minY);
+    buf.appendRaw(entry.box.maxX);
+    buf.appendRaw(entry.box.maxY);
+    buf.appendRaw(entry.ref);
+  }
+  if(!putSpatialNode(classId, propertyId, node.id, buf))
+    throw error("spatial index node was not saved");
+}
+
+/**
+ * distribute the entries of an overflowing node between the node and a new sibling, using Guttman's quadratic split
+ */
+static void splitSpatialNode(SpatialNode &node, SpatialNode &sibling)
+{
+  std::vector<SpatialNode::Entry> entries;
+  entries.swap(node.entries);
+  sibling.level = node.level;
+  sibling.entries.clear();
+
+  //seeds are the pair of entries that would waste the most area if grouped together
+  size_t seed1 = 0, seed2 = 1;
+  double worst = -std::numeric_limits<double>::infinity();
+  for(size_t i=0; i<entries.size(); i++) {
+    for(size_t j=i+1; j<entries.size(); j++) {
+      double waste = entries[i].box.united(entries[j].box).area() - entries[i].box.area() - entries[j].box.area();
+      if(waste > worst) {
+        worst = waste;
+        seed1 = i;
+        seed2 = j;
+      }
+    }
+  }
+  std::vector<bool> assigned(entries.size(), false);
+  assigned[seed1] = assigned[seed2] = true;
+  node.entries.push_back(entries[seed1]);
+  sibling.entries.push_back(entries[seed2]);
+  BoundingBox box1 = entries[seed1].box, box2 = entries[seed2].box;
+
+  for(size_t remaining = entries.size() - 2; remaining > 0; remaining--) {
+    //make sure both groups reach the minimum fill
+    SpatialNode *forced = nullptr;
+    if(node.entries.size() + remaining <= SpatialNode_min) forced = &node;
+    else if(sibling.entries.size() + remaining <= SpatialNode_min) forced = &sibling;
+
+    //otherwise pick the entry with the strongest preference for one group
+    size_t next = 0;
+    double d1 = 0, d2 = 0, maxDiff = -1;
+    for(size_t i=0; i<entries.size(); i++) {
+      if(assigned[i]) continue;
+      double e1 = box1.united(entries[i].box).area() - box1.area();
+      double e2 = box2.united(entries[i].box).area() - box2.area();
+      double diff = std::fabs(e1 - e2);
+      if(diff > maxDiff) {
+        maxDiff = diff;
+        next = i;
+        d1 = e1;
+        d2 = e2;
+      }
+      if(forced) break;
+    }
+    assigned[next] = true;
+
+    bool first = forced ? forced == &node :
+                 d1 != d2 ? d1 < d2 :
+                 box1.area() != box2.area() ? box1.area() < box2.area() :
+                 node.entries.size() <= sibling.entries.size();
+    if(first) {
+      node.entries.push_back(entries[next]);
+      box1 = box1.united(entries[next].box);
+    }
+    else {
+      sibling.entries.push_back(entries[next]);
+      box2 = box2.united(entries[next].box);
+    }
+  }
+}
+
+void WriteTransaction::_insertSpatial(ClassId classId, PropertyId propertyId, const BoundingBox &box,
+                                      ClassId objClassId, ObjectId objectId)
+{
+  SpatialNode::Entry entry {box, spatialRef(objClassId, objectId)};
+
+  SpatialNodeId rootId, nextId;
+  if(!_loadSpatialRoot(classId, propertyId, rootId, nextId)) {
+    SpatialNode leaf;
+    leaf.id = nextId++;
+    leaf.entries.push_back(entry);
+    _saveSpatialNode(classId, propertyId, leaf);
+    _saveSpatialRoot(classId, propertyId, leaf.id, nextId);
+    return;
+  }
+  _insertSpatialEntry(classId, propertyId, entry, 0, rootId, nextId);
+  _saveSpatialRoot(classId, propertyId, rootId, nextId);
+}
+
+bool WriteTransaction::_insertSpatialEntry(ClassId classId, PropertyId propertyId, const SpatialNode::Entry &entry,
+                                           unsigned level, SpatialNodeId &rootId, SpatialNodeId &nextId)
+{
+  //descend to the given level, choosing the child needing the least enlargement (ties: the smaller one)
+  std::vector<SpatialNode> path(1);
+  std::vector<size_t> pos;
+  _loadSpatialNode(classId, propertyId, rootId, path[0]);
+  if(path[0].level < level) return false;
+
+  while(path.back().level > level) {
+    const SpatialNode &node = path.back();
+    size_t best = 0;
+    double bestEnlarge = 0, bestArea = 0;
+    for(size_t i=0; i<node.entries.size(); i++) {
+      double area = node.entries[i].box.area();
+      double enlarge = node.entries[i].box.united(entry.box).area() - area;
+      if(i == 0 || enlarge < bestEnlarge || (enlarge == bestEnlarge && area < bestArea)) {
+        best = i;
+        bestEnlarge = enlarge;
+        bestArea = area;
+      }
+    }
+    pos.push_back(best);
+    SpatialNodeId childId = (SpatialNodeId)node.entries[best].ref;
+    path.emplace_back();
+    _loadSpatialNode(classId, propertyId, childId, path.back());
+  }
+  path.back().entries.push_back(entry);
+
+  //walk back up, adjusting bounding boxes and splitting overflowing nodes
+  SpatialNode sibling;
+  bool split = false;
+  for(size_t i=path.size(); i-- > 0; ) {
+    SpatialNode &node = path[i];
+    if(i + 1 < path.size()) node.entries[pos[i]].box = path[i+1].bounds();
+    if(split) node.entries.push_back({sibling.bounds(), sibling.id});
+
+    split = node.entries.size() > SpatialNode_max;
+    if(split) {
+      sibling.id = nextId++;
+      splitSpatialNode(node, sibling);
+      _saveSpatialNode(classId, propertyId, sibling);
+    }
+    _saveSpatialNode(classId, propertyId, node);
+  }
+  if(split) {
+    //the root was split, grow the tree
+    SpatialNode root;
+    root.id = nextId++;
+    root.level = path[0].level + 1;
+    root.entries.push_back({path[0].bounds(), path[0].id});
+    root.entries.push_back({sibling.bounds(), sibling.id});
+    _saveSpatialNode(classId, propertyId, root);
+    rootId = root.id;
+  }
+  return true;
+}
+
+bool WriteTransaction::_removeSpatial(ClassId classId, PropertyId propertyId, const BoundingBox &box,
+                                      ClassId objClassId, ObjectId objectId)
+{
+  SpatialNodeId rootId, nextId;
+  if(!_loadSpatialRoot(classId, propertyId, rootId, nextId)) return false;
+
+  std::vector<SpatialNode> path;
+  std::vector<size_t> pos;
+  if(!_findSpatialEntry(classId, propertyId, rootId, box, spatialRef(objClassId, objectId), path, pos))
+    return false;
+
+  path.back().entries.erase(path.back().entries.begin() + pos.back());
+
+  //walk back up, dropping underfull nodes and shrinking bounding boxes. The entries of dropped nodes are
+  //reinserted below (Guttman's condense tree)
+  std::vector<SpatialNode> orphans;
+  for(size_t i=path.size()-1; i > 0; i--) {
+    SpatialNode &node = path[i], &parent = path[i-1];
+    if(node.entries.size() < SpatialNode_min) {
+      removeSpatialNode(classId, propertyId, node.id);
+      parent.entries.erase(parent.entries.begin() + pos[i-1]);
+      if(!node.entries.empty()) orphans.push_back(std::move(node));
+    }
+    else {
+      _saveSpatialNode(classId, propertyId, node);
+      parent.entries[pos[i-1]].box = node.bounds();
+    }
+  }
+  SpatialNode &root = path[0];
+  if(root.entries.empty()) {
+    removeSpatialNode(classId, propertyId, root.id);
+    rootId = 0;
+  }
+  else if(root.level > 0 && root.entries.size() == 1) {
+    //shorten the tree
+    removeSpatialNode(classId, propertyId, root.id);
+    rootId = (SpatialNodeId)root.entries[0].ref;
+  }
+  else
+    _saveSpatialNode(classId, propertyId, root);
+
+  //reinsert orphaned entries at their original level, highest level first
+  while(!orphans.empty()) {
+    SpatialNode orphan = std::move(orphans.back());
+    orphans.pop_back();
+
+    for(auto &entry : orphan.entries) {
+      if(!rootId && orphan.level == 0) {
+        SpatialNode leaf;
+        leaf.id = nextId++;
+        leaf.entries.push_back(entry);
+        _saveSpatialNode(classId, propertyId, leaf);
+        rootId = leaf.id;
+      }
+      else if(!rootId || !_insertSpatialEntry(classId, propertyId, entry, orphan.level, rootId, nextId)) {
+        //the tree has become too low to take the subtree, reinsert its entries instead
+        SpatialNode sub;
+        _loadSpatialNode(classId, propertyId, (SpatialNodeId)entry.ref, sub);
+        removeSpatialNode(classId, propertyId, sub.id);
+        orphans.push_back(std::move(sub));
+      }
+    }
+  }
+  _saveSpatialRoot(classId, propertyId, rootId, nextId);
+  return true;
 }
 
 void LazyBuf::checkData() {
@@ -498,26 +1636,30 @@ void WriteTransaction::startChunk(CollectionInfo *collectionInfo, size_t chunkSi
   byte_t * data = nullptr;
   chunkSize += ChunkHeader_sz;
 
-  if(!allocData(COLLECTION_CLSID, collectionInfo->collectionId, collectionInfo->nextChunkId, chunkSize, &data))
-    throw error("allocData failed");
+  if(!allocChunkData(COLLECTION_CLSID, collectionInfo->collectionId, collectionInfo->nextChunkId, chunkSize, &data))
+    throw error("allocChunkData failed");
 
   collectionInfo->chunkInfos.push_back(ChunkInfo(
       collectionInfo->nextChunkId, collectionInfo->nextStartIndex, elementCount, chunkSize));
+  collectionInfo->modifiedChunks.insert(collectionInfo->nextChunkId);
 
   writeBuf().start(data, chunkSize);
   writeBuf().allocate(ChunkHeader_sz);
   writeChunkHeader(collectionInfo->nextStartIndex, elementCount);
 
   collectionInfo->nextStartIndex += elementCount;
+  collectionInfo->elementCount += elementCount;
   collectionInfo->nextChunkId++;
 }
 
 CollectionCursorBase::CollectionCursorBase(ObjectId collectionId, Transaction *tr, ChunkCursor::Ptr chunkCursor)
-  : m_collectionInfo(tr->getCollectionInfo(collectionId)), m_tr(tr), m_chunkCursor(chunkCursor), m_storeId(tr->store.id)
+  : m_collectionInfo(tr->getCollectionChunks(collectionId)), m_tr(tr), m_chunkCursor(chunkCursor), m_storeId(tr->store.id)
 {
   if(!m_chunkCursor->atEnd()) {
+    //the first chunk need not start at index 0 if leading chunks were compacted away
+    m_chunkId = m_chunkCursor->chunkId();
     m_chunkCursor->get(m_readBuf);
-    readChunkHeader(m_readBuf, 0, 0, &m_elementCount);
+    readChunkHeader(m_readBuf, &m_dataSize, &m_startIndex, &m_elementCount);
   }
 }
 
@@ -548,52 +1690,81 @@ bool CollectionCursorBase::seek(size_t position)
     bufSeek(position - m_startIndex);
     return true;
   }
-  for(auto &ci : m_collectionInfo->chunkInfos) {
-    if(ci.startIndex <= position && ci.startIndex + ci.elementCount > position) {
-      m_chunkCursor->seek(ci.chunkId);
-      m_chunkCursor->get(m_readBuf);
-      m_curElement = m_elementCount = 0;
-      readChunkHeader(m_readBuf, 0, &m_startIndex, &m_elementCount);
-      bufSeek(position - m_startIndex);
-      return true;
-    }
-  }
-  return false;
+
+  if(!m_collectionInfo) return false;
+
+  //chunks are ordered by start index. Find the last one that starts at or before position
+  auto &chunkInfos = m_collectionInfo->chunkInfos;
+  auto it = std::upper_bound(chunkInfos.begin(), chunkInfos.end(), position,
+                             [](size_t pos, const ChunkInfo &ci) {return pos < ci.startIndex;});
+  if(it == chunkInfos.begin()) return false;
+
+  const ChunkInfo &ci = *(--it);
+  if(ci.startIndex + ci.elementCount <= position) return false;
+
+  m_chunkCursor->seek(ci.chunkId);
+  m_chunkCursor->get(m_readBuf);
+  m_chunkId = ci.chunkId;
+  m_curElement = m_elementCount = 0;
+  readChunkHeader(m_readBuf, 0, &m_startIndex, &m_elementCount);
+  bufSeek(position - m_startIndex);
+  return true;
 }
 
 size_t CollectionCursorBase::count()
 {
-  return m_collectionInfo->count();
+  return m_collectionInfo ? m_collectionInfo->count() : 0;
 }
 
 void CollectionCursorBase::objectBufSeek(size_t position)
 {
-  if(position > m_curElement) {
-    for(size_t pos=0, epos=position-m_curElement; pos < epos; ) {
+  if(m_chunkIndexId != m_chunkId) {
+    m_chunkIndex.start(nullptr, 0);
+    m_tr->getChunkData(m_chunkIndex, COLLINDEX_CLSID, m_collectionInfo->collectionId, m_chunkId);
+    m_chunkIndexId = m_chunkId;
+  }
+  if(!m_chunkIndex.null() && m_chunkIndex.size() >= (position + 1) * 4) {
+    //jump directly to the element
+    m_readBuf.reset();
+    m_readBuf.read(read_integer<size_t>(m_chunkIndex.data() + position * 4, 4));
+  }
+  else if(position > m_curElement) {
+    //deleted elements keep their positions, so we count them, too
+    for(size_t pos=0, epos=position-m_curElement; pos < epos; pos++) {
       size_t sz;
-      bool deleted;
-      readObjectHeader(m_readBuf, 0, 0, &sz, &deleted);
+      readObjectHeader(m_readBuf, 0, 0, &sz);
       m_readBuf.read(sz-ObjectHeader_sz);
-      if(!deleted) pos++;
     }
   }
   else {
     m_readBuf.reset();
     readChunkHeader(m_readBuf, 0, 0, 0);
-    for(size_t pos=0; pos < position; ) {
+    for(size_t pos=0; pos < position; pos++) {
       size_t sz;
-      bool deleted;
-      readObjectHeader(m_readBuf, 0, 0, &sz, &deleted);
+      readObjectHeader(m_readBuf, 0, 0, &sz);
       m_readBuf.read(sz-ObjectHeader_sz);
-      if(!deleted) pos++;
     }
   }
   m_curElement = position;
 }
 
-CollectionAppenderBase::CollectionAppenderBase(WriteTransaction *wtxn, ObjectId &collectionId, size_t chunkSize)
-    : m_chunkSize(chunkSize ? chunkSize : wtxn->store.getOptimalChunkSize()),
-      m_tr(wtxn), m_writeBuf(wtxn->writeBuf()), m_collectionId(collectionId)
+bool CollectionCursorBase::eraseCurrent(WriteTransaction *tr)
+{
+  if(!m_curElement) return false;
+
+  size_t offset = m_readBuf.cur() - m_readBuf.data();
+  if(!tr->deleteElement(m_collectionInfo->collectionId, m_startIndex + m_curElement - 1)) return false;
+
+  //the chunk was rewritten, reload
+  m_chunkCursor->seek(m_chunkId);
+  m_chunkCursor->get(m_readBuf);
+  m_readBuf.read(offset);
+  return true;
+}
+
+CollectionAppenderBase::CollectionAppenderBase(WriteTransaction *wtxn, ObjectId &collectionId, size_t chunkSize,
+                                               CollectionKind kind)
+    : m_chunkSize(chunkSize), m_tr(wtxn), m_writeBuf(wtxn->writeBuf()), m_collectionId(collectionId), m_kind(kind)
 {
   m_elementCount = 0;
 }
@@ -602,14 +1773,45 @@ CollectionInfo * CollectionAppenderBase::collectionInfo()
 {
   if(!m_collectionInfo) {
     m_collectionInfo = m_tr->getCollectionInfo(m_collectionId);
+    m_collectionInfo->setKind(m_kind);
     m_collectionInfo->appenders.insert(this);
   }
   return m_collectionInfo;
 }
 
+size_t CollectionAppenderBase::maxChunkData()
+{
+  size_t maxSize = m_chunkSize ? m_chunkSize : m_tr->store.getOptimalChunkSize(MAX_CHUNK_PAGES);
+  return maxSize > ChunkHeader_sz ? maxSize - ChunkHeader_sz : 0;
+}
+
+size_t CollectionAppenderBase::nextChunkSize(size_t required)
+{
+  required += ChunkHeader_sz;
+  if(m_chunkSize) return required < m_chunkSize ? m_chunkSize : required;
+
+  //every chunk filled by this appender doubles the size of the next one. Bulk appends thus produce fewer keys and
+  //less chunk metadata, while occasional appends don't waste space
+  if(m_chunkOpen && m_chunkPages < MAX_CHUNK_PAGES) m_chunkPages *= 2;
+
+  if(m_elementsAppended) {
+    size_t avgSize = m_bytesAppended / m_elementsAppended;
+    required = std::max(required, avgSize * MIN_CHUNK_ELEMENTS + ChunkHeader_sz);
+  }
+
+  //multiples of the page size make full use of the overflow pages
+  unsigned pages = m_chunkPages;
+  size_t size = m_tr->store.getOptimalChunkSize(pages);
+  while(size < required) size = m_tr->store.getOptimalChunkSize(++pages);
+
+  return size;
+}
+
 void CollectionAppenderBase::startChunk(size_t size)
 {
-  if(m_elementCount) {
+  collectionInfo();
+
+  if(m_chunkOpen) {
     //write chunkinfo for current chunk
     ChunkInfo &ci = m_collectionInfo->chunkInfos.back();
     if(!ci.startIndex) ci.startIndex = m_collectionInfo->nextStartIndex;
@@ -618,34 +1820,55 @@ void CollectionAppenderBase::startChunk(size_t size)
 
     m_tr->writeChunkHeader(ci.startIndex, ci.elementCount);
     m_collectionInfo->nextStartIndex += m_elementCount;
+    m_collectionInfo->elementCount += m_elementCount;
+    writeChunkIndex();
+    finishChunk(ci);
+
+    m_bytesAppended += ci.dataSize - ChunkHeader_sz;
+    m_elementsAppended += ci.elementCount;
   }
   //allocate a new chunk
   byte_t * data = nullptr;
-  size_t sz = size + ChunkHeader_sz < m_chunkSize ? m_chunkSize : size;
-  if(m_tr->allocData(COLLECTION_CLSID, m_collectionInfo->collectionId, m_collectionInfo->nextChunkId, sz, &data)) {
+  size_t sz = nextChunkSize(size);
+  if(m_tr->allocChunkData(COLLECTION_CLSID, m_collectionInfo->collectionId, m_collectionInfo->nextChunkId, sz, &data)) {
     m_collectionInfo->chunkInfos.push_back(ChunkInfo(m_collectionInfo->nextChunkId));
+    m_collectionInfo->modifiedChunks.insert(m_collectionInfo->nextChunkId);
 
     m_writeBuf.start(data, sz);
     m_writeBuf.allocate(ChunkHeader_sz); //reserve for writing later
 
     m_collectionInfo->nextChunkId++;
   }
-  else throw error("allocData failed");
+  else throw error("allocChunkData failed");
 
   m_elementCount = 0;
+  m_chunkOpen = true;
 }
 
 void CollectionAppenderBase::close(bool erase)
 {
-  if(m_collectionInfo && !m_collectionInfo->chunkInfos.empty()) {
+  if(m_chunkOpen) {
     ChunkInfo &ci = m_collectionInfo->chunkInfos.back();
     if(!ci.startIndex) ci.startIndex = m_collectionInfo->nextStartIndex;
     ci.elementCount += m_elementCount;
     ci.dataSize = m_writeBuf.size();
-
-    if(erase) m_collectionInfo->appenders.erase(this);
+    m_collectionInfo->nextStartIndex += m_elementCount;
+    m_collectionInfo->elementCount += m_elementCount;
+    m_elementCount = 0;
+    m_chunkOpen = false;
 
     m_tr->writeChunkHeader(ci.startIndex, ci.elementCount);
+    writeChunkIndex();
+    finishChunk(ci);
+  }
+  if(erase && m_collectionInfo) m_collectionInfo->appenders.erase(this);
+}
+
+void CollectionAppenderBase::writeChunkIndex()
+{
+  if(!m_elementOffsets.empty()) {
+    m_tr->writeChunkIndex(m_collectionInfo->collectionId, m_collectionInfo->chunkInfos.back().chunkId, m_elementOffsets);
+    m_elementOffsets.clear();
   }
 }
 
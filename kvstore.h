@@ -26,11 +26,23 @@
 #include <memory>
 #include <functional>
 #include <set>
+#include <map>
 #include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <limits>
+#include <algorithm>
 #include <type_traits>
 #include <cstdlib>
+#include <cstddef>
 
 #include "kvtraits.h"
+#include "kvaggregate.h"
 
 #define PROPERTY_ID(__cls, __name) flexis::persistence::kv::ClassTraits<__cls>::__name->id
 #define PROPERTY(__cls, __name) flexis::persistence::kv::ClassTraits<__cls>::__name
@@ -42,13 +54,37 @@ namespace flexis {
 namespace persistence {
 
 /**
- * predefined ClassId for collections
+ * predefined ClassIds used by the first collection format (16-bit chunk ids, 32-bit chunk header fields).
+ * Databases containing these are migrated when opened
  */
-static const kv::ClassId COLLECTION_CLSID = 1;
+static const kv::ClassId LEGACY_COLLECTION_CLSID = 1;
+static const kv::ClassId LEGACY_COLLINFO_CLSID = 2;
+/**
+ * predefined ClassId for the per-chunk element offset index of object collections. Keyed by chunk id
+ */
+static const kv::ClassId COLLINDEX_CLSID = 3;
+/**
+ * predefined ClassId for collections. Keyed by chunk id
+ */
+static const kv::ClassId COLLECTION_CLSID = 4;
 /**
  * predefined ClassId for collection metadata
  */
-static const kv::ClassId COLLINFO_CLSID = 2;
+static const kv::ClassId COLLINFO_CLSID = 5;
+/**
+ * predefined ClassId for collection chunk metadata. Keyed by chunk id
+ */
+static const kv::ClassId CHUNKINFO_CLSID = 6;
+/**
+ * predefined ClassId for per-class statistics (instance counts and property aggregates). Keyed by the ClassId
+ * of the counted class, with chunk id 0 for the instance count and the PropertyId for aggregates
+ */
+static const kv::ClassId CLASSSTATS_CLSID = 7;
+/**
+ * predefined ClassId for the persisted id counters (maximum ClassId, maximum collection id and the maximum ObjectId
+ * per class), which spare the store from searching for them when opened
+ */
+static const kv::ClassId COUNTERS_CLSID = 8;
 
 /**
  * data structures and enums used during schema validation
@@ -128,6 +164,7 @@ class ReadTransaction;
 class ExclusiveReadTransaction;
 class WriteTransaction;
 template <typename T> class ClassCursor;
+template <typename T> class TimeSeriesCursor;
 
 using TransactionPtr = std::shared_ptr<kv::Transaction>;
 using ReadTransactionPtr = std::shared_ptr<kv::ReadTransaction>;
@@ -138,34 +175,145 @@ using ObjectProperties = std::unordered_map<ClassId, Properties *>;
 using ObjectClassInfos = std::unordered_map<ClassId, AbstractClassInfo *>;
 
 /**
- * object cache interface
+ * transaction id. For read transactions, this identifies the committed database state (snapshot) that is
+ * being read. For write transactions, it identifies the state that will be produced by the commit
+ */
+using TxnId = uint64_t;
+
+/**
+ * object cache interface. Cached objects are tagged with the range of snapshots they are valid for, such that
+ * a transaction will only be served an object state that corresponds to its own snapshot. Implementations must
+ * be thread-safe
  */
 struct ObjectCache {
+  /**
+   * snapshot id that designates the latest committed state. Used for lookups by write transactions
+   */
+  static const TxnId LATEST = std::numeric_limits<TxnId>::max() - 1;
+
   virtual ~ObjectCache() {}
 
-  template <typename T> std::shared_ptr<T> &get(ObjectId id);
-  template <typename T> void put(ObjectId id, std::shared_ptr<T> ptr);
-  template <typename T> void erase(ObjectId id);
+  template <typename T> std::shared_ptr<const T> get(ObjectId id, TxnId snapshot);
+  template <typename T> void put(ObjectId id, TxnId snapshot, std::shared_ptr<const T> ptr);
+
+  /**
+   * close the validity range of a cached object. Must be called before the modifying transaction is committed
+   *
+   * @param id the id of the modified object
+   * @param commitId the id of the committing write transaction
+   */
+  virtual void invalidate(ObjectId id, TxnId commitId) = 0;
 };
 /**
- * map-based object cache implementation
+ * sharded, map-based object cache implementation
  */
 template <typename T>
-struct TypedObjectCache : public ObjectCache {
-  std::unordered_map<ObjectId, std::shared_ptr<T>> objects;
+class TypedObjectCache : public ObjectCache
+{
+  static const unsigned SHARDS = 16;
+  static const TxnId OPEN = std::numeric_limits<TxnId>::max();
+
+  struct Entry {
+    std::shared_ptr<const T> object;
+    TxnId validFrom = 0, validUntil = OPEN;
+    TxnId lastCommit = 0;
+  };
+  struct Shard {
+    std::mutex mutex;
+    std::unordered_map<ObjectId, Entry> entries;
+  };
+  Shard m_shards[SHARDS];
+
+  //snapshots older than this may have missed invalidations that occurred before the cache was created
+  const TxnId m_minSnapshot;
+
+  Shard &shard(ObjectId id) {return m_shards[id % SHARDS];}
+
+public:
+  TypedObjectCache(TxnId minSnapshot) : m_minSnapshot(minSnapshot) {}
+
+  std::shared_ptr<const T> lookup(ObjectId id, TxnId snapshot)
+  {
+    Shard &sh = shard(id);
+    std::lock_guard<std::mutex> lock(sh.mutex);
+
+    auto it = sh.entries.find(id);
+    if(it == sh.entries.end()) return nullptr;
+
+    Entry &e = it->second;
+    return e.validFrom <= snapshot && snapshot < e.validUntil ? e.object : nullptr;
+  }
+
+  void insert(ObjectId id, TxnId snapshot, std::shared_ptr<const T> ptr)
+  {
+    if(snapshot < m_minSnapshot) return;
+
+    Shard &sh = shard(id);
+    std::lock_guard<std::mutex> lock(sh.mutex);
+
+    Entry &e = sh.entries[id];
+    if(snapshot < e.lastCommit) return; //object was modified after this snapshot
+
+    //if the current entry is still open, the object state is the same in both snapshots
+    e.validFrom = e.object && e.validUntil == OPEN ? std::min(e.validFrom, snapshot) : snapshot;
+    e.validUntil = OPEN;
+    e.object = ptr;
+  }
+
+  void invalidate(ObjectId id, TxnId commitId) override
+  {
+    Shard &sh = shard(id);
+    std::lock_guard<std::mutex> lock(sh.mutex);
+
+    Entry &e = sh.entries[id];
+    e.lastCommit = std::max(e.lastCommit, commitId);
+    e.validUntil = std::min(e.validUntil, commitId);
+  }
 };
 
-template <typename T> std::shared_ptr<T> &ObjectCache::get(ObjectId id) {
-  return dynamic_cast<TypedObjectCache<T> *>(this)->objects[id];
+template <typename T> std::shared_ptr<const T> ObjectCache::get(ObjectId id, TxnId snapshot) {
+  TypedObjectCache<T> *cache = dynamic_cast<TypedObjectCache<T> *>(this);
+  return cache ? cache->lookup(id, snapshot) : nullptr;
 }
 
-template <typename T> void ObjectCache::put(ObjectId id, std::shared_ptr<T> ptr) {
-  dynamic_cast<TypedObjectCache<T> *>(this)->objects[id] = ptr;
+template <typename T> void ObjectCache::put(ObjectId id, TxnId snapshot, std::shared_ptr<const T> ptr) {
+  TypedObjectCache<T> *cache = dynamic_cast<TypedObjectCache<T> *>(this);
+  if(cache) cache->insert(id, snapshot, ptr);
 }
 
-template <typename T> void ObjectCache::erase(ObjectId id) {
-  dynamic_cast<TypedObjectCache<T> *>(this)->objects.erase(id);
-}
+/**
+ * fixed set of worker threads owned by a store. Threads are started with the pool and live until it is destroyed,
+ * so parallel operations don't pay for thread creation on every call
+ */
+class WorkerPool
+{
+  struct Batch;
+  struct Task {
+    std::function<void()> *fn;
+    Batch *batch;
+  };
+
+  std::vector<std::thread> m_threads;
+  std::deque<Task> m_tasks;
+  std::mutex m_mutex;
+  std::condition_variable m_available, m_done;
+  bool m_stop = false;
+
+  void work();
+
+public:
+  WorkerPool(unsigned size);
+  ~WorkerPool();
+
+  unsigned size() const {return (unsigned)m_threads.size();}
+
+  /**
+   * run a batch of tasks and wait for all of them to complete. The first task runs on the calling thread, the others
+   * on the workers. Since the pool is shared by concurrent callers, tasks must not depend on running simultaneously.
+   * Tasks must not throw
+   */
+  void run(std::vector<std::function<void()>> &tasks);
+};
 
 /**
  * global function for assigning storage IDs
@@ -203,9 +351,10 @@ protected:
   using PropertyMetaInfoPtr = std::shared_ptr<PropertyMetaInfo>;
 
   /**
-   * @return the optimal chunk size minus the reserved size
+   * @return the size of the largest value that occupies no more than the given number of storage pages, minus the
+   * reserved size
    */
-  virtual size_t getOptimalChunkSize(size_t reserved) = 0;
+  virtual size_t getOptimalChunkSize(size_t reserved, unsigned pages) = 0;
 
   /**
    * compare loaded and declared property mapping
@@ -249,10 +398,12 @@ protected:
 
 public:
   /**
-   * @return the optimal chunk size, which is the current page size minus the chunk header
+   * @param pages the number of storage pages the chunk should occupy
+   * @return the optimal chunk size including the chunk header, which is the size of the given number of pages minus
+   * the storage engine's page overhead
    */
-  size_t getOptimalChunkSize() {
-    return getOptimalChunkSize(kv::ChunkHeader_sz);
+  size_t getOptimalChunkSize(unsigned pages=1) {
+    return getOptimalChunkSize(0, pages);
   }
 };
 
@@ -359,38 +510,102 @@ class KeyValueStore : public KeyValueStoreBase
   std::unordered_map<TypeInfoRef, kv::ClassId, TypeinfoHasher, TypeinfoEqualTo> objectTypeInfos;
   std::unordered_map<kv::ClassId, std::shared_ptr<kv::ObjectCache>> objectCaches;
 
-  template <typename T> inline
-  std::shared_ptr<T> putCache(T *obj, kv::object_handler<T> handler)
-  {
-    std::shared_ptr<T> result = std::shared_ptr<T>(obj, handler);
-    objectCaches[handler.classId]->put(handler.objectId, result);
-    return result;
+  //id of the last write transaction committed through this store
+  std::atomic<kv::TxnId> m_lastCommitId {0};
+
+  //workers for parallel collection decoding, started on first use
+  std::mutex m_workerPoolMutex;
+  std::unique_ptr<kv::WorkerPool> m_workerPool;
+
+  kv::WorkerPool &workerPool() {
+    std::lock_guard<std::mutex> lock(m_workerPoolMutex);
+    if(!m_workerPool)
+      m_workerPool.reset(new kv::WorkerPool(std::max(std::thread::hardware_concurrency(), 2u) - 1));
+    return *m_workerPool;
+  }
+
+  //write buffers and arenas released by finished transactions
+  std::mutex m_writeResourcesMutex;
+  std::vector<std::unique_ptr<kv::WriteResources>> m_writeResources;
+
+  kv::WriteResources *acquireWriteResources() {
+    std::lock_guard<std::mutex> lock(m_writeResourcesMutex);
+    if(m_writeResources.empty()) {
+      kv::notify_allocation(sizeof(kv::WriteResources));
+      return new kv::WriteResources();
+    }
+    kv::WriteResources *resources = m_writeResources.back().release();
+    m_writeResources.pop_back();
+    return resources;
+  }
+
+  void releaseWriteResources(kv::WriteResources *resources) {
+    resources->arena.reset();
+    std::lock_guard<std::mutex> lock(m_writeResourcesMutex);
+    m_writeResources.push_back(std::unique_ptr<kv::WriteResources>(resources));
   }
 
   template <typename T> inline
-  std::shared_ptr<T> &getCached(kv::ClassId classId, kv::ObjectId objectId)
+  std::shared_ptr<T> putCache(T *obj, kv::object_handler<T> handler, kv::TxnId snapshot)
   {
-#ifdef _MSC_VER
-    return objectCaches[classId]->ObjectCache::get<T>(objectId);
-#else
-    return objectCaches[classId]->template ObjectCache::get<T>(objectId);
-#endif
+    std::shared_ptr<T> result = std::shared_ptr<T>(obj, handler);
+    auto it = objectCaches.find(handler.classId);
+    if(it != objectCaches.end()) it->second->template put<T>(handler.objectId, snapshot, result);
+    return result;
   }
 
   template <typename T> inline
-  void removeCached(kv::ClassId classId, kv::ObjectId objectId)
+  std::shared_ptr<T> getCached(kv::ClassId classId, kv::ObjectId objectId, kv::TxnId snapshot)
   {
-#ifdef _MSC_VER
-    return objectCaches[classId]->ObjectCache::erase<T>(objectId);
-#else
-    objectCaches[classId]->template ObjectCache::erase<T>(objectId);
-#endif
+    auto it = objectCaches.find(classId);
+    if(it == objectCaches.end()) return nullptr;
+    return std::const_pointer_cast<T>(it->second->template get<T>(objectId, snapshot));
   }
 
 protected:
   kv::ClassId m_maxClassId = kv::AbstractClassInfo::MIN_USER_CLSID;
   kv::ObjectId m_maxCollectionId = 0;
 
+  /**
+   * merge the current maximum object ids of all registered classes into the given map
+   */
+  void collectMaxObjectIds(std::map<kv::ClassId, kv::ObjectId> &maxIds)
+  {
+    for(auto &ci : objectClassInfos) {
+      kv::ObjectId &maxId = maxIds[ci.first];
+      if(ci.second->data[id].maxObjectId > maxId) maxId = ci.second->data[id].maxObjectId;
+    }
+  }
+
+  /**
+   * @return true if the maximum object id of any registered class is greater than in the given map
+   */
+  bool maxObjectIdsAdvanced(const std::map<kv::ClassId, kv::ObjectId> &maxIds)
+  {
+    for(auto &ci : objectClassInfos) {
+      auto it = maxIds.find(ci.first);
+      if(ci.second->data[id].maxObjectId > (it != maxIds.end() ? it->second : 0)) return true;
+    }
+    return false;
+  }
+
+  /**
+   * let all classes that hold references to the given class prepare their updates and deletes if refcounting or
+   * the referrer index are configured for it
+   */
+  void updatePrepareClasses(kv::AbstractClassInfo *classInfo)
+  {
+    kv::ClassData &cdata = classInfo->data[id];
+    for(auto &op : objectProperties) {
+      if(op.first != cdata.classId && op.second->preparesUpdates(id, cdata.classId)) {
+        if(cdata.refcounting || cdata.referrerIndex)
+          objectClassInfos[op.first]->data[id].prepareClasses.insert(cdata.classId);
+        else
+          objectClassInfos[op.first]->data[id].prepareClasses.erase(cdata.classId);
+      }
+    }
+  }
+
 public:
   /**
    * create a new store object.
@@ -426,7 +641,7 @@ public:
    *
    * @param storeId the store ID. StoreIds should be obtained from kv::nextStoreId
    */
-  KeyValueStore(kv::StoreId storeId=kv::nextStoreId()) : KeyValueStoreBase(storeId) {}
+  KeyValueStore(kv::StoreId storeId=kv::nextStoreId());
 
   /**
    * register and validate the class schema for this store
@@ -457,6 +672,20 @@ public:
       objectClassInfos[info.classInfo->data[id].classId] = info.classInfo;
       objectTypeInfos[info.classInfo->typeinfo] = info.classInfo->data[id].classId;
     }
+    //classIds may have been assigned anywhere within the registered hierarchies
+    for(auto &ci : objectClassInfos) ci.second->buildTables(id);
+
+    //classes with indexed or aggregated properties must prepare updates and deletes against themselves
+    for(auto &op : objectProperties) {
+      for(unsigned px=0, sz=op.second->full_size(); px < sz; px++) {
+        const kv::StoreInfo *si = op.second->get(px)->storeinfo;
+        if(si->indexed() || si->aggregated()) {
+          objectClassInfos[op.first]->data[id].prepareClasses.insert(op.first);
+          break;
+        }
+      }
+    }
+
     if(!schemaError.empty()) {
       for(auto &info : vinfos)
         if(info.classInfo->compatibility < requiredCompatibility)
@@ -484,6 +713,10 @@ public:
    * This is an owned operation, meaning that once it has been set, it can only be changed by the holder of the ownerId
    * returned from the initial call.
    *
+   * Cached objects are shared between read transactions (and threads) which read the same database snapshot. They
+   * are only handed out as immutable pointers, through Transaction::getSharedObject and ClassCursor::getShared. All
+   * other API, and write transactions in general, load private objects which the application may modify.
+   *
    * @param cache whether caching should be turned on or off
    * @param owner an owner id returned from a previous call to this function
    * @return a non-0 owner id if the operation was performed successfully, or 0 if it was rejected but the
@@ -496,7 +729,7 @@ public:
       if(owner == 0) kv::ClassTraits<T>::traits_data(id).cacheOwner = owner = rand()+1;
 
       if(cache)
-        objectCaches[kv::ClassTraits<T>::traits_data(id).classId] = std::make_shared<kv::TypedObjectCache<T>>();
+        objectCaches[kv::ClassTraits<T>::traits_data(id).classId] = std::make_shared<kv::TypedObjectCache<T>>(m_lastCommitId);
       else
         objectCaches.erase(kv::ClassTraits<T>::traits_data(id).classId);
 
@@ -538,15 +771,7 @@ public:
       if(owner == 0) kv::ClassTraits<T>::traits_data(id).refcountingOwner = owner = rand()+1;
 
       kv::ClassTraits<T>::traits_info->setRefCounting(id, refcount);
-      kv::ClassId cid = kv::ClassTraits<T>::traits_data(id).classId;
-      for(auto &op : objectProperties) {
-        if(op.first != cid && op.second->preparesUpdates(id, cid)) {
-          if(refcount)
-            objectClassInfos[op.first]->data[id].prepareClasses.insert(cid);
-          else
-            objectClassInfos[op.first]->data[id].prepareClasses.erase(cid);
-        }
-      }
+      updatePrepareClasses(kv::ClassTraits<T>::traits_info);
       return owner;
     }
     else {
@@ -556,6 +781,70 @@ public:
     }
   }
 
+  /**
+   * configure the referrer index for the given template parameter class. When the referrer index is on, a reverse
+   * entry (target key -> referrer key + property) is maintained for every object reference to an instance of T that
+   * is held by a shared_ptr-mapped property (see ObjectPtrPropertyAssign, ObjectPtrVectorPropertyAssign). The entries
+   * can be queried through Transaction::getReferrers and Transaction::openReferrersCursor. References saved while the
+   * index was off are not indexed.
+   *
+   * This is an owned operation, meaning that once it has been set, it can only be changed by the holder of the ownerId
+   * returned from the initial call.
+   *
+   * @param index whether the referrer index should be turned on or off
+   * @param owner an owner id returned from a previous call to this function
+   * @return a non-0 owner id if the operation was performed successfully, or 0 if it was rejected but the
+   * setting is already as requested
+   * @throw error if the setting is already owned and not the same as requested
+   */
+  template <typename T>
+  unsigned  setReferrerIndex(bool index=true, unsigned owner=0)
+  {
+    if(kv::ClassTraits<T>::traits_data(id).referrerIndexOwner == owner) {
+      if(owner == 0) kv::ClassTraits<T>::traits_data(id).referrerIndexOwner = owner = rand()+1;
+
+      kv::ClassTraits<T>::traits_info->setReferrerIndex(id, index);
+      updatePrepareClasses(kv::ClassTraits<T>::traits_info);
+      return owner;
+    }
+    else {
+      if(kv::ClassTraits<T>::traits_info->getReferrerIndex(id) != index)
+        throw kv::error("referrer index configuration already owned and differs from requested value");
+      return 0;
+    }
+  }
+
+  /**
+   * configure change tracking for the given template parameter class. When change tracking is on, saving an existing
+   * object compares the serialized shallow buffer and all property keys with the stored data, and skips the writes
+   * for unchanged data. This trades an extra read for every write, which pays off for objects that are saved often
+   * while only few members change
+   *
+   * This is an owned operation, meaning that once it has been set, it can only be changed by the holder of the ownerId
+   * returned from the initial call.
+   *
+   * @param track whether change tracking should be turned on or off
+   * @param owner an owner id returned from a previous call to this function
+   * @return a non-0 owner id if the operation was performed successfully, or 0 if it was rejected but the
+   * setting is already as requested
+   * @throw error if the setting is already owned and not the same as requested
+   */
+  template <typename T>
+  unsigned  setChangeTracking(bool track=true, unsigned owner=0)
+  {
+    if(kv::ClassTraits<T>::traits_data(id).changeTrackingOwner == owner) {
+      if(owner == 0) kv::ClassTraits<T>::traits_data(id).changeTrackingOwner = owner = rand()+1;
+
+      kv::ClassTraits<T>::traits_info->setChangeTracking(id, track);
+      return owner;
+    }
+    else {
+      if(kv::ClassTraits<T>::traits_info->getChangeTracking(id) != track)
+        throw kv::error("change tracking configuration already owned and differs from requested value");
+      return 0;
+    }
+  }
+
   /**
    * register a substitute type to be used in polymorphic operations where a subclass of T is unknown.
    * <p>
@@ -586,6 +875,18 @@ public:
     return kv::ClassTraits<T>::getObjectKey(obj)->objectId;
   }
 
+  /**
+   * @return the number of persistent instances of T, read from the instance counts maintained by write
+   * transactions. See Transaction::count
+   */
+  template <typename T> size_t count(bool includeSubclasses=true);
+
+  /**
+   * @return the aggregate over an aggregated property, read from the values maintained by write transactions.
+   * See Transaction::aggregate
+   */
+  template <typename T> kv::DataAggregate<double> aggregate(const kv::PropertyAccessBase *pa, bool includeSubclasses=true);
+
   /**
    * @return a transaction object that provides read operations.
    */
@@ -663,6 +964,179 @@ public:
 };
 using IterPropertyBackendPtr = std::shared_ptr<IterPropertyBackend>;
 
+/**
+ * order-preserving binary encoding of indexed property values. Encoded values compare bytewise (memcmp) in the
+ * same order as the original values
+ */
+template <typename V, typename Enable=void> struct IndexValueTraits;
+
+template <typename V>
+struct IndexValueTraits<V, typename std::enable_if<std::is_integral<V>::value && !std::is_same<V, bool>::value>::type>
+{
+  static void encode(std::vector<byte_t> &key, V val) {
+    using U = typename std::make_unsigned<V>::type;
+    U u = (U)val;
+    //flip the sign bit so that negative values sort before positive ones
+    if(std::is_signed<V>::value) u ^= U(1) << (sizeof(V) * 8 - 1);
+
+    size_t pos = key.size();
+    key.resize(pos + sizeof(V));
+    write_integer(key.data() + pos, u, sizeof(V));
+  }
+};
+
+template <typename V>
+struct IndexValueTraits<V, typename std::enable_if<std::is_floating_point<V>::value>::type>
+{
+  static void encode(std::vector<byte_t> &key, V val) {
+    using U = typename std::conditional<sizeof(V) == 4, uint32_t, uint64_t>::type;
+    //-0.0 equals 0.0 and must have the same key
+    if(val == 0) val = 0;
+    U u;
+    memcpy(&u, &val, sizeof(V));
+    //negative values: invert all bits, positive values: set the sign bit
+    const U sign = U(1) << (sizeof(V) * 8 - 1);
+    u = (u & sign) ? ~u : (u | sign);
+
+    size_t pos = key.size();
+    key.resize(pos + sizeof(V));
+    write_integer(key.data() + pos, u, sizeof(V));
+  }
+};
+
+template <>
+struct IndexValueTraits<bool>
+{
+  static void encode(std::vector<byte_t> &key, bool val) {
+    key.push_back(val ? 1 : 0);
+  }
+};
+
+template <>
+struct IndexValueTraits<const char *>
+{
+  static void encode(std::vector<byte_t> &key, const char *val) {
+    //include the terminating 0, so that prefixes sort first
+    key.insert(key.end(), (const byte_t *)val, (const byte_t *)val + strlen(val) + 1);
+  }
+};
+
+template <>
+struct IndexValueTraits<std::string>
+{
+  static void encode(std::vector<byte_t> &key, const std::string &val) {
+    IndexValueTraits<const char *>::encode(key, val.c_str());
+  }
+};
+
+/**
+ * key of a secondary index entry: declaring class id, property id, encoded value and the key of the indexed object.
+ * All numbers are written big-endian, so that entries sort by property, then value, then object
+ */
+class IndexKey
+{
+  std::vector<byte_t> m_data;
+
+public:
+  IndexKey() {}
+  IndexKey(ClassId classId, PropertyId propertyId) {
+    m_data.resize(ClassId_sz + PropertyId_sz);
+    write_integer(m_data.data(), classId, ClassId_sz);
+    write_integer(m_data.data() + ClassId_sz, propertyId, PropertyId_sz);
+  }
+
+  template <typename V> IndexKey &value(const V &val) {
+    IndexValueTraits<V>::encode(m_data, val);
+    return *this;
+  }
+
+  IndexKey &object(ClassId classId, ObjectId objectId) {
+    size_t pos = m_data.size();
+    m_data.resize(pos + ObjectKey_sz);
+    write_integer(m_data.data() + pos, classId, ClassId_sz);
+    write_integer(m_data.data() + pos + ClassId_sz, objectId, ObjectId_sz);
+    return *this;
+  }
+
+  /**
+   * append the largest possible object key. Used as the upper bound of value ranges
+   */
+  IndexKey &maxObject() {
+    m_data.resize(m_data.size() + ObjectKey_sz, 0xFF);
+    return *this;
+  }
+
+  /**
+   * read the object key from the tail of an encoded index key
+   */
+  static void readObject(const byte_t *data, size_t size, ClassId &classId, ObjectId &objectId) {
+    classId = read_integer<ClassId>(data + size - ObjectKey_sz, ClassId_sz);
+    objectId = read_integer<ObjectId>(data + size - ObjectId_sz, ObjectId_sz);
+  }
+
+  const byte_t *data() const {return m_data.data();}
+  size_t size() const {return m_data.size();}
+  bool empty() const {return m_data.empty();}
+  void clear() {m_data.clear();}
+
+  bool operator ==(const IndexKey &other) const {return m_data == other.m_data;}
+  bool operator !=(const IndexKey &other) const {return m_data != other.m_data;}
+};
+
+/**
+ * axis-aligned 2D bounding box, used by spatial indexes
+ */
+struct BoundingBox
+{
+  double minX = 0, minY = 0, maxX = 0, maxY = 0;
+
+  BoundingBox() {}
+  BoundingBox(double minX, double minY, double maxX, double maxY) : minX(minX), minY(minY), maxX(maxX), maxY(maxY) {}
+
+  bool intersects(const BoundingBox &other) const {
+    return minX <= other.maxX && other.minX <= maxX && minY <= other.maxY && other.minY <= maxY;
+  }
+  bool contains(const BoundingBox &other) const {
+    return minX <= other.minX && other.maxX <= maxX && minY <= other.minY && other.maxY <= maxY;
+  }
+  double area() const {
+    return (maxX - minX) * (maxY - minY);
+  }
+  BoundingBox united(const BoundingBox &other) const {
+    return BoundingBox(std::min(minX, other.minX), std::min(minY, other.minY),
+                       std::max(maxX, other.maxX), std::max(maxY, other.maxY));
+  }
+  bool operator ==(const BoundingBox &other) const {
+    return minX == other.minX && minY == other.minY && maxX == other.maxX && maxY == other.maxY;
+  }
+  bool operator !=(const BoundingBox &other) const {return !(*this == other);}
+};
+static const size_t BoundingBox_sz = 4 * sizeof(double);
+
+using SpatialNodeId = uint32_t;
+
+/**
+ * R-tree node of a spatial index. Entries of leaf nodes (level 0) reference objects, entries of inner nodes
+ * reference child nodes
+ */
+struct SpatialNode
+{
+  struct Entry {
+    BoundingBox box;
+    uint64_t ref;
+  };
+
+  SpatialNodeId id = 0;
+  unsigned level = 0;
+  std::vector<Entry> entries;
+
+  BoundingBox bounds() const {
+    BoundingBox box = entries.empty() ? BoundingBox() : entries[0].box;
+    for(size_t i=1; i<entries.size(); i++) box = box.united(entries[i].box);
+    return box;
+  }
+};
+
 /**
  * data used internally during update/delete preparation
  */
@@ -673,14 +1147,46 @@ public:
     ClassId prepareCid = 0;
     ObjectId prepareOid = 0;
 
-    inline void reset() {updatePrepared = false; prepareCid = 0; prepareOid = 0;}
+    //index key recorded for the pre-update value of an indexed property
+    IndexKey prepareIndexKey;
+
+    //bounding box recorded for the pre-update state of a spatially indexed object (if updatePrepared)
+    BoundingBox prepareBox;
+
+    //pre-update value of an aggregated property (if updatePrepared)
+    double prepareValue = 0;
+
+    inline void reset() {updatePrepared = false; prepareCid = 0; prepareOid = 0; prepareIndexKey.clear();}
   };
 
 private:
-  std::unordered_map<unsigned, Entry> m_entries;
+  using Entries = std::unordered_map<unsigned, Entry, std::hash<unsigned>, std::equal_to<unsigned>,
+      ArenaAllocator<std::pair<const unsigned, Entry>>>;
+  Entries m_entries;
 
 public:
+  /**
+   * @param arena the arena which holds the entries. Must outlive this object
+   */
+  PrepareData(Arena &arena) : m_entries(0, std::hash<unsigned>(), std::equal_to<unsigned>(),
+                                        ArenaAllocator<std::pair<const unsigned, Entry>>(arena)) {}
+
+  //the top-level object being saved. Index entries are only maintained for this object, not for embedded children
+  ClassId indexClassId = 0;
+  ObjectId indexObjectId = 0;
+
+  //whether the top-level object is an existing object whose class has change tracking turned on
+  bool trackChanges = false;
+
   Entry &entry(unsigned key) {return m_entries[key];}
+
+  bool indexes(ClassId classId, ObjectId objectId) const {
+    return indexObjectId && classId == indexClassId && objectId == indexObjectId;
+  }
+
+  bool tracksChanges(ClassId classId, ObjectId objectId) const {
+    return trackChanges && indexes(classId, objectId);
+  }
 };
 
 /**
@@ -692,6 +1198,8 @@ protected:
   const bool makeCopy = false;
   bool dataChecked = false;
   size_t markOffs = 0;
+  //mark() was called before the data was loaded. The mark is set when loading
+  bool markPending = false;
   ReadBuf readBuf;
   virtual void checkData() {}
 
@@ -743,11 +1251,18 @@ public:
     return readBuf;
   }
 
-  void mark() {readBuf.mark();}
+  void mark() {
+    if(readBuf.null())
+      markPending = true;
+    else
+      readBuf.mark();
+  }
 
   void unmark(size_t offs) {
-    if(readBuf.null())
-      markOffs = offs;
+    if(readBuf.null()) {
+      markOffs += offs;
+      markPending = false;
+    }
     else
       readBuf.unmark(offs);
   }
@@ -767,11 +1282,24 @@ public:
   LazyBuf(Transaction * txn, const ObjectKey &key, bool makeCopy) : ObjectBuf(key, makeCopy), m_txn(txn) {}
 };
 
+/**
+ * an entry in the referrer index: an object holding a reference, and the property through which it is held
+ */
+struct Referrer
+{
+  ObjectKey key;
+  PropertyId propertyId = 0;
+
+  Referrer() {}
+  Referrer(ClassId classId, ObjectId objectId, PropertyId propertyId) : key(classId, objectId), propertyId(propertyId) {}
+};
+
 /**
  * Helper interface used by cursor, to be extended by implementors
  */
 class CursorHelper {
   template <typename T> friend class ClassCursor;
+  friend class Transaction;
 
 protected:
   ClassId m_currentClassId = 0;
@@ -798,6 +1326,11 @@ protected:
    */
   virtual bool erase() = 0;
 
+  /**
+   * @return whether erase() is supported. Checked before any data is changed
+   */
+  virtual bool erasable() {return true;}
+
   /**
    * @return the objectId of the item at the current cursor position
    */
@@ -824,46 +1357,301 @@ protected:
   virtual void getObjectData(ObjectBuf &buf) = 0;
 };
 
-struct ChunkInfo {
-  PropertyId chunkId = 0;
-  size_t startIndex = 0;
-  size_t elementCount = 0;
-  size_t dataSize = 0;
-
-  ChunkInfo() {}
-  ChunkInfo(PropertyId chunkId, size_t startIndex, size_t elementCount=0, size_t dataSize=0)
-      : chunkId(chunkId), startIndex(startIndex), elementCount(elementCount), dataSize(dataSize) {}
-  ChunkInfo(PropertyId chunkId) : chunkId(chunkId) {}
+/**
+ * comparison operators for object filters
+ */
+enum class FilterOp {eq, ne, lt, le, gt, ge};
 
-  bool operator == (const ChunkInfo &other) {
-    return chunkId == other.chunkId;
-  }
-  bool operator <= (const ChunkInfo &other) {
-    return chunkId <= other.chunkId;
-  }
+/**
+ * filter expression over the embedded scalar or string properties of a class. Filters are evaluated against the raw
+ * object buffer before an object is instantiated, so that only matching objects are materialized. Filters are
+ * obtained through where() and combined through && and ||. See Transaction::openCursor(const ObjectFilter &)
+ */
+class ObjectFilter
+{
+public:
+  /**
+   * comparison of one property value against a constant
+   */
+  struct Term {
+    const PropertyAccessBase * const pa;
+    const FilterOp op;
+
+    Term(const PropertyAccessBase *pa, FilterOp op) : pa(pa), op(op) {}
+    virtual ~Term() {}
+
+    /**
+     * @param buf the object buffer, positioned at the start of the property value
+     */
+    virtual bool test(ReadBuf &buf) const = 0;
+
+    /**
+     * @param cmp the result of comparing the property value with the constant (<0, 0, >0)
+     */
+    bool matches(int cmp) const {
+      switch(op) {
+        case FilterOp::eq: return cmp == 0;
+        case FilterOp::ne: return cmp != 0;
+        case FilterOp::lt: return cmp < 0;
+        case FilterOp::le: return cmp <= 0;
+        case FilterOp::gt: return cmp > 0;
+        case FilterOp::ge: return cmp >= 0;
+      }
+      return false;
+    }
+  };
+
+private:
+  //position of a term's property inside the object buffer of one class. If the property is preceded by variable-size
+  //properties only the property index is known, and the buffer must be walked
+  struct Location {
+    bool fixed;
+    size_t offset;
+    unsigned propertyIndex;
+  };
+
+  //the expression in postfix order. Values >= 0 refer to terms, the others are operators
+  static const int AND = -1, OR = -2;
+
+  std::vector<std::shared_ptr<const Term>> m_terms;
+  std::vector<int> m_program;
+
+  //compiled per ClassId on first use
+  std::unordered_map<ClassId, std::vector<Location>> m_plans;
+  std::vector<bool> m_stack;
+
+  const std::vector<Location> &plan(StoreId storeId, ClassId classId, Properties *props);
+
+  ObjectFilter combine(const ObjectFilter &other, int op) const;
+
+public:
+  ObjectFilter(std::shared_ptr<const Term> term) {
+    m_terms.push_back(term);
+    m_program.push_back(0);
+  }
+
+  ObjectFilter operator &&(const ObjectFilter &other) const {return combine(other, AND);}
+  ObjectFilter operator ||(const ObjectFilter &other) const {return combine(other, OR);}
+
+  /**
+   * evaluate the filter against a raw object buffer
+   *
+   * @param classId the actual class of the object
+   * @param props the properties of that class
+   * @param buf the object buffer
+   */
+  bool matches(StoreId storeId, ClassId classId, Properties *props, ReadBuf &buf);
+};
+
+/**
+ * filter term for embedded scalar values
+ */
+template <typename V>
+struct ValueFilterTerm : public ObjectFilter::Term
+{
+  const V value;
+
+  ValueFilterTerm(const PropertyAccessBase *pa, FilterOp op, V value) : Term(pa, op), value(value) {}
+
+  bool test(ReadBuf &buf) const override {
+    V val;
+    ValueTraits<V>::getBytes(buf, val);
+    return matches(val < value ? -1 : value < val ? 1 : 0);
+  }
+};
+
+/**
+ * filter term for embedded strings. The value is compared in place
+ */
+template <>
+struct ValueFilterTerm<std::string> : public ObjectFilter::Term
+{
+  const std::string value;
+
+  ValueFilterTerm(const PropertyAccessBase *pa, FilterOp op, std::string value) : Term(pa, op), value(value) {}
+
+  bool test(ReadBuf &buf) const override {
+    return matches(strcmp((const char *)buf.read(0), value.c_str()));
+  }
+};
+
+/**
+ * @param pa an embedded scalar or string property, obtainable through the PROPERTY macro
+ * @param op the comparison operator
+ * @param value the value the property is compared against
+ * @return a filter that matches all objects whose property value compares to value as requested
+ * @throw error if the property is not stored in the object buffer or the value type does not match the property type
+ */
+template <typename V> ObjectFilter where(const PropertyAccessBase *pa, FilterOp op, V value)
+{
+  if(pa->storeinfo->layout != StoreLayout::all_embedded || pa->type.isVector)
+    throw error("filter property must be an embedded value");
+  if(pa->type.id != TypeTraits<V>::id) throw error("filter value type mismatch");
+
+  return ObjectFilter(std::make_shared<ValueFilterTerm<V>>(pa, op, value));
+}
+
+inline ObjectFilter where(const PropertyAccessBase *pa, FilterOp op, const char *value)
+{
+  return where<std::string>(pa, op, value);
+}
+
+/**
+ * timestamp type used by time series collections. The unit is up to the application
+ */
+using Timestamp = int64_t;
+
+/**
+ * summary statistics (zone map) over the elements of a chunk of numeric values. Used by range scans to skip
+ * chunks. min and max hold the raw bytes of the element type. Chunks of time series collections additionally
+ * record the time range of their samples
+ */
+struct ChunkStats {
+  bool valid = false;
+  uint64_t min = 0, max = 0;
+  double sum = 0;
+
+  bool timed = false;
+  Timestamp firstTime = 0, lastTime = 0;
+
+  template <typename T> T minValue() const {T val; memcpy(&val, &min, sizeof(T)); return val;}
+  template <typename T> T maxValue() const {T val; memcpy(&val, &max, sizeof(T)); return val;}
+};
+
+/**
+ * read the optional statistics that follow the fixed fields of a saved chunk info
+ */
+void readChunkStats(ReadBuf &buf, ChunkStats &stats);
+
+/**
+ * accumulates ChunkStats while a chunk is written. Statistics are only maintained for arithmetic types
+ */
+template <typename T, bool = std::is_arithmetic<T>::value && sizeof(T) <= sizeof(uint64_t)>
+struct ChunkStatsBuilder
+{
+  void add(T val) {}
+  void add(const T *data, size_t count) {}
+  void store(ChunkStats &stats) {stats.valid = false;}
+};
+
+template <typename T>
+struct ChunkStatsBuilder<T, true>
+{
+  T min, max;
+  double sum = 0;
+  size_t count = 0;
+
+  void add(T val) {
+    if(!count++)
+      min = max = val;
+    else if(val < min)
+      min = val;
+    else if(val > max)
+      max = val;
+    sum += val;
+  }
+  void add(const T *data, size_t count) {
+    for(size_t i=0; i<count; i++) add(data[i]);
+  }
+
+  /**
+   * save the statistics gathered so far and start over
+   */
+  void store(ChunkStats &stats) {
+    stats.valid = count > 0;
+    stats.min = stats.max = 0;
+    if(stats.valid) {
+      memcpy(&stats.min, &min, sizeof(T));
+      memcpy(&stats.max, &max, sizeof(T));
+    }
+    stats.sum = sum;
+    count = 0;
+    sum = 0;
+  }
+};
+
+struct ChunkInfo {
+  ChunkId chunkId = 0;
+  size_t startIndex = 0;
+  size_t elementCount = 0;
+  size_t dataSize = 0;
+
+  //number of elements marked as deleted. These still occupy their positions until the chunk is compacted
+  size_t deletedCount = 0;
+
+  //optional statistics, maintained for numeric value and data collections. For time series collections, min and
+  //max hold the first and last timestamp
+  ChunkStats stats;
+
+  ChunkInfo() {}
+  ChunkInfo(ChunkId chunkId, size_t startIndex, size_t elementCount=0, size_t dataSize=0)
+      : chunkId(chunkId), startIndex(startIndex), elementCount(elementCount), dataSize(dataSize) {}
+  ChunkInfo(ChunkId chunkId) : chunkId(chunkId) {}
+
+  bool operator == (const ChunkInfo &other) {
+    return chunkId == other.chunkId;
+  }
+  bool operator <= (const ChunkInfo &other) {
+    return chunkId <= other.chunkId;
+  }
 };
 class CollectionAppenderBase;
-struct CollectionInfo
+
+/**
+ * kind of elements held by a top-level collection. Collection infos saved by earlier versions don't record
+ * the kind and are treated as object collections
+ */
+enum class CollectionKind : byte_t {unknown=0, objects=1, values=2, data=3, timeSeries=4};
+
+/**
+ * chunk layout of a top-level collection as of a given snapshot. Instances parsed by read transactions are shared
+ * through the store's collection info cache and must not be modified
+ */
+struct CollectionChunks
 {
   //unique collection id
   ObjectId collectionId = 0;
 
-  //appenders that will be automatically closed on commit
-  std::set<CollectionAppenderBase *> appenders;
-
   //collection chunks
   std::vector <ChunkInfo> chunkInfos;
 
-  PropertyId nextChunkId = 1;
+  ChunkId nextChunkId = 1;
   size_t nextStartIndex = 0;
 
+  //running total of elements in all chunks
+  size_t elementCount = 0;
+
+  CollectionKind kind = CollectionKind::unknown;
+
+  CollectionChunks() {}
+  CollectionChunks(ObjectId collectionId) : collectionId(collectionId) {}
+
+  size_t count() const {
+    return elementCount;
+  }
+};
+
+/**
+ * collection info as modified by a write transaction. Private to the transaction
+ */
+struct CollectionInfo : public CollectionChunks
+{
+  //appenders that will be automatically closed on commit
+  std::set<CollectionAppenderBase *> appenders;
+
+  //chunks added, changed or removed since the info was last saved
+  std::set<ChunkId> modifiedChunks;
+
   CollectionInfo() {}
-  CollectionInfo(ObjectId collectionId) : collectionId(collectionId) {}
+  CollectionInfo(ObjectId collectionId) : CollectionChunks(collectionId) {}
+  CollectionInfo(const CollectionChunks &chunks) : CollectionChunks(chunks) {}
+
+  void setKind(CollectionKind k) {
+    if(kind == CollectionKind::unknown) kind = k;
 
-  size_t count() {
-    size_t cnt = 0;
-    for(ChunkInfo &ci : chunkInfos) cnt += ci.elementCount;
-    return cnt;
+    //values and raw data of the same type share the layout, time series chunks carry time ranges
+    else if(kind != k && (kind == CollectionKind::timeSeries || k == CollectionKind::timeSeries))
+      throw error("collection kind mismatch");
   }
 };
 
@@ -876,9 +1664,10 @@ public:
   using Ptr = std::shared_ptr<ChunkCursor>;
 
   bool atEnd() const {return m_atEnd;}
-  virtual bool next(PropertyId *chunkId = nullptr) = 0;
+  virtual ChunkId chunkId() = 0;
+  virtual bool next(ChunkId *chunkId = nullptr) = 0;
   virtual void get(ReadBuf &rb) = 0;
-  virtual bool seek(PropertyId chunkId) = 0;
+  virtual bool seek(ChunkId chunkId) = 0;
   virtual void close() = 0;
 };
 
@@ -891,16 +1680,25 @@ protected:
   ChunkCursor::Ptr m_chunkCursor;
   Transaction * const m_tr;
   const StoreId m_storeId;
-  CollectionInfo * const m_collectionInfo;
+  const CollectionChunks * const m_collectionInfo;
 
   ReadBuf m_readBuf;
-  PropertyId m_chunkId;
+  ChunkId m_chunkId = 0;
   size_t m_dataSize = 0, m_startIndex = 0, m_elementCount = 0, m_curElement = 0;
 
+  //element offset index for the current chunk, if available
+  ReadBuf m_chunkIndex;
+  ChunkId m_chunkIndexId = 0;
+
   bool next();
 
   void objectBufSeek(size_t position);
 
+  /**
+   * mark the element at the previous cursor position (i.e., last read) as deleted. Object collections only
+   */
+  bool eraseCurrent(WriteTransaction *tr);
+
   /**
    * @return true if the current entry is valid, e.g. not marked for delete
    */
@@ -945,12 +1743,15 @@ class ObjectCollectionCursor : public CollectionCursorBase
 protected:
   bool isValid() override
   {
-    if(!read_integer<byte_t>(m_readBuf.data() + ObjectHeader_sz - 1, 1)) { //check deleted flag
-      ClassId cid = read_integer<ClassId>(m_readBuf.cur(), ClassId_sz);
+    const byte_t *hdr = m_readBuf.cur();
+    if(!read_integer<byte_t>(hdr + ObjectHeader_sz - 1, 1)) { //check deleted flag
+      ClassId cid = read_integer<ClassId>(hdr, ClassId_sz);
       m_curClassInfo = FIND_CLS(T, m_storeId, cid);
 
-      return m_curClassInfo != nullptr || ClassTraits<T>::traits_info->substitute != nullptr;
+      if(m_curClassInfo != nullptr || ClassTraits<T>::traits_info->substitute != nullptr) return true;
     }
+    //skip the element
+    m_readBuf.read(read_integer<size_t>(hdr + ClassId_sz + ObjectId_sz, 4));
     return false;
   }
 
@@ -966,6 +1767,16 @@ public:
     objectBufSeek(position);
   }
 
+  /**
+   * mark the element last returned by #get as deleted
+   *
+   * @param tr the write transaction this cursor was opened in
+   * @return true if the element was deleted
+   */
+  bool erase(WriteTransactionPtr tr) {
+    return eraseCurrent(tr.get());
+  }
+
   /**
    * @return the next object read from the buffer, or nullptr if the end was reached
    */
@@ -1004,7 +1815,12 @@ public:
   {}
 
   void bufSeek(size_t position) {
-    if(position > m_curElement) {
+    if(TypeTraits<T>::byteSize) {
+      //fixed-size elements, compute the offset
+      m_readBuf.reset();
+      m_readBuf.read(ChunkHeader_sz + position * TypeTraits<T>::byteSize);
+    }
+    else if(position > m_curElement) {
       for(size_t pos=0, epos=position-m_curElement; pos < epos; pos++) {
         T val;
         ValueTraits<T>::getBytes(m_readBuf, val);
@@ -1041,6 +1857,8 @@ public:
 template <typename T>
 class ClassCursor
 {
+  friend class WriteTransaction;
+
   ClassCursor(ClassCursor<T> &other) = delete;
 
   CursorHelper * const m_helper;
@@ -1049,10 +1867,32 @@ class ClassCursor
   Transaction * const m_tr;
   bool m_hasData;
   ClassInfo<T> *m_classInfo;
+  std::shared_ptr<ObjectFilter> m_filter;
+
+  //raw data at the current position
+  void getData(ObjectKey &key, ReadBuf &readBuf) {
+    m_helper->get(key, readBuf);
+  }
 
   bool validateClass() {
     m_classInfo = FIND_CLS(T, m_store.id, m_helper->currentClassId());
-    return m_classInfo != nullptr || ClassTraits<T>::traits_info->substitute != nullptr;
+    if(!m_classInfo && !ClassTraits<T>::traits_info->substitute) return false;
+    return !m_filter || matchFilter();
+  }
+
+  /**
+   * evaluate the filter against the raw data at the current position. Objects of unknown classes never match
+   */
+  bool matchFilter() {
+    if(!m_classInfo) return false;
+
+    ObjectKey key;
+    ReadBuf readBuf;
+    m_helper->get(key, readBuf);
+    if(readBuf.null()) return false;
+
+    Properties *props = ClassTraits<T>::getProperties(m_store.id, key.classId);
+    return props && m_filter->matches(m_store.id, key.classId, props, readBuf);
   }
 
   T *makeObject(ObjectKey &key, ReadBuf &readBuf)
@@ -1072,19 +1912,10 @@ class ClassCursor
 public:
   using Ptr = std::shared_ptr<ClassCursor<T>>;
 
-  ClassCursor(CursorHelper *helper, KeyValueStore &store, Transaction *tr)
-      : m_helper(helper), m_store(store), m_tr(tr), m_useCache(store.isCache<T>())
-  {
-    bool hasData = helper->start();
-    bool clsFound = validateClass();
-
-    while(hasData && !clsFound) {
-      hasData = helper->next();
-      clsFound = hasData && validateClass();
-    }
-    m_hasData = hasData && clsFound;
-    if(!m_hasData) close();
-  }
+  /**
+   * @param filter if set, only objects matching the filter are visited
+   */
+  ClassCursor(CursorHelper *helper, KeyValueStore &store, Transaction *tr, const ObjectFilter *filter=nullptr);
 
   virtual ~ClassCursor() {
     delete m_helper;
@@ -1095,51 +1926,7 @@ public:
    * 
    * @return true if the cursor has not reached the end
    */
-  bool erase(WriteTransactionPtr tr)
-  {
-    ObjectKey key;
-
-    ReadBuf readBuf;
-    m_helper->get(key, readBuf);
-    if(readBuf.null()) return m_hasData;
-    if(key.refcount > 1) throw error("removeObject: refcount > 1");
-
-    using Traits = ClassTraits<T>;
-
-    if(Traits::needsPrepare(m_store.id, key.classId)) {
-      Properties *props = Traits::getProperties(m_store.id, key.classId);
-      ObjectBuf obuf(readBuf.data(), readBuf.size());
-
-      for(unsigned px=0, sz=props->full_size(); px < sz; px++) {
-        const PropertyAccessBase *pa = props->get(px);
-
-        if(!pa->enabled) continue;
-
-        obuf.mark();
-        size_t psz = pa->storeinfo->size(m_store.id, obuf);
-        ClassTraits<T>::prepareDelete(m_store.id, tr.get(), obuf, pa);
-        obuf.unmark(psz);
-      }
-    }
-
-    //now remove the object proper
-    if(m_useCache) m_store.removeCached<T>(key.classId, key.objectId);
-
-    if(m_helper->erase()) {
-      bool hasData=true, clsFound;
-      do {
-        clsFound = hasData && validateClass();
-        hasData = m_helper->next();
-      } while(hasData && !clsFound);
-
-      m_hasData = hasData && clsFound;
-      return true;
-    }
-    else m_hasData = false;
-
-    if(!m_hasData) close();
-    return m_hasData;
-  }
+  bool erase(WriteTransactionPtr tr);
 
   /**
    * retrieve the address of the value of the given object property at the current cursor position. Note that
@@ -1192,7 +1979,8 @@ public:
   }
 
   /**
-   * @return a persistent pointer to the object at the current cursor position. Object caching is honored
+   * @return a persistent pointer to the object at the current cursor position. The object is private to the caller,
+   * object caching is ignored
    */
   std::shared_ptr<T> get()
   {
@@ -1202,13 +1990,15 @@ public:
 
     if(readBuf.null()) return std::shared_ptr<T>();
 
-    if(m_useCache) {
-      std::shared_ptr<T> &cached = m_store.getCached<T>(handler.classId, handler.objectId);
-      return cached ? cached : m_store.putCache(makeObject(handler, readBuf), handler);
-    }
     return std::shared_ptr<T>(makeObject(handler, readBuf), handler);
   }
 
+  /**
+   * @return an immutable pointer to the object at the current cursor position. Object caching is honored, see
+   * Transaction::getSharedObject
+   */
+  std::shared_ptr<const T> getShared();
+
   bool next() {
     bool hasData, clsFound;
     do {
@@ -1250,12 +2040,102 @@ public:
   V *data() {return m_data;}
 };
 
+/**
+ * contiguous run of raw elements inside one chunk of a top-level data collection. The data points into store-owned
+ * memory and remains valid until the transaction ends
+ */
+template <typename V> struct DataSpan
+{
+  const V *data;
+  size_t count;
+
+  DataSpan(const V *data, size_t count) : data(data), count(count) {}
+
+  const V *begin() const {return data;}
+  const V *end() const {return data + count;}
+};
+
+/**
+ * element of a time series collection. Samples are stored in native layout, the raw data API restrictions apply
+ * to the value type
+ */
+template <typename T> struct TimeSample
+{
+  Timestamp time;
+  T value;
+};
+
+/**
+ * result of a segmented collection load. The elements are held in one segment per collection chunk, in collection
+ * order, which saves the final copy into one contiguous vector
+ */
+template <typename V> class CollectionSegments
+{
+  std::vector<std::vector<V>> m_segments;
+
+  //element count up to and including each segment
+  std::vector<size_t> m_ends;
+
+public:
+  CollectionSegments(std::vector<std::vector<V>> &&segments) : m_segments(std::move(segments))
+  {
+    size_t end = 0;
+    for(auto &segment : m_segments) {
+      end += segment.size();
+      m_ends.push_back(end);
+    }
+  }
+
+  size_t size() const {return m_ends.empty() ? 0 : m_ends.back();}
+  bool empty() const {return size() == 0;}
+
+  std::vector<std::vector<V>> &segments() {return m_segments;}
+
+  /**
+   * positional access. Locates the segment by binary search
+   */
+  V &operator[](size_t index)
+  {
+    size_t seg = std::upper_bound(m_ends.begin(), m_ends.end(), index) - m_ends.begin();
+    return m_segments[seg][seg ? index - m_ends[seg-1] : index];
+  }
+
+  /**
+   * call f for each element, in collection order
+   */
+  template <typename F> void forEach(F f)
+  {
+    for(auto &segment : m_segments)
+      for(auto &v : segment) f(v);
+  }
+
+  /**
+   * move all elements into one contiguous vector. This object is empty afterwards
+   */
+  std::vector<V> flatten()
+  {
+    std::vector<V> result;
+    if(m_segments.size() == 1)
+      result.swap(m_segments[0]);
+    else {
+      result.reserve(size());
+      for(auto &segment : m_segments)
+        result.insert(result.end(), std::make_move_iterator(segment.begin()), std::make_move_iterator(segment.end()));
+    }
+    m_segments.clear();
+    m_ends.clear();
+    return result;
+  }
+};
+
 /**
  * Transaction that allows read operations only. Read transactions can be run concurrently
  */
 class Transaction
 {
   template<typename T, typename V> friend struct ValueEmbeddedStorage;
+  template<typename T, typename V> friend struct ValueIndexedStorage;
+  template<typename T> friend struct SpatialIndexStorage;
   template<typename T, typename V> friend struct ValueKeyedStorage;
   template<typename T, typename V> friend struct ObjectPropertyStorage;
   template<typename T, typename V> friend struct ObjectPropertyStorageEmbedded;
@@ -1271,13 +2151,19 @@ class Transaction
   template<typename T> friend struct ObjectIdStorage;
   template <typename T> friend class ObjectCollectionCursor;
   template <typename T> friend class ClassCursor;
+  template <typename T> friend class TimeSeriesCursor;
   friend class CollectionAppenderBase;
   friend class ObjectBuf;
+  friend class KeyListCursorHelper;
 
-  CollectionInfo *readCollectionInfo(ReadBuf &readBuf);
+  bool readCollectionInfo(ObjectId collectionId, CollectionChunks &info);
 
 protected:
-  std::unordered_map<ObjectId, CollectionInfo *> m_collectionInfos;
+  //collection infos modified by this transaction. Deleted collections are kept as null entries
+  std::unordered_map<ObjectId, std::shared_ptr<CollectionInfo>> m_collectionInfos;
+
+  //cached collection chunk layouts shared with other read transactions
+  std::unordered_map<ObjectId, std::shared_ptr<const CollectionChunks>> m_sharedCollections;
 
   KeyValueStore &store;
   bool m_blockWrites;
@@ -1312,14 +2198,15 @@ protected:
    * load an object from the KV store polymorphically + refcounting (if configured)
    *
    * @param handler the object handler, which contains the key
-   * @param reload bypass possibly configured cache and reload the object
+   * @param shared if true, the object may be taken from or put into a configured cache, and must therefore not be
+   * modified. Otherwise, a private object is loaded
    * @return the object pointer, or nullptr if the key is not defined.
    */
-  template<typename T> std::shared_ptr<T> loadObject(object_handler<T> &handler, bool reload=false)
+  template<typename T> std::shared_ptr<T> loadObject(object_handler<T> &handler, bool shared=false)
   {
-    bool doCache = store.isCache<T>();
-    if(doCache && !reload) {
-      std::shared_ptr<T> &cached = store.getCached<T>(handler.classId, handler.objectId);
+    bool doCache = shared && store.isCache<T>() && readOnly();
+    if(doCache) {
+      std::shared_ptr<T> cached = store.getCached<T>(handler.classId, handler.objectId, txnId());
       if(cached) return cached;
     }
 
@@ -1331,7 +2218,7 @@ protected:
     T *obj = ClassTraits<T>::makeObject(store.id, handler.classId);
     readObject<T>(store.id, this, readBuf, handler.classId, handler.objectId, obj);
 
-    return doCache ? store.putCache(obj, handler) : std::shared_ptr<T>(obj, handler);
+    return doCache ? store.putCache(obj, handler, txnId()) : std::shared_ptr<T>(obj, handler);
   }
 
   /**
@@ -1356,55 +2243,187 @@ protected:
   }
 
   /**
-   * completely load the contents of a chunked collection
+   * decode the chunks of a top-level collection into one segment per chunk. The chunk buffers are collected on the
+   * calling thread, then handed out to up to threads decoders, the calling thread included
+   *
+   * @param collectionId the collection
+   * @param threads the number of threads. 0 means use the hardware concurrency
+   * @param decode called as decode(ReadBuf &chunk, std::vector<V> &segment, bool shared). If shared is true, decode
+   * runs concurrently with other threads and must not access the transaction. In this case it may refuse by
+   * returning false, and the chunk will be decoded on the calling thread after all workers have finished
    */
-  template <typename T, template <typename> class Ptr=std::shared_ptr> std::vector<Ptr<T>> loadChunkedCollection(
-      CollectionInfo *ci)
+  template <typename V, typename Decode>
+  std::vector<std::vector<V>> decodeChunks(ObjectId collectionId, unsigned threads, Decode decode)
   {
-    std::vector<Ptr<T>> result;
-    for(ChunkCursor::Ptr cc= _openChunkCursor(COLLECTION_CLSID, ci->collectionId); !cc->atEnd(); cc->next()) {
+    std::vector<std::pair<byte_t *, size_t>> chunks;
+    for(ChunkCursor::Ptr cc= _openChunkCursor(COLLECTION_CLSID, collectionId); !cc->atEnd(); cc->next()) {
       ReadBuf buf;
       cc->get(buf);
+      chunks.push_back(std::make_pair(buf.data(), buf.size()));
+    }
+    std::vector<std::vector<V>> segments(chunks.size());
 
-      size_t elementCount;
-      readChunkHeader(buf, 0, 0, &elementCount);
-
-      for(size_t i=0; i < elementCount; i++) {
-        ClassId cid;
-        ObjectId oid;
-        bool deleted;
-        readObjectHeader(buf, &cid, &oid, nullptr, &deleted);
-
-        if(!deleted) {
-          ClassInfo<T> *ti = FIND_CLS(T, store.id, cid);
-          if(!ti) {
-            T *sp = ClassTraits<T>::getSubstitute();
-            if(sp) {
-              readObject<T>(store.id, this, buf, *sp, cid, oid);
-              result.push_back(std::shared_ptr<T>(sp));
-            }
-          }
-          else {
-            T *obj = ti->makeObject(store.id, cid);
-            readObject<T>(store.id, this, buf, cid, oid, obj);
-            result.push_back(std::shared_ptr<T>(obj));
+    if(!threads) threads = std::max(std::thread::hardware_concurrency(), 1u);
+    if(threads > chunks.size()) threads = (unsigned)chunks.size();
+
+    if(threads <= 1) {
+      for(size_t i=0; i<chunks.size(); i++) {
+        ReadBuf buf(chunks[i].first, chunks[i].second);
+        decode(buf, segments[i], false);
+      }
+      return segments;
+    }
+
+    std::atomic<size_t> nextChunk(0);
+    std::vector<char> deferred(chunks.size(), 0);
+    std::exception_ptr failure;
+    std::mutex failureMutex;
+
+    auto work = [&]() {
+      try {
+        for(size_t i=nextChunk++; i < chunks.size(); i=nextChunk++) {
+          ReadBuf buf(chunks[i].first, chunks[i].second);
+          if(!decode(buf, segments[i], true)) {
+            segments[i].clear();
+            deferred[i] = 1;
           }
         }
       }
+      catch(...) {
+        std::lock_guard<std::mutex> lock(failureMutex);
+        if(!failure) failure = std::current_exception();
+        nextChunk = chunks.size();
+      }
+    };
+    kv::WorkerPool &pool = store.workerPool();
+    if(threads > pool.size() + 1) threads = pool.size() + 1;
+
+    std::vector<std::function<void()>> tasks(threads, work);
+    pool.run(tasks);
+
+    if(failure) std::rethrow_exception(failure);
+
+    for(size_t i=0; i<chunks.size(); i++) {
+      if(deferred[i]) {
+        ReadBuf buf(chunks[i].first, chunks[i].second);
+        decode(buf, segments[i], false);
+      }
     }
-    return result;
+    return segments;
   }
 
   /**
-   * read data by full property key into a buffer. Used internally by storage traits
+   * load the contents of a chunked collection into per-chunk segments. Chunks are decoded in parallel as long as
+   * the element classes can be loaded from the object buffer alone (see Properties::selfContained), and on the
+   * calling thread otherwise
    */
-  virtual void getData(ReadBuf &buf, ClassId classId, ObjectId objectId, PropertyId propertyId) = 0;
-
-  /**
+  template <typename T, template <typename> class Ptr=std::shared_ptr> CollectionSegments<Ptr<T>> loadChunkedSegments(
+      const CollectionChunks *ci, unsigned threads)
+  {
+    return CollectionSegments<Ptr<T>>(decodeChunks<Ptr<T>>(ci->collectionId, threads,
+      [this](ReadBuf &buf, std::vector<Ptr<T>> &segment, bool shared) -> bool
+      {
+        size_t elementCount;
+        readChunkHeader(buf, 0, 0, &elementCount);
+        segment.reserve(elementCount);
+
+        for(size_t i=0; i < elementCount; i++) {
+          ClassId cid;
+          ObjectId oid;
+          size_t size;
+          bool deleted;
+          readObjectHeader(buf, &cid, &oid, &size, &deleted);
+
+          if(deleted)
+            buf.read(size - ObjectHeader_sz);
+          else {
+            ClassInfo<T> *ti = FIND_CLS(T, store.id, cid);
+            if(!ti) {
+              if(shared && !ClassTraits<T>::traits_properties->selfContained) return false;
+
+              T *sp = ClassTraits<T>::getSubstitute();
+              if(sp) {
+                readObject<T>(store.id, this, buf, *sp, cid, oid);
+                segment.push_back(Ptr<T>(sp));
+              }
+            }
+            else {
+              if(shared) {
+                Properties *props = ClassTraits<T>::getProperties(store.id, cid);
+                if(!props || !props->selfContained) return false;
+              }
+              T *obj = ti->makeObject(store.id, cid);
+              readObject<T>(store.id, this, buf, cid, oid, obj);
+              segment.push_back(Ptr<T>(obj));
+            }
+          }
+        }
+        return true;
+      }));
+  }
+
+  /**
+   * completely load the contents of a chunked collection
+   *
+   * @param ci the collection info
+   * @param threads number of decoding threads, see #loadChunkedSegments
+   */
+  template <typename T, template <typename> class Ptr=std::shared_ptr> std::vector<Ptr<T>> loadChunkedCollection(
+      const CollectionChunks *ci, unsigned threads=1)
+  {
+    return loadChunkedSegments<T, Ptr>(ci, threads).flatten();
+  }
+
+  /**
+   * read data by full property key into a buffer. Used internally by storage traits
+   */
+  virtual void getData(ReadBuf &buf, ClassId classId, ObjectId objectId, PropertyId propertyId) = 0;
+
+  /**
    * read data by object key into a buffer. Used internally by storage traits
    */
   virtual void getData(ReadBuf &buf, ObjectKey &key, bool getRefount) = 0;
 
+  /**
+   * read data by chunk key into a buffer. Used internally by collections
+   */
+  virtual void getChunkData(ReadBuf &buf, ClassId classId, ObjectId objectId, ChunkId chunkId) = 0;
+
+  /**
+   * read a spatial index node into a buffer. Node 0 holds the index root
+   *
+   * @param classId the class that declares the spatially indexed property
+   * @param propertyId the spatially indexed property
+   */
+  virtual void getSpatialNode(ReadBuf &buf, ClassId classId, PropertyId propertyId, SpatialNodeId nodeId) = 0;
+
+  /**
+   * read the root and next free node id of a spatial index
+   *
+   * @return false if the index is empty
+   */
+  bool _loadSpatialRoot(ClassId classId, PropertyId propertyId, SpatialNodeId &rootId, SpatialNodeId &nextId);
+
+  /**
+   * read a spatial index node
+   */
+  void _loadSpatialNode(ClassId classId, PropertyId propertyId, SpatialNodeId nodeId, SpatialNode &node);
+
+  /**
+   * locate the leaf entry for the given object, descending into all nodes whose bounding box contains box
+   *
+   * @param path receives the nodes from the root down to the leaf
+   * @param pos receives the entry positions within the path nodes
+   * @return true if the entry was found
+   */
+  bool _findSpatialEntry(ClassId classId, PropertyId propertyId, SpatialNodeId nodeId, const BoundingBox &box,
+                         uint64_t ref, std::vector<SpatialNode> &path, std::vector<size_t> &pos);
+
+  /**
+   * collect the keys of all objects in a spatial index whose bounding box intersects box
+   */
+  void _searchSpatial(ClassId classId, PropertyId propertyId, const BoundingBox &box, std::vector<ObjectKey> &keys);
+
   /**
    * read scalar collection data
    *
@@ -1419,16 +2438,102 @@ protected:
    * @param owned (out) set to true if a buffer was allocated to store the data
    */
   virtual bool _getCollectionData(
-      CollectionInfo *info, size_t startIndex, size_t length, size_t elementSize, void **data, bool *owned) = 0;
+      const CollectionChunks *info, size_t startIndex, size_t length, size_t elementSize, void **data, bool *owned) = 0;
+
+  /**
+   * walk scalar collection data chunk by chunk, without copying
+   *
+   * @param info collection info
+   * @param startIndex start index of data to visit
+   * @param length number of elements to visit
+   * @param elementSize size of one element
+   * @param visitor called for every chunk-contiguous run of data with a pointer into store-owned memory and the
+   * number of elements. Returning false stops the walk
+   * @return the number of elements visited
+   */
+  size_t _visitCollectionData(const CollectionChunks *info, size_t startIndex, size_t length, size_t elementSize,
+                              std::function<bool(const byte_t *data, size_t count)> visitor);
+
+  /**
+   * locate the first sample at or after the given time in a time series collection. Chunks are located by
+   * binary search over the first and last timestamps saved with the chunk info, samples by binary search within
+   * the chunk
+   *
+   * @param info collection info
+   * @param time the time to seek to
+   * @param sampleSize the size of one sample
+   * @param chunkPos receives the position of the chunk within info->chunkInfos
+   * @param offset receives the position of the sample within the chunk
+   * @return false if there is no such sample
+   */
+  bool _seekTime(const CollectionChunks *info, Timestamp time, size_t sampleSize, size_t &chunkPos, size_t &offset);
 
   virtual CursorHelper * _openCursor(const std::vector<ClassId> &classIds) = 0;
   virtual CursorHelper * _openCursor(ClassId classId, ObjectId objectId, PropertyId propertyId) = 0;
   virtual CursorHelper * _openCursor(ClassId classId, ObjectId collectionId) = 0;
 
+  /**
+   * open a cursor over the objects referenced by the secondary index entries between lo and hi (inclusive)
+   */
+  virtual CursorHelper * _openIndexCursor(const IndexKey &lo, const IndexKey &hi) = 0;
+
+  /**
+   * open a cursor over the objects whose spatial index bounding box intersects box
+   */
+  CursorHelper * _openSpatialCursor(ClassId classId, PropertyId propertyId, const BoundingBox &box);
+
+  /**
+   * read all referrer index entries for the given target object
+   */
+  virtual void loadReferrers(const ObjectKey &target, std::vector<Referrer> &referrers) = 0;
+
+  /**
+   * open a cursor over the objects that hold a reference to the target object
+   */
+  CursorHelper * _openReferrersCursor(const ObjectKey &target);
+
+  /**
+   * make statistics changes that are pending in this transaction visible to reads. Only write transactions
+   * have any
+   */
+  virtual void syncStatistics() {}
+
+  /**
+   * @return the number of instances of exactly the given class. If no count was saved yet, the instances are counted
+   */
+  size_t _classCount(ClassId classId);
+
+  /**
+   * @return the aggregate over an aggregated property for instances of exactly the given class. If no aggregate was
+   * saved yet, it is computed from the objects
+   */
+  DataAggregate<double> _classAggregate(ClassId classId, const PropertyAccessBase *pa);
+
+  /**
+   * compute the aggregate over an aggregated property by reading all instances of exactly the given class
+   */
+  DataAggregate<double> _scanAggregate(ClassId classId, const PropertyAccessBase *pa);
+
+  /**
+   * count the instances of exactly the given class by walking over the objects
+   */
+  size_t _scanCount(ClassId classId);
+
   virtual void doReset() = 0;
   virtual void doRenew() = 0;
   virtual void doAbort() = 0;
 
+  /**
+   * @return the backend transaction id. For read transactions, this identifies the snapshot being read, for
+   * write transactions the snapshot that will be produced by the commit. Ids must increase with every commit
+   */
+  virtual TxnId txnId() = 0;
+
+  /**
+   * @return true if this transaction cannot write
+   */
+  virtual bool readOnly() = 0;
+
   virtual uint16_t decrementRefCount(ClassId cid, ObjectId oid) = 0;
 
   void _abort();
@@ -1463,6 +2568,15 @@ public:
    */
   CollectionInfo *getCollectionInfo(ObjectId &collectionId, bool create=true);
 
+  /**
+   * retrieve the chunk layout of a top-level collection for reading. Read transactions share the layout with other
+   * transactions on the same snapshot, write transactions see their own modifications. Only valid until the end
+   * of the transaction
+   *
+   * @return the collection chunks or nullptr
+   */
+  const CollectionChunks *getCollectionChunks(ObjectId collectionId);
+
   /**
    * load an object from the store using the key generated by a previous call to WriteTransaction::putObject().
    * Non-polymorphical, T must be the exact type of the object. The object is allocated on the heap.
@@ -1507,6 +2621,19 @@ public:
   {
     ObjectKey *key = ClassTraits<T>::getObjectKey(obj);
     object_handler<T> handler(*key);
+    return loadObject<T>(handler);
+  }
+
+  /**
+   * load an object from the store, using the key generated by a previous call to WriteTransaction::putObject()
+   * Non-polymorphical, T must be the exact type of the object. If caching is configured for T, the object is
+   * taken from or put into the object cache and may be shared with concurrent readers of the same snapshot
+   *
+   * @return an immutable shared pointer to the object, or an empty shared_ptr if the key does not exist
+   */
+  template<typename T> std::shared_ptr<const T> getSharedObject(ObjectId objectId)
+  {
+    object_handler<T> handler(ClassTraits<T>::traits_data(store.id).classId, objectId);
     return loadObject<T>(handler, true);
   }
 
@@ -1520,6 +2647,18 @@ public:
     return typename ClassCursor<T>::Ptr(new ClassCursor<T>(_openCursor(classIds), store, this));
   }
 
+  /**
+   * @param filter a filter expression, see where()
+   * @return a cursor over all instances of the given class that match the filter. The filter is evaluated against
+   * the raw object data, only matching objects are instantiated
+   */
+  template <typename T> typename ClassCursor<T>::Ptr openCursor(const ObjectFilter &filter) {
+    using Traits = ClassTraits<T>;
+    std::vector<ClassId> classIds = Traits::traits_info->allClassIds(store.id);
+
+    return typename ClassCursor<T>::Ptr(new ClassCursor<T>(_openCursor(classIds), store, this, &filter));
+  }
+
   /**
    * @param objectId a valid object ID
    * @param propertyId the propertyId (1-based index into declared properties, obtainable through PROPERTY_ID macro)
@@ -1547,6 +2686,146 @@ public:
     return typename ClassCursor<V>::Ptr(new ClassCursor<V>(_openCursor(cid, oid, propertyId), store, this));
   }
 
+  /**
+   * @param pa an indexed property (see MAPPED_PROP_INDEXED), obtainable through the PROPERTY macro
+   * @param lo the lower bound of the value range (inclusive)
+   * @param hi the upper bound of the value range (inclusive)
+   * @return a cursor over all objects whose property value lies within [lo, hi], in value order
+   * @throw error if the property is not indexed or the value type does not match the property type
+   */
+  template <typename T, typename V> typename ClassCursor<T>::Ptr openIndexCursor(const PropertyAccessBase *pa, V lo, V hi)
+  {
+    if(!pa->storeinfo->indexed()) throw error("property is not indexed");
+    if(pa->type.id != TypeTraits<V>::id) throw error("index value type mismatch");
+
+    ClassId cid = pa->classId[store.id];
+    IndexKey loKey(cid, pa->id), hiKey(cid, pa->id);
+    loKey.value(lo);
+    hiKey.value(hi).maxObject();
+
+    return typename ClassCursor<T>::Ptr(new ClassCursor<T>(_openIndexCursor(loKey, hiKey), store, this));
+  }
+
+  /**
+   * @param pa an indexed property (see MAPPED_PROP_INDEXED), obtainable through the PROPERTY macro
+   * @param value the property value to look up
+   * @return a cursor over all objects whose property value equals value
+   */
+  template <typename T, typename V> typename ClassCursor<T>::Ptr openIndexCursor(const PropertyAccessBase *pa, V value)
+  {
+    return openIndexCursor<T, V>(pa, value, value);
+  }
+
+  /**
+   * @param pa a spatially indexed property (see MAPPED_PROP_SPATIAL), obtainable through the PROPERTY macro
+   * @param box the query rectangle
+   * @return a cursor over all objects whose bounding box intersects the query rectangle, in index order
+   * @throw error if the property is not spatially indexed
+   */
+  template <typename T> typename ClassCursor<T>::Ptr openSpatialCursor(const PropertyAccessBase *pa, const BoundingBox &box)
+  {
+    if(!pa->storeinfo->spatial()) throw error("property is not spatially indexed");
+
+    return typename ClassCursor<T>::Ptr(
+        new ClassCursor<T>(_openSpatialCursor(pa->classId[store.id], pa->id, box), store, this));
+  }
+
+  /**
+   * @param box the query rectangle
+   * @return a cursor over all objects whose bounding box intersects the query rectangle, using the first spatial
+   * index declared by T or its superclasses
+   * @throw error if T has no spatial index
+   */
+  template <typename T> typename ClassCursor<T>::Ptr openSpatialCursor(const BoundingBox &box)
+  {
+    Properties *props = ClassTraits<T>::traits_properties;
+    for(unsigned px=0, sz=props->full_size(); px < sz; px++) {
+      const PropertyAccessBase *pa = props->get(px);
+      if(pa->enabled && pa->storeinfo->spatial()) return openSpatialCursor<T>(pa, box);
+    }
+    throw error("class has no spatial index");
+  }
+
+  /**
+   * @param target the key of a persistent object. The referrer index must be configured for its class
+   * (see KeyValueStore::setReferrerIndex)
+   * @return all objects holding a reference to the target, together with the referencing property. An object
+   * that references the target through several properties is reported once per property
+   */
+  std::vector<Referrer> getReferrers(const ObjectKey &target)
+  {
+    std::vector<Referrer> referrers;
+    loadReferrers(target, referrers);
+    return referrers;
+  }
+
+  /**
+   * @param target a persistent object. The referrer index must be configured for its class
+   * @return all objects holding a reference to the target, together with the referencing property
+   */
+  template <typename V> std::vector<Referrer> getReferrers(const std::shared_ptr<V> &target)
+  {
+    return getReferrers(*ClassTraits<V>::getObjectKey(target));
+  }
+
+  /**
+   * @param target the key of a persistent object. The referrer index must be configured for its class
+   * (see KeyValueStore::setReferrerIndex)
+   * @return a cursor over all objects of type T (or subclasses) that hold a reference to the target. Every
+   * referrer is visited once
+   */
+  template <typename T> typename ClassCursor<T>::Ptr openReferrersCursor(const ObjectKey &target)
+  {
+    return typename ClassCursor<T>::Ptr(new ClassCursor<T>(_openReferrersCursor(target), store, this));
+  }
+
+  /**
+   * @param target a persistent object. The referrer index must be configured for its class
+   * @return a cursor over all objects of type T (or subclasses) that hold a reference to the target
+   */
+  template <typename T, typename V> typename ClassCursor<T>::Ptr openReferrersCursor(const std::shared_ptr<V> &target)
+  {
+    return openReferrersCursor<T>(*ClassTraits<V>::getObjectKey(target));
+  }
+
+  /**
+   * @param includeSubclasses whether instances of subclasses are counted
+   * @return the number of persistent instances of T. Counts are maintained by write transactions, so this does
+   * not require a scan over the objects
+   */
+  template <typename T> size_t count(bool includeSubclasses=true)
+  {
+    syncStatistics();
+
+    size_t result = 0;
+    if(includeSubclasses) {
+      for(ClassId cid : ClassTraits<T>::traits_info->allClassIds(store.id)) result += _classCount(cid);
+    }
+    else result = _classCount(ClassTraits<T>::traits_data(store.id).classId);
+    return result;
+  }
+
+  /**
+   * @param pa an aggregated property (see MAPPED_PROP_AGGREGATED), obtainable through the PROPERTY macro
+   * @param includeSubclasses whether instances of subclasses are included
+   * @return count, sum, min, max and variance of the property values of all persistent instances of T. The
+   * aggregates are maintained by write transactions, so this does not require a scan over the objects
+   * @throw error if the property is not aggregated
+   */
+  template <typename T> DataAggregate<double> aggregate(const PropertyAccessBase *pa, bool includeSubclasses=true)
+  {
+    if(!pa->storeinfo->aggregated()) throw error("property is not aggregated");
+
+    syncStatistics();
+
+    DataAggregate<double> result;
+    if(includeSubclasses) {
+      for(ClassId cid : ClassTraits<T>::traits_info->allClassIds(store.id)) result.merge(_classAggregate(cid, pa));
+    }
+    else result = _classAggregate(ClassTraits<T>::traits_data(store.id).classId, pa);
+    return result;
+  }
+
   /**
    * @param collectionId the id of a top-level object collection
    * @return a cursor over the contents of the top-level collection
@@ -1585,6 +2864,21 @@ public:
     return result;
   }
 
+  /**
+   * retrieve all instances of a given mapped class (including mapped subclasses) that match a filter expression.
+   * Other than with a predicate, non-matching objects are never instantiated
+   *
+   * @param filter a filter expression, see where()
+   */
+  template <typename T>
+  std::vector<std::shared_ptr<T>> getInstances(const ObjectFilter &filter)
+  {
+    std::vector<std::shared_ptr<T>> result;
+    for(auto curs = openCursor<T>(filter); !curs->atEnd(); curs->next())
+      result.push_back(curs->get());
+    return result;
+  }
+
   /**
    * retrieve an attached member collection. Attached mebers are stored under a key that is derived from
    * the object they are attached to. The key is the same as if the member was a property member of the
@@ -1631,36 +2925,174 @@ public:
    * load a top-level (chunked) object collection
    *
    * @param collectionId an id returned from a previous #putCollection call
+   * @param threads number of threads used for decoding. 0 means use the hardware concurrency
    */
-  template <typename T, template <typename> class Ptr=std::shared_ptr> std::vector<Ptr<T>> getCollection(ObjectId collectionId)
+  template <typename T, template <typename> class Ptr=std::shared_ptr> std::vector<Ptr<T>> getCollection(
+      ObjectId collectionId, unsigned threads=1)
   {
-    CollectionInfo *ci = getCollectionInfo(collectionId);
-    return loadChunkedCollection<T, Ptr>(ci);
+    const CollectionChunks *ci = getCollectionChunks(collectionId);
+    return loadChunkedCollection<T, Ptr>(ci, threads);
+  }
+
+  /**
+   * load a top-level (chunked) object collection in parallel, without copying the result into one vector
+   *
+   * @param collectionId an id returned from a previous #putCollection call
+   * @param threads number of threads used for decoding. 0 means use the hardware concurrency
+   * @return the collection elements, segmented by chunk
+   */
+  template <typename T, template <typename> class Ptr=std::shared_ptr> CollectionSegments<Ptr<T>> getCollectionSegments(
+      ObjectId collectionId, unsigned threads=0)
+  {
+    const CollectionChunks *ci = getCollectionChunks(collectionId);
+    return loadChunkedSegments<T, Ptr>(ci, threads);
   }
 
   /**
    * load a top-level (chunked) value collection
    *
    * @param collectionId an id returned from a previous #putCollection call
+   * @param threads number of threads used for decoding. 0 means use the hardware concurrency
    */
   template <typename T>
-  std::vector<T> getValueCollection(ObjectId collectionId)
+  std::vector<T> getValueCollection(ObjectId collectionId, unsigned threads=1)
   {
-    std::vector<T> result;
-    for(ChunkCursor::Ptr cc= _openChunkCursor(COLLECTION_CLSID, collectionId); !cc->atEnd(); cc->next()) {
-      ReadBuf buf;
-      cc->get(buf);
+    return getValueSegments<T>(collectionId, threads).flatten();
+  }
+
+  /**
+   * load a top-level (chunked) value collection in parallel, without copying the result into one vector
+   *
+   * @param collectionId an id returned from a previous #putCollection call
+   * @param threads number of threads used for decoding. 0 means use the hardware concurrency
+   * @return the collection elements, segmented by chunk
+   */
+  template <typename T>
+  CollectionSegments<T> getValueSegments(ObjectId collectionId, unsigned threads=0)
+  {
+    return CollectionSegments<T>(decodeChunks<T>(collectionId, threads,
+      [](ReadBuf &buf, std::vector<T> &segment, bool shared) -> bool
+      {
+        size_t elementCount;
+        readChunkHeader(buf, 0, 0, &elementCount);
+        segment.reserve(elementCount);
+
+        for(size_t i=0; i < elementCount; i++) {
+          T val;
+          ValueTraits<T>::getBytes(buf, val);
+          segment.push_back(val);
+        }
+        return true;
+      }));
+  }
+
+  /**
+   * @param collectionId the ID of a time series collection
+   * @param time the time to seek to
+   * @return the index of the first sample at or after the given time, or the collection size if there is none
+   */
+  template <typename T>
+  size_t seekTime(ObjectId collectionId, Timestamp time)
+  {
+    RAWDATA_API_ASSERT(T)
+    const CollectionChunks *ci = getCollectionChunks(collectionId);
+    if(!ci) return 0;
+
+    size_t chunkPos, offset;
+    if(!_seekTime(ci, time, sizeof(TimeSample<T>), chunkPos, offset)) return ci->nextStartIndex;
+    return ci->chunkInfos[chunkPos].startIndex + offset;
+  }
+
+  /**
+   * compute aggregate values (count, sum, min, max, mean, variance) over a range of a top-level data collection.
+   * The data is processed chunk by chunk directly from store-owned memory, using SIMD instructions where available.
+   * The raw data API restrictions described at #getDataCollection apply
+   *
+   * @param collectionId the ID of the collection
+   * @param startIndex the start index of the data
+   * @param length number of elements to aggregate. Defaults to the whole collection
+   */
+  template <typename T>
+  DataAggregate<T> aggregateDataCollection(ObjectId collectionId, size_t startIndex=0,
+                                           size_t length=std::numeric_limits<size_t>::max())
+  {
+    RAWDATA_API_ASSERT(T)
+    DataAggregate<T> agg;
+    const CollectionChunks *ci = getCollectionChunks(collectionId);
+    if(!ci) return agg;
+
+    _visitCollectionData(ci, startIndex, length, TypeTraits<T>::byteSize,
+                         [&agg](const byte_t *data, size_t count) -> bool {
+                           kv::aggregate((const T *)data, count, agg);
+                           return true;
+                         });
+    return agg;
+  }
+
+  /**
+   * compute a histogram with equal-width bins over a top-level data collection. The raw data API restrictions
+   * described at #getDataCollection apply
+   *
+   * @param collectionId the ID of the collection
+   * @param lo lower bound of the first bin
+   * @param hi upper bound of the last bin (inclusive)
+   * @param bins the number of bins
+   * @return the number of values per bin. Values outside [lo, hi] are not counted
+   */
+  template <typename T>
+  std::vector<size_t> histogramDataCollection(ObjectId collectionId, T lo, T hi, unsigned bins)
+  {
+    RAWDATA_API_ASSERT(T)
+    std::vector<size_t> result(bins, 0);
+    const CollectionChunks *ci = getCollectionChunks(collectionId);
+    if(!ci) return result;
+
+    _visitCollectionData(ci, 0, std::numeric_limits<size_t>::max(), TypeTraits<T>::byteSize,
+                         [&](const byte_t *data, size_t count) -> bool {
+                           histogram((const T *)data, count, lo, hi, result);
+                           return true;
+                         });
+    return result;
+  }
+
+  /**
+   * scan a top-level data collection of numeric values for elements within a value range. Chunks whose
+   * statistics show that they contain no matching elements are skipped without being read. The raw data API
+   * restrictions described at #getDataCollection apply
+   *
+   * @param collectionId the ID of the collection
+   * @param lo the lower bound of the value range (inclusive)
+   * @param hi the upper bound of the value range (inclusive)
+   * @param visitor called with the index and value of every matching element. Returning false stops the scan
+   * @return the number of matching elements visited
+   */
+  template <typename T>
+  size_t scanDataCollection(ObjectId collectionId, T lo, T hi, std::function<bool(size_t index, T value)> visitor)
+  {
+    RAWDATA_API_ASSERT(T)
+    const CollectionChunks *ci = getCollectionChunks(collectionId);
+    if(!ci) return 0;
+
+    size_t matched = 0;
+    for(const ChunkInfo &chunk : ci->chunkInfos) {
+      if(chunk.stats.valid && (chunk.stats.maxValue<T>() < lo || chunk.stats.minValue<T>() > hi))
+        continue;
 
-      size_t elementCount;
-      readChunkHeader(buf, 0, 0, &elementCount);
+      ReadBuf buf;
+      getChunkData(buf, COLLECTION_CLSID, collectionId, chunk.chunkId);
+      if(buf.null()) throw error("scanDataCollection: chunk not found");
 
-      for(size_t i=0; i < elementCount; i++) {
+      const byte_t *data = buf.data() + ChunkHeader_sz;
+      for(size_t i=0; i<chunk.elementCount; i++) {
         T val;
-        ValueTraits<T>::getBytes(buf, val);
-        result.push_back(val);
+        memcpy(&val, data + i * sizeof(T), sizeof(T));
+        if(val < lo || val > hi) continue;
+
+        matched++;
+        if(!visitor(chunk.startIndex + i, val)) return matched;
       }
     }
-    return result;
+    return matched;
   }
 
   /**
@@ -1682,7 +3114,7 @@ public:
   size_t getDataCollection(ObjectId collectionId, size_t startIndex, size_t length, T* &data, bool *owned)
   {
     RAWDATA_API_ASSERT(T)
-    CollectionInfo *ci = getCollectionInfo(collectionId);
+    const CollectionChunks *ci = getCollectionChunks(collectionId);
     if(!ci) return 0;
 
     if(_getCollectionData(ci, startIndex, length, TypeTraits<T>::byteSize, (void **)&data, owned)) {
@@ -1772,57 +3204,226 @@ public:
  * reason for this is is the fact that the functions in this interface may return pointers to database-owned
  * memory. With LMDB, this memory will be invalidated upon the next write call.
  */
-class ExclusiveReadTransaction : public ReadTransaction
+class ExclusiveReadTransaction : public ReadTransaction
+{
+protected:
+  ExclusiveReadTransaction(KeyValueStore &store) : Transaction(store), ReadTransaction(store) {}
+
+public:
+  /**
+   * Note that the raw data API is only usable for floating point (float, double) and for integral data types that
+   * conform to the LP64 data model. This precludes the long data type on Windows platforms
+   *
+   * @param collectionId the ID of the collection
+   * @param startIndex the start index of the data
+   * @param length number of elements to retrieve
+   *
+   * @return a pointer to a memory chunk containing the raw collection data. The memory chunk may be
+   * database-owned or copied, depending on whether start and end lie within the same chunk.
+   */
+  template <typename T>
+  typename CollectionData<T>::Ptr getDataCollection(ObjectId collectionId, size_t startIndex, size_t length)
+  {
+    RAWDATA_API_ASSERT(T)
+    void *data = nullptr;
+    bool owned = false;
+    const CollectionChunks *ci = getCollectionChunks(collectionId);
+    if(!ci) return nullptr;
+
+    if(_getCollectionData(ci, startIndex, length, TypeTraits<T>::byteSize, &data, &owned)) {
+      return typename CollectionData<T>::Ptr(new CollectionData<T>(data, owned));
+    }
+    return nullptr;
+  }
+
+  /**
+   * zero-copy access to a range of raw collection data that may straddle chunks. Same type restrictions as
+   * #getDataCollection apply
+   *
+   * @param collectionId the ID of the collection
+   * @param startIndex the start index of the data
+   * @param length number of elements to retrieve
+   *
+   * @return one span per chunk touched by the range, in collection order. The spans point into store-owned memory
+   * and are valid until the end of the transaction. If the range exceeds the collection, the spans will cover
+   * fewer than length elements
+   */
+  template <typename T>
+  std::vector<DataSpan<T>> getDataSegments(ObjectId collectionId, size_t startIndex, size_t length)
+  {
+    RAWDATA_API_ASSERT(T)
+    std::vector<DataSpan<T>> segments;
+    const CollectionChunks *ci = getCollectionChunks(collectionId);
+    if(!ci) return segments;
+
+    _visitCollectionData(ci, startIndex, length, TypeTraits<T>::byteSize,
+                         [&segments](const byte_t *data, size_t count) -> bool {
+                           segments.push_back(DataSpan<T>((const T *)data, count));
+                           return true;
+                         });
+    return segments;
+  }
+
+  /**
+   * stream a range of raw collection data without copying. Same type restrictions as #getDataCollection apply
+   *
+   * @param collectionId the ID of the collection
+   * @param startIndex the start index of the data
+   * @param length number of elements to visit
+   * @param visitor called with each chunk-contiguous span of data, in collection order. The span is only valid
+   * until the end of the transaction. Returning false stops the walk
+   *
+   * @return the number of elements visited
+   */
+  template <typename T>
+  size_t visitDataCollection(ObjectId collectionId, size_t startIndex, size_t length,
+                             std::function<bool(const DataSpan<T> &span)> visitor)
+  {
+    RAWDATA_API_ASSERT(T)
+    const CollectionChunks *ci = getCollectionChunks(collectionId);
+    if(!ci) return 0;
+
+    return _visitCollectionData(ci, startIndex, length, TypeTraits<T>::byteSize,
+                                [&visitor](const byte_t *data, size_t count) -> bool {
+                                  return visitor(DataSpan<T>((const T *)data, count));
+                                });
+  }
+
+  /**
+   * open a cursor over the samples of a time series collection that lie within a time range
+   *
+   * @param collectionId the ID of the collection
+   * @param startTime start of the time range (inclusive)
+   * @param endTime end of the time range (inclusive)
+   * @return a cursor that returns the samples as spans into store-owned memory
+   */
+  template <typename T>
+  typename TimeSeriesCursor<T>::Ptr openTimeSeriesCursor(ObjectId collectionId, Timestamp startTime, Timestamp endTime)
+  {
+    RAWDATA_API_ASSERT(T)
+    return typename TimeSeriesCursor<T>::Ptr(
+        new TimeSeriesCursor<T>(this, getCollectionChunks(collectionId), startTime, endTime));
+  }
+};
+
+/**
+ * cursor over the samples of a time series collection that fall into a time range. Each step yields the matching
+ * samples of one chunk as a contiguous span. The spans point into store-owned memory and remain valid until the
+ * transaction ends
+ */
+template <typename T>
+class TimeSeriesCursor
 {
-protected:
-  ExclusiveReadTransaction(KeyValueStore &store) : Transaction(store), ReadTransaction(store) {}
+  Transaction * const m_tr;
+  const CollectionChunks * const m_collectionInfo;
+  const Timestamp m_endTime;
+
+  size_t m_chunkPos = 0, m_offset = 0;
+  bool m_atEnd;
 
 public:
+  using Ptr = std::shared_ptr<TimeSeriesCursor<T>>;
+
+  TimeSeriesCursor(Transaction *tr, const CollectionChunks *collectionInfo, Timestamp startTime, Timestamp endTime)
+      : m_tr(tr), m_collectionInfo(collectionInfo), m_endTime(endTime)
+  {
+    m_atEnd = !collectionInfo || startTime > endTime
+              || !tr->_seekTime(collectionInfo, startTime, sizeof(TimeSample<T>), m_chunkPos, m_offset);
+  }
+
   /**
-   * Note that the raw data API is only usable for floating point (float, double) and for integral data types that
-   * conform to the LP64 data model. This precludes the long data type on Windows platforms
-   *
-   * @param collectionId the ID of the collection
-   * @param startIndex the start index of the data
-   * @param length number of elements to retrieve
-   *
-   * @return a pointer to a memory chunk containing the raw collection data. The memory chunk may be
-   * database-owned or copied, depending on whether start and end lie within the same chunk.
+   * @return true if this cursor has reached the end
    */
-  template <typename T>
-  typename CollectionData<T>::Ptr getDataCollection(ObjectId collectionId, size_t startIndex, size_t length)
+  bool atEnd() const {return m_atEnd;}
+
+  /**
+   * @return the next run of samples within the time range. The span is empty if the end was reached
+   */
+  DataSpan<TimeSample<T>> next()
   {
-    RAWDATA_API_ASSERT(T)
-    void *data = nullptr;
-    bool owned = false;
-    CollectionInfo *ci = getCollectionInfo(collectionId);
-    if(!ci) return nullptr;
+    if(m_atEnd) return DataSpan<TimeSample<T>>(nullptr, 0);
 
-    if(_getCollectionData(ci, startIndex, length, TypeTraits<T>::byteSize, &data, &owned)) {
-      return typename CollectionData<T>::Ptr(new CollectionData<T>(data, owned));
+    const ChunkInfo &chunk = m_collectionInfo->chunkInfos[m_chunkPos];
+    ReadBuf buf;
+    m_tr->getChunkData(buf, COLLECTION_CLSID, m_collectionInfo->collectionId, chunk.chunkId);
+    if(buf.null()) throw error("time series chunk not found");
+
+    const TimeSample<T> *samples = (const TimeSample<T> *)(buf.data() + ChunkHeader_sz) + m_offset;
+    size_t count = chunk.elementCount - m_offset;
+
+    if(chunk.stats.lastTime > m_endTime) {
+      //the range ends within this chunk
+      count = std::upper_bound(samples, samples + count, m_endTime,
+                               [](Timestamp time, const TimeSample<T> &sample) {return time < sample.time;}) - samples;
+      m_atEnd = true;
     }
-    return nullptr;
+    m_offset = 0;
+    if(++m_chunkPos == m_collectionInfo->chunkInfos.size()) m_atEnd = true;
+
+    return DataSpan<TimeSample<T>>(count ? samples : nullptr, count);
   }
 };
 
 class CollectionAppenderBase
 {
+  //upper limit for adaptively sized chunks, in storage pages
+  static const unsigned MAX_CHUNK_PAGES = 64;
+
+  //adaptively sized chunks should hold at least this many elements of the observed average size
+  static const unsigned MIN_CHUNK_ELEMENTS = 16;
+
   CollectionInfo *m_collectionInfo = nullptr;
 
+  //storage pages for the next adaptively sized chunk
+  unsigned m_chunkPages = 1;
+
+  //data bytes and elements in the chunks completed by this appender
+  size_t m_bytesAppended = 0, m_elementsAppended = 0;
+
+  /**
+   * determine the size of the next chunk
+   *
+   * @param required the number of data bytes that must fit into the chunk
+   * @return the full chunk size, including the chunk header
+   */
+  size_t nextChunkSize(size_t required);
+
 protected:
   ObjectId &m_collectionId;
+  const CollectionKind m_kind;
+
+  //the chunk size requested by the user. If 0, chunk sizes adapt to the appended data
   const size_t m_chunkSize;
   WriteTransaction * const m_tr;
 
   WriteBuf &m_writeBuf;
   size_t m_elementCount;
 
-  CollectionAppenderBase(WriteTransaction *wtxn, ObjectId &collectionId, size_t chunkSize);
+  //whether m_writeBuf is currently positioned in a chunk started by this appender
+  bool m_chunkOpen = false;
+
+  //offsets of the elements written to the current chunk. Only maintained by object appenders
+  std::vector<size_t> m_elementOffsets;
+
+  CollectionAppenderBase(WriteTransaction *wtxn, ObjectId &collectionId, size_t chunkSize, CollectionKind kind);
 
   CollectionInfo *collectionInfo();
   void startChunk(size_t size);
+  void writeChunkIndex();
+
+  /**
+   * called when the current chunk is complete. Override to save additional chunk information
+   */
+  virtual void finishChunk(ChunkInfo &info) {}
+
+  /**
+   * @return the largest number of data bytes that should go into one chunk
+   */
+  size_t maxChunkData();
 
 public:
+  virtual ~CollectionAppenderBase() {}
+
   void close(bool erase=true);
 };
 
@@ -1854,6 +3455,9 @@ static size_t calculateBuffer(StoreId storeId, T *obj, Properties *properties)
 class WriteTransaction : public virtual Transaction
 {
   template<typename T, typename V> friend struct ValueEmbeddedStorage;
+  template<typename T, typename V> friend struct ValueIndexedStorage;
+  template<typename T, typename V> friend struct ValueAggregatedStorage;
+  template<typename T> friend struct SpatialIndexStorage;
   template<typename T, typename V> friend struct ValueKeyedStorage;
   template<typename T, typename V> friend class SimplePropertyStorage;
   template<typename T, typename V> friend struct ObjectPropertyStorage;
@@ -1866,14 +3470,75 @@ class WriteTransaction : public virtual Transaction
   template<typename T, typename V> friend class ObjectPtrVectorPropertyStorageEmbedded;
   template<typename T, typename V, typename KVIter, typename Iter> friend struct CollectionIterPropertyStorage;
   template<typename V> friend class AbstractObjectVectorStorage;
+  template <typename T> friend class ClassCursor;
   friend class CollectionAppenderBase;
 
-  WriteBuf writeBufStart;
-  WriteBuf  *curBuf;
+protected:
+  //a serialized object within a batch buffer
+  struct BatchEntry {
+    ObjectKey *key;
+    size_t offset, size;
+  };
+
+private:
+  //write buffers and arena, obtained from the store's pool on first use
+  WriteResources *m_resources = nullptr;
+  WriteBuf  *curBuf = nullptr;
+
+  //objects of cached classes that were modified by this transaction
+  std::unordered_map<ClassId, std::unordered_set<ObjectId>> m_cacheTouched;
+
+  //collection infos saved by writeCollections, to be published to the store-level cache after commit
+  std::vector<std::shared_ptr<CollectionInfo>> m_writtenCollectionInfos;
+
+  //changes to aggregated property values, accumulated until the statistics are written
+  struct AggregateDelta {
+    const PropertyAccessBase *pa = nullptr;
+    long count = 0;
+    double sum = 0, sumsq = 0;
+    bool added = false, removed = false;
+    double addedMin = 0, addedMax = 0, removedMin = 0, removedMax = 0;
+  };
+
+  //instance count and aggregate changes, to be written to the class statistics upon commit
+  std::unordered_map<ClassId, long> m_countDeltas;
+  std::map<std::pair<ClassId, PropertyId>, AggregateDelta> m_aggregateDeltas;
+
+  //objects serialized by saveObjects, to be written in key order once all are serialized
+  struct ObjectBatch {
+    WriteBuf &data;
+    BatchEntry * const entries;
+    const size_t capacity;
+    size_t count = 0;
+
+    //the entries are allocated once, up front. Growing them inside the arena scopes opened while the objects are
+    //serialized would place them in memory that is released when those scopes end
+    ObjectBatch(WriteBuf &data, Arena &arena, size_t capacity)
+        : data(data), entries((BatchEntry *)arena.allocate(capacity * sizeof(BatchEntry), alignof(BatchEntry))),
+          capacity(capacity) {}
+
+    void add(ObjectKey &key, WriteBuf &buf) {
+      if(count == capacity) throw error("object batch overflow");
+      entries[count++] = BatchEntry {&key, data.size(), buf.size()};
+      data.append(buf.data(), buf.size());
+    }
+  };
 
   void writeChunkHeader(size_t startIndex, size_t elementCount);
   void writeObjectHeader(ClassId classId, ObjectId objectId, size_t size);
 
+  /**
+   * apply the accumulated instance count and aggregate changes to the saved class statistics
+   */
+  void writeStatistics();
+
+  /**
+   * save the element offset index for an object collection chunk
+   *
+   * @param offsets the offsets of all elements, relative to the start of the chunk
+   */
+  void writeChunkIndex(ObjectId collectionId, ChunkId chunkId, const std::vector<size_t> &offsets);
+
   /**
    * start a new chunk by allocating memory from the KV store for it. Also write the chunk header for the
    * current chunk, if any
@@ -1884,11 +3549,79 @@ class WriteTransaction : public virtual Transaction
    */
   void startChunk(CollectionInfo *collectionInfo, size_t chunkSize, size_t elementCount);
 
+  /**
+   * overwrite a range of raw collection data, rewriting only the affected chunks
+   *
+   * @return the number of elements updated
+   */
+  size_t _updateCollectionData(ObjectId collectionId, size_t startIndex, size_t length, size_t elementSize,
+                               const byte_t *data, std::function<void(ChunkInfo &info, const byte_t *data)> updateStats);
+
 protected:
   const bool m_append;
 
-  WriteTransaction(KeyValueStore &store, bool append=false) : Transaction(store), m_append(append) {
-    curBuf = &writeBufStart;
+  WriteTransaction(KeyValueStore &store, bool append=false) : Transaction(store), m_append(append) {}
+
+  WriteResources &resources() {
+    if(!m_resources) m_resources = store.acquireWriteResources();
+    return *m_resources;
+  }
+
+  /**
+   * record the modification of an object. If the object's class is cached, the cached state will be invalidated
+   * upon commit. Must be called by backend implementations for every write to object data
+   */
+  void touchCached(ClassId classId, ObjectId objectId) {
+    if(!store.objectCaches.empty() && store.objectCaches.count(classId))
+      m_cacheTouched[classId].insert(objectId);
+  }
+
+  void syncStatistics() override {
+    writeStatistics();
+  }
+
+  /**
+   * record the creation (delta 1) or deletion (delta -1) of an instance of the given class
+   */
+  void countInstance(ClassId classId, long delta) {
+    m_countDeltas[classId] += delta;
+  }
+
+  /**
+   * drop the referrer index entries of a deleted object, if the referrer index is enabled for its class
+   */
+  template <typename T>
+  void removeTargetReferrers(ClassId classId, ObjectId objectId) {
+    AbstractClassInfo *classInfo = ClassTraits<T>::traits_info->resolve(store.id, classId);
+    if(classInfo && classInfo->getReferrerIndex(store.id)) removeReferrers(ObjectKey(classId, objectId));
+  }
+
+  /**
+   * record a value that was added to an aggregated property of an instance of the given class
+   */
+  void addAggregateValue(ClassId classId, const PropertyAccessBase *pa, double value) {
+    AggregateDelta &delta = m_aggregateDeltas[std::make_pair(classId, pa->id)];
+    delta.pa = pa;
+    delta.count++;
+    delta.sum += value;
+    delta.sumsq += value * value;
+    if(!delta.added || value < delta.addedMin) delta.addedMin = value;
+    if(!delta.added || value > delta.addedMax) delta.addedMax = value;
+    delta.added = true;
+  }
+
+  /**
+   * record a value that was removed from an aggregated property of an instance of the given class
+   */
+  void removeAggregateValue(ClassId classId, const PropertyAccessBase *pa, double value) {
+    AggregateDelta &delta = m_aggregateDeltas[std::make_pair(classId, pa->id)];
+    delta.pa = pa;
+    delta.count--;
+    delta.sum -= value;
+    delta.sumsq -= value * value;
+    if(!delta.removed || value < delta.removedMin) delta.removedMin = value;
+    if(!delta.removed || value > delta.removedMax) delta.removedMax = value;
+    delta.removed = true;
   }
 
   /**
@@ -1917,7 +3650,10 @@ protected:
           prepBuf.unmark(psz);
         }
         //now remove the object proper
-        return remove(classId, objectId);
+        if(!remove(classId, objectId)) return false;
+        countInstance(classId, -1);
+        removeTargetReferrers<T>(classId, objectId);
+        return true;
       }
       return false;
     }
@@ -1928,7 +3664,10 @@ protected:
         if(pa->enabled && pa->storeinfo->layout == StoreLayout::property)
           remove(classId, objectId, pa->id);
       }
-      return remove(classId, objectId);
+      if(!remove(classId, objectId)) return false;
+      countInstance(classId, -1);
+      removeTargetReferrers<T>(classId, objectId);
+      return true;
     }
   }
 
@@ -1977,14 +3716,33 @@ protected:
     auto &cdata = ClassTraits<T>::traits_data(store.id);
     Properties *properties = ClassTraits<T>::traits_properties;
 
-    size_t size = calculateBuffer(store.id, &obj, properties);
-    if(!objectId) objectId = ++cdata.maxObjectId;
+    ArenaScope scope(arena());
+    PrepareData pd(arena());
+    if(!objectId) {
+      objectId = ++cdata.maxObjectId;
+      countInstance(cdata.classId, 1);
+    }
+    else {
+      if(ClassTraits<T>::needsPrepare(store.id, cdata.classId)) {
+        ObjectKey key(cdata.classId, objectId);
+        prepareUpdate(key, &obj, pd, properties);
+      }
+      pd.trackChanges = cdata.changeTracking;
+    }
+    pd.indexClassId = cdata.classId;
+    pd.indexObjectId = objectId;
+
+    if(properties->fixedSize && properties->writesInPlace && !pd.trackChanges) {
+      ObjectKey key(cdata.classId, objectId);
+      writeObjectInPlace(key, obj, pd, properties, shallow);
+      return objectId;
+    }
 
-    PrepareData pd;
-    writeBuf().start(size);
+    //the buffer grows as needed, so serialization takes a single pass over the properties
+    writeBuf().start(properties->fixedSize);
     writeObject(cdata.classId, objectId, obj, pd, properties, shallow);
 
-    if(!putData(cdata.classId, objectId, 0, writeBuf()))
+    if(!putTrackedData(pd, cdata.classId, objectId, 0, writeBuf()))
       throw error("data was not saved");
 
     writeBuf().reset();
@@ -1992,18 +3750,16 @@ protected:
   }
 
   /**
-   * fully polymorphic, refcounting + caching save
+   * fully polymorphic, refcounting save
    *
    * @param key the object key
    * @param obj the object to save
-   * @param useCache if true, put the object into the cache after saving
    * @param setRefcount if true, set refcount to 1 on this object if a) the object is new and b) refcounting is turned on for the class
    */
   template <typename T>
-  void save_object(ObjectKey &key, const std::shared_ptr<T> &obj, bool useCache, bool setRefcount=true)
+  void save_object(ObjectKey &key, const std::shared_ptr<T> &obj, bool setRefcount=true)
   {
-    if(save_object(key, *obj, setRefcount) && useCache)
-      store.objectCaches[key.classId]->put(key.objectId, obj);
+    save_object(key, *obj, setRefcount);
   }
 
   /**
@@ -2014,13 +3770,16 @@ protected:
    * @param setRefcount if true, set refcount to 1 on this object if a) the object is new and b) refcounting is turned on for the class
    * @param shallow skip properties that go to separate keys (except pa if present)
    * @param pa property that has changed. If null, everything will be written
+   * @param batch if set, the object buffer is added to the batch instead of being written
    * @return true if the object was newly made persistent
    */
   template <typename T>
-  bool save_object(ObjectKey &key, T &obj, bool setRefcount, bool shallow=false, const PropertyAccessBase *pa=nullptr)
+  bool save_object(ObjectKey &key, T &obj, bool setRefcount, bool shallow=false, const PropertyAccessBase *pa=nullptr,
+                   ObjectBatch *batch=nullptr)
   {
     Properties *properties;
-    PrepareData pd;
+    ArenaScope scope(arena());
+    PrepareData pd(arena());
 
     using Traits = ClassTraits<T>;
 
@@ -2050,17 +3809,33 @@ protected:
     else {
       properties = poly ? store.objectProperties[key.classId] : Traits::traits_properties;
       if(Traits::needsPrepare(store.id, key.classId)) prepareUpdate(key, &obj, pd, properties);
+      pd.trackChanges = poly ?
+                        store.objectClassInfos.at(key.classId)->data[store.id].changeTracking :
+                        Traits::traits_data(store.id).changeTracking;
     }
 
+    if(isNew) countInstance(key.classId, 1);
+
+    pd.indexClassId = key.classId;
+    pd.indexObjectId = key.objectId;
+
     if(pa && shallow)
       Traits::save(store.id, this, key.classId, key.objectId, &obj, pd, pa, StoreMode::force_property);
 
-    //create the data buffer
-    size_t size = calculateBuffer(store.id, &obj, properties);
-    writeBuf().start(size);
+    if(properties->fixedSize && properties->writesInPlace && !pd.trackChanges && !batch) {
+      writeObjectInPlace(key, obj, pd, properties, shallow);
+      return isNew;
+    }
+
+    //create the data buffer. It grows as needed, so serialization takes a single pass over the properties
+    writeBuf().start(properties->fixedSize);
     writeObject(key.classId, key.objectId, obj, pd, properties, shallow);
 
-    if(!putData(key, writeBuf()))
+    if(pd.trackChanges && unchanged(key, writeBuf()))
+      ;
+    else if(batch)
+      batch->add(key, writeBuf());
+    else if(!putData(key, writeBuf()))
       throw error("data was not saved");
 
     writeBuf().reset();
@@ -2068,11 +3843,19 @@ protected:
   }
 
   WriteBuf &writeBuf() {
+    if(!curBuf) curBuf = &resources().writeBuf;
     return *curBuf;
   }
 
   void pushWriteBuf() {
-    curBuf = curBuf->push();
+    curBuf = writeBuf().push();
+  }
+
+  /**
+   * @return the arena for bookkeeping data that lives no longer than a save operation
+   */
+  Arena &arena() {
+    return resources().arena;
   }
 
   void popWriteBuf() {
@@ -2120,9 +3903,12 @@ protected:
   template <typename T, template <typename T> class Ptr>
   void saveChunk(const std::vector<Ptr<T>> &vect, CollectionInfo *collectionInfo, bool poly)
   {
+    collectionInfo->setKind(CollectionKind::objects);
     if(vect.empty()) return;
 
-    PrepareData pd; //dummy, no prepare done for object chunks
+    ArenaScope scope(arena());
+    PrepareData pd(arena()); //dummy, no prepare done for object chunks
+    std::vector<size_t> offsets(vect.size());
     if(poly) {
       size_t chunkSize = 0;
       chunk_helper *helpers = prepare_collection(vect, chunkSize);
@@ -2132,6 +3918,7 @@ protected:
       for(size_t i=0, vectSize = vect.size(); i<vectSize; i++) {
         chunk_helper &helper = helpers[i];
 
+        offsets[i] = writeBuf().size();
         writeObjectHeader(helper.classId, helper.objectId, helper.size);
         writeObject(helper.classId, helper.objectId, *vect[i], pd, helper.properties, true);
       }
@@ -2155,11 +3942,13 @@ protected:
         ObjectId objectId = ++cdata.maxObjectId;
 
         size_t size = sizes[i];
+        offsets[i] = writeBuf().size();
         writeObjectHeader(classId, objectId, size);
         writeObject(classId, objectId, *vect[i], pd, Traits::traits_properties, true);
       }
       delete [] sizes;
     }
+    writeChunkIndex(collectionInfo->collectionId, collectionInfo->chunkInfos.back().chunkId, offsets);
   }
 
   /**
@@ -2171,6 +3960,7 @@ protected:
   template <typename T>
   void saveChunk(const std::vector<T> &vect, CollectionInfo *ci)
   {
+    ci->setKind(CollectionKind::values);
     if(vect.empty()) return;
 
     size_t chunkSize = 0;
@@ -2179,8 +3969,12 @@ protected:
 
     startChunk(ci, chunkSize, vect.size());
 
-    for(size_t i=0, vectSize = vect.size(); i<vectSize; i++)
+    ChunkStatsBuilder<T> stats;
+    for(size_t i=0, vectSize = vect.size(); i<vectSize; i++) {
       ValueTraits<T>::putBytes(writeBuf(), vect[i]);
+      stats.add(vect[i]);
+    }
+    stats.store(ci->chunkInfos.back().stats);
   }
 
   /**
@@ -2194,12 +3988,21 @@ protected:
   template <typename T>
   void saveChunk(T *&array, size_t arraySize, CollectionInfo *ci)
   {
+    ci->setKind(CollectionKind::data);
     if(!arraySize) return;
 
     size_t chunkSize = arraySize * sizeof(T);
 
     startChunk(ci, chunkSize, arraySize);
-    if(array) writeBuf().append((byte_t *)array, chunkSize);
+
+    //with zero-copy writes, the data is not yet known and the chunk goes without statistics
+    if(array) {
+      writeBuf().append((byte_t *)array, chunkSize);
+
+      ChunkStatsBuilder<typename std::remove_const<T>::type> stats;
+      stats.add(array, arraySize);
+      stats.store(ci->chunkInfos.back().stats);
+    }
     array = (T *)writeBuf().cur();
   }
 
@@ -2214,20 +4017,194 @@ protected:
   virtual bool putData(ObjectKey &key, WriteBuf &buf) = 0;
 
   /**
-   * save a sub-object data buffer
+   * save a batch of object buffers, including refcounts, in one ordered pass
+   *
+   * @param data the buffer holding the serialized objects
+   * @param entries the batch entries, sorted by key
+   */
+  virtual void putDataBatch(const byte_t *data, const BatchEntry *entries, size_t count) = 0;
+
+  /**
+   * save a data buffer under a chunk key
+   */
+  virtual bool putChunkData(ClassId classId, ObjectId objectId, ChunkId chunkId, WriteBuf &buf) = 0;
+
+  /**
+   * allocate a data buffer under a chunk key. The returned memory is only valid until the next write operation
+   */
+  virtual bool allocChunkData(ClassId classId, ObjectId objectId, ChunkId chunkId, size_t size, byte_t **data) = 0;
+
+  /**
+   * allocate a data buffer under a full property key. The returned memory is only valid until the next write operation
    */
   virtual bool allocData(ClassId classId, ObjectId objectId, PropertyId propertyId, size_t size, byte_t **data) = 0;
 
+  /**
+   * allocate a data buffer under an object key, and save the refcount. The returned memory is only valid until
+   * the next write operation
+   */
+  virtual bool allocData(ObjectKey &key, size_t size, byte_t **data) = 0;
+
+  /**
+   * serialize an object directly into store-owned memory. Only applicable to fixed-size objects whose properties
+   * write nothing else to the store (see Properties::writesInPlace)
+   */
+  template <typename T>
+  void writeObjectInPlace(ObjectKey &key, T &obj, PrepareData &pd, Properties *properties, bool shallow)
+  {
+    byte_t *data;
+    if(!allocData(key, properties->fixedSize, &data))
+      throw error("data was not saved");
+
+    WriteBuf buf(data, properties->fixedSize);
+    WriteBuf *prevBuf = curBuf;
+    curBuf = &buf;
+    try {
+      writeObject(key.classId, key.objectId, obj, pd, properties, shallow);
+    }
+    catch(...) {
+      curBuf = prevBuf;
+      throw;
+    }
+    curBuf = prevBuf;
+  }
+
+  /**
+   * save data of known size under a property key. The data is serialized directly into store-owned memory, unless
+   * change tracking requires it for comparison with the stored data
+   *
+   * @param write called to serialize the data into the buffer. Must not write to the store
+   */
+  template <typename F>
+  void putKeyedData(PrepareData &pd, ClassId classId, ObjectId objectId, PropertyId propertyId, size_t size, F write)
+  {
+    if(pd.tracksChanges(classId, objectId)) {
+      ArenaScope scope(arena());
+      WriteBuf buf((byte_t *)arena().allocate(size, 1), size);
+      write(buf);
+      if(!putTrackedData(pd, classId, objectId, propertyId, buf))
+        throw error("data was not saved");
+    }
+    else {
+      byte_t *data;
+      if(!allocData(classId, objectId, propertyId, size, &data))
+        throw error("data was not saved");
+      WriteBuf buf(data, size);
+      write(buf);
+    }
+  }
+
   /**
    * remove an object key from the KV store. This will NOT cleanup referenced data
    */
   virtual bool remove(ClassId classId, ObjectId objectId) = 0;
 
+  /**
+   * @return true if the stored data under the given key is identical to buf
+   */
+  bool unchanged(ClassId classId, ObjectId objectId, PropertyId propertyId, WriteBuf &buf)
+  {
+    ReadBuf readBuf;
+    getData(readBuf, classId, objectId, propertyId);
+    return !readBuf.null() && readBuf.size() == buf.size() && memcmp(readBuf.data(), buf.data(), buf.size()) == 0;
+  }
+
+  /**
+   * @return true if the stored shallow buffer is identical to buf and the stored refcount equals key.refcount
+   */
+  bool unchanged(const ObjectKey &key, WriteBuf &buf)
+  {
+    ReadBuf readBuf;
+    ObjectKey stored(key.classId, key.objectId);
+    getData(readBuf, stored, true);
+    return !readBuf.null() && stored.refcount == key.refcount
+           && readBuf.size() == buf.size() && memcmp(readBuf.data(), buf.data(), buf.size()) == 0;
+  }
+
+  /**
+   * save data under a property key, unless change tracking is active for the object being saved and the stored
+   * data is identical
+   */
+  bool putTrackedData(PrepareData &pd, ClassId classId, ObjectId objectId, PropertyId propertyId, WriteBuf &buf)
+  {
+    if(pd.tracksChanges(classId, objectId) && unchanged(classId, objectId, propertyId, buf)) return true;
+    return putData(classId, objectId, propertyId, buf);
+  }
+
   /**
    * remove a property key from the KV store. This will NOT cleanup referenced data
    */
   virtual bool remove(ClassId classId, ObjectId objectId, PropertyId propertyId) = 0;
 
+  /**
+   * remove a chunk key from the KV store
+   */
+  virtual bool removeChunkData(ClassId classId, ObjectId objectId, ChunkId chunkId) = 0;
+
+  /**
+   * add an entry to the secondary index
+   */
+  virtual bool putIndexEntry(const IndexKey &key) = 0;
+
+  /**
+   * remove an entry from the secondary index
+   */
+  virtual bool removeIndexEntry(const IndexKey &key) = 0;
+
+  /**
+   * save a spatial index node
+   */
+  virtual bool putSpatialNode(ClassId classId, PropertyId propertyId, SpatialNodeId nodeId, WriteBuf &buf) = 0;
+
+  /**
+   * remove a spatial index node
+   */
+  virtual bool removeSpatialNode(ClassId classId, PropertyId propertyId, SpatialNodeId nodeId) = 0;
+
+  /**
+   * add an entry to the referrer index
+   *
+   * @param target the referenced object
+   * @param referrer the object holding the reference
+   * @param propertyId the property holding the reference
+   */
+  virtual bool putReferrer(const ObjectKey &target, const ObjectKey &referrer, PropertyId propertyId) = 0;
+
+  /**
+   * remove an entry from the referrer index
+   */
+  virtual bool removeReferrer(const ObjectKey &target, const ObjectKey &referrer, PropertyId propertyId) = 0;
+
+  /**
+   * remove all referrer index entries for the given target. Called when the target is deleted
+   */
+  virtual void removeReferrers(const ObjectKey &target) = 0;
+
+  void _saveSpatialRoot(ClassId classId, PropertyId propertyId, SpatialNodeId rootId, SpatialNodeId nextId);
+  void _saveSpatialNode(ClassId classId, PropertyId propertyId, const SpatialNode &node);
+
+  /**
+   * add an object to a spatial index. Overflowing nodes are split (quadratic split), growing the tree at the root
+   */
+  void _insertSpatial(ClassId classId, PropertyId propertyId, const BoundingBox &box, ClassId objClassId, ObjectId objectId);
+
+  /**
+   * add an entry to the node at the given level of a non-empty spatial index. Level 0 entries reference objects,
+   * higher level entries reference nodes of the level below. The root id is updated if the root is split
+   *
+   * @return false if the tree is lower than level
+   */
+  bool _insertSpatialEntry(ClassId classId, PropertyId propertyId, const SpatialNode::Entry &entry, unsigned level,
+                           SpatialNodeId &rootId, SpatialNodeId &nextId);
+
+  /**
+   * remove an object from a spatial index. Nodes that fall below the minimum fill are removed and their entries
+   * reinserted, bounding boxes are shrunk along the path
+   *
+   * @return false if the object was not found
+   */
+  bool _removeSpatial(ClassId classId, PropertyId propertyId, const BoundingBox &box, ClassId objClassId, ObjectId objectId);
+
   /**
    * clear refcounting data for all classes
    */
@@ -2303,10 +4280,54 @@ public:
   ObjectId saveObject(const std::shared_ptr<T> &obj, bool setRefCount=true)
   {
     ObjectKey *key = ClassTraits<T>::getObjectKey(obj);
-    save_object<T>(*key, obj, store.isCache<T>(), setRefCount);
+    save_object<T>(*key, obj, setRefCount);
     return key->objectId;
   }
 
+  /**
+   * save a batch of objects. All objects are serialized first, then their buffers are written in key order in a
+   * single pass, which gives better page locality and fewer page splits than saving them one by one. Properties
+   * stored under separate keys and referenced objects are written during serialization, as with saveObject
+   *
+   * @param objs persistent object pointers, which must have been obtained from KV. Each object must appear only once
+   * @throw error if an object appears more than once. Nothing is saved in that case
+   * @param setRefCount if true and refcounting is configured for T, set refcount to 1 on new objects
+   */
+  template <typename T>
+  void saveObjects(const std::vector<std::shared_ptr<T>> &objs, bool setRefCount=true)
+  {
+    if(objs.empty()) return;
+
+    ArenaScope scope(arena());
+
+    //an object passed twice would be serialized twice and yield two batch entries under one key
+    const T **sorted = (const T **)arena().allocate(objs.size() * sizeof(T *), alignof(T *));
+    for(size_t i=0; i<objs.size(); i++) sorted[i] = objs[i].get();
+    std::sort(sorted, sorted + objs.size());
+    if(std::adjacent_find(sorted, sorted + objs.size()) != sorted + objs.size())
+      throw error("saveObjects: object appears more than once");
+
+    ObjectBatch batch(writeBuf(), arena(), objs.size());
+    batch.data.start(objs.size() * 64);
+
+    //the batch holds the current buffer, objects are serialized into the next one
+    pushWriteBuf();
+    try {
+      for(auto &obj : objs)
+        save_object(*ClassTraits<T>::getObjectKey(obj), *obj, setRefCount, false, nullptr, &batch);
+    }
+    catch(...) {
+      popWriteBuf();
+      throw;
+    }
+    popWriteBuf();
+
+    std::sort(batch.entries, batch.entries + batch.count,
+              [](const BatchEntry &e1, const BatchEntry &e2) {return *e1.key < *e2.key;});
+    putDataBatch(batch.data.data(), batch.entries, batch.count);
+    batch.data.reset();
+  }
+
   /**
    * update a member variable of the given, already persistent object. The current variable state is written to the
    * store
@@ -2322,7 +4343,8 @@ public:
     switch(pa->storeinfo->layout) {
       case StoreLayout::property: {
         //property goes to a separate key, no need to touch the object buffer
-        PrepareData pd;
+        ArenaScope scope(arena());
+        PrepareData pd(arena());
         if(ClassTraits<T>::needsPrepare(store.id, key.classId)) {
           LazyBuf buf(this, key, false);
           ClassTraits<T>::prepareUpdate(store.id, buf, pd, &obj, pa);
@@ -2356,6 +4378,55 @@ public:
     updateMember(*key, *obj, pa, shallow);
   }
 
+  /**
+   * create the index entries of an indexed property for all persistent instances of T and its subclasses. Index
+   * entries are only maintained by saves and deletes, so objects that were stored before the property was mapped
+   * with MAPPED_PROP_INDEXED are not found by Transaction::openIndexCursor until this was called once. Entries
+   * that already exist are left in place
+   *
+   * @param pa the indexed property. Note that the template type parameter must refer to the (super-)class which declares the member
+   * @return the number of objects that were indexed
+   */
+  template <typename T>
+  size_t buildIndex(const PropertyAccessBase *pa)
+  {
+    if(!pa->storeinfo->indexed()) throw error("property is not indexed");
+
+    size_t count = 0;
+    for(auto cursor = openCursor<T>(); !cursor->atEnd(); cursor->next()) {
+      ObjectKey key;
+      ReadBuf readBuf;
+      cursor->getData(key, readBuf);
+      if(readBuf.null()) continue;
+
+      Properties *props = ClassTraits<T>::getProperties(store.id, key.classId);
+      if(!props) continue;
+
+      ObjectBuf obuf(readBuf.data(), readBuf.size());
+      obuf.key = key;
+
+      for(unsigned px=0, sz=props->full_size(); px < sz; px++) {
+        const PropertyAccessBase *p = props->get(px);
+
+        if(!p->enabled) continue;
+        if(p == pa) {
+          //the pre-update hook reads the persistent value into an index key
+          ArenaScope scope(arena());
+          PrepareData pd(arena());
+          ClassTraits<T>::prepareUpdate(store.id, obuf, pd, nullptr, pa);
+
+          const IndexKey &indexKey = pd.entry(pa->id).prepareIndexKey;
+          if(!indexKey.empty() && putIndexEntry(indexKey)) count++;
+          break;
+        }
+        obuf.mark();
+        size_t psz = p->storeinfo->size(store.id, obuf);
+        obuf.unmark(psz);
+      }
+    }
+    return count;
+  }
+
   /**
    * initialize the given member. Member initialization is required by special property mappings after a new object
    * is created.
@@ -2433,7 +4504,33 @@ public:
    * @param collectionId a collection id. Silently fails if invalid
    * @throw error if an error occurred
    */
-  void deleteCollection(ObjectId collectionId);
+  void deleteCollection(ObjectId collectionId);
+
+  /**
+   * mark an element of a top-level object collection as deleted. The element keeps its position (and its space)
+   * until the containing chunk is compacted. Must not be called while the collection has open appenders
+   *
+   * @param collectionId the collection id
+   * @param index the 0-based element position
+   * @return true if the element was found and not already deleted
+   * @throw error if an error occurred, or if the collection holds values or raw data
+   */
+  bool deleteElement(ObjectId collectionId, size_t index);
+
+  /**
+   * compact a top-level object collection. Chunks whose ratio of live elements has fallen below the threshold are
+   * rewritten with only the live elements, and small neighbouring chunks are merged. Elements in rewritten
+   * chunks are renumbered starting at the first chunk's start index, positions in other chunks remain unchanged.
+   * To bound the work done per transaction, limit the number of chunks and call repeatedly in successive
+   * transactions until 0 is returned
+   *
+   * @param collectionId the collection id
+   * @param threshold live element ratio below which a chunk is rewritten
+   * @param maxChunks maximum number of chunks to process. 0 means no limit
+   * @return the number of chunks that were rewritten or removed
+   * @throw error if an error occurred, or if the collection holds values or raw data
+   */
+  size_t compactCollection(ObjectId collectionId, double threshold=0.5, size_t maxChunks=0);
 
   /**
    * create a top-level (chunked) object collection.
@@ -2443,8 +4540,8 @@ public:
    */
   template <typename T, template <typename> class Ptr> ObjectId putCollection(const std::vector<Ptr<T>> &vect)
   {
-    CollectionInfo *ci = new CollectionInfo(++store.m_maxCollectionId);
-    m_collectionInfos[ci->collectionId] = ci;
+    ObjectId collectionId = 0;
+    CollectionInfo *ci = getCollectionInfo(collectionId);
 
     saveChunk(vect, ci, ClassTraits<T>::traits_info->isPoly());
 
@@ -2459,8 +4556,8 @@ public:
   template <typename T>
   ObjectId putValueCollection(const std::vector<T> &vect)
   {
-    CollectionInfo *ci = new CollectionInfo(++store.m_maxCollectionId);
-    m_collectionInfos[ci->collectionId] = ci;
+    ObjectId collectionId = 0;
+    CollectionInfo *ci = getCollectionInfo(collectionId);
 
     saveChunk(vect, ci);
 
@@ -2479,8 +4576,8 @@ public:
   ObjectId putDataCollection(const T* array, size_t arraySize)
   {
     RAWDATA_API_ASSERT(T)
-    CollectionInfo *ci = new CollectionInfo(++store.m_maxCollectionId);
-    m_collectionInfos[ci->collectionId] = ci;
+    ObjectId collectionId = 0;
+    CollectionInfo *ci = getCollectionInfo(collectionId);
 
     saveChunk(array, arraySize, ci);
 
@@ -2501,8 +4598,8 @@ public:
   ObjectId putDataCollection(T ** array, size_t arraySize)
   {
     RAWDATA_API_ASSERT(T)
-    CollectionInfo *ci = new CollectionInfo(++store.m_maxCollectionId);
-    m_collectionInfos[ci->collectionId] = ci;
+    ObjectId collectionId = 0;
+    CollectionInfo *ci = getCollectionInfo(collectionId);
 
     *array = nullptr;
     saveChunk(*array, arraySize, ci);
@@ -2581,6 +4678,34 @@ public:
     saveChunk(*data, dataSize, ci);
   }
 
+  /**
+   * overwrite a range of elements in a top-level raw data collection. Only the chunks touched by the range are
+   * rewritten, the collection layout remains unchanged. Use #appendDataCollection to extend the collection. The
+   * raw data API restrictions described at #appendDataCollection apply
+   *
+   * @param collectionId the id of the collection to update
+   * @param startIndex index of the first element to overwrite
+   * @param data the new element values
+   * @param length number of elements in data
+   * @return the number of elements updated. This is less than length if the range exceeds the collection
+   * @throw error if an error occurred
+   */
+  template <typename T>
+  size_t updateDataCollection(ObjectId collectionId, size_t startIndex, const T *data, size_t length)
+  {
+    RAWDATA_API_ASSERT(T)
+    return _updateCollectionData(collectionId, startIndex, length, TypeTraits<T>::byteSize, (const byte_t *)data,
+                                 [](ChunkInfo &info, const byte_t *chunkData) {
+                                   ChunkStatsBuilder<T> stats;
+                                   for(size_t i=0; i<info.elementCount; i++) {
+                                     T val;
+                                     memcpy(&val, chunkData + i * sizeof(T), sizeof(T));
+                                     stats.add(val);
+                                   }
+                                   stats.store(info.stats);
+                                 });
+  }
+
   template <typename T>
   void deleteObject(ObjectKey &key) {
     if(!key.isValid()) return;
@@ -2622,7 +4747,8 @@ public:
       ObjectId oid;
 
       Properties *properties;
-      PrepareData pd; //dummy, no prepare in object collections
+      ArenaScope scope(m_tr->arena());
+      PrepareData pd(m_tr->arena()); //dummy, no prepare in object collections
       if(m_poly) {
         cid = m_tr->getClassId(typeid(obj));
 
@@ -2637,8 +4763,9 @@ public:
       }
       size_t size = calculateBuffer(m_tr->store.id, &obj, properties) + ObjectHeader_sz;
 
-      if(collectionInfo()->chunkInfos.empty() || m_writeBuf.avail() < size) startChunk(size);
+      if(!m_chunkOpen || m_writeBuf.avail() < size) startChunk(size);
 
+      m_elementOffsets.push_back(m_writeBuf.size());
       m_tr->writeObjectHeader(cid, oid, size);
       m_tr->writeObject(cid, oid, obj, pd, properties, true);
 
@@ -2650,7 +4777,7 @@ public:
 
     ObjectCollectionAppender(WriteTransaction *wtxn, ObjectId &collectionId,
                              size_t chunkSize, ObjectClassInfos *objectClassInfos, ObjectProperties *objectProperties, bool poly)
-        : CollectionAppenderBase(wtxn, collectionId, chunkSize),
+        : CollectionAppenderBase(wtxn, collectionId, chunkSize, CollectionKind::objects),
           m_objectClassInfos(objectClassInfos), m_objectProperties(objectProperties), m_poly(poly)
     {
     }
@@ -2670,11 +4797,18 @@ public:
   template <typename T>
   class ValueCollectionAppender : public CollectionAppenderBase
   {
+    ChunkStatsBuilder<T> m_stats;
+
+  protected:
+    void finishChunk(ChunkInfo &info) override {
+      m_stats.store(info.stats);
+    }
+
   public:
     using Ptr = std::shared_ptr<ValueCollectionAppender>;
 
     ValueCollectionAppender(WriteTransaction *wtxn, ObjectId &collectionId, size_t chunkSize)
-        : CollectionAppenderBase(wtxn, collectionId, chunkSize)
+        : CollectionAppenderBase(wtxn, collectionId, chunkSize, CollectionKind::values)
     {}
 
     void put(T val)
@@ -2682,11 +4816,10 @@ public:
       size_t sz = TypeTraits<T>::byteSize;
       if(sz == 0) sz = ValueTraits<T>::size(val);
 
-      size_t avail = m_writeBuf.avail();
-
-      if(collectionInfo()->chunkInfos.empty() || avail < sz) startChunk(sz);
+      if(!m_chunkOpen || m_writeBuf.avail() < sz) startChunk(sz);
 
       ValueTraits<T>::putBytes(m_writeBuf, val);
+      m_stats.add(val);
       m_elementCount++;
     }
   };
@@ -2697,38 +4830,122 @@ public:
   template <typename T>
   class DataCollectionAppender : public CollectionAppenderBase
   {
+    ChunkStatsBuilder<T> m_stats;
+
+  protected:
+    void finishChunk(ChunkInfo &info) override {
+      m_stats.store(info.stats);
+    }
+
   public:
     using Ptr = std::shared_ptr<DataCollectionAppender>;
 
     DataCollectionAppender(WriteTransaction *wtxn, ObjectId &collectionId, size_t chunkSize)
-        : CollectionAppenderBase(wtxn, collectionId, chunkSize)
+        : CollectionAppenderBase(wtxn, collectionId, chunkSize, CollectionKind::data)
     {}
 
     void put(T *val, size_t size)
     {
-      size_t avail = m_writeBuf.avail() / sizeof(T);
-
-      if(avail) {
+      while(size) {
+        size_t avail = m_chunkOpen ? m_writeBuf.avail() / sizeof(T) : 0;
+        if(!avail) {
+          //large arrays are spread over several chunks
+          startChunk(std::max(std::min(size * sizeof(T), maxChunkData()), sizeof(T)));
+          avail = m_writeBuf.avail() / sizeof(T);
+        }
         size_t putsz = avail > size ? size : avail;
         m_writeBuf.append(val, putsz);
+        m_stats.add(val, putsz);
         m_elementCount += putsz;
         size -= putsz;
         val += putsz;
       }
-      if(collectionInfo()->chunkInfos.empty() || size) {
-        size_t dataSize = size * sizeof(T);
-        startChunk(dataSize < m_chunkSize ? m_chunkSize : dataSize);
-        m_writeBuf.append(val, size);
-        m_elementCount += size;
+    }
+  };
+
+  /**
+   * appender for time series collections. The first and last timestamp of each chunk are saved with the chunk
+   * info and allow range lookups by time
+   */
+  template <typename T>
+  class TimeSeriesAppender : public CollectionAppenderBase
+  {
+    ChunkStatsBuilder<T> m_stats;
+    Timestamp m_firstTime = 0, m_lastTime = std::numeric_limits<Timestamp>::min();
+    bool m_started = false;
+
+    //start of the padding behind the value, if any. Padding is zeroed so no uninitialized memory goes to disk
+    static const size_t Padding_offs = offsetof(TimeSample<T>, value) + sizeof(T);
+
+  protected:
+    void finishChunk(ChunkInfo &info) override {
+      m_stats.store(info.stats);
+      info.stats.timed = true;
+      info.stats.firstTime = m_firstTime;
+      info.stats.lastTime = m_lastTime;
+    }
+
+  public:
+    using Ptr = std::shared_ptr<TimeSeriesAppender>;
+
+    TimeSeriesAppender(WriteTransaction *wtxn, ObjectId &collectionId, size_t chunkSize)
+        : CollectionAppenderBase(wtxn, collectionId, chunkSize, CollectionKind::timeSeries)
+    {}
+
+    /**
+     * append samples. Samples must be appended in ascending time order. If they are not, nothing is appended
+     */
+    void put(const TimeSample<T> *samples, size_t size)
+    {
+      if(!m_started) {
+        //continue after the samples already in the collection
+        CollectionInfo *ci = collectionInfo();
+        if(!ci->chunkInfos.empty()) m_lastTime = ci->chunkInfos.back().stats.lastTime;
+        m_started = true;
+      }
+      //validate before updating any state, so the time range and statistics only cover samples that are written
+      Timestamp last = m_lastTime;
+      for(size_t i=0; i<size; i++) {
+        if(samples[i].time < last) throw error("time series samples must be appended in time order");
+        last = samples[i].time;
+      }
+      while(size) {
+        size_t avail = m_chunkOpen ? m_writeBuf.avail() / sizeof(TimeSample<T>) : 0;
+        if(!avail) {
+          startChunk(std::max(std::min(size * sizeof(TimeSample<T>), maxChunkData()), sizeof(TimeSample<T>)));
+          avail = m_writeBuf.avail() / sizeof(TimeSample<T>);
+        }
+        size_t putsz = avail > size ? size : avail;
+        for(size_t i=0; i<putsz; i++) {
+          if(!m_elementCount && !i) m_firstTime = samples[i].time;
+          m_lastTime = samples[i].time;
+          m_stats.add(samples[i].value);
+        }
+        m_writeBuf.append(samples, putsz);
+        if(sizeof(TimeSample<T>) > Padding_offs) {
+          byte_t *written = m_writeBuf.cur() - putsz * sizeof(TimeSample<T>);
+          for(size_t i=0; i<putsz; i++)
+            memset(written + i * sizeof(TimeSample<T>) + Padding_offs, 0, sizeof(TimeSample<T>) - Padding_offs);
+        }
+        m_elementCount += putsz;
+        size -= putsz;
+        samples += putsz;
       }
     }
+
+    void put(Timestamp time, T value)
+    {
+      TimeSample<T> sample {time, value};
+      put(&sample, 1);
+    }
   };
 
   /**
    * create an appender for the given top-level object collection
    *
    * @param collectionId the id of a top-level collection
-   * @param chunkSize the chunk size. If 0, the optimal generic size will be calculated
+   * @param chunkSize the chunk size. If 0, chunk sizes are chosen adaptively, starting with one storage page and
+   * growing with the amount of data appended
    * @return an appender over the contents of the collection.
    */
   template <typename V> typename ObjectCollectionAppender<V>::Ptr appendCollection(
@@ -2742,7 +4959,8 @@ public:
    * create an appender for the given top-level value collection
    *
    * @param collectionId the id of a top-level collection
-   * @param chunkSize the chunk size. if 0, the optimal generic size will be calculated
+   * @param chunkSize the chunk size. If 0, chunk sizes are chosen adaptively, starting with one storage page and
+   * growing with the amount of data appended
    * @return an appender over the contents of the collection.
    */
   template <typename V> typename ValueCollectionAppender<V>::Ptr appendValueCollection(
@@ -2755,7 +4973,8 @@ public:
    * create an appender for the given top-level raw-data collection
    *
    * @param collectionId the id of a top-level collection
-   * @param chunkSize the keychunk size. If 0, the optimal generic size will be calculated
+   * @param chunkSize the chunk size. If 0, chunk sizes are chosen adaptively, starting with one storage page and
+   * growing with the amount of data appended
    * @return an appender over the contents of the collection.
    */
   template <typename T> typename DataCollectionAppender<T>::Ptr appendDataCollection(
@@ -2764,6 +4983,22 @@ public:
     RAWDATA_API_ASSERT(T)
     return typename DataCollectionAppender<T>::Ptr(new DataCollectionAppender<T>(this, collectionId, chunkSize));
   }
+
+  /**
+   * create an appender for the given time series collection. The raw data API restrictions described at
+   * #appendDataCollection apply to the value type
+   *
+   * @param collectionId the id of a top-level collection
+   * @param chunkSize the chunk size. If 0, chunk sizes are chosen adaptively, starting with one storage page and
+   * growing with the amount of data appended
+   * @return an appender over the contents of the collection.
+   */
+  template <typename T> typename TimeSeriesAppender<T>::Ptr appendTimeSeries(
+      ObjectId &collectionId, size_t chunkSize = 0)
+  {
+    RAWDATA_API_ASSERT(T)
+    return typename TimeSeriesAppender<T>::Ptr(new TimeSeriesAppender<T>(this, collectionId, chunkSize));
+  }
 };
 
 /**
@@ -2779,11 +5014,9 @@ struct ValueKeyedStorage : public StoreAccessPropertyKey<T>
     V val;
     ClassTraits<T>::put(tr->store.id, *tp, pa, val);
 
-    WriteBuf propBuf(ValueTraits<V>::size(val));
-    ValueTraits<V>::putBytes(propBuf, val);
-
-    if(!tr->putData(classId, objectId, pa->id, propBuf))
-      throw error("data was not saved");
+    tr->putKeyedData(pd, classId, objectId, pa->id, ValueTraits<V>::size(val), [&val](WriteBuf &propBuf) {
+      ValueTraits<V>::putBytes(propBuf, val);
+    });
   }
   void load(Transaction *tr, ReadBuf &buf,
             ClassId classId, ObjectId objectId, T *tp, const PropertyAccessBase *pa, StoreMode mode) const override
@@ -2814,12 +5047,9 @@ struct ValueKeyedStorage<T, std::vector<V>> : public StoreAccessPropertyKey<T>
     size_t psz = 0;
     for(auto &v : val) psz += ValueTraits<V>::size(v);
     if(psz) {
-      WriteBuf propBuf(psz);
-
-      for(auto v : val) ValueTraits<V>::putBytes(propBuf, v);
-
-      if(!tr->putData(classId, objectId, pa->id, propBuf))
-        throw error("data was not saved");
+      tr->putKeyedData(pd, classId, objectId, pa->id, psz, [&val](WriteBuf &propBuf) {
+        for(auto v : val) ValueTraits<V>::putBytes(propBuf, v);
+      });
     }
   }
   void load(Transaction *tr, ReadBuf &buf,
@@ -2855,12 +5085,9 @@ struct ValueKeyedStorage<T, std::set<V>> : public StoreAccessPropertyKey<T>
     size_t psz = 0;
     for(auto &v : val) psz += ValueTraits<V>::size(v);
     if(psz) {
-      WriteBuf propBuf(psz);
-
-      for(auto v : val) ValueTraits<V>::putBytes(propBuf, v);
-
-      if(!tr->putData(classId, objectId, pa->id, propBuf))
-        throw error("data was not saved");
+      tr->putKeyedData(pd, classId, objectId, pa->id, psz, [&val](WriteBuf &propBuf) {
+        for(auto v : val) ValueTraits<V>::putBytes(propBuf, v);
+      });
     }
   }
   void load(Transaction *tr, ReadBuf &buf,
@@ -2889,6 +5116,8 @@ struct ValueEmbeddedStorage : public StoreAccessBase<T>
 {
   ValueEmbeddedStorage() : StoreAccessBase<T>(StoreLayout::all_embedded, TypeTraits<V>::byteSize) {}
 
+  bool selfContained() const override {return true;}
+
   size_t size(StoreId storeId, ObjectBuf &buf) const override
   {
     if(TypeTraits<V>::byteSize) return TypeTraits<V>::byteSize;
@@ -2926,6 +5155,8 @@ struct ValueEmbeddedStorage : public StoreAccessBase<T>
 template<typename T>
 struct ValueEmbeddedStorage<T, const char *> : public StoreAccessBase<T>
 {
+  bool selfContained() const override {return true;}
+
   size_t size(StoreId storeId, ObjectBuf &buf) const override {
     return buf.strlen()+1;
   }
@@ -2956,6 +5187,8 @@ struct ValueEmbeddedStorage<T, const char *> : public StoreAccessBase<T>
 template<typename T>
 struct ValueEmbeddedStorage<T, std::string> : public StoreAccessBase<T>
 {
+  bool selfContained() const override {return true;}
+
   size_t size(StoreId storeId, ObjectBuf &buf) const override {
     return buf.strlen()+1;
   }
@@ -2980,6 +5213,184 @@ struct ValueEmbeddedStorage<T, std::string> : public StoreAccessBase<T>
   }
 };
 
+/**
+ * storage template for embedded scalar or string values which are also recorded in a secondary index. Index entries
+ * are maintained for top-level objects only, not for objects embedded into other objects or collections
+ */
+template<typename T, typename V>
+struct ValueIndexedStorage : public ValueEmbeddedStorage<T, V>
+{
+  static IndexKey makeKey(StoreId storeId, const PropertyAccessBase *pa, const V &val, ClassId classId, ObjectId objectId)
+  {
+    IndexKey key(pa->classId[storeId], pa->id);
+    key.value(val).object(classId, objectId);
+    return key;
+  }
+
+  bool indexed() const override {return true;}
+
+  void prepareUpdate(StoreId storeId, ObjectBuf &buf, PrepareData &pd, T *obj, const PropertyAccessBase *pa) const override
+  {
+    ReadBuf &readBuf = buf.getReadBuf();
+    if(readBuf.null()) return;
+
+    V val;
+    ValueTraits<V>::getBytes(readBuf, val);
+    pd.entry(pa->id).prepareIndexKey = makeKey(storeId, pa, val, buf.key.classId, buf.key.objectId);
+  }
+  void prepareDelete(StoreId storeId, WriteTransaction *tr, ObjectBuf &buf, const PropertyAccessBase *pa) const override
+  {
+    ReadBuf &readBuf = buf.getReadBuf();
+    if(readBuf.null()) return;
+
+    V val;
+    ValueTraits<V>::getBytes(readBuf, val);
+    tr->removeIndexEntry(makeKey(storeId, pa, val, buf.key.classId, buf.key.objectId));
+  }
+  void save(WriteTransaction *tr,
+            ClassId classId, ObjectId objectId, T *tp, PrepareData &pd, const PropertyAccessBase *pa, StoreMode mode) const override
+  {
+    ValueEmbeddedStorage<T, V>::save(tr, classId, objectId, tp, pd, pa, mode);
+
+    if(pd.indexes(classId, objectId)) {
+      V val;
+      ClassTraits<T>::put(tr->store.id, *tp, pa, val);
+
+      IndexKey key = makeKey(tr->store.id, pa, val, classId, objectId);
+      PrepareData::Entry &pe = pd.entry(pa->id);
+      if(pe.prepareIndexKey != key) {
+        if(!pe.prepareIndexKey.empty()) tr->removeIndexEntry(pe.prepareIndexKey);
+        if(!tr->putIndexEntry(key)) throw error("index entry was not saved");
+        pe.prepareIndexKey = key;
+      }
+    }
+  }
+};
+
+/**
+ * storage template for embedded numeric values which are also recorded in a per-class aggregate (count, sum,
+ * min, max). Like ValueIndexedStorage, only objects saved under their own key are aggregated
+ */
+template<typename T, typename V>
+struct ValueAggregatedStorage : public ValueEmbeddedStorage<T, V>
+{
+  static_assert(std::is_arithmetic<V>::value, "aggregated properties must be numeric");
+
+  bool aggregated() const override {return true;}
+
+  double aggregateValue(ReadBuf &buf) const override
+  {
+    V val;
+    ValueTraits<V>::getBytes(buf, val);
+    return (double)val;
+  }
+  void prepareUpdate(StoreId storeId, ObjectBuf &buf, PrepareData &pd, T *obj, const PropertyAccessBase *pa) const override
+  {
+    ReadBuf &readBuf = buf.getReadBuf();
+    if(readBuf.null()) return;
+
+    PrepareData::Entry &pe = pd.entry(pa->id);
+    pe.prepareValue = aggregateValue(readBuf);
+    pe.updatePrepared = true;
+  }
+  void prepareDelete(StoreId storeId, WriteTransaction *tr, ObjectBuf &buf, const PropertyAccessBase *pa) const override
+  {
+    ReadBuf &readBuf = buf.getReadBuf();
+    if(readBuf.null()) return;
+
+    tr->removeAggregateValue(buf.key.classId, pa, aggregateValue(readBuf));
+  }
+  void save(WriteTransaction *tr,
+            ClassId classId, ObjectId objectId, T *tp, PrepareData &pd, const PropertyAccessBase *pa, StoreMode mode) const override
+  {
+    ValueEmbeddedStorage<T, V>::save(tr, classId, objectId, tp, pd, pa, mode);
+
+    if(pd.indexes(classId, objectId)) {
+      V val;
+      ClassTraits<T>::put(tr->store.id, *tp, pa, val);
+
+      PrepareData::Entry &pe = pd.entry(pa->id);
+      if(!pe.updatePrepared || pe.prepareValue != (double)val) {
+        if(pe.updatePrepared) tr->removeAggregateValue(classId, pa, pe.prepareValue);
+        tr->addAggregateValue(classId, pa, (double)val);
+        pe.prepareValue = (double)val;
+        pe.updatePrepared = true;
+      }
+    }
+  }
+};
+
+/**
+ * storage template for the bounding box of a spatially indexed object. The box is computed from the object by the
+ * mapping's extractor and saved into the shallow buffer, so that the previous state is available when the object is
+ * updated or deleted. Like ValueIndexedStorage, only top-level objects are indexed
+ */
+template<typename T>
+struct SpatialIndexStorage : public StoreAccessBase<T>
+{
+  SpatialIndexStorage() : StoreAccessBase<T>(StoreLayout::all_embedded, BoundingBox_sz) {}
+
+  static BoundingBox readBox(ReadBuf &buf) {
+    BoundingBox box;
+    box.minX = buf.readRaw<double>();
+    box.minY = buf.readRaw<double>();
+    box.maxX = buf.readRaw<double>();
+    box.maxY = buf.readRaw<double>();
+    return box;
+  }
+
+  bool selfContained() const override {return true;}
+  bool indexed() const override {return true;}
+  bool spatial() const override {return true;}
+
+  size_t size(StoreId storeId, ObjectBuf &buf) const override {return BoundingBox_sz;}
+  size_t size(StoreId storeId, T *tp, const PropertyAccessBase *pa) const override {return BoundingBox_sz;}
+
+  void prepareUpdate(StoreId storeId, ObjectBuf &buf, PrepareData &pd, T *obj, const PropertyAccessBase *pa) const override
+  {
+    ReadBuf &readBuf = buf.getReadBuf();
+    if(readBuf.null()) return;
+
+    PrepareData::Entry &pe = pd.entry(pa->id);
+    pe.prepareBox = readBox(readBuf);
+    pe.updatePrepared = true;
+  }
+  void prepareDelete(StoreId storeId, WriteTransaction *tr, ObjectBuf &buf, const PropertyAccessBase *pa) const override
+  {
+    ReadBuf &readBuf = buf.getReadBuf();
+    if(readBuf.null()) return;
+
+    tr->_removeSpatial(pa->classId[storeId], pa->id, readBox(readBuf), buf.key.classId, buf.key.objectId);
+  }
+  void save(WriteTransaction *tr,
+            ClassId classId, ObjectId objectId, T *tp, PrepareData &pd, const PropertyAccessBase *pa, StoreMode mode) const override
+  {
+    BoundingBox box;
+    ClassTraits<T>::put(tr->store.id, *tp, pa, box);
+
+    tr->writeBuf().appendRaw(box.minX);
+    tr->writeBuf().appendRaw(box.minY);
+    tr->writeBuf().appendRaw(box.maxX);
+    tr->writeBuf().appendRaw(box.maxY);
+
+    if(pd.indexes(classId, objectId)) {
+      PrepareData::Entry &pe = pd.entry(pa->id);
+      if(!pe.updatePrepared || pe.prepareBox != box) {
+        if(pe.updatePrepared) tr->_removeSpatial(pa->classId[tr->store.id], pa->id, pe.prepareBox, classId, objectId);
+        tr->_insertSpatial(pa->classId[tr->store.id], pa->id, box, classId, objectId);
+        pe.prepareBox = box;
+        pe.updatePrepared = true;
+      }
+    }
+  }
+  void load(Transaction *tr, ReadBuf &buf,
+            ClassId classId, ObjectId objectId, T *tp, const PropertyAccessBase *pa, StoreMode mode) const override
+  {
+    //derived data, nothing to load
+    buf.read(BoundingBox_sz);
+  }
+};
+
 /**
  * storage template for ClassId-typed properties. The ClassId (which is already part of the key) is mapped to an
  * object property
@@ -2989,6 +5400,8 @@ struct ObjectIdStorage : public StoreAccessBase<T>
 {
   ObjectIdStorage() : StoreAccessBase<T>(StoreLayout::none) {}
 
+  bool selfContained() const override {return true;}
+
   size_t size(StoreId storeId, ObjectBuf &buf) const override {return 0;}
   size_t size(StoreId storeId, T *obj, const PropertyAccessBase *pa) const override {return 0;}
 
@@ -3058,6 +5471,8 @@ template<typename T, typename V> struct ObjectPropertyStorageEmbedded : public S
 
   ObjectPropertyStorageEmbedded() : StoreAccessBase<T>(StoreLayout::all_embedded) {}
 
+  bool selfContained() const override {return ClassTraits<V>::traits_properties->selfContained;}
+
   size_t size(StoreId storeId, ObjectBuf &buf) const override {return buf.readInteger<unsigned>(4);}
   size_t size(StoreId storeId, T *tp, const PropertyAccessBase *pa) const override {
     size_t sz = ClassTraits<V>::traits_properties->fixedSize;
@@ -3074,11 +5489,12 @@ template<typename T, typename V> struct ObjectPropertyStorageEmbedded : public S
     ClassTraits<T>::put(tr->store.id, *tp, pa, val);
 
     ClassId childClassId = ClassTraits<V>::traits_data(tr->store.id).classId;
-    size_t sz = ClassTraits<V>::traits_properties->fixedSize;
-    if(!sz) sz = calculateBuffer(tr->store.id, &val, ClassTraits<V>::traits_properties);
 
-    tr->writeBuf().appendInteger(sz, 4);
+    //reserve the size field and fill it in after the object was written
+    size_t offset = tr->writeBuf().size();
+    tr->writeBuf().appendInteger(0, 4);
     tr->writeObject(childClassId, 1, val, pd, ClassTraits<V>::traits_properties, true);
+    tr->writeBuf().writeInteger(offset, tr->writeBuf().size() - offset - 4, 4);
   }
   void load(Transaction *tr, ReadBuf &buf,
             ClassId classId, ObjectId objectId, T *tp, const PropertyAccessBase *pa, StoreMode mode) const override
@@ -3111,17 +5527,22 @@ public:
   }
   void prepareUpdate(StoreId storeId, ObjectBuf &buf, PrepareData &pd, T *obj, const PropertyAccessBase *pa) const override
   {
-    if(ClassTraits<V>::traits_data(storeId).refcounting) {
+    auto &vdata = ClassTraits<V>::traits_data(storeId);
+    if(vdata.refcounting || vdata.referrerIndex) {
       //read pre-update state
       PrepareData::Entry &pe = pd.entry(pa->id);
       buf.read(pe.prepareCid, pe.prepareOid);
     }
   }
   void prepareDelete(StoreId storeId, WriteTransaction *tr, ObjectBuf &buf, const PropertyAccessBase *pa) const override {
-    if(ClassTraits<V>::traits_data(storeId).refcounting) {
+    auto &vdata = ClassTraits<V>::traits_data(storeId);
+    if(vdata.refcounting || vdata.referrerIndex) {
       ClassId cid; ObjectId oid;
       buf.read(cid, oid);
-      if(cid && oid && tr->decrementRefCount(cid, oid) <= 1) tr->removeObject<V>(cid, oid);
+      if(cid && oid) {
+        if(vdata.referrerIndex) tr->removeReferrer(ObjectKey(cid, oid), buf.key, pa->id);
+        if(vdata.refcounting && tr->decrementRefCount(cid, oid) <= 1) tr->removeObject<V>(cid, oid);
+      }
     }
   }
 
@@ -3132,6 +5553,7 @@ public:
     ClassTraits<T>::put(tr->store.id, *tp, pa, val);
 
     bool refcount = ClassTraits<V>::traits_data(tr->store.id).refcounting;
+    bool referrers = ClassTraits<V>::traits_data(tr->store.id).referrerIndex && pd.indexes(classId, objectId);
     PrepareData::Entry &pe = pd.entry(pa->id);
     if(val) {
       //save the pointed-to object
@@ -3144,8 +5566,13 @@ public:
           childKey->refcount++;
         }
         tr->pushWriteBuf();
-        tr->save_object<V>(*childKey, val, tr->store.isCache<T>());
+        tr->save_object<V>(*childKey, val);
         tr->popWriteBuf();
+
+        if(referrers && (pe.prepareCid != childKey->classId || pe.prepareOid != childKey->objectId)) {
+          if(pe.prepareOid) tr->removeReferrer(ObjectKey(pe.prepareCid, pe.prepareOid), ObjectKey(classId, objectId), pa->id);
+          tr->putReferrer(*childKey, ObjectKey(classId, objectId), pa->id);
+        }
       }
       if(mode != StoreMode::force_property) {
         //save the key in this objects write buffer
@@ -3153,6 +5580,9 @@ public:
       }
     }
     else {
+      if(referrers && mode != StoreMode::force_buffer && pe.prepareOid)
+        tr->removeReferrer(ObjectKey(pe.prepareCid, pe.prepareOid), ObjectKey(classId, objectId), pa->id);
+
       if(refcount && mode != StoreMode::force_buffer && pe.prepareOid && tr->decrementRefCount(pe.prepareCid, pe.prepareOid) <= 1)
         tr->removeObject<V>(pe.prepareCid, pe.prepareOid);
 
@@ -3213,13 +5643,17 @@ template<typename T, typename V> struct ObjectPtrPropertyStorageEmbedded : publi
     std::shared_ptr<V> val;
     ClassTraits<T>::put(tr->store.id, *tp, pa, val);
 
-    ClassId childClassId = 0;
-    size_t sz = val ? ClassTraits<V>::bufferSize(tr->store.id, &(*val), &childClassId) : 0;
+    ClassId childClassId = val ? ClassTraits<V>::getClassId(tr->store.id, &(*val)) : 0;
 
     tr->writeBuf().appendInteger(childClassId, ClassId_sz);
-    tr->writeBuf().appendInteger(sz, 4);
 
-    if(val) tr->writeObject(childClassId, 1, *val, pd, ClassTraits<V>::getProperties(tr->store.id, childClassId), true);
+    //reserve the size field and fill it in after the object was written
+    size_t offset = tr->writeBuf().size();
+    tr->writeBuf().appendInteger(0, 4);
+    if(val) {
+      tr->writeObject(childClassId, 1, *val, pd, ClassTraits<V>::getProperties(tr->store.id, childClassId), true);
+      tr->writeBuf().writeInteger(offset, tr->writeBuf().size() - offset - 4, 4);
+    }
   }
   void load(Transaction *tr, ReadBuf &buf,
             ClassId classId, ObjectId objectId, T *tp, const PropertyAccessBase *pa, StoreMode mode) const override
@@ -3267,12 +5701,11 @@ public:
     std::vector<V> val;
     ClassTraits<T>::put(tr->store.id, *tp, pa, val);
 
-    size_t psz = sizeof(ClassId) + sizeof(size_t);
     Properties *properties = ClassTraits<V>::traits_properties;
 
+    //the buffer grows as the elements are written
     tr->pushWriteBuf();
-    for(V &v : val) psz += calculateBuffer(tr->store.id, &v, properties);
-    tr->writeBuf().start(psz);
+    tr->writeBuf().start(sizeof(ClassId) + sizeof(size_t) + val.size() * properties->fixedSize);
 
     ClassId childClassId = ClassTraits<V>::traits_data(tr->store.id).classId;
     tr->writeBuf().appendRaw(childClassId);
@@ -3282,7 +5715,7 @@ public:
     for(V &v : val) tr->writeObject(childClassId, 0, v, pd, properties, false);
 
     //put vector into a separate property key
-    if(!tr->putData(classId, objectId, pa->id, tr->writeBuf()))
+    if(!tr->putTrackedData(pd, classId, objectId, pa->id, tr->writeBuf()))
       throw error("data was not saved");
 
     tr->popWriteBuf();
@@ -3322,6 +5755,8 @@ public:
 template<typename T, typename V> class ObjectVectorPropertyStorageEmbedded : public StoreAccessBase<T>
 {
 public:
+  bool selfContained() const override {return ClassTraits<V>::traits_properties->selfContained;}
+
   size_t size(StoreId storeId, ObjectBuf &buf) const override {
     unsigned vectSize = buf.readInteger<unsigned>(4);
     size_t sz = ClassTraits<V>::traits_properties->fixedSize;
@@ -3358,12 +5793,12 @@ public:
     tr->writeBuf().appendInteger((unsigned)val.size(), 4);
     ClassId childClassId = ClassTraits<V>::traits_data(tr->store.id).classId;
     PropertyId childObjectId = 0;
-    size_t fsz = ClassTraits<V>::traits_properties->fixedSize;
     for(V &v : val) {
-      size_t sz = fsz ? fsz : calculateBuffer(tr->store.id, &v, ClassTraits<V>::traits_properties);
-
-      tr->writeBuf().appendInteger(sz, 4);
+      //reserve the size field and fill it in after the element was written
+      size_t offset = tr->writeBuf().size();
+      tr->writeBuf().appendInteger(0, 4);
       tr->writeObject(childClassId, ++childObjectId, v, pd, ClassTraits<V>::traits_properties, true);
+      tr->writeBuf().writeInteger(offset, tr->writeBuf().size() - offset - 4, 4);
     }
   }
 
@@ -3404,12 +5839,14 @@ template<typename T, typename V> class ObjectPtrVectorPropertyStorage : public S
   }
   void prepareUpdate(StoreId storeId, ObjectBuf &buf, PrepareData &pd, T *obj, const PropertyAccessBase *pa) const override
   {
+    auto &vdata = ClassTraits<V>::traits_data(storeId);
     PrepareData::Entry &pe = pd.entry(pa->id);
-    pe.updatePrepared = ClassTraits<V>::traits_data(storeId).refcounting;
+    pe.updatePrepared = vdata.refcounting || vdata.referrerIndex;
   }
   void prepareDelete(StoreId storeId, WriteTransaction *tr, ObjectBuf &buf, const PropertyAccessBase *pa) const override
   {
-    if(ClassTraits<V>::traits_data(storeId).refcounting) {
+    auto &vdata = ClassTraits<V>::traits_data(storeId);
+    if(vdata.refcounting || vdata.referrerIndex) {
       ReadBuf readBuf;
       tr->getData(readBuf, buf.key.classId, buf.key.objectId, pa->id);
       if (!readBuf.null()) {
@@ -3418,17 +5855,21 @@ template<typename T, typename V> class ObjectPtrVectorPropertyStorage : public S
         std::vector<ObjectKey> oks(count);
         for(size_t i=0; i<count; i++) readBuf.read(oks[i]);
 
-        //now work all keys by decrementing refcount and deleting
+        //now work all keys by removing the referrer entry, decrementing refcount and deleting
         for(size_t i=0; i<count; i++) {
           ObjectKey &key = oks[i];
-          if(tr->decrementRefCount(key.classId, key.objectId) <= 1) tr->removeObject<V>(key.classId, key.objectId);
+          if(vdata.referrerIndex) tr->removeReferrer(key, buf.key, pa->id);
+          if(vdata.refcounting && tr->decrementRefCount(key.classId, key.objectId) <= 1)
+            tr->removeObject<V>(key.classId, key.objectId);
         }
       }
     }
     tr->remove(buf.key.classId, buf.key.objectId, pa->id);
   }
 
-  void loadStoredKeys(Transaction *tr, ClassId cid, ObjectId oid, PropertyId pid, std::set<ObjectKey> &keys) const
+  using KeySet = std::set<ObjectKey, std::less<ObjectKey>, ArenaAllocator<ObjectKey>>;
+
+  void loadStoredKeys(Transaction *tr, ClassId cid, ObjectId oid, PropertyId pid, KeySet &keys) const
   {
     ReadBuf readBuf;
     tr->getData(readBuf, cid, oid, pid);
@@ -3450,42 +5891,63 @@ public:
   {
     if(m_lazy && mode == StoreMode::force_none) return;
 
-    std::vector<std::shared_ptr<V>> val;
-    ClassTraits<T>::put(tr->store.id, *tp, pa, val);
+    //work on the member itself if possible, copying the vector would allocate
+    std::vector<std::shared_ptr<V>> copy;
+    std::vector<std::shared_ptr<V>> *valp = ClassTraits<T>::template address<std::vector<std::shared_ptr<V>>>(tr->store.id, *tp, pa);
+    if(!valp) {
+      ClassTraits<T>::put(tr->store.id, *tp, pa, copy);
+      valp = &copy;
+    }
+    std::vector<std::shared_ptr<V>> &val = *valp;
 
-    std::set<ObjectKey> oldKeys;
+    auto &vdata = ClassTraits<V>::traits_data(tr->store.id);
+    bool referrers = vdata.referrerIndex && pd.indexes(classId, objectId) && mode != StoreMode::force_buffer;
 
+    //the entry must be created before the scope, it lives in the enclosing one
     PrepareData::Entry &pe = pd.entry(pa->id);
+
+    ArenaScope scope(tr->arena());
+    KeySet oldKeys(tr->arena()), oldReferenced(tr->arena());
     if (pe.updatePrepared && mode != StoreMode::force_buffer)
       loadStoredKeys(tr, classId, objectId, pa->id, oldKeys);
     pe.reset();
+    if(referrers) oldReferenced = oldKeys;
 
     size_t psz = ObjectKey_sz * val.size();
-    WriteBuf propBuf(psz);
-
-    bool useCache = tr->store.isCache<T>();
+    WriteBuf propBuf((byte_t *)tr->arena().allocate(psz, 1), psz);
 
     tr->pushWriteBuf();
     for(std::shared_ptr<V> &v : val) {
       ObjectKey *childKey = ClassTraits<V>::getObjectKey(v);
 
       if(mode != StoreMode::force_buffer) {
-        if(ClassTraits<V>::traits_data(tr->store.id).refcounting && !childKey->isNew()) {
+        if(vdata.refcounting && !childKey->isNew()) {
           if(oldKeys.empty() || !oldKeys.erase(*childKey)) childKey->refcount++;
         }
-        tr->save_object<V>(*childKey, v, useCache);
+        tr->save_object<V>(*childKey, v);
       }
       propBuf.append(*childKey);
+
+      //only references that were not there before need a new referrer entry
+      if(referrers && !oldReferenced.erase(*childKey))
+        tr->putReferrer(*childKey, ObjectKey(classId, objectId), pa->id);
     }
     tr->popWriteBuf();
 
     //vector goes into a separate property key
-    if(!tr->putData(classId, objectId, pa->id, propBuf))
+    if(!tr->putTrackedData(pd, classId, objectId, pa->id, propBuf))
       throw error("data was not saved");
 
+    //references that were dropped from the vector
+    for(auto &key : oldReferenced) {
+      tr->removeReferrer(key, ObjectKey(classId, objectId), pa->id);
+    }
+
     //cleanup orphaned objects
-    for(auto &key : oldKeys) {
-      if(tr->decrementRefCount(key.classId, key.objectId) <= 1) tr->removeObject<V>(key.classId, key.objectId);
+    if(vdata.refcounting) {
+      for(auto &key : oldKeys) {
+        if(tr->decrementRefCount(key.classId, key.objectId) <= 1) tr->removeObject<V>(key.classId, key.objectId);
+      }
     }
   }
 
@@ -3572,12 +6034,14 @@ public:
     tr->writeBuf().appendInteger((unsigned)val.size(), 4);
     PropertyId childObjectId = 0;
     for(std::shared_ptr<V> &v : val) {
-      ClassId childClassId;
-      size_t sz = ClassTraits<V>::bufferSize(tr->store.id, &(*v), &childClassId);
-
+      ClassId childClassId = ClassTraits<V>::getClassId(tr->store.id, &(*v));
       tr->writeBuf().appendInteger(childClassId, ClassId_sz);
-      tr->writeBuf().appendInteger(sz, 4);
+
+      //reserve the size field and fill it in after the element was written
+      size_t offset = tr->writeBuf().size();
+      tr->writeBuf().appendInteger(0, 4);
       tr->writeObject(childClassId, ++childObjectId, *v, pd, ClassTraits<V>::getProperties(tr->store.id, childClassId), true);
+      tr->writeBuf().writeInteger(offset, tr->writeBuf().size() - offset - 4, 4);
     }
   }
 
@@ -3647,7 +6111,7 @@ struct CollectionIterPropertyStorage : public StoreAccessPropertyKey<T>
     if(iter && iter->getCollectionId()) {
       WriteBuf wb(sizeof(ObjectId));
       wb.appendRaw(iter->getCollectionId());
-      tr->putData(classId, objectId, pa->id, wb);
+      tr->putTrackedData(pd, classId, objectId, pa->id, wb);
     }
   }
 
@@ -3693,6 +6157,38 @@ struct ValuePropertyEmbeddedAssign : public ValuePropertyAssign<O, P, ValueEmbed
       : ValuePropertyAssign<O, P, ValueEmbeddedStorage, p>(name) {}
 };
 
+/**
+ * mapping configuration for simple types that are stored directly into the shallow buffer and recorded in a
+ * secondary index. See Transaction::openIndexCursor
+ */
+template <typename O, typename P, P O::*p>
+struct ValuePropertyIndexedAssign : public ValuePropertyAssign<O, P, ValueIndexedStorage, p> {
+  ValuePropertyIndexedAssign(const char * name)
+      : ValuePropertyAssign<O, P, ValueIndexedStorage, p>(name) {}
+};
+
+/**
+ * mapping configuration for numeric types that are stored directly into the shallow buffer and recorded in a
+ * per-class aggregate. See Transaction::aggregate
+ */
+template <typename O, typename P, P O::*p>
+struct ValuePropertyAggregatedAssign : public ValuePropertyAssign<O, P, ValueAggregatedStorage, p> {
+  ValuePropertyAggregatedAssign(const char * name)
+      : ValuePropertyAssign<O, P, ValueAggregatedStorage, p>(name) {}
+};
+
+/**
+ * mapping configuration for a spatial index. The bounding box is computed by the extractor function, there is no
+ * corresponding member variable. See Transaction::openSpatialCursor
+ */
+template <typename O, BoundingBox (*extractor)(const O &)>
+struct SpatialIndexAssign : public PropertyAccess<O, BoundingBox> {
+  SpatialIndexAssign(const char * name)
+      : PropertyAccess<O, BoundingBox>(name, new SpatialIndexStorage<O>(), PropertyType(0, BoundingBox_sz, false)) {}
+  void set(O &o, BoundingBox val) const override {}
+  BoundingBox get(O &o) const override {return extractor(o);}
+};
+
 /**
  * mapping configuration for an ObjectId property
  */
@@ -3811,7 +6307,111 @@ struct ValueCollectionIterPropertyAssign : public PropertyAssign<O, std::shared_
       : PropertyAssign<O, std::shared_ptr<Iter>, p>(name, new CollectionIterPropertyStorage<O, P, KVIter, Iter>(), PROPERTY_TYPE_VECT(P)) {}
 };
 
+template <typename T>
+ClassCursor<T>::ClassCursor(CursorHelper *helper, KeyValueStore &store, Transaction *tr, const ObjectFilter *filter)
+    : m_helper(helper), m_store(store), m_tr(tr), m_useCache(store.isCache<T>() && tr->readOnly()),
+      m_filter(filter ? std::make_shared<ObjectFilter>(*filter) : nullptr)
+{
+  bool hasData = helper->start();
+  bool clsFound = hasData && validateClass();
+
+  while(hasData && !clsFound) {
+    hasData = helper->next();
+    clsFound = hasData && validateClass();
+  }
+  m_hasData = hasData && clsFound;
+  if(!m_hasData) close();
+}
+
+template <typename T>
+bool ClassCursor<T>::erase(WriteTransactionPtr tr)
+{
+  ObjectKey key;
+
+  if(!m_helper->erasable()) throw error("objects cannot be erased through this cursor");
+
+  ReadBuf readBuf;
+  m_helper->get(key, readBuf);
+  if(readBuf.null()) return m_hasData;
+  if(key.refcount > 1) throw error("removeObject: refcount > 1");
+
+  using Traits = ClassTraits<T>;
+
+  if(Traits::needsPrepare(m_store.id, key.classId)) {
+    Properties *props = Traits::getProperties(m_store.id, key.classId);
+    ObjectBuf obuf(readBuf.data(), readBuf.size());
+    obuf.key = key;
+
+    for(unsigned px=0, sz=props->full_size(); px < sz; px++) {
+      const PropertyAccessBase *pa = props->get(px);
+
+      if(!pa->enabled) continue;
+
+      obuf.mark();
+      size_t psz = pa->storeinfo->size(m_store.id, obuf);
+      ClassTraits<T>::prepareDelete(m_store.id, tr.get(), obuf, pa);
+      obuf.unmark(psz);
+    }
+  }
+
+  //now remove the object proper. Statistics and cache are updated only if that succeeded
+  bool hasNext = m_helper->erase();
+  tr->touchCached(key.classId, key.objectId);
+  tr->countInstance(key.classId, -1);
+  tr->removeTargetReferrers<T>(key.classId, key.objectId);
+
+  if(hasNext) {
+    bool hasData=true, clsFound;
+    do {
+      clsFound = hasData && validateClass();
+      hasData = m_helper->next();
+    } while(hasData && !clsFound);
+
+    m_hasData = hasData && clsFound;
+    return true;
+  }
+  else m_hasData = false;
+
+  if(!m_hasData) close();
+  return m_hasData;
+}
+
+template <typename T>
+std::shared_ptr<const T> ClassCursor<T>::getShared()
+{
+  object_handler<T> handler;
+  ReadBuf readBuf;
+  m_helper->get(handler, readBuf);
+
+  if(readBuf.null()) return std::shared_ptr<const T>();
+
+  if(m_useCache) {
+    std::shared_ptr<T> cached = m_store.getCached<T>(handler.classId, handler.objectId, m_tr->txnId());
+    return cached ? cached : m_store.putCache(makeObject(handler, readBuf), handler, m_tr->txnId());
+  }
+  return std::shared_ptr<const T>(makeObject(handler, readBuf), handler);
+}
+
 } //kv
+
+template <typename T>
+size_t KeyValueStore::count(bool includeSubclasses)
+{
+  kv::ReadTransactionPtr tr = beginRead();
+  size_t result = tr->count<T>(includeSubclasses);
+  tr->end();
+  return result;
+}
+
+template <typename T>
+kv::DataAggregate<double> KeyValueStore::aggregate(const kv::PropertyAccessBase *pa, bool includeSubclasses)
+{
+  kv::ReadTransactionPtr tr = beginRead();
+  kv::DataAggregate<double> result = tr->aggregate<T>(pa, includeSubclasses);
+  tr->end();
+  return result;
+}
+
 } //persistence
 } //flexis
 
@@ -26,6 +26,11 @@
 #include <sstream>
 #include <cstring>
 #include <typeinfo>
+#include <typeindex>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
 #include <stdexcept>
 #include <stdint.h>
 #include <type_traits>
@@ -175,6 +180,35 @@ struct StoreInfo
    */
   virtual bool preparesUpdates(StoreId storeId, ClassId classId) {return false;}
 
+  /**
+   * determine whether loading this storage only reads from the object buffer, without accessing the transaction.
+   * Objects consisting of such storages only can be decoded off the transaction thread
+   */
+  virtual bool selfContained() const {return false;}
+
+  /**
+   * determine whether this storage maintains secondary index entries. Classes holding such a storage always
+   * participate in update/delete preparation
+   */
+  virtual bool indexed() const {return false;}
+
+  /**
+   * determine whether this storage maintains a spatial index. Spatial storages are also indexed()
+   */
+  virtual bool spatial() const {return false;}
+
+  /**
+   * determine whether this storage maintains a persistent per-class aggregate over its values. Classes holding
+   * such a storage always participate in update/delete preparation
+   */
+  virtual bool aggregated() const {return false;}
+
+  /**
+   * read the value of an aggregated storage from a serialized buffer. The buffer's read position is at the start
+   * of this object's data
+   */
+  virtual double aggregateValue(ReadBuf &buf) const {return 0;}
+
   /**
    * determine the size from a serialized buffer. The buffer's read position is at the start of this object's data
    *
@@ -252,6 +286,8 @@ struct StoreAccessBase : public StoreInfo
 struct NullStorage : public StoreAccessBase<void> {
   NullStorage() : StoreAccessBase<void>(StoreLayout::none, 0) { }
 
+  bool selfContained() const override {return true;}
+
   size_t size(StoreId storeId, ObjectBuf &buf) const override { return 0; }
 
   void save(WriteTransaction *tr,
@@ -343,7 +379,7 @@ struct ValueTraits : public ValueTraitsBase<true>
     const byte_t *data = buf.read(byteSize);
     val = read_integer<T>(data, byteSize);
   }
-  static void putBytes(WriteBuf &buf, T &val) {
+  static void putBytes(WriteBuf &buf, const T &val) {
     size_t byteSize = TypeTraits<T>::byteSize;
     byte_t *data = buf.allocate(byteSize);
     write_integer(data, val, byteSize);
@@ -512,6 +548,11 @@ struct PropertyAccess : public PropertyAccessBase {
   virtual void set(O &o, P val) const = 0;
   virtual P get(O &o) const = 0;
   virtual bool same(O *obj, ObjectId oid) {return false;}
+
+  /**
+   * @return the address of the mapped member variable, or nullptr if the value is not directly accessible
+   */
+  virtual P *address(O &o) const {return nullptr;}
 };
 
 /**
@@ -524,6 +565,7 @@ template <typename O, typename P, P O::*p> struct PropertyAssign : public Proper
       : PropertyAccess<O, P>(name, inverse, type) {}
   void set(O &o, P val) const override { o.*p = val;}
   P get(O &o) const override { return o.*p;}
+  P *address(O &o) const override { return &(o.*p);}
 };
 
 template <typename T> struct ClassTraits;
@@ -549,13 +591,19 @@ protected:
   unsigned startPos = 0;
 
   Properties(const PropertyAccessBase ** decl_props[], unsigned numProps)
-      : decl_props(decl_props), numProps(numProps), fixedSize(0)
+      : decl_props(decl_props), numProps(numProps), fixedSize(0), selfContained(false), writesInPlace(false)
   {}
 
   Properties(const Properties& mit) = delete;
 public:
   size_t fixedSize;
 
+  //all properties can be loaded from the object buffer alone. See StoreInfo::selfContained
+  bool selfContained;
+
+  //saving writes nothing but the object buffer, which can therefore be serialized directly into store memory
+  bool writesInPlace;
+
   virtual void init() = 0;
 
   template <typename O>
@@ -627,6 +675,22 @@ public:
       }
     }
 
+    //see if we can be decoded without transaction access. Like fixedSize, this may fail for circular dependencies
+    selfContained = !superIter || superIter->selfContained;
+    for(unsigned i=0; i<numProps && selfContained; i++) {
+      const PropertyAccessBase *pa = *decl_props[i];
+      if(pa->enabled && (!pa->storeinfo || !pa->storeinfo->selfContained()))
+        selfContained = false;
+    }
+
+    //index maintenance writes to the store while the object buffer is serialized
+    writesInPlace = selfContained && (!superIter || superIter->writesInPlace);
+    for(unsigned i=0; i<numProps && writesInPlace; i++) {
+      const PropertyAccessBase *pa = *decl_props[i];
+      if(pa->enabled && pa->storeinfo->indexed())
+        writesInPlace = false;
+    }
+
     //see if we're fixed size
     fixedSize = 0;
     if(superIter) {
@@ -671,6 +735,10 @@ struct ClassData
   bool refcounting = false;
   long cacheOwner = 0;
   long refcountingOwner = 0;
+  bool referrerIndex = false;
+  long referrerIndexOwner = 0;
+  bool changeTracking = false;
+  long changeTrackingOwner = 0;
 
   std::set<ClassId> prepareClasses;
 };
@@ -697,7 +765,18 @@ struct AbstractClassInfo
 
   std::vector<AbstractClassInfo *> subs;
 
-  AbstractClassInfo(const char *name, const std::type_info &typeinfo) : name(name), typeinfo(typeinfo) {}
+  using ClassIdTable = std::vector<AbstractClassInfo *>;
+  using TypeTable = std::unordered_map<std::type_index, AbstractClassInfo *>;
+
+  //lookup tables for the inheritance tree rooted in this class, built at schema registration time. Published tables
+  //are never modified, so lookups need no locking
+  std::atomic<const ClassIdTable *> classIdTable[MAX_DATABASES];
+  std::atomic<const TypeTable *> typeTable;
+
+  AbstractClassInfo(const char *name, const std::type_info &typeinfo) : name(name), typeinfo(typeinfo) {
+    for(auto &table : classIdTable) table.store(nullptr);
+    typeTable.store(nullptr);
+  }
 
   void addSub(AbstractClassInfo *rsub) {
     subs.push_back(rsub);
@@ -708,10 +787,7 @@ struct AbstractClassInfo
   }
 
   bool hasClassId(StoreId storeId, ClassId cid) {
-    if(data[storeId].classId == cid) return true;
-    for(auto &sub : subs)
-      if(sub->hasClassId(storeId, cid)) return true;
-    return false;
+    return resolve(storeId, cid) != nullptr;
   }
 
   void setRefCounting(StoreId storeId, bool refcount) {
@@ -725,16 +801,64 @@ struct AbstractClassInfo
     return data[storeId].refcounting;
   }
 
+  void setReferrerIndex(StoreId storeId, bool index) {
+    data[storeId].referrerIndex = index;
+    for(auto &sub : subs) {
+      sub->setReferrerIndex(storeId, index);
+    }
+  }
+
+  bool getReferrerIndex(StoreId storeId) {
+    return data[storeId].referrerIndex;
+  }
+
+  void setChangeTracking(StoreId storeId, bool track) {
+    data[storeId].changeTracking = track;
+    for(auto &sub : subs) {
+      sub->setChangeTracking(storeId, track);
+    }
+  }
+
+  bool getChangeTracking(StoreId storeId) {
+    return data[storeId].changeTracking;
+  }
+
   bool isInstance(StoreId storeId, ClassId _classId) {
-    if(data[storeId].classId == _classId) return true;
-    for(auto s : subs) {
-      if(s->isInstance(storeId, _classId)) return true;
+    return resolve(storeId, _classId) != nullptr;
+  }
+
+  /**
+   * (re-)build the lookup tables for the inheritance tree rooted in this object. Must be called whenever
+   * classIds were assigned within the tree. A replaced table is released, so this must not run concurrently with
+   * lookups in the same store (classes are registered before the store is used)
+   */
+  void buildTables(StoreId storeId) {
+    std::lock_guard<std::mutex> lock(tablesMutex());
+
+    //the type table does not depend on the store, since the inheritance tree is fixed at static initialization
+    TypeTable *types = typeTable.load() ? nullptr : new TypeTable();
+    std::unique_ptr<ClassIdTable> ids(new ClassIdTable());
+    addToTables(storeId, *ids, types);
+
+    //every store has its own table, so replacing it does not affect lookups in other stores. A table that did not
+    //change is kept, which makes rebuilding the tables after registering unrelated classes free of side effects
+    std::unique_ptr<const ClassIdTable> &built = m_builtTables[storeId];
+    if(!built || *built != *ids) {
+      classIdTable[storeId].store(ids.get(), std::memory_order_release);
+      built.reset(ids.release());
+    }
+    if(types) {
+      m_builtTypeTable.reset(types);
+      typeTable.store(types, std::memory_order_release);
     }
-    return false;
   }
 
   AbstractClassInfo *resolve(StoreId storeId, ClassId otherClassId)
   {
+    const ClassIdTable *table = classIdTable[storeId].load(std::memory_order_acquire);
+    if(table)
+      return otherClassId < table->size() ? (*table)[otherClassId] : nullptr;
+
     if(otherClassId == data[storeId].classId) {
       return this;
     }
@@ -747,11 +871,14 @@ struct AbstractClassInfo
 
   AbstractClassInfo *resolve(const std::type_info &ti)
   {
-      const char *n1 = ti.name();
-      const char *n2 = typeinfo.name();
     if(ti == typeinfo) {
       return this;
     }
+    const TypeTable *table = typeTable.load(std::memory_order_acquire);
+    if(table) {
+      auto it = table->find(std::type_index(ti));
+      return it != table->end() ? it->second : nullptr;
+    }
     for(auto res : subs) {
       AbstractClassInfo *r = res->resolve(ti);
       if(r) return r;
@@ -796,6 +923,25 @@ struct AbstractClassInfo
     ids.push_back(data[storeId].classId);
     for(auto &sub : subs) sub->addClassIds(storeId, ids);
   }
+
+private:
+  std::unique_ptr<const ClassIdTable> m_builtTables[MAX_DATABASES];
+  std::unique_ptr<const TypeTable> m_builtTypeTable;
+
+  static std::mutex &tablesMutex() {
+    static std::mutex mutex;
+    return mutex;
+  }
+
+  void addToTables(StoreId storeId, ClassIdTable &ids, TypeTable *types) {
+    ClassId cid = data[storeId].classId;
+    if(cid) {
+      if(ids.size() <= cid) ids.resize(cid + 1, nullptr);
+      if(!ids[cid]) ids[cid] = this;
+    }
+    if(types) types->emplace(std::type_index(typeinfo), this);
+    for(auto &sub : subs) sub->addToTables(storeId, ids, types);
+  }
 };
 
 namespace sub {
@@ -1007,6 +1153,16 @@ public:
     return traits_properties->objectIdAccess<T>();
   }
 
+  /**
+   * @return the classId of the runtime type of obj
+   */
+  static ClassId getClassId(StoreId storeId, T *obj)
+  {
+    const std::type_info &ti = typeid(*obj);
+    if(ti == traits_info->typeinfo) return traits_data(storeId).classId;
+    return RESOLVE_SUB_TI(ti)->data[storeId].classId;
+  }
+
   static size_t bufferSize(StoreId storeId, T *obj, ClassId *clsId=nullptr)
   {
     const std::type_info &ti = typeid(*obj);
@@ -1201,6 +1357,19 @@ public:
     value = acc->get(d);
   }
 
+  /**
+   * @return the address of the given property's member variable, or nullptr if the value can only be copied
+   * through put(). Must only be called after type resolution, such that pa->classId[storeId] == info->classId
+   */
+  template <typename TV>
+  static TV *address(StoreId storeId, T &d, const PropertyAccessBase *pa) {
+    if(pa->classId[storeId] != traits_data(storeId).classId)
+      throw error("internal error: type mismatch");
+
+    const PropertyAccess <T, TV> *acc = (const PropertyAccess <T, TV> *) pa;
+    return acc->address(d);
+  }
+
   /**
    * update the given property using value. Must only be called after type resolution, such
    * that pa->classId[storeId] == info->classId
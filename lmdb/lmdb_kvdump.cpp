@@ -57,6 +57,11 @@ static const unsigned PropertyId_off = flexis::persistence::kv::ClassId_sz + fle
 #define SK_OBJID(k) *(ObjectId *)(k+ObjectId_off)
 #define SK_PROPID(k) *(PropertyId *)(k+PropertyId_off)
 
+#define CK_CONSTR(nm, c, o, ch) byte_t nm[ChunkKey::byteSize]; *(ClassId *)nm = c; *(ObjectId *)(nm+ObjectId_off) = o; \
+*(ChunkId *)(nm+PropertyId_off) = ch
+
+#define CK_CHUNKID(k) *(ChunkId *)(k+PropertyId_off)
+
 using namespace std;
 using namespace flexis::persistence::lmdb;
 
@@ -126,11 +131,15 @@ struct DatabaseInfo
   ::lmdb::dbi m_dbi_data = 0;
 
   bool useLockFile = false;
+  unsigned pageSize = 0;
 
   vector<ClassInfo> classInfos;
   vector<TypeInfo> typeInfos;
   vector<kv::CollectionInfo *> collectionInfos;
 
+  //stored (allocated) size of each collection chunk
+  map<pair<ObjectId, ChunkId>, size_t> chunkSizes;
+
   DatabaseInfo(string location, string name, size_t mapsize) : m_env(::lmdb::env::create())
   {
     m_dbpath = location;
@@ -151,6 +160,7 @@ struct DatabaseInfo
 
     MDB_stat envstat;
     mdb_env_stat(m_env, &envstat);
+    pageSize = envstat.ms_psize;
 
     auto txn = ::lmdb::txn::begin(m_env, nullptr, MDB_RDONLY);
 
@@ -260,12 +270,19 @@ struct DatabaseInfo
       collectionInfos.push_back(info);
 
       info->collectionId = readBuf.readRaw<ObjectId>();
-      size_t sz = readBuf.readRaw<size_t>();
-      for(size_t i=0; i<sz; i++) {
-        PropertyId chunkId = readBuf.readRaw<PropertyId>();
+      info->elementCount = readBuf.readRaw<size_t>();
+
+      CK_CONSTR(ck, CHUNKINFO_CLSID, info->collectionId, 0);
+      ::lmdb::val chunkKey {ck, sizeof(ck)}, chunkVal;
+      auto chunkCursor = ::lmdb::cursor::open(txn, m_dbi_data);
+      for(bool ok = chunkCursor.get(chunkKey, chunkVal, MDB_SET_RANGE);
+          ok && SK_CLASSID(chunkKey.data<byte_t>()) == CHUNKINFO_CLSID && SK_OBJID(chunkKey.data<byte_t>()) == info->collectionId;
+          ok = chunkCursor.get(chunkKey, chunkVal, MDB_NEXT)) {
+        ChunkId chunkId = CK_CHUNKID(chunkKey.data<byte_t>());
         if(chunkId >= info->nextChunkId)
-          info->nextChunkId = chunkId + PropertyId(1);
+          info->nextChunkId = chunkId + 1;
 
+        readBuf.start(chunkVal.data<byte_t>(), chunkVal.size());
         size_t startIndex = readBuf.readRaw<size_t>();
         size_t elementCount = readBuf.readRaw<size_t>();
         if(startIndex + elementCount > info->nextStartIndex)
@@ -273,9 +290,20 @@ struct DatabaseInfo
 
         size_t dataSize = readBuf.readRaw<size_t>();
         info->chunkInfos.push_back(ChunkInfo(chunkId, startIndex, elementCount, dataSize));
+        info->chunkInfos.back().deletedCount = readBuf.readRaw<size_t>();
+        readChunkStats(readBuf, info->chunkInfos.back().stats);
       }
+      chunkCursor.close();
 
-      SK_CONSTR(sk, COLLINFO_CLSID, info->collectionId+1, 0);
+      for(auto &chunk : info->chunkInfos) {
+        CK_CONSTR(dk, COLLECTION_CLSID, info->collectionId, chunk.chunkId);
+        ::lmdb::val dataKey {dk, sizeof(dk)}, dataVal;
+        if(::lmdb::dbi_get(txn, m_dbi_data.handle(), dataKey, dataVal))
+          chunkSizes[make_pair(info->collectionId, chunk.chunkId)] = dataVal.size();
+      }
+
+      //continue with the next collection. The key buffer must outlive the loop body
+      SK_OBJID(sk) = info->collectionId+1;
       key.assign(sk, sizeof(sk));
     }
     cursor.close();
@@ -428,13 +456,31 @@ void dumpClassesMeta(DatabaseInfo &dbinfo, string opt)
   }
 }
 
+/**
+ * @return the number of pages occupied by a chunk of the given stored size. Chunks larger than one page go into
+ * overflow pages, which carry a page header
+ */
+size_t chunkPages(DatabaseInfo &dbinfo, size_t storedSize)
+{
+  return (storedSize + OverflowPageHeader_sz + dbinfo.pageSize - 1) / dbinfo.pageSize;
+}
+
 void dumpCollectionInfos(DatabaseInfo &dbinfo)
 {
   for(auto ci : dbinfo.collectionInfos) {
+    size_t minSize = 0, maxSize = 0, sumSize = 0;
+    for(auto &chunk : ci->chunkInfos) {
+      size_t size = dbinfo.chunkSizes[make_pair(ci->collectionId, chunk.chunkId)];
+      if(!minSize || size < minSize) minSize = size;
+      if(size > maxSize) maxSize = size;
+      sumSize += size;
+    }
     stringstream ss; ss << "(" << ci->collectionId << ")";
     cout << "collection " << setw(8) << ss.str();
     cout << setw(6) << ci->chunkInfos.size() << setw(12) << " chunks";
-    cout << setw(8) << ci->count() << " elements" << endl;
+    cout << setw(8) << ci->count() << " elements";
+    cout << "  chunk size min/avg/max: " << minSize << "/"
+         << (ci->chunkInfos.empty() ? 0 : sumSize / ci->chunkInfos.size()) << "/" << maxSize << endl;
   }
 }
 
@@ -476,7 +522,19 @@ void dumpCollectionInfo(DatabaseInfo &dbinfo, ObjectId collId)
     cout << "chunk " << setw(6) << ss.str();
     cout << "  startIndex: " << setw(8) << chunk.startIndex;
     cout << "  elementCount: " << setw(8) << chunk.elementCount;
-    cout << "  dataSize: " << setw(8) << chunk.dataSize << endl;
+    cout << "  deleted: " << setw(8) << chunk.deletedCount;
+    cout << "  dataSize: " << setw(8) << chunk.dataSize;
+
+    size_t storedSize = dbinfo.chunkSizes[make_pair(ci->collectionId, chunk.chunkId)];
+    cout << "  stored: " << setw(8) << storedSize;
+    cout << "  pages: " << setw(4) << chunkPages(dbinfo, storedSize);
+
+    //the element type is unknown here, so we can only show the raw values
+    if(chunk.stats.valid)
+      cout << "  stats: " << hex << chunk.stats.min << "/" << chunk.stats.max << dec << " sum: " << chunk.stats.sum;
+    if(chunk.stats.timed)
+      cout << "  time: " << chunk.stats.firstTime << "-" << chunk.stats.lastTime;
+    cout << endl;
   }
 }
 
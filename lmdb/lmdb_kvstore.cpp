@@ -32,6 +32,9 @@ using namespace persistence;
 
 static const char * CLASSDATA = "classdata";
 static const char * CLASSMETA = "classmeta";
+static const char * CLASSINDEX = "classindex";
+static const char * SPATIALINDEX = "spatialindex";
+static const char * REFERRERS = "referrers";
 
 static const unsigned ObjectId_off = ClassId_sz;
 static const unsigned PropertyId_off = ClassId_sz + ObjectId_sz;
@@ -49,6 +52,22 @@ static const unsigned PropertyId_off = ClassId_sz + ObjectId_sz;
 #define SK_OBJID(k) *(ObjectId *)(k+ObjectId_off)
 #define SK_PROPID(k) *(PropertyId *)(k+PropertyId_off)
 
+#define CK_CONSTR(nm, c, o, ch) byte_t nm[ChunkKey::byteSize]; *(ClassId *)nm = c; *(ObjectId *)(nm+ObjectId_off) = o; \
+*(ChunkId *)(nm+PropertyId_off) = ch
+
+#define CK_CHUNKID(k) *(ChunkId *)(k+PropertyId_off)
+
+//spatial index node key, big-endian so that the nodes of one index are adjacent
+#define SPK_CONSTR(nm, c, p, n) byte_t nm[ClassId_sz + PropertyId_sz + 4]; write_integer(nm, c, ClassId_sz); \
+write_integer(nm+ClassId_sz, p, PropertyId_sz); write_integer(nm+ClassId_sz+PropertyId_sz, n, 4)
+
+//referrer index key (target, referrer, property), big-endian so that the referrers of one target are adjacent
+static const unsigned ReferrerKey_sz = (ClassId_sz + ObjectId_sz) * 2 + PropertyId_sz;
+
+#define RFK_CONSTR(nm, t, r, p) byte_t nm[ReferrerKey_sz]; write_integer(nm, t.classId, ClassId_sz); \
+write_integer(nm+ClassId_sz, t.objectId, ObjectId_sz); write_integer(nm+ClassId_sz+ObjectId_sz, r.classId, ClassId_sz); \
+write_integer(nm+ClassId_sz*2+ObjectId_sz, r.objectId, ObjectId_sz); write_integer(nm+(ClassId_sz+ObjectId_sz)*2, p, PropertyId_sz)
+
 int key_compare(const MDB_val *a, const MDB_val *b)
 {
   byte_t *k1 = (byte_t *)a->mv_data;
@@ -63,7 +82,14 @@ int key_compare(const MDB_val *a, const MDB_val *b)
     if(c == 0) {
       k1 += ObjectId_sz;
       k2 += ObjectId_sz;
-      c = *(PropertyId *)k1 - *(PropertyId *)k2 ;
+      if(a->mv_size == ChunkKey::byteSize || b->mv_size == ChunkKey::byteSize) {
+        //chunk key. Compare the widened ids, then the key sizes
+        ChunkId id1 = a->mv_size == ChunkKey::byteSize ? *(ChunkId *)k1 : *(PropertyId *)k1;
+        ChunkId id2 = b->mv_size == ChunkKey::byteSize ? *(ChunkId *)k2 : *(PropertyId *)k2;
+        c = id1 < id2 ? -1 : (id1 > id2 ? 1 : (int)a->mv_size - (int)b->mv_size);
+      }
+      else
+        c = *(PropertyId *)k1 - *(PropertyId *)k2 ;
     }
   }
   return c;
@@ -174,6 +200,90 @@ public:
   ~ClassCursorHelper() {m_cursor.close();}
 };
 
+/**
+ * secondary index cursor backend. Iterates over the index entries within a key range and reads the referenced objects
+ * from the data db
+ */
+class IndexCursorHelper : public flexis::persistence::kv::CursorHelper
+{
+  ::lmdb::txn &m_txn;
+  ::lmdb::dbi &m_dbi;
+  ::lmdb::dbi &m_indexDbi;
+
+  ::lmdb::cursor m_cursor;
+  ::lmdb::val m_keyval;
+
+  const IndexKey m_lo, m_hi;
+
+  bool setCurrent()
+  {
+    const byte_t *key = m_keyval.data<byte_t>();
+    size_t size = m_keyval.size();
+
+    //stop at the upper bound
+    int c = memcmp(key, m_hi.data(), std::min(size, m_hi.size()));
+    if(c > 0 || (c == 0 && size > m_hi.size())) return false;
+
+    IndexKey::readObject(key, size, m_currentClassId, m_currentObjectId);
+    return true;
+  }
+
+protected:
+  bool start() override
+  {
+    m_keyval.assign(m_lo.data(), m_lo.size());
+    return m_cursor.get(m_keyval, MDB_SET_RANGE) && setCurrent();
+  }
+
+  bool next() override
+  {
+    return m_cursor.get(m_keyval, MDB_NEXT) && setCurrent();
+  }
+
+  bool erasable() override
+  {
+    return false;
+  }
+
+  bool erase() override
+  {
+    throw error("objects cannot be erased through an index cursor");
+  }
+
+  virtual void close() override {
+    m_cursor.close();
+  }
+
+  void get(ObjectKey &key, ReadBuf &rb) override
+  {
+    SK_CONSTR(sk, m_currentClassId, m_currentObjectId, 0);
+    ::lmdb::val k{sk, sizeof(sk)};
+    ::lmdb::val dataval{};
+    if(::lmdb::dbi_get(m_txn, m_dbi.handle(), k, dataval)) {
+      key.classId = m_currentClassId;
+      key.objectId = m_currentObjectId;
+      rb.start(dataval.data<byte_t>(), dataval.size());
+    }
+  }
+
+  void getObjectData(ObjectBuf &buf) override {
+    SK_CONSTR(sk, m_currentClassId, m_currentObjectId, 0);
+    ::lmdb::val k{sk, sizeof(sk)};
+    ::lmdb::val dataval{};
+    if(::lmdb::dbi_get(m_txn, m_dbi.handle(), k, dataval)) {
+      buf.key.classId = m_currentClassId;
+      buf.key.objectId = m_currentObjectId;
+      buf.start(dataval.data<byte_t>(), dataval.size());
+    }
+  }
+
+public:
+  IndexCursorHelper(::lmdb::txn &txn, ::lmdb::dbi &dbi, ::lmdb::dbi &indexDbi, const IndexKey &lo, const IndexKey &hi)
+      : m_txn(txn), m_dbi(dbi), m_indexDbi(indexDbi), m_cursor(::lmdb::cursor::open(m_txn, m_indexDbi)), m_lo(lo), m_hi(hi)
+  {}
+  ~IndexCursorHelper() {m_cursor.close();}
+};
+
 /**
  * cursor over collection chunks
  */
@@ -193,7 +303,7 @@ public:
       : m_txn(txn), m_dbi(dbi), m_cursor(::lmdb::cursor::open(txn, dbi)), m_classId(classId), m_objectId(objectId)
   {
     if(toEnd) {
-      SK_CONSTR(k, classId, objectId, 0xFFFF);
+      CK_CONSTR(k, classId, objectId, 0xFFFFFFFF);
       keyval.assign(k, sizeof(k));
 
       auto cursor = ::lmdb::cursor::open(m_txn, m_dbi);
@@ -207,29 +317,34 @@ public:
       m_atEnd = !(ok && SK_CLASSID(keyval.data<byte_t>()) == classId && SK_OBJID(keyval.data<byte_t>()) == objectId);
     }
     else {
-      SK_CONSTR(k, classId, objectId, 1);
+      CK_CONSTR(k, classId, objectId, 0);
       keyval.assign(k, sizeof(k));
 
-      m_atEnd = !m_cursor.get(keyval, dataval, MDB_SET);
+      m_atEnd = !m_cursor.get(keyval, dataval, MDB_SET_RANGE)
+                || SK_CLASSID(keyval.data<byte_t>()) != classId || SK_OBJID(keyval.data<byte_t>()) != objectId;
     }
   }
 
-  bool seek(PropertyId chunkId) override {
-    SK_CONSTR(k, m_classId, m_objectId, chunkId);
+  ChunkId chunkId() override {
+    return CK_CHUNKID(keyval.data<byte_t>());
+  }
+
+  bool seek(ChunkId chunkId) override {
+    CK_CONSTR(k, m_classId, m_objectId, chunkId);
     keyval.assign(k, sizeof(k));
 
-    m_atEnd = !m_cursor.get(keyval, dataval, MDB_SET);
+    m_atEnd = !m_cursor.get(keyval, dataval, MDB_SET_KEY);
     return m_atEnd;
   }
 
-  bool next(PropertyId *chunkId = nullptr) override {
+  bool next(ChunkId *chunkId = nullptr) override {
     m_atEnd = !m_cursor.get(keyval, dataval, MDB_NEXT);
 
     if(!m_atEnd)
       m_atEnd = SK_CLASSID(keyval.data<byte_t>()) != m_classId || SK_OBJID(keyval.data<byte_t>()) != m_objectId;
 
     if(chunkId && !m_atEnd)
-      *chunkId = SK_PROPID(keyval.data<byte_t>());
+      *chunkId = CK_CHUNKID(keyval.data<byte_t>());
 
     return !m_atEnd;
   }
@@ -297,6 +412,10 @@ protected:
     return true;
   }
 
+  bool erasable() override {
+    return false;
+  }
+
   bool erase() {
     throw error("not implemented");
   }
@@ -455,6 +574,9 @@ private:
 
   ::lmdb::txn m_txn;
   ::lmdb::dbi &m_dbi;
+  ::lmdb::dbi &m_indexDbi;
+  ::lmdb::dbi &m_spatialDbi;
+  ::lmdb::dbi &m_referrerDbi;
 
   Mode m_mode;
   bool m_closed = false;
@@ -462,34 +584,54 @@ private:
 protected:
   bool putData(ClassId classId, ObjectId objectId, PropertyId propertyId, WriteBuf &buf) override;
   bool putData(ObjectKey &key, WriteBuf &buf) override;
+  void putDataBatch(const byte_t *data, const BatchEntry *entries, size_t count) override;
+  bool putChunkData(ClassId classId, ObjectId objectId, ChunkId chunkId, WriteBuf &buf) override;
+  bool allocChunkData(ClassId classId, ObjectId objectId, ChunkId chunkId, size_t size, byte_t **data) override;
   bool allocData(ClassId classId, ObjectId objectId, PropertyId propertyId, size_t size, byte_t **data) override;
+  bool allocData(ObjectKey &key, size_t size, byte_t **data) override;
   void getData(ReadBuf &buf, ClassId classId, ObjectId objectId, PropertyId propertyId) override;
   void getData(ReadBuf &buf, ObjectKey &key, bool getRefount) override;
+  void getChunkData(ReadBuf &buf, ClassId classId, ObjectId objectId, ChunkId chunkId) override;
+  void getSpatialNode(ReadBuf &buf, ClassId classId, PropertyId propertyId, SpatialNodeId nodeId) override;
   bool remove(ClassId classId, ObjectId objectId) override;
   bool remove(ClassId classId, ObjectId objectId, PropertyId propertyId) override;
+  bool removeChunkData(ClassId classId, ObjectId objectId, ChunkId chunkId) override;
+  bool putIndexEntry(const IndexKey &key) override;
+  bool removeIndexEntry(const IndexKey &key) override;
+  bool putSpatialNode(ClassId classId, PropertyId propertyId, SpatialNodeId nodeId, WriteBuf &buf) override;
+  bool removeSpatialNode(ClassId classId, PropertyId propertyId, SpatialNodeId nodeId) override;
+  bool putReferrer(const ObjectKey &target, const ObjectKey &referrer, PropertyId propertyId) override;
+  bool removeReferrer(const ObjectKey &target, const ObjectKey &referrer, PropertyId propertyId) override;
+  void removeReferrers(const ObjectKey &target) override;
+  void loadReferrers(const ObjectKey &target, vector<Referrer> &referrers) override;
   void clearRefCounts(vector<ClassId> classes) override;
 
   ClassCursorHelper * _openCursor(const vector<ClassId> &classId) override;
   CollectionCursorHelper * _openCursor(ClassId classId, ObjectId collectionId) override;
   VectorCursorHelper * _openCursor(ClassId classId, ObjectId objectId, PropertyId propertyId) override;
+  IndexCursorHelper * _openIndexCursor(const IndexKey &lo, const IndexKey &hi) override;
 
-  bool _getCollectionData(CollectionInfo *info, size_t startIndex, size_t length, size_t elementSize,
+  bool _getCollectionData(const CollectionChunks *info, size_t startIndex, size_t length, size_t elementSize,
                           void **data, bool *owned) override;
 
-  bool lastChunk(ObjectId collectionId, PropertyId &chunkId, ::lmdb::val &data);
+  bool lastChunk(ObjectId collectionId, ChunkId &chunkId, ::lmdb::val &data);
   ChunkCursor::Ptr _openChunkCursor(ClassId classId, ObjectId objectId, bool atEnd) override;
 
   uint16_t decrementRefCount(ClassId cid, ObjectId oid) override;
 
 public:
-  Transaction(KeyValueStore &store, Mode mode, ::lmdb::env &env, ::lmdb::dbi &dbi, bool blockWrites=false)
+  Transaction(KeyValueStore &store, Mode mode, ::lmdb::env &env, ::lmdb::dbi &dbi, ::lmdb::dbi &indexDbi,
+              ::lmdb::dbi &spatialDbi, ::lmdb::dbi &referrerDbi, bool blockWrites=false)
       : flexis::persistence::kv::Transaction(store),
         flexis::persistence::kv::WriteTransaction(store, false),
         flexis::persistence::kv::ExclusiveReadTransaction(store),
-        m_mode(mode),
         m_env(env),
+        m_txn(::lmdb::txn::begin(env, nullptr, mode == Mode::read ? MDB_RDONLY : 0)),
         m_dbi(dbi),
-        m_txn(::lmdb::txn::begin(env, nullptr, mode == Mode::read ? MDB_RDONLY : 0))
+        m_indexDbi(indexDbi),
+        m_spatialDbi(spatialDbi),
+        m_referrerDbi(referrerDbi),
+        m_mode(mode)
   {
     setBlockWrites(blockWrites);
   }
@@ -500,6 +642,9 @@ public:
   void doAbort() override;
   void doReset() override;
   void doRenew() override;
+
+  TxnId txnId() override {return ::mdb_txn_id(m_txn);}
+  bool readOnly() override {return m_mode == Mode::read;}
 };
 
 /**
@@ -510,6 +655,9 @@ class KeyValueStoreImpl : public KeyValueStore
   ::lmdb::env m_env;
   ::lmdb::dbi m_dbi_meta = 0;
   ::lmdb::dbi m_dbi_data = 0;
+  ::lmdb::dbi m_dbi_index = 0;
+  ::lmdb::dbi m_dbi_spatial = 0;
+  ::lmdb::dbi m_dbi_referrers = 0;
 
   unsigned m_flags;
   weak_ptr<Transaction> writeTxn;
@@ -521,10 +669,32 @@ class KeyValueStoreImpl : public KeyValueStore
   unsigned m_maxKeySize;
   unsigned m_writeBlocks = 0;
 
+  //maximum object ids per class, read from the persisted counters or looked up upon class registration
+  std::map<ClassId, ObjectId> m_maxObjectIds;
+
+  //maximum class and collection ids as last saved with the counters
+  ClassId m_savedMaxClassId = 0;
+  ObjectId m_savedMaxCollectionId = 0;
+
   PropertyMetaInfoPtr make_propertyinfo(MDB_val *mdbVal);
   MDB_val make_propertyval(const PropertyAccessBase *prop);
   ObjectId findMaxObjectId(::lmdb::txn &txn, ClassId classId);
 
+  /**
+   * read the persisted id counters. The counters record holds the id of the transaction that wrote it. If that is not
+   * the last committed transaction, the database was changed since, either by a writer that did not maintain the
+   * record or by transactions that did not advance any counter. The counters must then be looked up again
+   *
+   * @return false if there is no valid counters record
+   */
+  bool loadCounters(::lmdb::txn &txn);
+
+  /**
+   * convert collections saved in the legacy format (16-bit chunk ids, 32-bit chunk header fields) to
+   * the current format
+   */
+  void migrateCollections(::lmdb::txn &txn);
+
 protected:
   void loadSaveClassMeta(
       StoreId storeId,
@@ -546,7 +716,17 @@ public:
   WriteTransactionPtr beginWrite(unsigned needsKBs) override;
 
   void transactionCompleted(Transaction::Mode mode, bool blockWrites);
-  size_t getOptimalChunkSize(size_t reserved) override {return m_pageSize - reserved;};
+
+  /**
+   * save the id counters within the given write transaction, if any of them advanced since they were last saved.
+   * Must be called by every write transaction before commit
+   *
+   * @param force save even if no counter advanced
+   */
+  void saveCounters(MDB_txn *txn, bool force=false);
+  size_t getOptimalChunkSize(size_t reserved, unsigned pages) override {
+    return m_pageSize * pages - OverflowPageHeader_sz - reserved;
+  };
 };
 
 KeyValueStore::Factory::operator flexis::persistence::KeyValueStore *() const
@@ -584,8 +764,8 @@ KeyValueStoreImpl::KeyValueStoreImpl(StoreId storeId, string location, string na
   //don't need to worry for existing files. LMDB will increase to committed size if neeed
   m_env.set_mapsize(m_curMapSize);
 
-  //classmeta + classdata db
-  m_env.set_max_dbs(2);
+  //classmeta + classdata + classindex + spatialindex + referrers db
+  m_env.set_max_dbs(5);
   m_flags = MDB_NOSUBDIR;
 
   if(!m_options.lockFile) m_flags |= MDB_NOLOCK;
@@ -613,23 +793,40 @@ KeyValueStoreImpl::KeyValueStoreImpl(StoreId storeId, string location, string na
   m_dbi_meta = ::lmdb::dbi::open(txn, CLASSMETA, MDB_DUPSORT | MDB_CREATE);
   m_dbi_meta.set_dupsort(txn, meta_dup_compare);
 
-  //find the maximum classId
-  ::lmdb::val key, val;
-
-  key.assign((byte_t *)0, 0);
-  val.assign((byte_t *)0, 0);
-  auto cursor = ::lmdb::cursor::open(txn, m_dbi_meta);
-  while (cursor.get(key, val, MDB_NEXT_NODUP)) {
-    ClassId cid = read_integer<ClassId>(val.data<byte_t>()+2, 2);
-    if(cid > m_maxClassId) m_maxClassId = cid;
-  }
-  cursor.close();
-
   //open/create the classdata database
   m_dbi_data = ::lmdb::dbi::open(txn, CLASSDATA, MDB_CREATE);
   m_dbi_data.set_compare(txn, key_compare);
 
-  m_maxCollectionId = findMaxObjectId(txn, COLLECTION_CLSID);
+  //open/create the secondary index database. Index keys are compared bytewise
+  m_dbi_index = ::lmdb::dbi::open(txn, CLASSINDEX, MDB_CREATE);
+
+  //open/create the spatial index database, which holds the R-tree nodes
+  m_dbi_spatial = ::lmdb::dbi::open(txn, SPATIALINDEX, MDB_CREATE);
+
+  //open/create the referrer index database. Keys are compared bytewise, values are empty
+  m_dbi_referrers = ::lmdb::dbi::open(txn, REFERRERS, MDB_CREATE);
+
+  migrateCollections(txn);
+
+  if(!loadCounters(txn)) {
+    //find the maximum classId
+    ::lmdb::val key, val;
+
+    key.assign((byte_t *)0, 0);
+    val.assign((byte_t *)0, 0);
+    auto cursor = ::lmdb::cursor::open(txn, m_dbi_meta);
+    while (cursor.get(key, val, MDB_NEXT_NODUP)) {
+      ClassId cid = read_integer<ClassId>(val.data<byte_t>()+2, 2);
+      if(cid > m_maxClassId) m_maxClassId = cid;
+    }
+    cursor.close();
+
+    m_maxCollectionId = findMaxObjectId(txn, COLLECTION_CLSID);
+
+    //object ids are looked up as classes are registered
+    m_maxObjectIds.clear();
+    saveCounters(txn, true);
+  }
 
   txn.commit();
 }
@@ -668,7 +865,8 @@ void KeyValueStoreImpl::transactionCompleted(Transaction::Mode mode, bool blockW
 
 ReadTransactionPtr KeyValueStoreImpl::beginRead()
 {
-  return ReadTransactionPtr(new Transaction(*this, Transaction::Mode::read, m_env, m_dbi_data, false));
+  return ReadTransactionPtr(
+      new Transaction(*this, Transaction::Mode::read, m_env, m_dbi_data, m_dbi_index, m_dbi_spatial, m_dbi_referrers, false));
 }
 
 ExclusiveReadTransactionPtr KeyValueStoreImpl::beginExclusiveRead()
@@ -677,7 +875,8 @@ ExclusiveReadTransactionPtr KeyValueStoreImpl::beginExclusiveRead()
   if(wtr && !wtr->isClosed()) throw invalid_argument("a write transaction is already running");
   m_writeBlocks++;
 
-  return ExclusiveReadTransactionPtr(new Transaction(*this, Transaction::Mode::read, m_env, m_dbi_data, true));
+  return ExclusiveReadTransactionPtr(
+      new Transaction(*this, Transaction::Mode::read, m_env, m_dbi_data, m_dbi_index, m_dbi_spatial, m_dbi_referrers, true));
 }
 
 WriteTransactionPtr KeyValueStoreImpl::beginWrite(unsigned needsKBs)
@@ -689,7 +888,8 @@ WriteTransactionPtr KeyValueStoreImpl::beginWrite(unsigned needsKBs)
   if(wtr && !wtr->isClosed()) throw invalid_argument("a write transaction is already running");
 
   checkAvailableSpace(needsKBs);
-  auto tptr = shared_ptr<Transaction>(new Transaction(*this, Transaction::Mode::write, m_env, m_dbi_data));
+  auto tptr = shared_ptr<Transaction>(
+      new Transaction(*this, Transaction::Mode::write, m_env, m_dbi_data, m_dbi_index, m_dbi_spatial, m_dbi_referrers));
   writeTxn = tptr;
 
   return tptr;
@@ -697,6 +897,7 @@ WriteTransactionPtr KeyValueStoreImpl::beginWrite(unsigned needsKBs)
 
 void Transaction::doCommit()
 {
+  if(m_mode == Mode::write) ((KeyValueStoreImpl *)&store)->saveCounters(m_txn);
   m_txn.commit();
   m_closed = true;
   ((KeyValueStoreImpl *)&store)->transactionCompleted(m_mode, m_blockWrites);
@@ -721,6 +922,8 @@ void Transaction::doRenew()
 
 bool Transaction::putData(ClassId classId, ObjectId objectId, PropertyId propertyId, WriteBuf &buf)
 {
+  touchCached(classId, objectId);
+
   SK_CONSTR(kv, classId, objectId, propertyId);
   ::lmdb::val k{kv, sizeof(kv)};
   ::lmdb::val v{buf.data(), buf.size()};
@@ -730,6 +933,8 @@ bool Transaction::putData(ClassId classId, ObjectId objectId, PropertyId propert
 
 bool Transaction::putData(ObjectKey &key, WriteBuf &buf)
 {
+  touchCached(key.classId, key.objectId);
+
   //object shallow buffer under propertyId == 0
   SK_CONSTR(kv, key.classId, key.objectId, 0);
   ::lmdb::val k{kv, sizeof(kv)};
@@ -746,12 +951,111 @@ bool Transaction::putData(ObjectKey &key, WriteBuf &buf)
   return true;
 }
 
+/**
+ * put a value through a cursor, appending if possible. If LMDB rejects the append because the key does not sort
+ * behind the last one, the value is put regularly and appending is switched off
+ */
+static void cursorPut(MDB_cursor *cursor, ::lmdb::val &k, ::lmdb::val &v, bool &append)
+{
+  if(append) {
+    int rc = ::mdb_cursor_put(cursor, k, v, MDB_APPEND);
+    if(rc == MDB_SUCCESS) return;
+    if(rc != MDB_KEYEXIST) ::lmdb::error::raise("mdb_cursor_put", rc);
+    append = false;
+  }
+  ::lmdb::cursor_put(cursor, k, v, 0);
+}
+
+void Transaction::putDataBatch(const byte_t *data, const BatchEntry *entries, size_t count)
+{
+  if(!count) return;
+
+  ::lmdb::cursor cursor = ::lmdb::cursor::open(m_txn, m_dbi);
+
+  //entries behind the last stored key can be appended without a tree search. Since the entries are sorted,
+  //all entries following the first such entry can be appended as well
+  ::lmdb::val lk, lv;
+  bool append = !cursor.get(lk, lv, MDB_LAST);
+
+  for(size_t i=0; i<count; i++) {
+    const BatchEntry &entry = entries[i];
+    ObjectKey &key = *entry.key;
+    touchCached(key.classId, key.objectId);
+
+    SK_CONSTR(kv, key.classId, key.objectId, 0);
+    ::lmdb::val k{kv, sizeof(kv)};
+    ::lmdb::val v{data + entry.offset, entry.size};
+    if(!append) append = key_compare(k, lk) > 0;
+
+    cursorPut(cursor.handle(), k, v, append);
+
+    if(key.refcount) {
+      //object refcount under propertyId == 1
+      SK_PROPID(kv) = 1;
+      k.assign(kv, sizeof(kv));
+      v.assign(&key.refcount, sizeof(key.refcount));
+      cursorPut(cursor.handle(), k, v, append);
+    }
+  }
+}
+
 bool Transaction::allocData(ClassId classId, ObjectId objectId, PropertyId propertyId, size_t size, byte_t **data)
 {
+  touchCached(classId, objectId);
+
   SK_CONSTR(kv, classId, objectId, propertyId);
   ::lmdb::val k{kv, sizeof(kv)};
   ::lmdb::val v{nullptr, size};
 
+  if(::lmdb::dbi_put(m_txn, m_dbi.handle(), k, v, m_append ? MDB_APPEND | MDB_RESERVE : MDB_RESERVE)) {
+    *data = v.data<byte_t>();
+    return true;
+  }
+  return false;
+}
+
+bool Transaction::allocData(ObjectKey &key, size_t size, byte_t **data)
+{
+  touchCached(key.classId, key.objectId);
+
+  SK_CONSTR(kv, key.classId, key.objectId, 0);
+  ::lmdb::val k{kv, sizeof(kv)};
+  ::lmdb::val v{};
+
+  if(key.refcount) {
+    //object refcount under propertyId == 1. Written first, so that the reserved memory stays valid
+    SK_PROPID(kv) = 1;
+    k.assign(kv, sizeof(kv));
+    v.assign(&key.refcount, sizeof(key.refcount));
+    if(!::lmdb::dbi_put(m_txn, m_dbi.handle(), k, v, 0)) return false;
+
+    SK_PROPID(kv) = 0;
+    k.assign(kv, sizeof(kv));
+  }
+
+  //object shallow buffer under propertyId == 0
+  v.assign((byte_t *)nullptr, size);
+  if(::lmdb::dbi_put(m_txn, m_dbi.handle(), k, v, m_append && !key.refcount ? MDB_APPEND | MDB_RESERVE : MDB_RESERVE)) {
+    *data = v.data<byte_t>();
+    return true;
+  }
+  return false;
+}
+
+bool Transaction::putChunkData(ClassId classId, ObjectId objectId, ChunkId chunkId, WriteBuf &buf)
+{
+  CK_CONSTR(kv, classId, objectId, chunkId);
+  ::lmdb::val k{kv, sizeof(kv)};
+  ::lmdb::val v{buf.data(), buf.size()};
+  return ::lmdb::dbi_put(m_txn, m_dbi.handle(), k, v, 0);
+}
+
+bool Transaction::allocChunkData(ClassId classId, ObjectId objectId, ChunkId chunkId, size_t size, byte_t **data)
+{
+  CK_CONSTR(kv, classId, objectId, chunkId);
+  ::lmdb::val k{kv, sizeof(kv)};
+  ::lmdb::val v{nullptr, size};
+
   if(::lmdb::dbi_put(m_txn, m_dbi.handle(), k, v, MDB_RESERVE)) {
     *data = v.data<byte_t>();
     return true;
@@ -768,6 +1072,24 @@ void Transaction::getData(ReadBuf &buf, ClassId classId, ObjectId objectId, Prop
     buf.start(v.data<byte_t>(), v.size());
 }
 
+void Transaction::getChunkData(ReadBuf &buf, ClassId classId, ObjectId objectId, ChunkId chunkId)
+{
+  CK_CONSTR(kv, classId, objectId, chunkId);
+  ::lmdb::val k{kv, sizeof(kv)};
+  ::lmdb::val v{};
+  if(::lmdb::dbi_get(m_txn, m_dbi.handle(), k, v))
+    buf.start(v.data<byte_t>(), v.size());
+}
+
+void Transaction::getSpatialNode(ReadBuf &buf, ClassId classId, PropertyId propertyId, SpatialNodeId nodeId)
+{
+  SPK_CONSTR(kv, classId, propertyId, nodeId);
+  ::lmdb::val k{kv, sizeof(kv)};
+  ::lmdb::val v{};
+  if(::lmdb::dbi_get(m_txn, m_spatialDbi.handle(), k, v))
+    buf.start(v.data<byte_t>(), v.size());
+}
+
 void Transaction::getData(ReadBuf &buf, ObjectKey &key, bool getRefcount)
 {
   SK_CONSTR(kv, key.classId, key.objectId, 0);
@@ -788,6 +1110,8 @@ void Transaction::getData(ReadBuf &buf, ObjectKey &key, bool getRefcount)
 
 bool Transaction::remove(ClassId classId, ObjectId objectId)
 {
+  touchCached(classId, objectId);
+
   SK_CONSTR(kv, classId, objectId, 1);
   ::lmdb::val k{kv, sizeof(kv)};
   ::lmdb::dbi_del(m_txn, m_dbi.handle(), k);
@@ -799,11 +1123,102 @@ bool Transaction::remove(ClassId classId, ObjectId objectId)
 
 bool Transaction::remove(ClassId classId, ObjectId objectId, PropertyId propertyId)
 {
+  touchCached(classId, objectId);
+
   SK_CONSTR(kv, classId, objectId, propertyId);
   ::lmdb::val k{kv, sizeof(kv)};
   return ::lmdb::dbi_del(m_txn, m_dbi.handle(), k);
 }
 
+bool Transaction::removeChunkData(ClassId classId, ObjectId objectId, ChunkId chunkId)
+{
+  CK_CONSTR(kv, classId, objectId, chunkId);
+  ::lmdb::val k{kv, sizeof(kv)};
+  return ::lmdb::dbi_del(m_txn, m_dbi.handle(), k);
+}
+
+bool Transaction::putIndexEntry(const IndexKey &key)
+{
+  if(key.size() > ::lmdb::env_get_max_keysize(m_env.handle()))
+    throw error("indexed value exceeds the maximum key size");
+
+  ::lmdb::val k{key.data(), key.size()};
+  ::lmdb::val v{nullptr, 0};
+  return ::lmdb::dbi_put(m_txn, m_indexDbi.handle(), k, v, 0);
+}
+
+bool Transaction::removeIndexEntry(const IndexKey &key)
+{
+  if(key.size() > ::lmdb::env_get_max_keysize(m_env.handle()))
+    throw error("indexed value exceeds the maximum key size");
+
+  ::lmdb::val k{key.data(), key.size()};
+  return ::lmdb::dbi_del(m_txn, m_indexDbi.handle(), k);
+}
+
+bool Transaction::putSpatialNode(ClassId classId, PropertyId propertyId, SpatialNodeId nodeId, WriteBuf &buf)
+{
+  SPK_CONSTR(kv, classId, propertyId, nodeId);
+  ::lmdb::val k{kv, sizeof(kv)};
+  ::lmdb::val v{buf.data(), buf.size()};
+  return ::lmdb::dbi_put(m_txn, m_spatialDbi.handle(), k, v, 0);
+}
+
+bool Transaction::removeSpatialNode(ClassId classId, PropertyId propertyId, SpatialNodeId nodeId)
+{
+  SPK_CONSTR(kv, classId, propertyId, nodeId);
+  ::lmdb::val k{kv, sizeof(kv)};
+  return ::lmdb::dbi_del(m_txn, m_spatialDbi.handle(), k);
+}
+
+bool Transaction::putReferrer(const ObjectKey &target, const ObjectKey &referrer, PropertyId propertyId)
+{
+  RFK_CONSTR(kv, target, referrer, propertyId);
+  ::lmdb::val k{kv, sizeof(kv)};
+  ::lmdb::val v{nullptr, 0};
+  return ::lmdb::dbi_put(m_txn, m_referrerDbi.handle(), k, v, 0);
+}
+
+bool Transaction::removeReferrer(const ObjectKey &target, const ObjectKey &referrer, PropertyId propertyId)
+{
+  RFK_CONSTR(kv, target, referrer, propertyId);
+  ::lmdb::val k{kv, sizeof(kv)};
+  return ::lmdb::dbi_del(m_txn, m_referrerDbi.handle(), k);
+}
+
+void Transaction::removeReferrers(const ObjectKey &target)
+{
+  RFK_CONSTR(kv, target, ObjectKey::NIL, 0);
+  static const unsigned prefix_sz = ClassId_sz + ObjectId_sz;
+
+  auto cursor = ::lmdb::cursor::open(m_txn, m_referrerDbi);
+  ::lmdb::val k{kv, sizeof(kv)};
+  bool found = cursor.get(k, nullptr, MDB_SET_RANGE);
+  while(found && k.size() == ReferrerKey_sz && memcmp(k.data(), kv, prefix_sz) == 0) {
+    cursor.del();
+    found = cursor.get(k, nullptr, MDB_NEXT);
+  }
+  cursor.close();
+}
+
+void Transaction::loadReferrers(const ObjectKey &target, vector<Referrer> &referrers)
+{
+  RFK_CONSTR(kv, target, ObjectKey::NIL, 0);
+  static const unsigned prefix_sz = ClassId_sz + ObjectId_sz;
+
+  auto cursor = ::lmdb::cursor::open(m_txn, m_referrerDbi);
+  ::lmdb::val k{kv, sizeof(kv)};
+  bool found = cursor.get(k, nullptr, MDB_SET_RANGE);
+  while(found && k.size() == ReferrerKey_sz && memcmp(k.data(), kv, prefix_sz) == 0) {
+    byte_t *rk = k.data<byte_t>() + prefix_sz;
+    referrers.push_back(Referrer(read_integer<ClassId>(rk, ClassId_sz),
+                                 read_integer<ObjectId>(rk + ClassId_sz, ObjectId_sz),
+                                 read_integer<PropertyId>(rk + ClassId_sz + ObjectId_sz, PropertyId_sz)));
+    found = cursor.get(k, nullptr, MDB_NEXT);
+  }
+  cursor.close();
+}
+
 uint16_t Transaction::decrementRefCount(ClassId cid, ObjectId oid)
 {
   auto cursor = ::lmdb::cursor::open(m_txn, m_dbi);
@@ -847,9 +1262,9 @@ ChunkCursor::Ptr Transaction::_openChunkCursor(ClassId classId, ObjectId objectI
   return ChunkCursor::Ptr(new ChunkCursorImpl(m_txn, m_dbi, classId, objectId, atEnd));
 }
 
-bool Transaction::lastChunk(ObjectId collectionId, PropertyId &chunkId, ::lmdb::val &data)
+bool Transaction::lastChunk(ObjectId collectionId, ChunkId &chunkId, ::lmdb::val &data)
 {
-  SK_CONSTR(k, COLLECTION_CLSID, collectionId, 0xFFFF);
+  CK_CONSTR(k, COLLECTION_CLSID, collectionId, 0xFFFFFFFF);
   ::lmdb::val key {k, sizeof(k)};
 
   auto cursor = ::lmdb::cursor::open(m_txn, m_dbi);
@@ -861,7 +1276,7 @@ bool Transaction::lastChunk(ObjectId collectionId, PropertyId &chunkId, ::lmdb::
     ok = cursor.get(key, data, MDB_LAST);
 
   if(ok && SK_CLASSID(key.data<byte_t>()) == COLLECTION_CLSID && SK_OBJID(key.data<byte_t>()) == collectionId) {
-    chunkId = SK_PROPID(key.data<byte_t>());
+    chunkId = CK_CHUNKID(key.data<byte_t>());
     return true;
   }
   return false;
@@ -872,7 +1287,7 @@ bool check_chunkinfo(const ChunkInfo &run, const ChunkInfo &ref)
   return run.startIndex + run.elementCount - 1 < ref.startIndex;
 }
 
-bool Transaction::_getCollectionData(CollectionInfo *info, size_t startIndex, size_t length,
+bool Transaction::_getCollectionData(const CollectionChunks *info, size_t startIndex, size_t length,
                                      size_t elementSize, void **data, bool *owned)
 {
   ChunkInfo chunk(0, startIndex);
@@ -883,7 +1298,7 @@ bool Transaction::_getCollectionData(CollectionInfo *info, size_t startIndex, si
     if(findEnd != info->chunkInfos.cend()) {
       ::lmdb::val keyval, startval, endval;
 
-      SK_CONSTR(k, COLLECTION_CLSID, info->collectionId, findStart->chunkId);
+      CK_CONSTR(k, COLLECTION_CLSID, info->collectionId, findStart->chunkId);
       keyval.assign(k, sizeof(k));
       if(!m_dbi.get(m_txn, keyval, startval)) return false;
 
@@ -904,7 +1319,7 @@ bool Transaction::_getCollectionData(CollectionInfo *info, size_t startIndex, si
         for(auto fs=findStart+1; fs != findEnd; fs++)
           datalen += fs->dataSize - ChunkHeader_sz;
 
-        SK_CONSTR(k, COLLECTION_CLSID, info->collectionId, findEnd->chunkId);
+        CK_CONSTR(k, COLLECTION_CLSID, info->collectionId, findEnd->chunkId);
         keyval.assign(k, sizeof(k));
         if(!m_dbi.get(m_txn, keyval, endval)) return false;
 
@@ -923,7 +1338,7 @@ bool Transaction::_getCollectionData(CollectionInfo *info, size_t startIndex, si
         dta += startlen;
 
         for(auto fs=findStart+1; fs != findEnd; fs++) {
-          SK_CONSTR(k, COLLECTION_CLSID, info->collectionId, fs->chunkId);
+          CK_CONSTR(k, COLLECTION_CLSID, info->collectionId, fs->chunkId);
           keyval.assign(k, sizeof(k));
           ::lmdb::val dataval;
           if(!m_dbi.get(m_txn, keyval, dataval)) return false;
@@ -954,6 +1369,63 @@ CollectionCursorHelper * Transaction::_openCursor(ClassId classId, ObjectId coll
   return new CollectionCursorHelper(m_txn, m_dbi, classId, collectionId);
 }
 
+IndexCursorHelper * Transaction::_openIndexCursor(const IndexKey &lo, const IndexKey &hi)
+{
+  return new IndexCursorHelper(m_txn, m_dbi, m_indexDbi, lo, hi);
+}
+
+bool KeyValueStoreImpl::loadCounters(::lmdb::txn &txn)
+{
+  SK_CONSTR(kv, COUNTERS_CLSID, 0, 0);
+  ::lmdb::val k{kv, sizeof(kv)};
+  ::lmdb::val v;
+  if(!::lmdb::dbi_get(txn, m_dbi_data.handle(), k, v)) return false;
+
+  MDB_envinfo envinfo;
+  mdb_env_info(m_env, &envinfo);
+
+  ReadBuf buf(v.data<byte_t>(), v.size());
+  if(v.size() < sizeof(uint64_t) || buf.readRaw<uint64_t>() != envinfo.me_last_txnid) return false;
+
+  m_maxClassId = m_savedMaxClassId = buf.readRaw<ClassId>();
+  m_maxCollectionId = m_savedMaxCollectionId = buf.readRaw<ObjectId>();
+  while(!buf.atEnd()) {
+    ClassId classId = buf.readRaw<ClassId>();
+    m_maxObjectIds[classId] = buf.readRaw<ObjectId>();
+  }
+  return true;
+}
+
+void KeyValueStoreImpl::saveCounters(MDB_txn *txn, bool force)
+{
+  //counters only grow, so they have advanced if any of them is past its saved value
+  if(!force && m_maxClassId == m_savedMaxClassId && m_maxCollectionId == m_savedMaxCollectionId &&
+     !maxObjectIdsAdvanced(m_maxObjectIds))
+    return;
+
+  collectMaxObjectIds(m_maxObjectIds);
+  m_savedMaxClassId = m_maxClassId;
+  m_savedMaxCollectionId = m_maxCollectionId;
+
+  SK_CONSTR(kv, COUNTERS_CLSID, 0, 0);
+  ::lmdb::val k{kv, sizeof(kv)};
+
+  //this transaction's id becomes the last committed id once it commits
+  uint64_t txnid = mdb_txn_id(txn);
+
+  WriteBuf buf(sizeof(uint64_t) + ClassId_sz + ObjectId_sz + m_maxObjectIds.size() * (ClassId_sz + ObjectId_sz));
+  buf.appendRaw(txnid);
+  buf.appendRaw(m_maxClassId);
+  buf.appendRaw(m_maxCollectionId);
+  for(auto &maxId : m_maxObjectIds) {
+    buf.appendRaw(maxId.first);
+    buf.appendRaw(maxId.second);
+  }
+
+  ::lmdb::val v{buf.data(), buf.size()};
+  ::lmdb::dbi_put(txn, m_dbi_data.handle(), k, v, 0);
+}
+
 ObjectId KeyValueStoreImpl::findMaxObjectId(::lmdb::txn &txn, ClassId classId)
 {
   ObjectId maxId = 0;
@@ -980,6 +1452,89 @@ ObjectId KeyValueStoreImpl::findMaxObjectId(::lmdb::txn &txn, ClassId classId)
   return maxId;
 }
 
+void KeyValueStoreImpl::migrateCollections(::lmdb::txn &txn)
+{
+  static const size_t LegacyChunkHeader_sz = 4 * 3;
+  static const size_t headerDelta = ChunkHeader_sz - LegacyChunkHeader_sz;
+
+  auto cursor = ::lmdb::cursor::open(txn, m_dbi_data);
+
+  SK_CONSTR(k, LEGACY_COLLINFO_CLSID, 0, 0);
+  ::lmdb::val key {k, sizeof(k)}, val;
+
+  //legacy infos are deleted as we go, so the first one is always at the start of the class range
+  while(cursor.get(key, val, MDB_SET_RANGE) && SK_CLASSID(key.data<byte_t>()) == LEGACY_COLLINFO_CLSID) {
+    ObjectId collectionId = SK_OBJID(key.data<byte_t>());
+
+    ReadBuf readBuf(val.data<byte_t>(), val.size());
+    readBuf.readRaw<ObjectId>();
+    size_t numChunks = readBuf.readRaw<size_t>();
+
+    vector<ChunkInfo> chunkInfos;
+    size_t elementCount = 0;
+    for(size_t i=0; i<numChunks; i++) {
+      ChunkInfo ci;
+      ci.chunkId = readBuf.readRaw<PropertyId>();
+      ci.startIndex = readBuf.readRaw<size_t>();
+      ci.elementCount = readBuf.readRaw<size_t>();
+      ci.dataSize = readBuf.readRaw<size_t>() + headerDelta;
+      chunkInfos.push_back(ci);
+      elementCount += ci.elementCount;
+    }
+    cursor.del();
+
+    for(auto &ci : chunkInfos) {
+      SK_CONSTR(lk, LEGACY_COLLECTION_CLSID, collectionId, (PropertyId)ci.chunkId);
+      ::lmdb::val legacyKey {lk, sizeof(lk)}, legacyVal;
+      if(!::lmdb::dbi_get(txn, m_dbi_data.handle(), legacyKey, legacyVal))
+        throw error("collection migration: chunk not found");
+
+      //copy away, the pointer is not valid across writes
+      vector<byte_t> chunk(legacyVal.data<byte_t>(), legacyVal.data<byte_t>() + legacyVal.size());
+      size_t dataSize = read_integer<size_t>(chunk.data(), 4);
+
+      CK_CONSTR(ck, COLLECTION_CLSID, collectionId, ci.chunkId);
+      ::lmdb::val chunkKey {ck, sizeof(ck)}, chunkVal {nullptr, chunk.size() + headerDelta};
+      ::lmdb::dbi_put(txn, m_dbi_data.handle(), chunkKey, chunkVal, MDB_RESERVE);
+
+      byte_t *data = chunkVal.data<byte_t>();
+      write_integer(data, dataSize + headerDelta, 4);
+      write_integer(data+4, ci.startIndex, 8);
+      write_integer(data+12, ci.elementCount, 4);
+      memcpy(data + ChunkHeader_sz, chunk.data() + LegacyChunkHeader_sz, chunk.size() - LegacyChunkHeader_sz);
+
+      ::lmdb::dbi_del(txn, m_dbi_data.handle(), legacyKey);
+
+      //element offsets are relative to the old header, drop them. Readers will scan instead
+      SK_CONSTR(ik, COLLINDEX_CLSID, collectionId, (PropertyId)ci.chunkId);
+      ::lmdb::val indexKey {ik, sizeof(ik)};
+      ::lmdb::dbi_del(txn, m_dbi_data.handle(), indexKey);
+    }
+
+    for(auto &ci : chunkInfos) {
+      WriteBuf writeBuf(4 * sizeof(size_t));
+      writeBuf.appendRaw(ci.startIndex);
+      writeBuf.appendRaw(ci.elementCount);
+      writeBuf.appendRaw(ci.dataSize);
+      writeBuf.appendRaw(ci.deletedCount);
+
+      CK_CONSTR(ck, CHUNKINFO_CLSID, collectionId, ci.chunkId);
+      ::lmdb::val chunkKey {ck, sizeof(ck)}, chunkVal {writeBuf.data(), writeBuf.size()};
+      ::lmdb::dbi_put(txn, m_dbi_data.handle(), chunkKey, chunkVal, 0);
+    }
+
+    WriteBuf writeBuf(ObjectId_sz + sizeof(size_t));
+    writeBuf.appendRaw(collectionId);
+    writeBuf.appendRaw(elementCount);
+    SK_CONSTR(nk, COLLINFO_CLSID, collectionId, 0);
+    ::lmdb::val infoKey {nk, sizeof(nk)}, infoVal {writeBuf.data(), writeBuf.size()};
+    ::lmdb::dbi_put(txn, m_dbi_data.handle(), infoKey, infoVal, 0);
+
+    key.assign(k, sizeof(k));
+  }
+  cursor.close();
+}
+
 KeyValueStoreBase::PropertyMetaInfoPtr KeyValueStoreImpl::make_propertyinfo(MDB_val *mdbVal)
 {
   byte_t *readPtr = (byte_t *)mdbVal->mv_data;
@@ -1067,8 +1622,12 @@ void KeyValueStoreImpl::loadSaveClassMeta(
     }
     cursor.close();
 
+    //classes missing from the counters have not been registered since the counters were (re)built
+    auto it = m_maxObjectIds.find(cdata.classId);
+    ObjectId maxoid = it != m_maxObjectIds.end() ? it->second : findMaxObjectId(txn, cdata.classId);
+    m_maxObjectIds[cdata.classId] = maxoid;
+
     //if multiple databases use the same ClassData, we must use the maximum value
-    ObjectId maxoid = findMaxObjectId(txn, cdata.classId);
     if(maxoid > classInfo->data[id].maxObjectId)
       classInfo->data[id].maxObjectId = maxoid;
 
@@ -1100,6 +1659,8 @@ void KeyValueStoreImpl::loadSaveClassMeta(
       ::lmdb::dbi_put(txn, m_dbi_meta.handle(), (MDB_val *)key, &val, 0);
       free(val.mv_data);
     }
+    m_maxObjectIds[cdata.classId] = 0;
+    saveCounters(txn);
     txn.commit();
 
     classInfo->data[id].maxObjectId = 0;
@@ -26,6 +26,12 @@ namespace flexis {
 namespace persistence {
 namespace lmdb {
 
+/**
+ * size of the header LMDB writes in front of a value stored in overflow pages (PAGEHDRSZ in mdb.c). A value fills
+ * a whole number of overflow pages if its size plus this header is a multiple of the page size
+ */
+static const size_t OverflowPageHeader_sz = sizeof(size_t) + 2 * sizeof(uint16_t) + sizeof(uint32_t);
+
 class KeyValueStore : public flexis::persistence::KeyValueStore
 {
 public:
@@ -71,6 +77,19 @@ struct StorageKey
       : classId(classId), objectId(objectId), propertyId(propertyId) {}
 };
 
+/**
+ * a storage key for collection chunks. Same layout as StorageKey, but with a 32-bit chunk id in place of
+ * the property id. This structure must not be changed (lest db files become unreadable)
+ */
+struct ChunkKey
+{
+  static const unsigned byteSize = kv::ClassId_sz + kv::ObjectId_sz + kv::ChunkId_sz;
+
+  kv::ClassId classId;
+  kv::ObjectId objectId;
+  kv::ChunkId chunkId;
+};
+
 } //lmdb
 } //persistence
 } //flexis
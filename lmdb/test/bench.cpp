@@ -23,6 +23,7 @@
 #include <iostream>
 #include <chrono>
 #include <cassert>
+#include <cmath>
 #include "testclasses.h"
 
 using namespace flexis::persistence;
@@ -195,6 +196,68 @@ void benchDataCollection(KeyValueStore *kv)
   }
 }
 
+void benchDataAggregates(KeyValueStore *kv)
+{
+  static const size_t count = 4000000;
+  ObjectId collectionId = 0;
+  {
+    auto wtxn = kv->beginWrite();
+
+    double buf[1000];
+    auto appender = wtxn->appendDataCollection<double>(collectionId);
+    for(size_t i=0; i<count; i+=1000) {
+      for(auto j=0; j<1000; j++) buf[j] = (i + j) % 997 * 0.25;
+      appender->put(buf, 1000);
+    }
+    appender->close();
+
+    wtxn->commit();
+  }
+  double naiveMean, naiveVariance;
+  {
+    //naive loop over a copy of the data
+    cout << "aggregates naive: ";
+    BEG()
+    auto rtxn = kv->beginRead();
+
+    double *data = nullptr;
+    bool owned = false;
+    rtxn->getDataCollection(collectionId, 0, count, data, &owned);
+
+    double sum = 0, min = data[0], max = data[0];
+    for(size_t i=0; i<count; i++) {
+      sum += data[i];
+      if(data[i] < min) min = data[i];
+      if(data[i] > max) max = data[i];
+    }
+    naiveMean = sum / count;
+    double m2 = 0;
+    for(size_t i=0; i<count; i++) m2 += (data[i] - naiveMean) * (data[i] - naiveMean);
+    naiveVariance = m2 / count;
+
+    if(owned) free(data);
+    rtxn->end();
+    DUR()
+  }
+  {
+    cout << "aggregates builtin: ";
+    BEG()
+    auto rtxn = kv->beginRead();
+
+    auto agg = rtxn->aggregateDataCollection<double>(collectionId);
+    assert(agg.count == count && agg.min == 0 && agg.max == 996 * 0.25);
+    assert(fabs(agg.mean() - naiveMean) < 1e-6 && fabs(agg.variance() - naiveVariance) < 1e-3);
+
+    rtxn->end();
+    DUR()
+  }
+  {
+    auto wtxn = kv->beginWrite();
+    wtxn->deleteCollection(collectionId);
+    wtxn->commit();
+  }
+}
+
 void benchObjectCollection(KeyValueStore *kv)
 {
   ObjectId collectionId = 0;
@@ -405,6 +468,7 @@ int main()
   benchColored2DPointRead(kv);
   benchValueCollection(kv);
   benchDataCollection(kv);
+  benchDataAggregates(kv);
   benchObjectCollection(kv);
 
   delete kv;
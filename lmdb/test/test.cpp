@@ -4,10 +4,20 @@
 
 #include <cassert>
 #include <sstream>
+#include <thread>
+#include <atomic>
+#include <cmath>
 #include <kvstore.h>
 #include <lmdb/lmdb_kvstore.h>
+#include <lmdb/liblmdb/lmdb.h>
 #include "testclasses.h"
 
+namespace flexis {
+namespace persistence {
+namespace lmdb {
+int key_compare(const MDB_val *a, const MDB_val *b);
+}}}
+
 using namespace flexis::persistence;
 using namespace flexis::persistence::kv;
 using namespace flexis;
@@ -708,6 +718,38 @@ void testDataCollection1(KeyValueStore *kv)
 
     rtxn->end();
   }
+
+  {
+    //zero-copy access to data straddling chunks
+    auto rtxn = kv->beginExclusiveRead();
+
+    auto segments = rtxn->getDataSegments<double>(collectionId2, 500, 1000);
+    assert(segments.size() == 2);
+    assert(segments[0].count == 500 && segments[1].count == 500);
+    assert(segments[0].data[0] == 1.44 * 500 && segments[1].data[499] == 4.44 * 499);
+
+    segments = rtxn->getDataSegments<double>(collectionId2, 1990, 100);
+    assert(segments.size() == 1 && segments[0].count == 10);
+
+    size_t index = 500;
+    bool ok = true;
+    size_t visited = rtxn->visitDataCollection<double>(collectionId2, 500, 1000, [&](const DataSpan<double> &span) {
+      for(double d : span) {
+        ok = ok && d == (index < 1000 ? 1.44 * index : 4.44 * (index - 1000));
+        index++;
+      }
+      return true;
+    });
+    assert(visited == 1000 && index == 1500 && ok);
+
+    //stop after the first span
+    visited = rtxn->visitDataCollection<double>(collectionId2, 0, 2000, [](const DataSpan<double> &span) {
+      return false;
+    });
+    assert(visited == 1000);
+
+    rtxn->end();
+  }
 }
 //test persistent collection of scalar (primitve) values sub-array API
 void testDataCollection2(KeyValueStore *kv)
@@ -935,186 +977,1831 @@ void testGrowDatabase(KeyValueStore *kv)
   }
 }
 
-void testDelete(KeyValueStore *kv, unsigned expectedOverlays)
+void testObjectCache(KeyValueStore *kv)
 {
-  ObjectKey siKey, otKey;
-  {
-    player::SourceInfo si;
-    si.sourceIndex = 123456789;
+  unsigned owner = kv->setCache<FixedSizeObject2>();
 
-    TestRectangularOverlayPtr ro = kv::make_obj<TestRectangularOverlay>();
-    ro->name = "testDelete.FlexisOverlay";
-    si.userOverlays.push_back(ro);
+  ObjectId objectId;
+  {
+    auto wtxn = kv->beginWrite();
+    objectId = wtxn->saveObject(make_obj<FixedSizeObject2>(1.5, 2.5));
+    wtxn->commit();
+  }
 
-    TimeCodeOverlayPtr  to = kv::make_obj<TimeCodeOverlay>();
-    to->name = "testDelete.FlexisOverlay";
-    si.userOverlays.push_back(to);
+  auto rtxn1 = kv->beginRead();
+  auto cached = rtxn1->getSharedObject<FixedSizeObject2>(objectId);
+  assert(cached && cached->number1 == 1.5);
+  assert(rtxn1->getSharedObject<FixedSizeObject2>(objectId) == cached);
+  {
+    //the mutable API loads private objects, the cursor shares the cached instance
+    auto priv = rtxn1->getObject<FixedSizeObject2>(objectId);
+    assert(priv && priv != cached && priv->number1 == 1.5);
+
+    bool found = false;
+    for(auto cursor = rtxn1->openCursor<FixedSizeObject2>(); !cursor->atEnd(); cursor->next()) {
+      if(ClassTraits<FixedSizeObject2>::getObjectKey(cursor->get())->objectId != objectId) continue;
+      assert(cursor->get() != cached && cursor->getShared() == cached);
+      found = true;
+    }
+    assert(found);
+  }
+  {
+    //concurrent readers of the same snapshot share the cached instance
+    vector<shared_ptr<const FixedSizeObject2>> loaded(4);
+    vector<thread> readers;
+    for(unsigned i=0; i<loaded.size(); i++) {
+      readers.push_back(thread([kv, objectId, &loaded, i]() {
+        auto rtxn = kv->beginRead();
+        for(unsigned j=0; j<1000; j++) loaded[i] = rtxn->getSharedObject<FixedSizeObject2>(objectId);
+        rtxn->end();
+      }));
+    }
+    for(auto &reader : readers) reader.join();
+    for(auto &obj : loaded) assert(obj == cached);
+  }
+  {
+    //writers load private copies, and invalidate the cached state on commit
+    auto wtxn = kv->beginWrite();
+    auto obj = wtxn->getObject<FixedSizeObject2>(objectId);
+    assert(obj != cached);
+    obj->number1 = 3.5;
+    wtxn->saveObject(obj);
+    wtxn->commit();
+  }
 
-    RefCountingTest ot;
-    ot.vso = kv::make_obj<VariableSizeObject>(1, "testDelete.VariableSizeObject");
-    ot.fso = kv::make_obj<FixedSizeObject>(99, 99);
-    ot.fso_vect.push_back(kv::make_obj<FixedSizeObject>(99, 99));
+  //the old snapshot still sees the old state
+  assert(rtxn1->getSharedObject<FixedSizeObject2>(objectId) == cached && cached->number1 == 1.5);
+  rtxn1->end();
 
-    auto txn = kv->beginWrite();
+  auto rtxn2 = kv->beginRead();
+  auto updated = rtxn2->getSharedObject<FixedSizeObject2>(objectId);
+  assert(updated != cached && updated->number1 == 3.5);
+  assert(rtxn2->getSharedObject<FixedSizeObject2>(objectId) == updated);
+  rtxn2->end();
 
-    txn->saveObject(si, siKey);
-    txn->saveObject(ot, otKey);
+  kv->setCache<FixedSizeObject2>(false, owner);
+}
 
-    txn->commit();
-  }
+void testCollectionInfoCache(KeyValueStore *kv)
+{
+  ObjectId collectionId;
   {
-    auto txn = kv->beginRead();
-
-    unsigned si = countInstances<player::SourceInfo>(
-        txn, [](shared_ptr<player::SourceInfo> s)->bool {return s->sourceIndex == 123456789;});
-    assert(si == 1);
-    unsigned ov = countInstances<IFlexisOverlay>(
-        txn, [](shared_ptr<IFlexisOverlay> o)->bool {return o->name == "testDelete.FlexisOverlay";});
-    assert(ov == 2);
+    auto wtxn = kv->beginWrite();
+    collectionId = wtxn->putValueCollection(vector<unsigned>({1, 2, 3}));
+    wtxn->commit();
+  }
 
-    unsigned ot = countInstances<RefCountingTest>(
-        txn, [](shared_ptr<RefCountingTest> o)->bool {return o->vso->name == "testDelete.VariableSizeObject";});
-    assert(ot == 1);
-    unsigned vo = countInstances<VariableSizeObject>(
-        txn, [](shared_ptr<VariableSizeObject> v)->bool {return v->name == "testDelete.VariableSizeObject";});
-    assert(vo == 1);
-    unsigned fo = countInstances<FixedSizeObject>(
-        txn, [](shared_ptr<FixedSizeObject> v)->bool {return v->number1 == 99;});
-    assert(fo == 2);
+  //readers of the same snapshot share the parsed collection info
+  auto rtxn1 = kv->beginRead();
+  auto rtxn2 = kv->beginRead();
+  const CollectionChunks *ci = rtxn1->getCollectionChunks(collectionId);
+  assert(ci && ci->count() == 3);
+  assert(rtxn2->getCollectionChunks(collectionId) == ci);
+  rtxn2->end();
+  {
+    //the writer's mutable info is private, and is what it reads through
+    auto wtxn = kv->beginWrite();
+    CollectionInfo *wci = wtxn->getCollectionInfo(collectionId, false);
+    assert(wci != ci && wtxn->getCollectionChunks(collectionId) == wci);
+    wtxn->appendValueCollection(collectionId, vector<unsigned>({4, 5}));
+    wtxn->commit();
+  }
+  assert(ci->count() == 3);
+  rtxn1->end();
 
-    txn->end();
+  auto rtxn3 = kv->beginRead();
+  assert(rtxn3->getCollectionChunks(collectionId)->count() == 5);
+  assert(rtxn3->getValueCollection<unsigned>(collectionId).size() == 5);
+  rtxn3->end();
+  {
+    //a deleted collection is gone for the deleting transaction, although the committed layout is still cached
+    auto wtxn = kv->beginWrite();
+    wtxn->deleteCollection(collectionId);
+    assert(!wtxn->getCollectionInfo(collectionId, false));
+    assert(!wtxn->getCollectionChunks(collectionId));
+    assert(wtxn->getValueCollection<unsigned>(collectionId).empty());
+    wtxn->commit();
   }
+  auto rtxn4 = kv->beginRead();
+  assert(!rtxn4->getCollectionChunks(collectionId));
+  rtxn4->end();
+}
+
+void testCollectionSeek(KeyValueStore *kv)
+{
+  ObjectId collectionId = 0, valueCollectionId = 0;
   {
-    auto txn = kv->beginWrite();
+    //small chunks, so the collections span many of them
+    auto wtxn = kv->beginWrite();
+    auto appender = wtxn->appendCollection<OtherThing>(collectionId, 256);
+    for(int i=0; i<100; i++) {
+      stringstream ss;
+      ss << "Seek_" << i;
+      OtherThingB ob(ss.str());
+      appender->put(&ob);
+    }
+    appender->close();
 
-    txn->deleteObject<player::SourceInfo>(siKey);
-    txn->deleteObject<RefCountingTest>(otKey);
+    auto vappender = wtxn->appendValueCollection<double>(valueCollectionId, 128);
+    for(int i=0; i<100; i++) vappender->put(i * 1.5);
+    vappender->close();
 
-    txn->commit();
+    wtxn->commit();
   }
   {
-    auto txn = kv->beginWrite();
+    auto rtxn = kv->beginRead();
+    assert(rtxn->getCollectionChunks(collectionId)->chunkInfos.size() > 1);
 
-    unsigned si = countInstances<player::SourceInfo>(
-        txn, [](shared_ptr<player::SourceInfo> s)->bool {return s->sourceIndex == 123456789;});
-    assert(si == 0);
-    vector<IFlexisOverlayPtr> ov = getInstances<IFlexisOverlay>(
-        txn, [](shared_ptr<IFlexisOverlay> o)->bool {return o->name == "testDelete.FlexisOverlay";});
-    assert(ov.size() == expectedOverlays);
-    for(auto &o : ov) txn->deleteObject(o);
+    auto cursor = rtxn->openCursor<OtherThing>(collectionId);
+    for(int pos : {57, 3, 99, 0, 58, 31}) {
+      assert(cursor->seek(pos));
+      OtherThing *ot = cursor->get();
+      stringstream ss;
+      ss << "Seek_" << pos;
+      assert(ot && ot->name == ss.str());
+      delete ot;
+    }
+    assert(!cursor->seek(100));
 
-    unsigned ot = countInstances<RefCountingTest>(
-        txn, [](shared_ptr<RefCountingTest> o)->bool {return o->vso->name == "testDelete.VariableSizeObject";});
-    assert(ot == 0);
-    unsigned vo = countInstances<VariableSizeObject>(
-        txn, [](shared_ptr<VariableSizeObject> v)->bool {return v->name == "testDelete.VariableSizeObject";});
-    assert(vo == 0);
-    unsigned fo = countInstances<FixedSizeObject>(
-        txn, [](shared_ptr<FixedSizeObject> v)->bool {return v->number1 == 99;});
-    assert(fo == 0);
+    auto vcursor = rtxn->openValueCursor<double>(valueCollectionId);
+    for(int pos : {77, 5, 99, 0, 78}) {
+      double val;
+      assert(vcursor->seek(pos) && vcursor->get(val) && val == pos * 1.5);
+    }
+    assert(!vcursor->seek(100));
 
-    txn->commit();
+    rtxn->end();
   }
 }
 
-void testUpdate(KeyValueStore *kv, unsigned expectedOverlays=1)
+void testCollectionCompaction(KeyValueStore *kv)
 {
-  ObjectKey siKey, rtKey;
+  ObjectId collectionId = 0;
   {
-    player::SourceInfo si;
-    si.sourceIndex = 2233445;
-    si.displayConfig = kv::make_obj<player::SourceDisplayConfig>(1);
-    TestRectangularOverlayPtr ro = kv::make_obj<TestRectangularOverlay>();
-    ro->name = "testUpdate.FlexisOverlay";
-    si.userOverlays.push_back(ro);
+    auto wtxn = kv->beginWrite();
+    auto appender = wtxn->appendCollection<OtherThing>(collectionId, 256);
+    for(int i=0; i<100; i++) {
+      stringstream ss;
+      ss << "Compact_" << i;
+      OtherThingB ob(ss.str());
+      appender->put(&ob);
+    }
+    appender->close();
+    wtxn->commit();
+  }
+  set<string> expected;
+  for(int i=0; i<100; i++) {
+    stringstream ss;
+    ss << "Compact_" << i;
+    expected.insert(ss.str());
+  }
+  {
+    //delete all but every 5th element from the first 60
+    auto wtxn = kv->beginWrite();
+    for(int i=0; i<60; i++) {
+      if(i % 5 == 0) continue;
+      assert(wtxn->deleteElement(collectionId, i));
+      stringstream ss;
+      ss << "Compact_" << i;
+      expected.erase(ss.str());
+    }
+    assert(!wtxn->deleteElement(collectionId, 1));
+    assert(!wtxn->deleteElement(collectionId, 1000));
+
+    //erase through a cursor
+    auto cursor = wtxn->openCursor<OtherThing>(collectionId);
+    assert(cursor->seek(70));
+    OtherThing *ot = cursor->get();
+    assert(ot && ot->name == "Compact_70");
+    delete ot;
+    assert(cursor->erase(wtxn));
+    expected.erase("Compact_70");
+    ot = cursor->get();
+    assert(ot && ot->name == "Compact_71");
+    delete ot;
+    cursor.reset();
 
-    TimeCodeOverlayPtr  to = kv::make_obj<TimeCodeOverlay>();
-    to->name = "testUpdate.FlexisOverlay";
-    si.userOverlays.push_back(to);
+    wtxn->commit();
+  }
+  auto check = [kv, &collectionId, &expected]() {
+    auto rtxn = kv->beginRead();
+    assert(rtxn->getCollectionChunks(collectionId)->count() == expected.size());
 
-    RefCountingTest ot;
-    ot.fso_vect.push_back(kv::make_obj<FixedSizeObject>(11, 11));
-    ot.fso_vect.push_back(kv::make_obj<FixedSizeObject>(22, 22));
+    vector<OtherThingPtr> loaded = rtxn->getCollection<OtherThing>(collectionId);
+    assert(loaded.size() == expected.size());
+    for(auto &ot : loaded) assert(expected.count(ot->name));
 
-    auto txn = kv->beginWrite();
+    //elements keep their order
+    size_t count = 0;
+    int last = -1;
+    auto cursor = rtxn->openCursor<OtherThing>(collectionId);
+    while(OtherThing *ot = cursor->get()) {
+      assert(expected.count(ot->name));
+      int num = atoi(ot->name.c_str() + 8);
+      assert(num > last);
+      last = num;
+      count++;
+      delete ot;
+    }
+    assert(count == expected.size());
+    rtxn->end();
+  };
+  check();
 
-    txn->saveObject(si, siKey);
-    txn->saveObject(ot, rtKey);
+  size_t chunksBefore;
+  {
+    auto rtxn = kv->beginRead();
+    chunksBefore = rtxn->getCollectionChunks(collectionId)->chunkInfos.size();
+    rtxn->end();
+  }
 
-    txn->commit();
+  //compact in bounded steps
+  size_t steps = 0;
+  for(size_t processed = 1; processed; steps++) {
+    auto wtxn = kv->beginWrite();
+    processed = wtxn->compactCollection(collectionId, 0.5, 2);
+    assert(processed <= 2);
+    wtxn->commit();
   }
+  assert(steps > 1);
+  check();
   {
-    auto txn = kv->beginWrite();
-
-    auto si = txn->getObject<player::SourceInfo>(siKey);
-    assert(si->userOverlays.size() == 2);
-    assert(si->displayConfig->sourceIndex == 1);
-    auto ot = txn->getObject<RefCountingTest>(rtKey);
-    assert(ot->fso_vect.size() == 2);
-
-    si->userOverlays.erase(si->userOverlays.begin());
-    ot->fso_vect.pop_back();
-    si->displayConfig = nullptr;
-
-    txn->saveObject(*si, siKey);
-    txn->saveObject(*ot, rtKey);
+    auto rtxn = kv->beginRead();
+    const CollectionChunks *ci = rtxn->getCollectionChunks(collectionId);
+    assert(ci->chunkInfos.size() < chunksBefore);
+    for(auto &info : ci->chunkInfos) assert(info.deletedCount == 0);
+    rtxn->end();
+  }
 
-    txn->commit();
-    delete ot;
-    delete si;
+  //compact away the leading chunk, cursors must then address elements by the remaining chunks' start index
+  ObjectId leadingId = 0;
+  size_t firstCount;
+  {
+    auto wtxn = kv->beginWrite();
+    auto appender = wtxn->appendCollection<OtherThing>(leadingId, 256);
+    for(int i=0; i<40; i++) {
+      stringstream ss;
+      ss << "Leading_" << i;
+      OtherThingB ob(ss.str());
+      appender->put(&ob);
+    }
+    appender->close();
+    wtxn->commit();
   }
   {
-    auto txn = kv->beginWrite();
+    auto wtxn = kv->beginWrite();
+    firstCount = wtxn->getCollectionChunks(leadingId)->chunkInfos.front().elementCount;
+    assert(firstCount < 38);
+    for(size_t i=0; i<firstCount; i++) assert(wtxn->deleteElement(leadingId, i));
+    assert(wtxn->compactCollection(leadingId, 0.5, 1) == 1);
+    assert(wtxn->getCollectionChunks(leadingId)->chunkInfos.front().startIndex == firstCount);
+    wtxn->commit();
+  }
+  {
+    auto wtxn = kv->beginWrite();
+    auto name = [](size_t i) {stringstream ss; ss << "Leading_" << i; return ss.str();};
 
-    auto si = txn->getObject<player::SourceInfo>(siKey);
-    assert(si->userOverlays.size() == 1);
-    assert(si->displayConfig == nullptr);
-    auto ot = txn->getObject<RefCountingTest>(rtKey);
-    assert(ot->fso_vect.size() == 1);
+    auto cursor = wtxn->openCursor<OtherThing>(leadingId);
+    assert(!cursor->seek(1));
+    OtherThing *ot = cursor->get();
+    assert(ot && ot->name == name(firstCount));
+    delete ot;
+    assert(cursor->erase(wtxn));
 
-    vector<IFlexisOverlayPtr> cov = getInstances<IFlexisOverlay>(
-        txn, [](shared_ptr<IFlexisOverlay> o)->bool {return o->name == "testUpdate.FlexisOverlay";});
-    assert(cov.size() == expectedOverlays);
-    for(auto &o : cov) txn->deleteObject(o);
+    cursor = wtxn->openCursor<OtherThing>(leadingId);
+    assert(cursor->seek(firstCount + 1));
+    ot = cursor->get();
+    assert(ot && ot->name == name(firstCount + 1));
+    delete ot;
+    assert(cursor->erase(wtxn));
+    cursor.reset();
 
-    unsigned vo = countInstances<player::SourceDisplayConfig>(
-        txn, [](shared_ptr<player::SourceDisplayConfig> v)->bool {return v->sourceIndex == 1;});
-    assert(vo == 0);
-    unsigned fo = countInstances<FixedSizeObject>(
-        txn, [](shared_ptr<FixedSizeObject> v)->bool {return v->number1 == 11 || v->number1 == 22;});
-    assert(fo == 1);
+    assert(!wtxn->deleteElement(leadingId, firstCount));
+    assert(!wtxn->deleteElement(leadingId, firstCount + 1));
+    wtxn->commit();
+  }
+  {
+    auto rtxn = kv->beginRead();
+    vector<OtherThingPtr> loaded = rtxn->getCollection<OtherThing>(leadingId);
+    assert(loaded.size() == 40 - firstCount - 2);
+    stringstream ss;
+    ss << "Leading_" << firstCount + 2;
+    assert(loaded.front()->name == ss.str());
+    rtxn->end();
+  }
 
-    txn->commit();
-    delete ot;
-    delete si;
+  //value and data collections have no element headers to flag deletions in
+  {
+    auto wtxn = kv->beginWrite();
+    ObjectId valueId = wtxn->putValueCollection(vector<unsigned>({1, 2, 3}));
+    ObjectId dataId = wtxn->putDataCollection(vector<double>({1.0, 2.0}).data(), 2);
+    for(ObjectId id : {valueId, dataId}) {
+      bool thrown = false;
+      try {wtxn->deleteElement(id, 0);} catch(error &) {thrown = true;}
+      assert(thrown);
+      thrown = false;
+      try {wtxn->compactCollection(id);} catch(error &) {thrown = true;}
+      assert(thrown);
+    }
+    wtxn->abort();
   }
-  auto txn = kv->beginWrite();
-  txn->deleteObject<player::SourceInfo>(siKey);
-  txn->deleteObject<RefCountingTest>(rtKey);
-  txn->commit();
 }
 
-void testRefCounting(KeyValueStore *kv, unsigned expectedCount=0)
+void testParallelCollectionLoad(KeyValueStore *kv)
 {
-  ObjectKey siKey;
+  ObjectId collectionId = 0, valueCollectionId = 0;
   {
-    player::SourceInfo si;
-    si.sourceIndex = 8887766;
-    si.displayConfig = kv::make_obj<player::SourceDisplayConfig>(1);
+    //small chunks, so the collections span many of them. Every 7th object has a keyed property and
+    //cannot be decoded off the transaction thread
+    auto wtxn = kv->beginWrite();
+    auto appender = wtxn->appendCollection<OtherThing>(collectionId, 256);
+    for(int i=0; i<500; i++) {
+      stringstream ss;
+      ss << "Parallel_" << i;
+      if(i % 7) {
+        OtherThingB ob(ss.str());
+        ob.dvalue = i;
+        appender->put(&ob);
+      }
+      else {
+        OtherThingA oa(ss.str());
+        oa.dvalue = i;
+        appender->put(&oa);
+      }
+    }
+    appender->close();
 
-    TestRectangularOverlayPtr ro = kv::make_obj<TestRectangularOverlay>();
-    ro->name = "testRefCounting.TestRectangularOverlay";
+    auto vappender = wtxn->appendValueCollection<double>(valueCollectionId, 128);
+    for(int i=0; i<1000; i++) vappender->put(i * 0.5);
+    vappender->close();
 
-    TimeCodeOverlayPtr  to = kv::make_obj<TimeCodeOverlay>();
-    to->name = "testRefCounting.TimeCodeOverlay";
+    wtxn->commit();
+  }
+  {
+    auto rtxn = kv->beginRead();
+    assert(rtxn->getCollectionChunks(collectionId)->chunkInfos.size() > 4);
+
+    vector<OtherThingPtr> sequential = rtxn->getCollection<OtherThing>(collectionId);
+    vector<OtherThingPtr> parallel = rtxn->getCollection<OtherThing>(collectionId, 4);
+    assert(sequential.size() == 500 && parallel.size() == 500);
+    for(int i=0; i<500; i++) {
+      assert(parallel[i]->name == sequential[i]->name && parallel[i]->dvalue == i);
+      assert(string(parallel[i]->sayhello()) == (i % 7 ? "i'm an OtherThingB" : "i'm an OtherThingA"));
+    }
 
-    si.userOverlays.push_back(to);
-    si.userOverlays.push_back(ro);
+    auto segments = rtxn->getCollectionSegments<OtherThing>(collectionId, 3);
+    assert(segments.size() == 500 && segments.segments().size() > 4);
+    assert(segments[0]->dvalue == 0 && segments[257]->dvalue == 257 && segments[499]->dvalue == 499);
 
-    auto txn = kv->beginWrite();
+    vector<double> values = rtxn->getValueCollection<double>(valueCollectionId, 4);
+    assert(values.size() == 1000);
+    for(int i=0; i<1000; i++) assert(values[i] == i * 0.5);
 
-    txn->saveObject(ro);        //owned by application + userOverlays
-    txn->saveObject(to, false); //owned by userOverlays only
+    auto valueSegments = rtxn->getValueSegments<double>(valueCollectionId);
+    double sum = 0;
+    valueSegments.forEach([&sum](double val) {sum += val;});
+    assert(valueSegments.size() == 1000 && sum == 999 * 1000 / 4);
+    assert(valueSegments.flatten() == values && valueSegments.empty());
+
+    rtxn->end();
+  }
+
+  //concurrent parallel loads share the store's worker pool
+  vector<thread> loaders;
+  for(int t=0; t<3; t++) {
+    loaders.push_back(thread([kv, collectionId, valueCollectionId]() {
+      auto rtxn = kv->beginRead();
+      for(int i=0; i<5; i++) {
+        vector<OtherThingPtr> loaded = rtxn->getCollection<OtherThing>(collectionId, 0);
+        assert(loaded.size() == 500 && loaded[499]->dvalue == 499);
+        assert(rtxn->getValueCollection<double>(valueCollectionId, 0).size() == 1000);
+      }
+      rtxn->end();
+    }));
+  }
+  for(auto &loader : loaders) loader.join();
+}
+
+void testAdaptiveChunkSize(KeyValueStore *kv)
+{
+  ObjectId valueCollectionId = 0, dataCollectionId = 0;
+  size_t maxChunkSize = kv->getOptimalChunkSize(64);
+  {
+    auto wtxn = kv->beginWrite();
+
+    auto vappender = wtxn->appendValueCollection<double>(valueCollectionId);
+    for(int i=0; i<100000; i++) vappender->put(i * 0.25);
+    vappender->close();
+
+    //one big array is spread over several chunks
+    vector<long long> data(100000);
+    for(size_t i=0; i<data.size(); i++) data[i] = i * 3;
+    auto dappender = wtxn->appendDataCollection<long long>(dataCollectionId);
+    dappender->put(data.data(), data.size());
+    dappender->close();
+
+    wtxn->commit();
+  }
+  {
+    auto rtxn = kv->beginRead();
+
+    //chunks grow, so we need a lot less than one chunk per page
+    const CollectionChunks *ci = rtxn->getCollectionChunks(valueCollectionId);
+    assert(ci->count() == 100000);
+    assert(ci->chunkInfos.size() < 100000 * sizeof(double) / kv->getOptimalChunkSize() / 4);
+    for(size_t i=1; i<ci->chunkInfos.size(); i++) {
+      assert(ci->chunkInfos[i].dataSize <= maxChunkSize);
+      assert(ci->chunkInfos[i].startIndex == ci->chunkInfos[i-1].startIndex + ci->chunkInfos[i-1].elementCount);
+    }
+    vector<double> values = rtxn->getValueCollection<double>(valueCollectionId);
+    assert(values.size() == 100000 && values[0] == 0 && values[99999] == 99999 * 0.25);
+
+    ci = rtxn->getCollectionChunks(dataCollectionId);
+    assert(ci->count() == 100000);
+    assert(ci->chunkInfos.size() == (100000 * sizeof(long long) - 1) / (maxChunkSize - ChunkHeader_sz) + 1);
+    for(auto &chunk : ci->chunkInfos) assert(chunk.dataSize <= maxChunkSize);
+
+    long long *loaded = new long long[100000];
+    assert(rtxn->getDataCollection<long long>(dataCollectionId, 0, 100000, loaded) == 100000);
+    for(long long i=0; i<100000; i++) assert(loaded[i] == i * 3);
+    delete [] loaded;
+
+    rtxn->end();
+  }
+
+  //optimal chunk sizes exactly fill their overflow pages
+  std::remove("./pages");
+  {
+    MDB_env *env;
+    MDB_txn *txn;
+    MDB_dbi dbi;
+    MDB_stat stat;
+    mdb_env_create(&env);
+    assert(mdb_env_open(env, "./pages", MDB_NOSUBDIR | MDB_NOLOCK, 0664) == 0);
+    mdb_env_stat(env, &stat);
+    size_t pageSize = stat.ms_psize;
+    assert(kv->getOptimalChunkSize(3) == 3 * pageSize - persistence::lmdb::OverflowPageHeader_sz);
+
+    vector<byte_t> data(3 * pageSize - persistence::lmdb::OverflowPageHeader_sz + 1);
+    mdb_txn_begin(env, nullptr, 0, &txn);
+    mdb_dbi_open(txn, nullptr, 0, &dbi);
+    unsigned keys[] = {1, 2};
+    MDB_val k = {sizeof(unsigned), &keys[0]}, v = {data.size() - 1, data.data()};
+    assert(mdb_put(txn, dbi, &k, &v, 0) == 0);
+    mdb_stat(txn, dbi, &stat);
+    assert(stat.ms_overflow_pages == 3);
+
+    k.mv_data = &keys[1];
+    v.mv_size = data.size();
+    assert(mdb_put(txn, dbi, &k, &v, 0) == 0);
+    mdb_stat(txn, dbi, &stat);
+    assert(stat.ms_overflow_pages == 3 + 4);
+    mdb_txn_abort(txn);
+    mdb_env_close(env);
+  }
+}
+
+void testUpdateDataCollection(KeyValueStore *kv)
+{
+  ObjectId collectionId;
+  {
+    vector<double> data(1000);
+    for(size_t i=0; i<data.size(); i++) data[i] = i;
+
+    auto wtxn = kv->beginWrite();
+    collectionId = wtxn->putDataCollection(data.data(), data.size());
+    wtxn->appendDataCollection(collectionId, data.data(), data.size());
+    wtxn->appendDataCollection(collectionId, data.data(), data.size());
+    wtxn->commit();
+  }
+  {
+    //patch a window straddling the first two chunks, one inside the last chunk, and one running past the end
+    vector<double> patch(600, -1.0);
+
+    auto wtxn = kv->beginWrite();
+    assert(wtxn->updateDataCollection(collectionId, 900, patch.data(), 200) == 200);
+    assert(wtxn->updateDataCollection(collectionId, 2100, patch.data(), 3) == 3);
+    assert(wtxn->updateDataCollection(collectionId, 2500, patch.data(), 600) == 500);
+    assert(wtxn->updateDataCollection(collectionId, 3000, patch.data(), 1) == 0);
+    wtxn->commit();
+  }
+  {
+    auto rtxn = kv->beginRead();
+    assert(rtxn->getCollectionChunks(collectionId)->chunkInfos.size() == 3);
+
+    vector<double> loaded(3000);
+    assert(rtxn->getDataCollection<double>(collectionId, 0, 3000, loaded.data()) == 3000);
+    for(size_t i=0; i<3000; i++) {
+      bool patched = (i >= 900 && i < 1100) || (i >= 2100 && i < 2103) || i >= 2500;
+      assert(loaded[i] == (patched ? -1.0 : i % 1000));
+    }
+    rtxn->end();
+  }
+}
+
+void testDataCollectionScan(KeyValueStore *kv)
+{
+  ObjectId dataCollectionId = 0, intCollectionId = 0;
+  {
+    auto wtxn = kv->beginWrite();
+
+    //a rising time series
+    vector<double> data(100000);
+    for(size_t i=0; i<data.size(); i++) data[i] = i * 0.5;
+    auto dappender = wtxn->appendDataCollection<double>(dataCollectionId);
+    dappender->put(data.data(), data.size());
+    dappender->close();
+
+    int ivals1[] = {5, -3, 12, 7}, ivals2[] = {100, 200, 150};
+    intCollectionId = wtxn->putDataCollection(ivals1, 4);
+    wtxn->appendDataCollection(intCollectionId, ivals2, 3);
+
+    wtxn->commit();
+  }
+  {
+    auto rtxn = kv->beginRead();
+
+    const CollectionChunks *ci = rtxn->getCollectionChunks(dataCollectionId);
+    assert(ci->chunkInfos.size() > 2);
+    for(auto &chunk : ci->chunkInfos) {
+      assert(chunk.stats.valid);
+      assert(chunk.stats.minValue<double>() == chunk.startIndex * 0.5);
+      assert(chunk.stats.maxValue<double>() == (chunk.startIndex + chunk.elementCount - 1) * 0.5);
+    }
+
+    size_t first = 0, last = 0;
+    size_t matched = rtxn->scanDataCollection<double>(dataCollectionId, 20000.0, 20100.0, [&](size_t index, double val) {
+      if(!first) first = index;
+      last = index;
+      return val == index * 0.5;
+    });
+    assert(matched == 201 && first == 40000 && last == 40200);
+
+    //stop early
+    matched = rtxn->scanDataCollection<double>(dataCollectionId, 0.0, 1e9, [](size_t index, double val) {
+      return index < 9;
+    });
+    assert(matched == 10);
+
+    ci = rtxn->getCollectionChunks(intCollectionId);
+    assert(ci->chunkInfos.size() == 2);
+    assert(ci->chunkInfos[0].stats.minValue<int>() == -3 && ci->chunkInfos[0].stats.maxValue<int>() == 12);
+    assert(ci->chunkInfos[1].stats.minValue<int>() == 100 && ci->chunkInfos[1].stats.sum == 450);
+
+    vector<size_t> indexes;
+    rtxn->scanDataCollection<int>(intCollectionId, 6, 160, [&](size_t index, int val) {
+      indexes.push_back(index);
+      return true;
+    });
+    assert(indexes == vector<size_t>({2, 3, 4, 6}));
+
+    rtxn->end();
+  }
+  {
+    //updates keep the statistics current
+    auto wtxn = kv->beginWrite();
+    int patch[] = {-50, 1000};
+    wtxn->updateDataCollection(intCollectionId, 1, patch, 2);
+    wtxn->commit();
+
+    auto rtxn = kv->beginRead();
+    const CollectionChunks *ci = rtxn->getCollectionChunks(intCollectionId);
+    assert(ci->chunkInfos[0].stats.minValue<int>() == -50 && ci->chunkInfos[0].stats.maxValue<int>() == 1000);
+    assert(rtxn->scanDataCollection<int>(intCollectionId, 999, 1000, [](size_t index, int val) {return true;}) == 1);
+    rtxn->end();
+  }
+}
+
+void testTimeSeries(KeyValueStore *kv)
+{
+  ObjectId collectionId = 0;
+  {
+    auto wtxn = kv->beginWrite();
+
+    //samples every 10 time units, starting at 1000
+    vector<TimeSample<double>> samples(40000);
+    for(size_t i=0; i<samples.size(); i++) samples[i] = {Timestamp(1000 + i * 10), i * 0.5};
+    auto appender = wtxn->appendTimeSeries<double>(collectionId);
+    appender->put(samples.data(), samples.size());
+    appender->close();
+
+    wtxn->commit();
+  }
+  {
+    //continue in a new transaction. Samples must not go back in time
+    auto wtxn = kv->beginWrite();
+    auto appender = wtxn->appendTimeSeries<double>(collectionId);
+    bool thrown = false;
+    try {
+      appender->put(Timestamp(1000), 0.0);
+    }
+    catch(error &e) {
+      thrown = true;
+    }
+    assert(thrown);
+    for(size_t i=40000; i<50000; i++) appender->put(Timestamp(1000 + i * 10), i * 0.5);
+    appender->close();
+
+    wtxn->commit();
+  }
+  {
+    auto rtxn = kv->beginExclusiveRead();
+
+    const CollectionChunks *ci = rtxn->getCollectionChunks(collectionId);
+    assert(ci->chunkInfos.size() > 2 && ci->elementCount == 50000);
+    assert(ci->kind == CollectionKind::timeSeries);
+    assert(ci->chunkInfos[0].stats.timed && ci->chunkInfos[0].stats.firstTime == 1000);
+    assert(ci->chunkInfos.back().stats.lastTime == 1000 + 49999 * 10);
+
+    //value statistics are kept separately from the time range
+    assert(ci->chunkInfos[0].stats.valid && ci->chunkInfos[0].stats.minValue<double>() == 0);
+    assert(ci->chunkInfos.back().stats.maxValue<double>() == 49999 * 0.5);
+
+    assert(rtxn->seekTime<double>(collectionId, 0) == 0);
+    assert(rtxn->seekTime<double>(collectionId, 1000) == 0);
+    assert(rtxn->seekTime<double>(collectionId, 1001) == 1);
+    assert(rtxn->seekTime<double>(collectionId, 1000 + 33333 * 10) == 33333);
+    assert(rtxn->seekTime<double>(collectionId, 1000 + 45678 * 10 - 5) == 45678);
+    assert(rtxn->seekTime<double>(collectionId, 1000 + 50000 * 10) == 50000);
+
+    //a window that straddles chunks
+    Timestamp t0 = 1000 + 12345 * 10 + 1, t1 = 1000 + 41234 * 10;
+    auto cursor = rtxn->openTimeSeriesCursor<double>(collectionId, t0, t1);
+    size_t count = 0, spans = 0;
+    Timestamp last = 0;
+    for(auto span = cursor->next(); span.count; span = cursor->next()) {
+      spans++;
+      for(auto &sample : span) {
+        assert(sample.time >= t0 && sample.time <= t1 && sample.time > last);
+        assert(sample.value == (sample.time - 1000) / 20.0);
+        last = sample.time;
+        count++;
+      }
+    }
+    assert(cursor->atEnd());
+    assert(spans > 1 && count == 41234 - 12345 && last == t1);
+
+    //empty windows
+    assert(rtxn->openTimeSeriesCursor<double>(collectionId, 0, 999)->next().count == 0);
+    assert(rtxn->openTimeSeriesCursor<double>(collectionId, 1001, 1009)->next().count == 0);
+    assert(rtxn->openTimeSeriesCursor<double>(collectionId, 1000 + 50000 * 10, 1000 + 60000 * 10)->atEnd());
+
+    rtxn->end();
+  }
+
+  ObjectId floatId = 0, valueId = 0;
+  {
+    auto wtxn = kv->beginWrite();
+
+    //samples with garbage in the padding behind the value
+    vector<TimeSample<float>> samples(100);
+    memset(samples.data(), 0xff, samples.size() * sizeof(TimeSample<float>));
+    for(size_t i=0; i<samples.size(); i++) {
+      samples[i].time = Timestamp(i);
+      samples[i].value = i * 2.0f;
+    }
+    auto appender = wtxn->appendTimeSeries<float>(floatId);
+    appender->put(samples.data(), samples.size());
+    appender->close();
+
+    valueId = wtxn->putValueCollection(vector<double>({1.0, 2.0}));
+
+    //time series and other collections don't mix
+    bool thrown = false;
+    try {wtxn->appendDataCollection(floatId, vector<float>({1.0f}).data(), 1);} catch(error &) {thrown = true;}
+    assert(thrown);
+    wtxn->commit();
+  }
+  {
+    auto rtxn = kv->beginExclusiveRead();
+    size_t count = 0;
+    auto cursor = rtxn->openTimeSeriesCursor<float>(floatId, 0, 1000);
+    for(auto span = cursor->next(); span.count; span = cursor->next()) {
+      for(auto &sample : span) {
+        const byte_t *bytes = (const byte_t *)&sample;
+        for(size_t b = sizeof(Timestamp) + sizeof(float); b < sizeof(TimeSample<float>); b++) assert(bytes[b] == 0);
+        count++;
+      }
+    }
+    assert(count == 100);
+
+    bool thrown = false;
+    try {rtxn->seekTime<double>(valueId, 0);} catch(error &) {thrown = true;}
+    assert(thrown);
+    rtxn->end();
+  }
+
+  ObjectId rejectedId = 0;
+  {
+    auto wtxn = kv->beginWrite();
+    auto appender = wtxn->appendTimeSeries<double>(rejectedId);
+    for(size_t i=0; i<10; i++) appender->put(Timestamp(i), double(i));
+
+    //a batch that goes back in time is rejected as a whole
+    TimeSample<double> batch[] = {{10, 100.0}, {11, 200.0}, {5, -50.0}};
+    bool thrown = false;
+    try {appender->put(batch, 3);} catch(error &) {thrown = true;}
+    assert(thrown);
+
+    appender->put(Timestamp(10), 10.0);
+    appender->close();
+    wtxn->commit();
+  }
+  {
+    auto rtxn = kv->beginRead();
+    const CollectionChunks *ci = rtxn->getCollectionChunks(rejectedId);
+    assert(ci->elementCount == 11 && ci->chunkInfos.size() == 1);
+    const ChunkStats &stats = ci->chunkInfos[0].stats;
+    assert(stats.firstTime == 0 && stats.lastTime == 10);
+    assert(stats.minValue<double>() == 0 && stats.maxValue<double>() == 10 && stats.sum == 55);
+    assert(rtxn->seekTime<double>(rejectedId, 10) == 10);
+    rtxn->end();
+  }
+}
+
+void testDataAggregates(KeyValueStore *kv)
+{
+  ObjectId doubleId = 0, floatId = 0, intId = 0;
+  vector<double> doubles(100003);
+  vector<float> floats(50001);
+  vector<int> ints(70000);
+  {
+    auto wtxn = kv->beginWrite();
+
+    for(size_t i=0; i<doubles.size(); i++) doubles[i] = sin(i * 0.01) * 100.0;
+    auto dappender = wtxn->appendDataCollection<double>(doubleId);
+    dappender->put(doubles.data(), doubles.size());
+    dappender->close();
+
+    for(size_t i=0; i<floats.size(); i++) floats[i] = float(i % 1000) - 250.5f;
+    floatId = wtxn->putDataCollection(floats.data(), floats.size());
+
+    for(size_t i=0; i<ints.size(); i++) ints[i] = int(i % 777) - 300;
+    intId = wtxn->putDataCollection(ints.data(), ints.size());
+
+    wtxn->commit();
+  }
+  auto rtxn = kv->beginRead();
+
+  //compare against naive computations
+  double sum = 0, m2 = 0;
+  for(auto d : doubles) sum += d;
+  double mean = sum / doubles.size();
+  for(auto d : doubles) m2 += (d - mean) * (d - mean);
+
+  auto dagg = rtxn->aggregateDataCollection<double>(doubleId);
+  assert(dagg.count == doubles.size());
+  assert(dagg.min == *min_element(doubles.begin(), doubles.end()));
+  assert(dagg.max == *max_element(doubles.begin(), doubles.end()));
+  assert(fabs(dagg.sum - sum) < 1e-6);
+  assert(fabs(dagg.mean() - mean) < 1e-9);
+  assert(fabs(dagg.variance() - m2 / doubles.size()) < 1e-6);
+
+  //partial range
+  dagg = rtxn->aggregateDataCollection<double>(doubleId, 1000, 10);
+  assert(dagg.count == 10 && dagg.min == *min_element(&doubles[1000], &doubles[1010]));
+
+  auto fagg = rtxn->aggregateDataCollection<float>(floatId);
+  double fsum = 0;
+  for(auto f : floats) fsum += f;
+  assert(fagg.count == floats.size() && fagg.min == -250.5f && fagg.max == 748.5f);
+  assert(fabs(fagg.sum - fsum) < 1e-6);
+
+  auto iagg = rtxn->aggregateDataCollection<int>(intId);
+  long long isum = 0;
+  for(auto i : ints) isum += i;
+  assert(iagg.count == ints.size() && iagg.min == -300 && iagg.max == 476 && iagg.sum == isum);
+
+  vector<size_t> bins = rtxn->histogramDataCollection<int>(intId, -300, 476, 4);
+  vector<size_t> expected(4, 0);
+  for(auto i : ints) expected[min<size_t>((i + 300) * 4 / 776, 3)]++;
+  assert(bins == expected);
+
+  bins = rtxn->histogramDataCollection<float>(floatId, 0.0f, 100.0f, 10);
+  assert(bins == vector<size_t>(10, 500));
+
+  auto empty = rtxn->aggregateDataCollection<double>(doubleId, doubles.size(), 10);
+  assert(empty.count == 0 && empty.mean() == 0);
+
+  rtxn->end();
+}
+
+template <typename T, typename V>
+vector<string> indexedNames(ReadTransactionPtr rtxn, const PropertyAccessBase *pa, V lo, V hi)
+{
+  vector<string> names;
+  for(auto curs = rtxn->openIndexCursor<T>(pa, lo, hi); !curs->atEnd(); curs->next())
+    names.push_back(curs->get()->name);
+  return names;
+}
+
+void testSecondaryIndex(KeyValueStore *kv)
+{
+  kv->putSchema<SomethingIndexed>();
+
+  ObjectKey annaKey, carlKey, doraKey;
+  {
+    auto wtxn = kv->beginWrite();
+    SomethingIndexed anna("Anna", 3, 1.5), bert("Bert", -2, 2.5), carl("Carl", 7, 3.5), dora("Dora", 3, 4.5);
+    annaKey = wtxn->putObject(anna);
+    wtxn->putObject(bert);
+    carlKey = wtxn->putObject(carl);
+    doraKey = wtxn->putObject(dora);
+
+    //embedded objects are not indexed
+    ObjectId embId = 0;
+    auto emb = wtxn->appendCollection<SomethingIndexed>(embId);
+    emb->put(make_shared<SomethingIndexed>("Ember", 3, 0));
+    emb->close();
+
+    wtxn->commit();
+  }
+  {
+    auto rtxn = kv->beginRead();
+    assert((indexedNames<SomethingIndexed>(rtxn, PROPERTY(SomethingIndexed, rank), 3, 3) == vector<string>{"Anna", "Dora"}));
+    assert((indexedNames<SomethingIndexed>(rtxn, PROPERTY(SomethingIndexed, rank), -5, 7) ==
+        vector<string>{"Bert", "Anna", "Dora", "Carl"}));
+    assert(indexedNames<SomethingIndexed>(rtxn, PROPERTY(SomethingIndexed, rank), 8, 100).empty());
+    assert((indexedNames<SomethingIndexed>(rtxn, PROPERTY(SomethingIndexed, name), string("Bert"), string("Carl")) ==
+        vector<string>{"Bert", "Carl"}));
+
+    auto curs = rtxn->openIndexCursor<SomethingIndexed>(PROPERTY(SomethingIndexed, name), "Carl");
+    assert(!curs->atEnd() && curs->get()->rank == 7);
+    curs->next();
+    assert(curs->atEnd());
+
+    bool thrown = false;
+    try {
+      rtxn->openIndexCursor<SomethingIndexed>(PROPERTY(SomethingIndexed, weight), 1.5);
+    }
+    catch(error &e) {
+      thrown = true;
+    }
+    assert(thrown);
+    rtxn->end();
+  }
+  {
+    //update through saveObject and updateMember, delete through deleteObject
+    auto wtxn = kv->beginWrite();
+    SomethingIndexed carl("Carl", -10, 3.5);
+    wtxn->saveObject(carl, carlKey);
+
+    SomethingIndexed anna("Annabel", 3, 1.5);
+    wtxn->updateMember(annaKey, anna, PROPERTY(SomethingIndexed, name));
+
+    wtxn->deleteObject<SomethingIndexed>(doraKey);
+    wtxn->commit();
+  }
+  {
+    auto rtxn = kv->beginRead();
+    assert((indexedNames<SomethingIndexed>(rtxn, PROPERTY(SomethingIndexed, rank), -100, 100) ==
+        vector<string>{"Carl", "Bert", "Annabel"}));
+    assert(indexedNames<SomethingIndexed>(rtxn, PROPERTY(SomethingIndexed, rank), 7, 7).empty());
+    assert((indexedNames<SomethingIndexed>(rtxn, PROPERTY(SomethingIndexed, name), string("A"), string("B")) ==
+        vector<string>{"Annabel"}));
+    rtxn->end();
+  }
+  {
+    //erasing through an index cursor is rejected before anything is changed
+    auto wtxn = kv->beginWrite();
+    auto curs = wtxn->openIndexCursor<SomethingIndexed>(PROPERTY(SomethingIndexed, name), "Carl");
+    bool thrown = false;
+    try {
+      curs->erase(wtxn);
+    }
+    catch(error &e) {
+      thrown = true;
+    }
+    assert(thrown);
+    curs.reset();
+    assert(wtxn->count<SomethingIndexed>() == 3);
+    wtxn->commit();
+
+    auto rtxn = kv->beginRead();
+    assert((indexedNames<SomethingIndexed>(rtxn, PROPERTY(SomethingIndexed, name), string("Carl"), string("Carl")) ==
+        vector<string>{"Carl"}));
+    assert((indexedNames<SomethingIndexed>(rtxn, PROPERTY(SomethingIndexed, rank), -100, 100) ==
+        vector<string>{"Carl", "Bert", "Annabel"}));
+    rtxn->end();
+  }
+  {
+    //building the index over existing objects keeps it consistent
+    auto wtxn = kv->beginWrite();
+    assert(wtxn->buildIndex<SomethingIndexed>(PROPERTY(SomethingIndexed, rank)) == 3);
+    bool thrown = false;
+    try {
+      wtxn->buildIndex<SomethingIndexed>(PROPERTY(SomethingIndexed, weight));
+    }
+    catch(error &e) {
+      thrown = true;
+    }
+    assert(thrown);
+    wtxn->commit();
+
+    auto rtxn = kv->beginRead();
+    assert((indexedNames<SomethingIndexed>(rtxn, PROPERTY(SomethingIndexed, rank), -100, 100) ==
+        vector<string>{"Carl", "Bert", "Annabel"}));
+    rtxn->end();
+  }
+  {
+    //values that exceed the key size can't be indexed
+    auto wtxn = kv->beginWrite();
+    SomethingIndexed huge(string(2000, 'x'), 1, 0);
+    bool thrown = false;
+    try {
+      wtxn->putObject(huge);
+    }
+    catch(error &e) {
+      thrown = true;
+    }
+    assert(thrown);
+    wtxn->abort();
+  }
+  //negative zero has the same key as zero, and negative values sort first
+  vector<byte_t> negZero, zero, negOne;
+  IndexValueTraits<double>::encode(negZero, -0.0);
+  IndexValueTraits<double>::encode(zero, 0.0);
+  IndexValueTraits<double>::encode(negOne, -1.0);
+  assert(negZero == zero && negOne < zero);
+}
+
+void checkSpatialQuery(KeyValueStore *kv, const BoundingBox &box, size_t expected)
+{
+  auto rtxn = kv->beginRead();
+
+  multiset<ObjectId> found, scanned;
+  for(auto curs = rtxn->openSpatialCursor<SomethingPlaced>(box); !curs->atEnd(); curs->next())
+    found.insert(ClassTraits<SomethingPlaced>::getObjectKey(curs->get())->objectId);
+  for(auto curs = rtxn->openCursor<SomethingPlaced>(); !curs->atEnd(); curs->next()) {
+    auto placed = curs->get();
+    if(placedBounds(*placed).intersects(box))
+      scanned.insert(ClassTraits<SomethingPlaced>::getObjectKey(placed)->objectId);
+  }
+  assert(found == scanned && found.size() == expected);
+  rtxn->end();
+}
+
+void testSpatialIndex(KeyValueStore *kv)
+{
+  kv->putSchema<SomethingPlaced>();
+
+  vector<ObjectKey> keys(1000);
+  {
+    auto wtxn = kv->beginWrite();
+    for(size_t i=0; i<keys.size(); i++) {
+      SomethingPlaced placed("square", (i % 40) * 10.0f, (i / 40) * 10.0f, 4, 4);
+      wtxn->saveObject(placed, keys[i]);
+    }
+    wtxn->commit();
+  }
+  checkSpatialQuery(kv, BoundingBox(95, 95, 125, 118), 6);
+  checkSpatialQuery(kv, BoundingBox(-10, -10, -1, -1), 0);
+  checkSpatialQuery(kv, BoundingBox(0, 0, 1000, 1000), 1000);
+  {
+    auto rtxn = kv->beginRead();
+    size_t count = 0;
+    BoundingBox box(0, 0, 4, 4);
+    for(auto curs = rtxn->openSpatialCursor<SomethingPlaced>(PROPERTY(SomethingPlaced, bounds), box); !curs->atEnd(); curs->next())
+      count++;
+    assert(count == 1);
+    rtxn->end();
+  }
+  {
+    //move, delete, and update without moving
+    auto wtxn = kv->beginWrite();
+    for(size_t i=0; i<100; i++) {
+      SomethingPlaced placed("moved", 1010 + i * 10.0f, 0, 4, 4);
+      wtxn->saveObject(placed, keys[i]);
+    }
+    for(size_t i=100; i<300; i++)
+      wtxn->deleteObject<SomethingPlaced>(keys[i]);
+
+    SomethingPlaced placed("square", (500 % 40) * 10.0f, (500 / 40) * 10.0f, 4, 4);
+    placed.visible = false;
+    wtxn->updateMember(keys[500], placed, PROPERTY(SomethingPlaced, visible));
+    wtxn->commit();
+  }
+  checkSpatialQuery(kv, BoundingBox(0, 0, 1000, 1000), 700);
+  checkSpatialQuery(kv, BoundingBox(1010, 0, 2010, 4), 100);
+  checkSpatialQuery(kv, BoundingBox(95, 115, 125, 128), 3);
+  {
+    //thin out the index, so that underfull nodes are condensed on all levels
+    auto wtxn = kv->beginWrite();
+    for(size_t i=300; i<keys.size(); i++)
+      if(i % 7) wtxn->deleteObject<SomethingPlaced>(keys[i]);
+    wtxn->commit();
+  }
+  checkSpatialQuery(kv, BoundingBox(0, 0, 1000, 1000), 100);
+  checkSpatialQuery(kv, BoundingBox(1010, 0, 2010, 4), 100);
+  checkSpatialQuery(kv, BoundingBox(0, 0, 2010, 1000), 200);
+  {
+    //down to a single leaf, and growing again
+    auto wtxn = kv->beginWrite();
+    for(size_t i=0; i<keys.size(); i++)
+      if(i >= 5 && (i < 300 || i % 7 == 0)) wtxn->deleteObject<SomethingPlaced>(keys[i]);
+    for(size_t i=0; i<100; i++) {
+      SomethingPlaced placed("again", i * 10.0f, 2000, 4, 4);
+      wtxn->putObject(placed);
+    }
+    wtxn->commit();
+  }
+  checkSpatialQuery(kv, BoundingBox(1010, 0, 2010, 4), 5);
+  checkSpatialQuery(kv, BoundingBox(0, 2000, 1000, 2004), 100);
+  checkSpatialQuery(kv, BoundingBox(0, 0, 2010, 2010), 105);
+}
+
+void testClassStatistics(KeyValueStore *kv)
+{
+  kv->putSchema<SomethingCounted, SomethingCountedMore>();
+
+  ObjectKey annaKey, bertKey;
+  {
+    auto wtxn = kv->beginWrite();
+    SomethingCounted anna("Anna", 4, 1.5), bert("Bert", 10, 2.5);
+    SomethingCountedMore carl("Carl", -3, 6.0, "more");
+    annaKey = wtxn->putObject(anna);
+    bertKey = wtxn->putObject(bert);
+    wtxn->putObject(carl);
+
+    //changes are visible within the transaction
+    assert(wtxn->count<SomethingCounted>() == 3);
+    assert(wtxn->count<SomethingCounted>(false) == 2);
+    wtxn->commit();
+  }
+  assert(kv->count<SomethingCounted>() == 3);
+  assert(kv->count<SomethingCountedMore>() == 1);
+
+  DataAggregate<double> agg = kv->aggregate<SomethingCounted>(PROPERTY(SomethingCounted, amount));
+  assert(agg.count == 3 && agg.sum == 11 && agg.min == -3 && agg.max == 10);
+  agg = kv->aggregate<SomethingCounted>(PROPERTY(SomethingCounted, price), false);
+  assert(agg.count == 2 && agg.sum == 4 && agg.min == 1.5 && agg.max == 2.5 && agg.variance() == 0.25);
+
+  bool thrown = false;
+  try {
+    kv->aggregate<SomethingCounted>(PROPERTY(SomethingCounted, name));
+  }
+  catch(error &e) {
+    thrown = true;
+  }
+  assert(thrown);
+  {
+    //update, delete the maximum
+    auto wtxn = kv->beginWrite();
+    SomethingCounted anna("Anna", 7, 1.5);
+    wtxn->saveObject(anna, annaKey);
+    wtxn->deleteObject<SomethingCounted>(bertKey);
+    wtxn->commit();
+  }
+  assert(kv->count<SomethingCounted>() == 2);
+  agg = kv->aggregate<SomethingCounted>(PROPERTY(SomethingCounted, amount));
+  assert(agg.count == 2 && agg.sum == 4 && agg.min == -3 && agg.max == 7);
+  {
+    //aborted changes are discarded
+    auto wtxn = kv->beginWrite();
+    SomethingCounted dora("Dora", 100, 1.0);
+    wtxn->putObject(dora);
+    assert(wtxn->count<SomethingCounted>() == 3);
+    wtxn->abort();
+  }
+  assert(kv->count<SomethingCounted>() == 2);
+  {
+    //erase through a cursor
+    auto wtxn = kv->beginWrite();
+    auto curs = wtxn->openCursor<SomethingCountedMore>();
+    assert(!curs->atEnd());
+    curs->erase(wtxn);
+    curs->close();
+    wtxn->commit();
+  }
+  assert(kv->count<SomethingCountedMore>() == 0);
+  agg = kv->aggregate<SomethingCounted>(PROPERTY(SomethingCounted, amount));
+  assert(agg.count == 1 && agg.sum == 7 && agg.min == 7 && agg.max == 7);
+
+  //counts of classes written by previous tests agree with a full walk
+  auto rtxn = kv->beginRead();
+  size_t walked = 0;
+  for(auto curs = rtxn->openCursor<ColoredPolygon>(); !curs->atEnd(); curs->next()) walked++;
+  assert(rtxn->count<ColoredPolygon>() == walked);
+  rtxn->end();
+}
+
+void checkFilter(ReadTransactionPtr rtxn, const ObjectFilter &filter, std::function<bool(std::shared_ptr<SomethingFiltered>)> predicate)
+{
+  auto filtered = rtxn->getInstances<SomethingFiltered>(filter);
+  auto expected = rtxn->getInstances<SomethingFiltered>(predicate);
+
+  assert(filtered.size() == expected.size());
+  for(size_t i=0; i<filtered.size(); i++) assert(filtered[i]->number == expected[i]->number);
+}
+
+void testObjectFilter(KeyValueStore *kv)
+{
+  kv->putSchema<SomethingFiltered>();
+  {
+    auto wtxn = kv->beginWrite();
+    for(int i=0; i<200; i++) {
+      SomethingFiltered sf(i, i * 0.5, "label_" + to_string(i % 7), i % 10);
+      wtxn->putObject(sf);
+    }
+    wtxn->commit();
+  }
+  auto rtxn = kv->beginRead();
+
+  //number and score are located by offset, label and level by walking the buffer
+  checkFilter(rtxn, where(PROPERTY(SomethingFiltered, number), FilterOp::lt, 20LL),
+              [](shared_ptr<SomethingFiltered> sf) {return sf->number < 20;});
+  checkFilter(rtxn, where(PROPERTY(SomethingFiltered, score), FilterOp::ge, 90.0),
+              [](shared_ptr<SomethingFiltered> sf) {return sf->score >= 90.0;});
+  checkFilter(rtxn, where(PROPERTY(SomethingFiltered, label), FilterOp::eq, "label_3"),
+              [](shared_ptr<SomethingFiltered> sf) {return sf->label == "label_3";});
+  checkFilter(rtxn, where(PROPERTY(SomethingFiltered, level), FilterOp::ne, 4) &&
+                    where(PROPERTY(SomethingFiltered, number), FilterOp::gt, 150LL),
+              [](shared_ptr<SomethingFiltered> sf) {return sf->level != 4 && sf->number > 150;});
+  checkFilter(rtxn, where(PROPERTY(SomethingFiltered, level), FilterOp::eq, 0) ||
+                    (where(PROPERTY(SomethingFiltered, label), FilterOp::le, "label_1") &&
+                     where(PROPERTY(SomethingFiltered, score), FilterOp::lt, 10.0)),
+              [](shared_ptr<SomethingFiltered> sf) {return sf->level == 0 || (sf->label <= "label_1" && sf->score < 10.0);});
+  checkFilter(rtxn, where(PROPERTY(SomethingFiltered, number), FilterOp::gt, 1000LL),
+              [](shared_ptr<SomethingFiltered> sf) {return false;});
+
+  //subclass instances are filtered, too
+  auto counted = rtxn->getInstances<SomethingCounted>(where(PROPERTY(SomethingCounted, amount), FilterOp::ge, 0));
+  assert(counted.size() == 1 && counted[0]->name == "Anna");
+
+  bool thrown = false;
+  try {
+    where(PROPERTY(SomethingFiltered, score), FilterOp::eq, 1);
+  }
+  catch(error &e) {
+    thrown = true;
+  }
+  assert(thrown);
+  rtxn->end();
+}
+
+size_t countReferrers(ReadTransactionPtr rtxn, shared_ptr<SomethingReferenced> target)
+{
+  size_t count = 0;
+  auto curs = rtxn->openReferrersCursor<SomethingReferring>(target);
+  while(!curs->atEnd()) {
+    count++;
+    curs->next();
+  }
+  return count;
+}
+
+void testReferrerIndex(KeyValueStore *kv)
+{
+  kv->putSchema<SomethingReferenced, SomethingReferring>();
+  kv->setReferrerIndex<SomethingReferenced>();
+
+  auto a = make_obj<SomethingReferenced>("a");
+  auto b = make_obj<SomethingReferenced>("b");
+  auto c = make_obj<SomethingReferenced>("c");
+
+  SomethingReferring r1("r1"), r2("r2");
+  r1.single = a;
+  r1.many = {a, b};
+  r2.single = b;
+  r2.many = {c};
+
+  ObjectKey r1Key, r2Key;
+  {
+    auto wtxn = kv->beginWrite();
+    r1Key = wtxn->putObject(r1);
+    r2Key = wtxn->putObject(r2);
+    wtxn->commit();
+  }
+  PropertyId singleId = PROPERTY(SomethingReferring, single)->id;
+  PropertyId manyId = PROPERTY(SomethingReferring, many)->id;
+
+  auto rtxn = kv->beginRead();
+  auto referrers = rtxn->getReferrers(a);
+  assert(referrers.size() == 2);
+  for(auto &referrer : referrers) {
+    assert(referrer.key.classId == r1Key.classId && referrer.key.objectId == r1Key.objectId);
+    assert(referrer.propertyId == singleId || referrer.propertyId == manyId);
+  }
+  assert(countReferrers(rtxn, a) == 1);
+  assert(countReferrers(rtxn, b) == 2);
+  assert(countReferrers(rtxn, c) == 1);
+
+  auto curs = rtxn->openReferrersCursor<SomethingReferring>(c);
+  assert(curs->get()->name == "r2");
+  rtxn->end();
+
+  //update both properties, then delete one of the referrers
+  {
+    auto wtxn = kv->beginWrite();
+    r1.single = c;
+    r1.many = {b};
+    wtxn->saveObject(r1, r1Key);
+    wtxn->deleteObject<SomethingReferring>(r2Key);
+    wtxn->commit();
+  }
+  rtxn = kv->beginRead();
+  assert(rtxn->getReferrers(a).empty());
+  assert(countReferrers(rtxn, a) == 0);
+
+  referrers = rtxn->getReferrers(b);
+  assert(referrers.size() == 1 && referrers[0].key.objectId == r1Key.objectId && referrers[0].propertyId == manyId);
+
+  referrers = rtxn->getReferrers(c);
+  assert(referrers.size() == 1 && referrers[0].key.objectId == r1Key.objectId && referrers[0].propertyId == singleId);
+  rtxn->end();
+
+  //deleting a target drops its entries, through deleteObject as well as through a cursor
+  {
+    auto wtxn = kv->beginWrite();
+    wtxn->deleteObject(b);
+    for(auto cc = wtxn->openCursor<SomethingReferenced>(); !cc->atEnd(); ) {
+      if(cc->get()->name == "c") cc->erase(wtxn);
+      else cc->next();
+    }
+    assert(wtxn->getReferrers(b).empty() && wtxn->getReferrers(c).empty());
+    wtxn->commit();
+  }
+  rtxn = kv->beginRead();
+  assert(rtxn->getReferrers(b).empty() && countReferrers(rtxn, b) == 0);
+  assert(rtxn->getReferrers(c).empty() && countReferrers(rtxn, c) == 0);
+  rtxn->end();
+}
+
+void testChangeTracking(KeyValueStore *kv)
+{
+  kv->putSchema<SomethingTracked>();
+  unsigned owner = kv->setChangeTracking<SomethingTracked>();
+  assert(owner != 0);
+
+  SomethingTracked st("tracked", 1);
+  st.numbers = {1, 2, 3};
+  st.tags = {"a", "b"};
+
+  ObjectKey key;
+  {
+    auto wtxn = kv->beginWrite();
+    key = wtxn->putObject(st);
+    wtxn->commit();
+  }
+  //change only the shallow buffer, then only one keyed property, then nothing
+  {
+    auto wtxn = kv->beginWrite();
+    st.counter = 2;
+    wtxn->saveObject(st, key);
+    st.numbers.push_back(4);
+    wtxn->saveObject(st, key);
+    wtxn->saveObject(st, key);
+    wtxn->commit();
+  }
+  {
+    auto rtxn = kv->beginRead();
+    SomethingTracked *loaded = rtxn->getObject<SomethingTracked>(key);
+    assert(loaded->name == "tracked" && loaded->counter == 2);
+    assert(loaded->numbers.size() == 4 && loaded->numbers[3] == 4);
+    assert(loaded->tags.size() == 2 && loaded->tags.count("b"));
+    delete loaded;
+    rtxn->end();
+  }
+  //an unchanged save writes nothing, so the cached object stays valid. A changed save replaces it
+  unsigned cacheOwner = kv->setCache<SomethingTracked>();
+  {
+    auto rtxn = kv->beginRead();
+    shared_ptr<const SomethingTracked> cached = rtxn->getSharedObject<SomethingTracked>(key.objectId);
+    rtxn->end();
+
+    auto wtxn = kv->beginWrite();
+    wtxn->saveObject(st, key);
+    wtxn->commit();
+
+    rtxn = kv->beginRead();
+    assert(rtxn->getSharedObject<SomethingTracked>(key.objectId) == cached);
+    rtxn->end();
+
+    wtxn = kv->beginWrite();
+    st.counter = 3;
+    wtxn->saveObject(st, key);
+    wtxn->commit();
+
+    rtxn = kv->beginRead();
+    shared_ptr<const SomethingTracked> updated = rtxn->getSharedObject<SomethingTracked>(key.objectId);
+    assert(updated != cached && updated->counter == 3);
+    rtxn->end();
+  }
+  kv->setCache<SomethingTracked>(false, cacheOwner);
+
+  //changes are still written after tracking is turned off again
+  kv->setChangeTracking<SomethingTracked>(false, owner);
+  {
+    auto wtxn = kv->beginWrite();
+    st.tags.insert("c");
+    wtxn->saveObject(st, key);
+    wtxn->commit();
+  }
+  auto rtxn = kv->beginRead();
+  SomethingTracked *loaded = rtxn->getObject<SomethingTracked>(key);
+  assert(loaded->tags.size() == 3);
+  delete loaded;
+  rtxn->end();
+
+  bool thrown = false;
+  try {
+    kv->setChangeTracking<SomethingTracked>(true);
+  }
+  catch(error &e) {
+    thrown = true;
+  }
+  assert(thrown);
+}
+
+void testInPlaceWrites(KeyValueStore *kv)
+{
+  //keyed values are serialized into reserved memory. Overwrite with larger and smaller values
+  SomethingWithAllValueKeyedProperties swakp;
+  swakp.name = "Jo";
+  swakp.counter = 1;
+  swakp.numbers = {1, 2};
+  swakp.children = set<string>({"Al"});
+
+  ObjectKey key;
+  {
+    auto wtxn = kv->beginWrite();
+    wtxn->saveObject(swakp, key);
+    swakp.name = "Josephine";
+    swakp.numbers = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+    swakp.children = set<string>({"Albert", "Bea", "Cy"});
+    wtxn->saveObject(swakp, key);
+    wtxn->commit();
+  }
+  {
+    auto rtxn = kv->beginRead();
+    SomethingWithAllValueKeyedProperties *loaded = rtxn->getObject<SomethingWithAllValueKeyedProperties>(key);
+    assert(loaded->name == "Josephine" && loaded->counter == 1);
+    assert(loaded->numbers.size() == 10 && loaded->numbers[9] == 10);
+    assert(loaded->children == set<string>({"Albert", "Bea", "Cy"}));
+    delete loaded;
+    rtxn->end();
+  }
+  {
+    auto wtxn = kv->beginWrite();
+    swakp.name = "J";
+    swakp.counter = -7;
+    swakp.numbers = {42};
+    swakp.children = set<string>({"Z"});
+    wtxn->saveObject(swakp, key);
+    wtxn->commit();
+  }
+  {
+    auto rtxn = kv->beginRead();
+    SomethingWithAllValueKeyedProperties *loaded = rtxn->getObject<SomethingWithAllValueKeyedProperties>(key);
+    assert(loaded->name == "J" && loaded->counter == -7);
+    assert(loaded->numbers == vector<int>({42}) && loaded->children == set<string>({"Z"}));
+    delete loaded;
+    rtxn->end();
+  }
+
+  //fixed-size objects of a refcounting class are reserved in place after their refcount was stored
+  FixedSizeObject fso(11, 12);
+  ObjectKey fsoKey;
+  {
+    auto wtxn = kv->beginWrite();
+    wtxn->saveObject(fso, fsoKey);
+    assert(fsoKey.refcount == 1);
+
+    fso.number1 = 13;
+    fsoKey.refcount = 3;
+    wtxn->saveObject(fso, fsoKey);
+    wtxn->commit();
+  }
+  {
+    auto rtxn = kv->beginRead();
+    ObjectKey loadedKey(fsoKey.classId, fsoKey.objectId);
+    FixedSizeObject *loaded = rtxn->getObject<FixedSizeObject>(loadedKey);
+    assert(loaded->number1 == 13 && loaded->number2 == 12 && loadedKey.refcount == 3);
+    delete loaded;
+    rtxn->end();
+  }
+  {
+    auto wtxn = kv->beginWrite();
+    ObjectKey loadedKey(fsoKey.classId, fsoKey.objectId);
+    delete wtxn->getObject<FixedSizeObject>(loadedKey);
+    bool thrown = false;
+    try {
+      wtxn->deleteObject<FixedSizeObject>(loadedKey);
+    }
+    catch(error &e) {
+      thrown = true;
+    }
+    assert(thrown);
+
+    fso.number2 = 14;
+    fsoKey.refcount = 1;
+    wtxn->saveObject(fso, fsoKey);
+    loadedKey.refcount = 0;
+    FixedSizeObject *loaded = wtxn->getObject<FixedSizeObject>(loadedKey);
+    assert(loaded->number1 == 13 && loaded->number2 == 14 && loadedKey.refcount == 1);
+    delete loaded;
+
+    wtxn->deleteObject<FixedSizeObject>(loadedKey);
+    assert(!wtxn->getObject<FixedSizeObject>(loadedKey));
+    wtxn->commit();
+  }
+}
+
+void testWriteBuf()
+{
+  //owned memory grows geometrically and keeps its contents
+  WriteBuf buf(16);
+  for(uint32_t i=0; i<1000; i++) buf.appendRaw(i);
+  assert(buf.size() == 1000 * sizeof(uint32_t));
+  for(uint32_t i=0; i<1000; i++) assert(((const uint32_t *)buf.data())[i] == i);
+
+  //a failed allocation leaves the buffer intact
+  bool thrown = false;
+  try {buf.ensure(std::numeric_limits<size_t>::max() / 2);} catch(std::bad_alloc &) {thrown = true;}
+  assert(thrown && buf.size() == 1000 * sizeof(uint32_t) && ((const uint32_t *)buf.data())[999] == 999);
+  buf.appendRaw(uint32_t(1000));
+  assert(((const uint32_t *)buf.data())[1000] == 1000);
+
+  //external memory is bounds-checked
+  byte_t mem[8];
+  WriteBuf ext(mem, sizeof(mem));
+  ext.appendRaw(uint32_t(1));
+  ext.appendRaw(uint32_t(2));
+  thrown = false;
+  try {ext.appendRaw(uint32_t(3));} catch(std::overflow_error &) {thrown = true;}
+  assert(thrown && ext.data() == mem && ext.size() == sizeof(mem));
+  assert(((const uint32_t *)mem)[0] == 1 && ((const uint32_t *)mem)[1] == 2);
+}
+
+/*
+ * heap allocations of the calling thread, counted while countAllocations is set. The global operator new is replaced
+ * for the test binary, so that allocations by std containers and shared pointers are seen, too. The library's own
+ * malloc-based buffers report through kv::allocation_hook
+ */
+static thread_local bool countAllocations = false;
+static thread_local size_t allocationCount = 0;
+
+void *operator new(size_t size)
+{
+  if(countAllocations) allocationCount++;
+  void *p = malloc(size ? size : 1);
+  if(!p) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+void countAllocation(size_t size)
+{
+  if(countAllocations) allocationCount++;
+}
+
+void testAllocations(KeyValueStore *kv)
+{
+  FixedSizeObject fso(1, 2);
+  VariableSizeObject vso(3, "drei");
+  SomethingReferring sr("referring");
+  sr.single = make_obj<SomethingReferenced>("single");
+  sr.many.push_back(make_obj<SomethingReferenced>("many"));
+
+  //first transaction grows the pooled buffers and arena
+  ObjectKey fkey, vkey, skey;
+  {
+    auto wtxn = kv->beginWrite();
+    fkey = wtxn->putObject(fso);
+    vkey = wtxn->putObject(vso);
+    skey = wtxn->putObject(sr);
+    wtxn->saveObject(fso, fkey);
+    wtxn->saveObject(vso, vkey);
+    wtxn->saveObject(sr, skey);
+    wtxn->commit();
+  }
+  //the counter sees allocations made by the library as well as the test
+  static int * volatile probe;
+  allocationCount = 0;
+  countAllocations = true;
+  probe = new int(1);
+  countAllocations = false;
+  delete probe;
+  assert(allocationCount == 1);
+
+  //subsequent transactions reuse them. Saving existing objects of classes without object caching and indexed
+  //properties does not allocate at all
+  for(int i=0; i<3; i++) {
+    auto wtxn = kv->beginWrite();
+    allocationCount = 0;
+    kv::allocation_hook = countAllocation;
+    countAllocations = true;
+    fso.number1 = i;
+    vso.number = i;
+    wtxn->saveObject(fso, fkey);
+    wtxn->saveObject(vso, vkey);
+    wtxn->saveObject(sr, skey);
+    countAllocations = false;
+    kv::allocation_hook = nullptr;
+    wtxn->commit();
+    assert(allocationCount == 0);
+  }
+  auto rtxn = kv->beginRead();
+  FixedSizeObject *loaded = rtxn->getObject<FixedSizeObject>(fkey);
+  assert(loaded->number1 == 2 && loaded->number2 == 2);
+  delete loaded;
+  assert(rtxn->getReferrers(sr.single).size() == 1);
+  rtxn->end();
+}
+
+void testBatchSave(KeyValueStore *kv)
+{
+  vector<VariableSizeObjectPtr> vobjs;
+  vector<FixedSizeObjectPtr> fobjs;
+  for(unsigned i=0; i<50; i++) {
+    vobjs.push_back(make_obj<VariableSizeObject>(i, "batch"));
+    fobjs.push_back(make_obj<FixedSizeObject>(i, 2 * i));
+  }
+  {
+    auto wtxn = kv->beginWrite();
+    wtxn->saveObjects(vobjs);
+    wtxn->saveObjects(fobjs);
+    wtxn->commit();
+  }
+  //update in reverse key order, mixed with new objects
+  vector<VariableSizeObjectPtr> vupdate(vobjs.rbegin(), vobjs.rend());
+  vector<FixedSizeObjectPtr> fupdate(fobjs.rbegin(), fobjs.rend());
+  for(unsigned i=0; i<vupdate.size(); i++) {
+    vupdate[i]->number += 100;
+    vupdate[i]->name = "updated";
+    fupdate[i]->number2 += 100;
+    if(i % 10 == 0) {
+      vupdate.insert(vupdate.begin() + i, make_obj<VariableSizeObject>(1000 + i, "new"));
+      fupdate.insert(fupdate.begin() + i, make_obj<FixedSizeObject>(1000 + i, 1000 + i));
+      i++;
+    }
+  }
+  {
+    auto wtxn = kv->beginWrite();
+    wtxn->saveObjects(vupdate);
+    wtxn->saveObjects(fupdate);
+    wtxn->commit();
+  }
+  auto rtxn = kv->beginRead();
+  for(auto &vobj : vupdate) {
+    ObjectKey &key = *ClassTraits<VariableSizeObject>::getObjectKey(vobj);
+    VariableSizeObject *loaded = rtxn->getObject<VariableSizeObject>(key);
+    assert(loaded && loaded->number == vobj->number && loaded->name == vobj->name);
+    delete loaded;
+  }
+  for(auto &fobj : fupdate) {
+    ObjectKey &key = *ClassTraits<FixedSizeObject>::getObjectKey(fobj);
+    FixedSizeObject *loaded = rtxn->getObject<FixedSizeObject>(key);
+    assert(loaded && loaded->number1 == fobj->number1 && loaded->number2 == fobj->number2);
+    delete loaded;
+  }
+  rtxn->end();
+
+  //an object passed twice is rejected before anything is written
+  auto twice = make_obj<FixedSizeObject>(7, 8);
+  vector<FixedSizeObjectPtr> duplicates {fobjs[0], twice, fobjs[1], twice};
+  {
+    auto wtxn = kv->beginWrite();
+    size_t before = wtxn->count<FixedSizeObject>();
+    bool thrown = false;
+    try {
+      wtxn->saveObjects(duplicates);
+    }
+    catch(error &e) {
+      thrown = true;
+    }
+    assert(thrown && wtxn->count<FixedSizeObject>() == before);
+    assert(!ClassTraits<FixedSizeObject>::getObjectKey(twice)->isValid());
+    wtxn->abort();
+  }
+}
+
+void testConcurrentSchema(KeyValueStore *kv)
+{
+  ObjectKey key;
+  {
+    auto wtxn = kv->beginWrite();
+    SomethingConcrete1 sc("concurrent", "schema");
+    key = wtxn->putObject(sc);
+    wtxn->commit();
+  }
+  AbstractClassInfo *info = ClassTraits<SomethingAbstract>::traits_info;
+  ClassId concreteId = ClassTraits<SomethingConcrete1>::traits_data(0).classId;
+
+  //registering the hierarchy with another store rebuilds the lookup tables while they are in use
+  std::remove("./schema");
+  KeyValueStore *other = lmdb::KeyValueStore::Factory{2, ".", "schema"};
+
+  std::atomic<bool> done {false};
+  vector<thread> readers;
+  for(unsigned i=0; i<4; i++) {
+    readers.push_back(thread([kv, info, concreteId, key, &done]() {
+      auto rtxn = kv->beginRead();
+      do {
+        assert(info->resolve(typeid(SomethingConcrete1)) == ClassTraits<SomethingConcrete1>::traits_info);
+        assert(info->resolve(0, concreteId) == ClassTraits<SomethingConcrete1>::traits_info);
+      } while(!done);
+      ObjectKey k = key;
+      SomethingConcrete1 *loaded = rtxn->getObject<SomethingConcrete1>(k);
+      assert(loaded && loaded->description == "schema");
+      delete loaded;
+      rtxn->end();
+    }));
+  }
+  for(unsigned i=0; i<20; i++)
+    other->putSchema<SomethingAbstract, SomethingConcrete1, SomethingConcrete2>();
+  done = true;
+  for(auto &reader : readers) reader.join();
+
+  assert(info->resolve(2, ClassTraits<SomethingConcrete2>::traits_data(2).classId) ==
+         ClassTraits<SomethingConcrete2>::traits_info);
+  delete other;
+}
+
+void testDelete(KeyValueStore *kv, unsigned expectedOverlays)
+{
+  ObjectKey siKey, otKey;
+  {
+    player::SourceInfo si;
+    si.sourceIndex = 123456789;
+
+    TestRectangularOverlayPtr ro = kv::make_obj<TestRectangularOverlay>();
+    ro->name = "testDelete.FlexisOverlay";
+    si.userOverlays.push_back(ro);
+
+    TimeCodeOverlayPtr  to = kv::make_obj<TimeCodeOverlay>();
+    to->name = "testDelete.FlexisOverlay";
+    si.userOverlays.push_back(to);
+
+    RefCountingTest ot;
+    ot.vso = kv::make_obj<VariableSizeObject>(1, "testDelete.VariableSizeObject");
+    ot.fso = kv::make_obj<FixedSizeObject>(99, 99);
+    ot.fso_vect.push_back(kv::make_obj<FixedSizeObject>(99, 99));
+
+    auto txn = kv->beginWrite();
+
+    txn->saveObject(si, siKey);
+    txn->saveObject(ot, otKey);
+
+    txn->commit();
+  }
+  {
+    auto txn = kv->beginRead();
+
+    unsigned si = countInstances<player::SourceInfo>(
+        txn, [](shared_ptr<player::SourceInfo> s)->bool {return s->sourceIndex == 123456789;});
+    assert(si == 1);
+    unsigned ov = countInstances<IFlexisOverlay>(
+        txn, [](shared_ptr<IFlexisOverlay> o)->bool {return o->name == "testDelete.FlexisOverlay";});
+    assert(ov == 2);
+
+    unsigned ot = countInstances<RefCountingTest>(
+        txn, [](shared_ptr<RefCountingTest> o)->bool {return o->vso->name == "testDelete.VariableSizeObject";});
+    assert(ot == 1);
+    unsigned vo = countInstances<VariableSizeObject>(
+        txn, [](shared_ptr<VariableSizeObject> v)->bool {return v->name == "testDelete.VariableSizeObject";});
+    assert(vo == 1);
+    unsigned fo = countInstances<FixedSizeObject>(
+        txn, [](shared_ptr<FixedSizeObject> v)->bool {return v->number1 == 99;});
+    assert(fo == 2);
+
+    txn->end();
+  }
+  {
+    auto txn = kv->beginWrite();
+
+    txn->deleteObject<player::SourceInfo>(siKey);
+    txn->deleteObject<RefCountingTest>(otKey);
+
+    txn->commit();
+  }
+  {
+    auto txn = kv->beginWrite();
+
+    unsigned si = countInstances<player::SourceInfo>(
+        txn, [](shared_ptr<player::SourceInfo> s)->bool {return s->sourceIndex == 123456789;});
+    assert(si == 0);
+    vector<IFlexisOverlayPtr> ov = getInstances<IFlexisOverlay>(
+        txn, [](shared_ptr<IFlexisOverlay> o)->bool {return o->name == "testDelete.FlexisOverlay";});
+    assert(ov.size() == expectedOverlays);
+    for(auto &o : ov) txn->deleteObject(o);
+
+    unsigned ot = countInstances<RefCountingTest>(
+        txn, [](shared_ptr<RefCountingTest> o)->bool {return o->vso->name == "testDelete.VariableSizeObject";});
+    assert(ot == 0);
+    unsigned vo = countInstances<VariableSizeObject>(
+        txn, [](shared_ptr<VariableSizeObject> v)->bool {return v->name == "testDelete.VariableSizeObject";});
+    assert(vo == 0);
+    unsigned fo = countInstances<FixedSizeObject>(
+        txn, [](shared_ptr<FixedSizeObject> v)->bool {return v->number1 == 99;});
+    assert(fo == 0);
+
+    txn->commit();
+  }
+}
+
+void testUpdate(KeyValueStore *kv, unsigned expectedOverlays=1)
+{
+  ObjectKey siKey, rtKey;
+  {
+    player::SourceInfo si;
+    si.sourceIndex = 2233445;
+    si.displayConfig = kv::make_obj<player::SourceDisplayConfig>(1);
+    TestRectangularOverlayPtr ro = kv::make_obj<TestRectangularOverlay>();
+    ro->name = "testUpdate.FlexisOverlay";
+    si.userOverlays.push_back(ro);
+
+    TimeCodeOverlayPtr  to = kv::make_obj<TimeCodeOverlay>();
+    to->name = "testUpdate.FlexisOverlay";
+    si.userOverlays.push_back(to);
+
+    RefCountingTest ot;
+    ot.fso_vect.push_back(kv::make_obj<FixedSizeObject>(11, 11));
+    ot.fso_vect.push_back(kv::make_obj<FixedSizeObject>(22, 22));
+
+    auto txn = kv->beginWrite();
+
+    txn->saveObject(si, siKey);
+    txn->saveObject(ot, rtKey);
+
+    txn->commit();
+  }
+  {
+    auto txn = kv->beginWrite();
+
+    auto si = txn->getObject<player::SourceInfo>(siKey);
+    assert(si->userOverlays.size() == 2);
+    assert(si->displayConfig->sourceIndex == 1);
+    auto ot = txn->getObject<RefCountingTest>(rtKey);
+    assert(ot->fso_vect.size() == 2);
+
+    si->userOverlays.erase(si->userOverlays.begin());
+    ot->fso_vect.pop_back();
+    si->displayConfig = nullptr;
+
+    txn->saveObject(*si, siKey);
+    txn->saveObject(*ot, rtKey);
+
+    txn->commit();
+    delete ot;
+    delete si;
+  }
+  {
+    auto txn = kv->beginWrite();
+
+    auto si = txn->getObject<player::SourceInfo>(siKey);
+    assert(si->userOverlays.size() == 1);
+    assert(si->displayConfig == nullptr);
+    auto ot = txn->getObject<RefCountingTest>(rtKey);
+    assert(ot->fso_vect.size() == 1);
+
+    vector<IFlexisOverlayPtr> cov = getInstances<IFlexisOverlay>(
+        txn, [](shared_ptr<IFlexisOverlay> o)->bool {return o->name == "testUpdate.FlexisOverlay";});
+    assert(cov.size() == expectedOverlays);
+    for(auto &o : cov) txn->deleteObject(o);
+
+    unsigned vo = countInstances<player::SourceDisplayConfig>(
+        txn, [](shared_ptr<player::SourceDisplayConfig> v)->bool {return v->sourceIndex == 1;});
+    assert(vo == 0);
+    unsigned fo = countInstances<FixedSizeObject>(
+        txn, [](shared_ptr<FixedSizeObject> v)->bool {return v->number1 == 11 || v->number1 == 22;});
+    assert(fo == 1);
+
+    txn->commit();
+    delete ot;
+    delete si;
+  }
+  auto txn = kv->beginWrite();
+  txn->deleteObject<player::SourceInfo>(siKey);
+  txn->deleteObject<RefCountingTest>(rtKey);
+  txn->commit();
+}
+
+void testRefCounting(KeyValueStore *kv, unsigned expectedCount=0)
+{
+  ObjectKey siKey;
+  {
+    player::SourceInfo si;
+    si.sourceIndex = 8887766;
+    si.displayConfig = kv::make_obj<player::SourceDisplayConfig>(1);
+
+    TestRectangularOverlayPtr ro = kv::make_obj<TestRectangularOverlay>();
+    ro->name = "testRefCounting.TestRectangularOverlay";
+
+    TimeCodeOverlayPtr  to = kv::make_obj<TimeCodeOverlay>();
+    to->name = "testRefCounting.TimeCodeOverlay";
+
+    si.userOverlays.push_back(to);
+    si.userOverlays.push_back(ro);
+
+    auto txn = kv->beginWrite();
+
+    txn->saveObject(ro);        //owned by application + userOverlays
+    txn->saveObject(to, false); //owned by userOverlays only
 
     txn->saveObject(si, siKey);
 
@@ -1348,6 +3035,268 @@ ObjectKey setupTestCompatibleDatabase(KeyValueStore *kv)
 
 #define IS_TYPE(__val, __cls) typeid(__val) == typeid(__cls)
 
+//write a value collection in the legacy format and check that it is migrated when the store is opened
+void testCollectionMigration()
+{
+  std::remove("./legacy");
+  {
+    MDB_env *env;
+    MDB_txn *txn;
+    MDB_dbi dbi;
+    mdb_env_create(&env);
+    mdb_env_set_maxdbs(env, 2);
+    assert(mdb_env_open(env, "./legacy", MDB_NOSUBDIR | MDB_NOLOCK, 0664) == 0);
+    mdb_txn_begin(env, nullptr, 0, &txn);
+    mdb_dbi_open(txn, "classdata", MDB_CREATE, &dbi);
+    mdb_set_compare(txn, dbi, persistence::lmdb::key_compare);
+
+    ObjectId collectionId = 7;
+    size_t counts[] = {3, 2};
+    unsigned value = 0;
+    for(PropertyId chunkId=1; chunkId <= 2; chunkId++) {
+      size_t count = counts[chunkId-1];
+      WriteBuf chunk(4 * 3 + count * 4);
+      chunk.appendInteger(4 * 3 + count * 4, 4);
+      chunk.appendInteger(chunkId == 1 ? 0 : counts[0], 4);
+      chunk.appendInteger(count, 4);
+      for(size_t i=0; i<count; i++) chunk.appendInteger(value++ * 10, 4);
+
+      byte_t key[lmdb::StorageKey::byteSize];
+      *(ClassId *)key = LEGACY_COLLECTION_CLSID;
+      *(ObjectId *)(key+ClassId_sz) = collectionId;
+      *(PropertyId *)(key+ClassId_sz+ObjectId_sz) = chunkId;
+      MDB_val k{sizeof(key), key}, v{chunk.size(), chunk.data()};
+      assert(mdb_put(txn, dbi, &k, &v, 0) == 0);
+    }
+
+    WriteBuf info(ObjectId_sz + sizeof(size_t) + 2 * (PropertyId_sz + 3 * sizeof(size_t)));
+    info.appendRaw(collectionId);
+    info.appendRaw(size_t(2));
+    for(PropertyId chunkId=1; chunkId <= 2; chunkId++) {
+      info.appendRaw(chunkId);
+      info.appendRaw(chunkId == 1 ? size_t(0) : counts[0]);
+      info.appendRaw(counts[chunkId-1]);
+      info.appendRaw(4 * 3 + counts[chunkId-1] * 4);
+    }
+    byte_t key[lmdb::StorageKey::byteSize];
+    *(ClassId *)key = LEGACY_COLLINFO_CLSID;
+    *(ObjectId *)(key+ClassId_sz) = collectionId;
+    *(PropertyId *)(key+ClassId_sz+ObjectId_sz) = 0;
+    MDB_val k{sizeof(key), key}, v{info.size(), info.data()};
+    assert(mdb_put(txn, dbi, &k, &v, 0) == 0);
+
+    mdb_txn_commit(txn);
+    mdb_env_close(env);
+  }
+
+  KeyValueStore *kv = lmdb::KeyValueStore::Factory{0, ".", "legacy"};
+  ObjectId collectionId = 7;
+  {
+    auto rtxn = kv->beginRead();
+    assert(rtxn->getCollectionChunks(collectionId)->count() == 5);
+
+    vector<unsigned> values = rtxn->getValueCollection<unsigned>(collectionId);
+    assert(values.size() == 5 && values[0] == 0 && values[2] == 20 && values[4] == 40);
+
+    auto cursor = rtxn->openValueCursor<unsigned>(collectionId);
+    unsigned val;
+    assert(cursor->seek(3) && cursor->get(val) && val == 30);
+    rtxn->end();
+  }
+  {
+    //new collections must not collide with the migrated one
+    auto wtxn = kv->beginWrite();
+    ObjectId newId = wtxn->putValueCollection(vector<unsigned>({1, 2}));
+    assert(newId != collectionId);
+    wtxn->appendValueCollection(collectionId, vector<unsigned>({50}));
+    wtxn->commit();
+  }
+  {
+    auto rtxn = kv->beginRead();
+    vector<unsigned> values = rtxn->getValueCollection<unsigned>(collectionId);
+    assert(values.size() == 6 && values[5] == 50);
+    assert(rtxn->getCollectionChunks(collectionId)->count() == 6);
+    rtxn->end();
+  }
+  delete kv;
+
+  //reopen, so collection infos are read from the chunk info records written by the appends
+  kv = lmdb::KeyValueStore::Factory{0, ".", "legacy"};
+  {
+    auto wtxn = kv->beginWrite();
+    wtxn->appendValueCollection(collectionId, vector<unsigned>({60, 70}));
+    wtxn->commit();
+  }
+  delete kv;
+
+  kv = lmdb::KeyValueStore::Factory{0, ".", "legacy"};
+  {
+    auto rtxn = kv->beginRead();
+    const CollectionChunks *ci = rtxn->getCollectionChunks(collectionId);
+    assert(ci->count() == 8 && ci->chunkInfos.size() == 4 && ci->nextStartIndex == 8);
+
+    vector<unsigned> values = rtxn->getValueCollection<unsigned>(collectionId);
+    assert(values.size() == 8 && values[3] == 30 && values[7] == 70);
+    rtxn->end();
+  }
+  delete kv;
+}
+
+void testIdCounters()
+{
+  std::remove("./counters");
+
+  ObjectKey key1, key2;
+  ObjectId collectionId;
+  {
+    KeyValueStore *kv = lmdb::KeyValueStore::Factory{1, ".", "counters"};
+    kv->putSchema<FixedSizeObject>();
+
+    auto wtxn = kv->beginWrite();
+    FixedSizeObject fso(1, 2);
+    key1 = wtxn->putObject(fso);
+    key2 = wtxn->putObject(fso);
+    collectionId = wtxn->putValueCollection(vector<unsigned>({1, 2}));
+    wtxn->commit();
+    delete kv;
+  }
+  //forget the in-memory counter, so it must be restored from the store
+  ClassTraits<FixedSizeObject>::traits_data(1).maxObjectId = 0;
+  {
+    KeyValueStore *kv = lmdb::KeyValueStore::Factory{1, ".", "counters"};
+    kv->putSchema<FixedSizeObject>();
+
+    auto wtxn = kv->beginWrite();
+    FixedSizeObject fso(3, 4);
+    ObjectKey key = wtxn->putObject(fso);
+    assert(key.classId == key1.classId && key.objectId == key2.objectId + 1);
+    assert(wtxn->putValueCollection(vector<unsigned>({3})) == collectionId + 1);
+    wtxn->commit();
+    delete kv;
+  }
+  //write to classdata behind the store's back, like a writer that does not maintain the counters. Adds an object
+  //with the given id and optionally deletes another one
+  auto foreignWrite = [&key1](ObjectId addId, ObjectId delId) {
+    MDB_env *env;
+    MDB_txn *txn;
+    MDB_dbi dbi;
+    mdb_env_create(&env);
+    mdb_env_set_maxdbs(env, 5);
+    assert(mdb_env_open(env, "./counters", MDB_NOSUBDIR | MDB_NOLOCK, 0664) == 0);
+    mdb_txn_begin(env, nullptr, 0, &txn);
+    mdb_dbi_open(txn, "classdata", 0, &dbi);
+    mdb_set_compare(txn, dbi, persistence::lmdb::key_compare);
+
+    byte_t key[lmdb::StorageKey::byteSize];
+    *(ClassId *)key = key1.classId;
+    *(ObjectId *)(key+ClassId_sz) = addId;
+    *(PropertyId *)(key+ClassId_sz+ObjectId_sz) = 0;
+    unsigned data[3] = {0, 5, 6};
+    MDB_val k{sizeof(key), key}, v{sizeof(data), data};
+    assert(mdb_put(txn, dbi, &k, &v, 0) == 0);
+
+    if(delId) {
+      *(ObjectId *)(key+ClassId_sz) = delId;
+      assert(mdb_del(txn, dbi, &k, nullptr) == 0);
+    }
+    mdb_txn_commit(txn);
+    mdb_env_close(env);
+  };
+  ObjectId foreignId = key2.objectId + 10;
+  foreignWrite(foreignId, 0);
+
+  ClassTraits<FixedSizeObject>::traits_data(1).maxObjectId = 0;
+  {
+    KeyValueStore *kv = lmdb::KeyValueStore::Factory{1, ".", "counters"};
+    kv->putSchema<FixedSizeObject>();
+
+    auto wtxn = kv->beginWrite();
+    FixedSizeObject fso(5, 6);
+    ObjectKey key = wtxn->putObject(fso);
+    assert(key.objectId == foreignId + 1);
+    assert(wtxn->putValueCollection(vector<unsigned>({4})) == collectionId + 2);
+    wtxn->commit();
+    delete kv;
+  }
+  //add one object and delete another, which leaves the number of entries unchanged
+  ObjectId foreignId2 = foreignId + 10;
+  foreignWrite(foreignId2, key1.objectId);
+
+  ClassTraits<FixedSizeObject>::traits_data(1).maxObjectId = 0;
+  {
+    KeyValueStore *kv = lmdb::KeyValueStore::Factory{1, ".", "counters"};
+    kv->putSchema<FixedSizeObject>();
+
+    auto rtxn = kv->beginRead();
+    assert(!rtxn->getObject<FixedSizeObject>(key1.objectId));
+    rtxn->end();
+
+    auto wtxn = kv->beginWrite();
+    FixedSizeObject fso(7, 8);
+    ObjectKey key = wtxn->putObject(fso);
+    assert(key.objectId == foreignId2 + 1);
+    wtxn->commit();
+    delete kv;
+  }
+  //read the transaction id saved with the counters, and the id of the last committed transaction
+  auto counterTxnIds = [] {
+    MDB_env *env;
+    MDB_txn *txn;
+    MDB_dbi dbi;
+    MDB_envinfo info;
+    mdb_env_create(&env);
+    mdb_env_set_maxdbs(env, 5);
+    assert(mdb_env_open(env, "./counters", MDB_NOSUBDIR | MDB_NOLOCK | MDB_RDONLY, 0664) == 0);
+    mdb_env_info(env, &info);
+    mdb_txn_begin(env, nullptr, MDB_RDONLY, &txn);
+    mdb_dbi_open(txn, "classdata", 0, &dbi);
+    mdb_set_compare(txn, dbi, persistence::lmdb::key_compare);
+
+    byte_t key[lmdb::StorageKey::byteSize] = {};
+    *(ClassId *)key = COUNTERS_CLSID;
+    MDB_val k{sizeof(key), key}, v;
+    assert(mdb_get(txn, dbi, &k, &v) == 0);
+    uint64_t saved = *(uint64_t *)v.mv_data;
+
+    mdb_txn_abort(txn);
+    mdb_env_close(env);
+    return std::make_pair(saved, (uint64_t)info.me_last_txnid);
+  };
+  auto txnIds = counterTxnIds();
+  assert(txnIds.first == txnIds.second);
+
+  //transactions that advance no counter don't rewrite them
+  ClassTraits<FixedSizeObject>::traits_data(1).maxObjectId = 0;
+  {
+    KeyValueStore *kv = lmdb::KeyValueStore::Factory{1, ".", "counters"};
+    kv->putSchema<FixedSizeObject>();
+
+    auto wtxn = kv->beginWrite();
+    FixedSizeObject fso(9, 10);
+    wtxn->saveObject(fso, key2);
+    wtxn->commit();
+    delete kv;
+  }
+  auto updatedIds = counterTxnIds();
+  assert(updatedIds.first == txnIds.first && updatedIds.second > txnIds.second);
+
+  //the counters are looked up again, and saved by the next transaction that advances them
+  ClassTraits<FixedSizeObject>::traits_data(1).maxObjectId = 0;
+  {
+    KeyValueStore *kv = lmdb::KeyValueStore::Factory{1, ".", "counters"};
+    kv->putSchema<FixedSizeObject>();
+
+    auto wtxn = kv->beginWrite();
+    FixedSizeObject fso(11, 12);
+    ObjectKey key = wtxn->putObject(fso);
+    assert(key.objectId == foreignId2 + 2);
+    wtxn->commit();
+    delete kv;
+  }
+  txnIds = counterTxnIds();
+  assert(txnIds.first == txnIds.second);
+}
+
 void testCompatibleDatabase(ObjectKey key)
 {
   KeyValueStore *kv = lmdb::KeyValueStore::Factory{0, ".", "test"};
@@ -1524,6 +3473,27 @@ int main()
   testDataCollection1(kv);
   testDataCollection2(kv);
   testGrowDatabase(kv);
+  testObjectCache(kv);
+  testCollectionInfoCache(kv);
+  testCollectionSeek(kv);
+  testCollectionCompaction(kv);
+  testParallelCollectionLoad(kv);
+  testAdaptiveChunkSize(kv);
+  testUpdateDataCollection(kv);
+  testDataCollectionScan(kv);
+  testTimeSeries(kv);
+  testDataAggregates(kv);
+  testSecondaryIndex(kv);
+  testSpatialIndex(kv);
+  testClassStatistics(kv);
+  testObjectFilter(kv);
+  testReferrerIndex(kv);
+  testChangeTracking(kv);
+  testInPlaceWrites(kv);
+  testWriteBuf();
+  testAllocations(kv);
+  testBatchSave(kv);
+  testConcurrentSchema(kv);
   testObjectVectorPropertyStorageEmbedded(kv);
   testObjectIterProperty(kv);
   testValueIterProperty(kv);
@@ -1536,6 +3506,8 @@ int main()
   delete kv;
 
   testCompatibleDatabase(key);
+  testCollectionMigration();
+  testIdCounters();
 #endif
 
   return 0;
@@ -102,8 +102,8 @@ class KeyValueStore : public KeyValueStoreBase
   }
 
 protected:
-  size_t getOptimalChunkSize(size_t reserved) override {
-    return 1024;
+  size_t getOptimalChunkSize(size_t reserved, unsigned pages) override {
+    return 1024 * pages;
   }
 
 public:
@@ -430,6 +430,68 @@ struct UnknownVirtual : public SomethingVirtual {
   UnknownVirtual() : SomethingVirtual(0, "unknown", true) {}
   void sayhello() override { SomethingVirtual::sayhello(); cout << " I am only a substitute";}
 };
+struct SomethingIndexed {
+  std::string name;
+  int rank;
+  double weight;
+  SomethingIndexed(string n, int r, double w) : name(n), rank(r), weight(w) {}
+  SomethingIndexed() {}
+};
+struct SomethingPlaced {
+  std::string name;
+  float x, y, width, height;
+  bool visible = true;
+  SomethingPlaced(string n, float x, float y, float w, float h) : name(n), x(x), y(y), width(w), height(h) {}
+  SomethingPlaced() {}
+};
+/**
+ * bounding box extractor for the SomethingPlaced spatial index
+ */
+inline flexis::persistence::kv::BoundingBox placedBounds(const SomethingPlaced &placed)
+{
+  return flexis::persistence::kv::BoundingBox(placed.x, placed.y, placed.x + placed.width, placed.y + placed.height);
+}
+struct SomethingCounted {
+  std::string name;
+  int amount;
+  double price;
+  SomethingCounted(string n, int a, double p) : name(n), amount(a), price(p) {}
+  SomethingCounted() {}
+  virtual ~SomethingCounted() {}
+};
+struct SomethingCountedMore : public SomethingCounted {
+  std::string extra;
+  SomethingCountedMore(string n, int a, double p, string e) : SomethingCounted(n, a, p), extra(e) {}
+  SomethingCountedMore() {}
+};
+struct SomethingFiltered {
+  long long number;
+  double score;
+  std::string label;
+  int level;
+  SomethingFiltered(long long n, double s, string l, int lv) : number(n), score(s), label(l), level(lv) {}
+  SomethingFiltered() {}
+};
+struct SomethingReferenced {
+  std::string name;
+  SomethingReferenced(string n) : name(n) {}
+  SomethingReferenced() {}
+};
+struct SomethingReferring {
+  std::string name;
+  shared_ptr<SomethingReferenced> single;
+  vector<shared_ptr<SomethingReferenced>> many;
+  SomethingReferring(string n) : name(n) {}
+  SomethingReferring() {}
+};
+struct SomethingTracked {
+  std::string name;
+  int counter = 0;
+  vector<int> numbers;
+  set<string> tags;
+  SomethingTracked(string n, int c) : name(n), counter(c) {}
+  SomethingTracked() {}
+};
 struct Wonderful {
   shared_ptr<SomethingVirtual> embeddedVirtual1;
   shared_ptr<SomethingVirtual> toplevelVirtual1;
@@ -527,7 +589,7 @@ template <typename V>
 struct DataIterImpl : public DataIter<V>, public IterPropertyBackend {
 
   typename WriteTransaction::DataCollectionAppender<V>::Ptr appender;
-  CollectionInfo *collectionInfo;
+  const CollectionChunks *collectionInfo;
   Transaction *readTransaction;
 
   V *lastData = nullptr;
@@ -539,11 +601,11 @@ struct DataIterImpl : public DataIter<V>, public IterPropertyBackend {
 
   void load(Transaction *tr) override {
     readTransaction = tr;
-    collectionInfo = tr->getCollectionInfo(m_collectionId);
+    collectionInfo = tr->getCollectionChunks(m_collectionId);
   }
 
   size_t size() override {
-    return collectionInfo->count();
+    return collectionInfo ? collectionInfo->count() : 0;
   }
 
   void add(V *value, size_t size) override {
@@ -969,6 +1031,56 @@ START_MAPPING_SUB(SomethingVirtual3, SomethingVirtual2, age)
   MAPPED_PROP(SomethingVirtual3, ValuePropertyEmbeddedAssign, unsigned, age)
 END_MAPPING_SUB(SomethingVirtual3, SomethingVirtual2)
 
+START_MAPPING(SomethingIndexed, name, rank, weight)
+  MAPPED_PROP_INDEXED(SomethingIndexed, std::string, name)
+  MAPPED_PROP_INDEXED(SomethingIndexed, int, rank)
+  MAPPED_PROP(SomethingIndexed, ValuePropertyEmbeddedAssign, double, weight)
+END_MAPPING(SomethingIndexed)
+
+START_MAPPING(SomethingPlaced, name, x, y, width, height, visible, bounds)
+  MAPPED_PROP(SomethingPlaced, ValuePropertyEmbeddedAssign, std::string, name)
+  MAPPED_PROP(SomethingPlaced, ValuePropertyEmbeddedAssign, float, x)
+  MAPPED_PROP(SomethingPlaced, ValuePropertyEmbeddedAssign, float, y)
+  MAPPED_PROP(SomethingPlaced, ValuePropertyEmbeddedAssign, float, width)
+  MAPPED_PROP(SomethingPlaced, ValuePropertyEmbeddedAssign, float, height)
+  MAPPED_PROP(SomethingPlaced, ValuePropertyEmbeddedAssign, bool, visible)
+  MAPPED_PROP_SPATIAL(SomethingPlaced, bounds, placedBounds)
+END_MAPPING(SomethingPlaced)
+
+START_MAPPING(SomethingCounted, name, amount, price)
+  MAPPED_PROP(SomethingCounted, ValuePropertyEmbeddedAssign, std::string, name)
+  MAPPED_PROP_AGGREGATED(SomethingCounted, int, amount)
+  MAPPED_PROP_AGGREGATED(SomethingCounted, double, price)
+END_MAPPING(SomethingCounted)
+
+START_MAPPING_SUB(SomethingCountedMore, SomethingCounted, extra)
+  MAPPED_PROP(SomethingCountedMore, ValuePropertyEmbeddedAssign, std::string, extra)
+END_MAPPING_SUB(SomethingCountedMore, SomethingCounted)
+
+START_MAPPING(SomethingFiltered, number, score, label, level)
+  MAPPED_PROP(SomethingFiltered, ValuePropertyEmbeddedAssign, long long, number)
+  MAPPED_PROP(SomethingFiltered, ValuePropertyEmbeddedAssign, double, score)
+  MAPPED_PROP(SomethingFiltered, ValuePropertyEmbeddedAssign, std::string, label)
+  MAPPED_PROP(SomethingFiltered, ValuePropertyEmbeddedAssign, int, level)
+END_MAPPING(SomethingFiltered)
+
+START_MAPPING(SomethingReferenced, name)
+  MAPPED_PROP(SomethingReferenced, ValuePropertyEmbeddedAssign, std::string, name)
+END_MAPPING(SomethingReferenced)
+
+START_MAPPING(SomethingReferring, name, single, many)
+  MAPPED_PROP(SomethingReferring, ValuePropertyEmbeddedAssign, std::string, name)
+  MAPPED_PROP(SomethingReferring, ObjectPtrPropertyAssign, SomethingReferenced, single)
+  MAPPED_PROP(SomethingReferring, ObjectPtrVectorPropertyAssign, SomethingReferenced, many)
+END_MAPPING(SomethingReferring)
+
+START_MAPPING(SomethingTracked, name, counter, numbers, tags)
+  MAPPED_PROP(SomethingTracked, ValuePropertyEmbeddedAssign, std::string, name)
+  MAPPED_PROP(SomethingTracked, ValuePropertyEmbeddedAssign, int, counter)
+  MAPPED_PROP(SomethingTracked, ValuePropertyKeyedAssign, vector<int>, numbers)
+  MAPPED_PROP(SomethingTracked, ValuePropertyKeyedAssign, set<string>, tags)
+END_MAPPING(SomethingTracked)
+
 START_MAPPING(Wonderful,
               embeddedVirtual1,
               toplevelVirtual1,
@@ -244,6 +244,40 @@ const PropertyAccessBase *ClassTraits<cls>::prop = new propkind<cls, proptype, &
 #define MAPPED_PROP3(cls, propkind, proptype, propname, parm) \
 const PropertyAccessBase *ClassTraits<cls>::propname = new propkind<cls, proptype, &cls::propname>(#propname, parm);
 
+/**
+ * define mapping for one scalar or string property which is stored in the shallow buffer and recorded in a
+ * secondary index. See Transaction::openIndexCursor
+ *
+ * @param cls the fully qualified class name
+ * @param proptype the property data type
+ * @param propname the property name
+ */
+#define MAPPED_PROP_INDEXED(cls, proptype, propname) \
+const PropertyAccessBase *ClassTraits<cls>::propname = new ValuePropertyIndexedAssign<cls, proptype, &cls::propname>(#propname);
+
+/**
+ * define mapping for one numeric property which is stored in the shallow buffer and recorded in a persistent
+ * per-class aggregate (count, sum, min, max). See Transaction::aggregate
+ *
+ * @param cls the fully qualified class name
+ * @param proptype the property data type
+ * @param propname the property name
+ */
+#define MAPPED_PROP_AGGREGATED(cls, proptype, propname) \
+const PropertyAccessBase *ClassTraits<cls>::propname = new ValuePropertyAggregatedAssign<cls, proptype, &cls::propname>(#propname);
+
+/**
+ * define a spatial index. The property name must have been mentioned in the preceding START_MAPPING* statement,
+ * but does not correspond to a member variable. The index is maintained using the bounding box computed by the
+ * extractor
+ *
+ * @param cls the fully qualified class name
+ * @param propname the index name
+ * @param extractor a function with signature BoundingBox (const cls &)
+ */
+#define MAPPED_PROP_SPATIAL(cls, propname, extractor) \
+const PropertyAccessBase *ClassTraits<cls>::propname = new SpatialIndexAssign<cls, extractor>(#propname);
+
 /**
  * define mapping for a objectid property
  *
@@ -29,5 +29,8 @@
 #undef MAPPED_PROP_ITER
 #undef MAPPED_PROP2
 #undef MAPPED_PROP3
+#undef MAPPED_PROP_INDEXED
+#undef MAPPED_PROP_AGGREGATED
+#undef MAPPED_PROP_SPATIAL
 #undef OBJECT_ID
 #undef KV_TYPEDEF